@@ -27,12 +27,20 @@ static clib_error_t *bgp_init(vlib_main_t *vm) {
     bmp->bgp_as_number = 0;        // Default AS number
     bmp->hold_time = 180;          // Default hold timer
     bmp->keepalive_time = 60;      // Default keepalive timer
-    bmp->prefix_lists = NULL;      // Initialize prefix lists
+    bmp->prefix_lists = NULL;      // Initialize prefix lists pool
+    bmp->prefix_list_by_name = hash_create_string(0, sizeof(uword));
+    bmp->route_map_by_name = hash_create_string(0, sizeof(uword));
+    bgp_attr_sets_init(bmp);       // Attribute set 0 is the empty set
+    bmp->as_path_regex_by_pattern = hash_create_string(0, sizeof(uword));
     bmp->routes = NULL;            // Initialize routes pool
     bmp->aggregates = NULL;        // Initialize aggregates pool
     bmp->neighbors = NULL;         // Initialize neighbors pool
-
-    clib_spinlock_init(&bmp->lock);
+    bmp->connect_retry_time = 120; // Default ConnectRetryTime (RFC 4271)
+    bmp->listen_fd = -1;           // Listener opens with the first neighbor
+    bmp->output_queue_byte_limit = 4 << 20; // Per-neighbor output budget
+    bmp->fast_external_fallover = 1;        // Directly connected eBGP follows link state
+    clib_bihash_init_8_8(&bmp->neighbor_by_addr, "bgp neighbors",
+                         BGP_NEIGHBOR_HASH_BUCKETS, BGP_NEIGHBOR_HASH_MEMORY);
 
     clib_warning("BGP plugin initialized.");
     return 0;
@@ -52,17 +60,28 @@ VLIB_PLUGIN_REGISTER() = {
 // === Cleanup Function ===
 static clib_error_t *bgp_exit(vlib_main_t *vm) {
     bgp_main_t *bmp = &bgp_main;
-
-    clib_spinlock_lock(&bmp->lock);
+    bgp_dest_t *dest;
 
     // Free resources
     bgp_free_prefix_lists(bmp);     // Free prefix lists
+    bgp_route_maps_free(bmp);
+    bgp_as_path_regexes_free(bmp);
+    bgp_attr_sets_free(bmp);
     pool_free(bmp->routes);         // Free routes pool
     pool_free(bmp->aggregates);     // Free aggregates pool
     pool_free(bmp->neighbors);      // Free neighbors pool
-
-    clib_spinlock_unlock(&bmp->lock);
-    clib_spinlock_free(&bmp->lock);
+    clib_bihash_free_8_8(&bmp->neighbor_by_addr);
+    clib_bitmap_free(bmp->bgp_enabled_interfaces);
+    bgp_rib_snapshots_free(bmp);
+    pool_foreach(dest, bmp->loc_rib.dests) {
+        vec_free(dest->paths);
+    }
+    pool_free(bmp->loc_rib.dests);
+    hash_free(bmp->loc_rib.dest_by_prefix);
+    vec_free(bmp->loc_rib.dirty);
+    vec_free(bmp->loc_rib.fib_queue);
+    bgp_update_groups_free(bmp);
+    bgp_peer_groups_free(bmp);
 
     clib_warning("BGP plugin cleaned up.");
     return 0;
@@ -4,9 +4,15 @@
 #include <vnet/vnet.h>
 #include <vnet/ip/ip.h>
 #include <vnet/ethernet/ethernet.h>
+#include <vnet/fib/fib_source.h>
 #include <vppinfra/hash.h>
 #include <vppinfra/error.h>
+#include <vppinfra/tw_timer_4t_3w_256sl.h>
+#include <vppinfra/bihash_8_8.h>
 #include <netinet/in.h>  // Required for struct sockaddr_in
+#include <sys/uio.h>     // Required for struct iovec
+#include <pthread.h>
+#include <bgp/bgp_ring.h>
 
 // #include <vppinfra/ring.h> // Include VPP's ring implementation
 // #include <bgp/bgp_socket.h>
@@ -24,54 +30,297 @@ typedef struct {
     char as_path[256];            // AS path string (optional, for debugging)
     u8 origin;                    // Origin attribute (IGP, EGP, incomplete)
     u32 med;                      // Multi-Exit Discriminator (optional)
+    u32 attr_set;                 // Interned AS path and communities, 0 = none
+    u32 source_neighbor;          // Neighbor the best path came from, ~0 for local routes
+    u8 source_is_ebgp;
+    u8 source_is_rr_client;
 } bgp_route_t;
 
 typedef struct bgp_message_t {
     uint8_t type;        // BGP message type (e.g., UPDATE, KEEPALIVE)
     uint8_t *data;       // Encoded message data
     uint16_t length;     // Length of the message data
+    u64 enqueue_time;    // clib_cpu_time_now() when queued, for output latency
 } bgp_message_t;
 
 typedef struct {
     bgp_message_t **buffer; // Array of message pointers
     int head;               // Head index
     int tail;               // Tail index
-    int capacity;           // Maximum number of elements
+    int capacity;           // Allocated slots; doubles when the ring fills
     int count;              // Current number of elements
+    u32 bytes;              // Encoded bytes currently queued
+    u32 byte_limit;         // Byte budget; above it Adj-RIB-Out generation pauses
 } custom_queue_t;
 
+// Output scheduling classes: control always goes to the wire ahead of bulk
+typedef enum {
+    BGP_OUTPUT_CONTROL = 0,      // OPEN, KEEPALIVE, NOTIFICATION, ROUTE-REFRESH
+    BGP_OUTPUT_BULK,             // UPDATE
+    BGP_OUTPUT_N_CLASSES,
+} bgp_output_class_t;
+
+typedef struct {
+    u64 messages;                // Messages written to the wire
+    u64 latency_clocks;          // Sum of enqueue-to-wire latency
+    u64 latency_max;             // Worst enqueue-to-wire latency
+    u32 max_depth;               // Deepest the class queue has been
+} bgp_output_stats_t;
+
+// Bulk bytes allowed in the wire queue ahead of any later control message
+#define BGP_OUTPUT_WIRE_WINDOW (64 << 10)
+
+// Transport backends behind the bgp_socket_* API
+typedef enum {
+    BGP_TRANSPORT_SOCKET = 0,     // Kernel sockets driven by the clib_file poller
+    BGP_TRANSPORT_IO_URING = 1,   // io_uring with registered buffers (bgp_uring.c)
+    BGP_TRANSPORT_SESSION = 2,    // VPP host stack session layer (bgp_session.c)
+} bgp_transport_t;
+
 // Definition of bgp_socket_t
 typedef struct {
     int socket_fd;
     struct sockaddr_in peer_addr;
+    u32 clib_file_index;          // Poller registration, ~0 when not registered
+    u32 neighbor_index;           // Owning neighbor (pool index)
+    u8 is_connecting;             // Non-blocking connect in progress
+    u8 is_connected;              // TCP connection established
+    u8 is_inbound;                // Opened by the peer and accepted here, not connected by us
+    u8 *rx_buffer;                // Received bytes not yet framed (vec)
+    u32 tx_offset;                // Bytes of the head queued message already sent
+    u8 backend;                   // bgp_transport_t chosen when the socket was created
+    u8 tx_in_flight;              // io_uring: a write from tx_slot is outstanding
+    u32 tx_slot;                  // io_uring: registered transmit buffer, ~0 if none
+    u32 generation;               // io_uring: tags completions for this socket instance
+    u64 session_handle;           // session layer: connected session, ~0 if none
+    struct _svm_fifo *rx_fifo;    // session layer: the session's fifos, used from the owner thread
+    struct _svm_fifo *tx_fifo;
+    ip4_address_t local_addr;     // session layer: our end of the connection
 } bgp_socket_t;
 
+// Per-neighbor session timers, run on the owner thread's timer wheel
+typedef enum {
+    BGP_TIMER_HOLD = 0,
+    BGP_TIMER_KEEPALIVE,
+    BGP_TIMER_CONNECT_RETRY,
+    BGP_N_TIMERS,
+} bgp_timer_type_t;
+
+#define BGP_TIMER_TICK_SECONDS 1.0
+
+// Jittered timers are placed by due-tick load over one wheel revolution
+#define BGP_TIMER_SPREAD_SLOTS 256
+
+// Per-tick transmit histogram: bucket 0 counts idle ticks, bucket n counts [2^(n-1), 2^n)
+#define BGP_TX_HISTOGRAM_BUCKETS 16
+
+// Neighbor address index, sized for ~10k peers
+#define BGP_NEIGHBOR_HASH_BUCKETS 4096
+#define BGP_NEIGHBOR_HASH_MEMORY  (4 << 20)
+
+// === BGP Session States ===
+typedef enum {
+    BGP_STATE_IDLE = 0,
+    BGP_STATE_CONNECT = 1,
+    BGP_STATE_ACTIVE = 2,
+    BGP_STATE_OPEN_SENT = 3,
+    BGP_STATE_OPEN_CONFIRM = 4,
+    BGP_STATE_ESTABLISHED = 5,
+    BGP_N_STATES,
+} bgp_state_t;
+
 // === BGP Neighbor Structure ===
 typedef struct {
     ip4_address_t neighbor_ip;    // Neighbor IP address
     u32 remote_as;                // Remote AS number
     u8 is_route_reflector_client; // Route reflector client flag
     char route_filter_name[64];   // Associated route filter
-    u32 hold_timer;               // Hold timer (per neighbor)
-    u32 keepalive_timer;          // Keepalive timer (per neighbor)
+    u32 route_map_in;             // Policy for received routes (pool index), ~0 if none
+    u32 route_map_out;            // Policy for advertised routes, ~0 if none
+    u32 timers[BGP_N_TIMERS];     // Timer wheel handles (bgp_timer_type_t), ~0 when stopped
+    f64 timer_deadline[BGP_N_TIMERS]; // Expiry time of running timers, for show commands
+    u8 timer_slot[BGP_N_TIMERS];  // Spread slot charged for each running timer
+    f64 last_update_tx;           // When an UPDATE last reached the wire, for keepalive suppression
     u32 state;                    // Current BGP state (BGP_STATE_IDLE, BGP_STATE_CONNECT, etc.)
-    custom_queue_t output_queue;    // Ring buffer for outgoing messages
+    u32 state_prev;               // Owner thread's list of neighbors in this state, ~0 at the ends
+    u32 state_next;
+    u32 owner_thread;             // Thread running this neighbor's I/O and FSM (0 = main)
+    u32 update_group;             // Outbound update group (pool index), ~0 if none
+    u32 peer_group;               // Configuration template (pool index), ~0 if none
+    u32 rib_out_version;          // Update group sequence last delivered, 0 = needs the full table
+    u8 rib_out_requested;         // Full table asked of the update group, not yet delivered
+    u8 peer_down_pending;         // PEER_DOWN refused by a full handoff ring; held in Idle until it goes
+    custom_queue_t output_queue;    // Wire queue: committed to the transport, in send order
+    custom_queue_t control_queue;   // Pending control messages, scheduled first
+    custom_queue_t bulk_queue;      // Pending UPDATEs, carries the Adj-RIB-Out byte budget
+    bgp_output_stats_t output_stats[BGP_OUTPUT_N_CLASSES];
+    u8 rib_out_paused;            // Output queue over budget; no UPDATEs generated until it drains
     bgp_socket_t *socket; // Add this field to represent the neighbor's socket
+    u32 rx_flags;                 // Messages received since the last FSM pass (BGP_RX_*)
+    u64 updates_received;         // UPDATE messages received from the peer
+    u32 remote_router_id;         // BGP Identifier from the peer's OPEN (host order)
+    u16 hold_time;                // Current hold time: the OpenSent wait, then the negotiated value (0 = none)
+    u16 keepalive_time;           // Negotiated keepalive interval, 0 when the hold time is 0
+    ip4_address_t local_addr;     // Our end of the connection, the NEXT_HOP sent with next-hop-self
+    bgp_socket_t *collision_socket; // Inbound connection racing the current one (RFC 4271 6.8)
 
 } bgp_neighbor_t;
 
+// Received message flags consumed by the state machine
+#define BGP_RX_OPEN          (1 << 0)
+#define BGP_RX_KEEPALIVE     (1 << 1)
+#define BGP_RX_NOTIFICATION  (1 << 2)
+
 // === BGP Prefix List and Entries ===
 typedef struct {
-    ip4_address_t prefix; // Prefix address
+    u32 seq;              // Sequence number; the lowest matching entry decides
+    ip4_address_t prefix; // Prefix address, host bits cleared
     u8 mask_length;       // Mask length
+    u8 ge;                // Matched route lengths, ge..le inclusive
+    u8 le;
     bool permit;          // Permit/Deny flag
 } bgp_prefix_t;
 
+// Binary trie over prefix bits; node 0 is the root (/0) and never a child
 typedef struct {
-    char name[64];           // Prefix list name
-    bgp_prefix_t **entries;  // Array of prefix entries
+    u32 child[2];            // Node index for the next bit, 0 if none
+    bgp_prefix_t *entries;   // Entries for exactly this prefix, by ascending seq
+} bgp_prefix_trie_node_t;
+
+typedef struct {
+    char name[64];                   // Prefix list name
+    bgp_prefix_trie_node_t *nodes;   // Trie, vec indexed by node
+    uword *node_by_seq;              // seq -> node holding that entry
+    u32 n_entries;
+    u32 last_seq;                    // Highest seq in use, for automatic numbering
+    u64 n_rechecked;                 // Prefixes re-checked by update groups after changes
 } bgp_prefix_list_t;
 
+/*
+ * Path attributes that do not fit inline in bgp_route_t. Sets are interned
+ * on the main thread, so routes with the same attributes share one ID and
+ * policy can compare or cache by it. Set 0 is empty and permanent; others
+ * are freed by bgp_attr_sets_sweep() once nothing holds a reference.
+ */
+typedef struct {
+    u32 *as_path;                 // AS_SEQUENCE, nearest AS first
+    u32 *communities;             // RFC 1997 values (AS << 16 | value), sorted
+    u32 *key;                     // Encoded set, key of attr_set_by_key
+    u64 hash;                     // Of key; stands for the set where an ID could be reused
+    u32 refcount;                 // Stored paths, routes, route-map entries and rewrite results
+} bgp_attr_set_t;
+
+/*
+ * An AS-path regular expression compiled to a DFA over the AS numbers
+ * themselves. The ASNs the pattern names are the alphabet, every other AS
+ * falls in one extra class, so each path element costs a class lookup and
+ * a table step.
+ */
+typedef struct {
+    CLIB_CACHE_LINE_ALIGN_MARK(cacheline0);
+    uword *known;                 // Bitmap of attribute set IDs with a cached result
+    uword *matched;               // Bitmap of those whose AS path matches
+    u64 hits;
+    u64 misses;
+} bgp_as_path_regex_cache_t;
+
+typedef struct {
+    u8 *pattern;                  // Source text, NUL-terminated; key of as_path_regex_by_pattern
+    u32 *literals;                // Sorted ASNs in the pattern; literals[i] is class i
+    u32 n_classes;                // vec_len(literals) + 1 for every other AS
+    u32 *next;                    // Transitions, state * n_classes + class; state 0 starts
+    u8 *accepting;                // Per state: the path read so far matches
+    u8 *decided;                  // Per state: every transition loops back, the result is final
+    bgp_as_path_regex_cache_t *caches; // Indexed by thread index
+} bgp_as_path_regex_t;
+
+#define BGP_AS_PATH_REGEX_MAX_STATES 4096
+
+// === BGP Route Maps ===
+typedef struct {
+    u32 seq;
+    u8 permit;
+    u8 set_flags;                 // BGP_ROUTE_MAP_SET_*
+    u8 match_next_hop_length;     // Next hop prefix length, 0xff if not matched
+    u8 prepend_count;
+    u32 match_prefix_list;        // Prefix list ID, ~0 if not matched
+    u32 match_as;                 // AS that must be in the path, 0 if not matched
+    u32 match_community;          // Community that must be present, 0 if not matched
+    u32 match_as_path_regex;      // AS-path regex ID, ~0 if not matched
+    ip4_address_t match_next_hop;
+    u32 local_pref;
+    u32 med;
+    u32 prepend_as;
+    u32 communities;              // Attribute set holding the replacement communities
+} bgp_route_map_entry_t;
+
+#define BGP_ROUTE_MAP_SET_LOCAL_PREF  (1 << 0)
+#define BGP_ROUTE_MAP_SET_MED         (1 << 1)
+#define BGP_ROUTE_MAP_SET_PREPEND     (1 << 2)
+#define BGP_ROUTE_MAP_SET_COMMUNITY   (1 << 3)
+
+typedef enum {
+    BGP_ROUTE_MAP_OP_ENTRY = 0,
+    BGP_ROUTE_MAP_OP_MATCH_PREFIX_LIST,
+    BGP_ROUTE_MAP_OP_MATCH_AS_PATH,
+    BGP_ROUTE_MAP_OP_MATCH_COMMUNITY,
+    BGP_ROUTE_MAP_OP_MATCH_AS_PATH_REGEX,
+    BGP_ROUTE_MAP_OP_MATCH_NEXT_HOP,
+    BGP_ROUTE_MAP_OP_SET_LOCAL_PREF,
+    BGP_ROUTE_MAP_OP_SET_MED,
+    BGP_ROUTE_MAP_OP_SET_PREPEND,
+    BGP_ROUTE_MAP_OP_SET_COMMUNITY,
+    BGP_ROUTE_MAP_OP_PERMIT,
+    BGP_ROUTE_MAP_OP_DENY,
+} bgp_route_map_op_t;
+
+/*
+ * One step of a compiled route-map; a failed match jumps to the next
+ * entry. Each entry starts with ENTRY, followed by its attribute-set
+ * matches (AS path, AS-path regex, community), then its per-route matches (prefix, next
+ * hop), its sets and PERMIT or DENY.
+ */
+typedef struct {
+    u8 op;                        // bgp_route_map_op_t
+    u8 count;                     // ENTRY: attribute-set matches that follow; SET_PREPEND: copies of arg
+    u16 fail;                     // ENTRY and matches: instruction to continue at on failure
+    u32 arg;                      // Entry index, list or set ID, AS, community, value or network-order address
+    u32 mask;                     // MATCH_NEXT_HOP: network-order mask
+} bgp_route_map_insn_t;
+
+// Entries whose attribute-set matches are memoized; later ones are evaluated per route
+#define BGP_ROUTE_MAP_CACHED_ENTRIES 64
+
+// Per-thread memo of the attribute-set matches, valid for one map version
+typedef struct {
+    CLIB_CACHE_LINE_ALIGN_MARK(cacheline0);
+    uword *mask_by_attr_set;      // Attribute set ID -> bit per entry whose attribute matches pass
+    u32 version;                  // Map version the masks belong to
+    u64 hits;
+    u64 misses;
+} bgp_route_map_cache_t;
+
+typedef struct {
+    char name[64];
+    bgp_route_map_entry_t *entries; // Configuration, by ascending seq
+    bgp_route_map_insn_t *program;  // Compiled entries, ending in DENY
+    u32 version;                  // Bumped on every compile
+    u8 has_attr_matches;          // Some entry matches on the attribute set
+    bgp_route_map_cache_t *caches; // Indexed by thread index
+    uword *rewrite_by_key;        // Main thread: (attribute set, entry) -> rewritten attribute set
+    u32 rewrite_version;          // Map version rewrite_by_key belongs to
+} bgp_route_map_t;
+
+// Attributes a route-map can change, starting from the route's own
+typedef struct {
+    u32 local_pref;
+    u32 med;
+    u32 prepend_as;
+    u32 communities;              // Attribute set whose communities are sent
+    u32 entry;                    // Entry that decided, ~0 if none did
+    u8 prepend_count;
+} bgp_route_map_result_t;
+
 // === BGP Aggregates ===
 typedef struct {
     ip4_address_t prefix;   // Aggregated prefix
@@ -81,6 +330,202 @@ typedef struct {
 } bgp_aggregate_t;
 
 // === Main BGP Structure ===
+// A route learned or withdrawn on a worker, applied to the RIB on the main thread
+typedef struct {
+    ip4_address_t prefix;
+    ip4_address_t next_hop;
+    u32 local_pref;
+    u32 as_path_length;
+    u32 med;
+    u32 *as_path;           // Received AS path (vec, owned by the change)
+    u32 *communities;       // Received communities (vec, owned by the change)
+    u8 origin;
+    u8 mask_length;
+    u8 is_withdraw;
+} bgp_route_change_t;
+
+// Per-thread handoff rings, indexed by thread index
+typedef struct {
+    CLIB_CACHE_LINE_ALIGN_MARK(cacheline0);
+    bgp_spsc_ring_t to_main;           // This worker -> main thread
+    bgp_mpsc_ring_t to_worker;         // Any thread -> this worker's neighbor shard
+    u64 dequeued;                      // to_main elements drained by the main thread
+    u64 drops;                         // Enqueues refused because a ring was full
+    u64 latency_clocks;                // Sum of to_main enqueue-to-dequeue latency
+    volatile u32 main_idle;            // Main thread found to_main empty; next enqueue must wake it
+} bgp_handoff_rings_t;
+
+// One peer's path to a destination (Adj-RIB-In entry)
+typedef struct {
+    u32 neighbor_index;           // Advertising neighbor
+    ip4_address_t next_hop;
+    ip4_address_t peer_addr;      // Final tie-breaker
+    u32 peer_router_id;
+    u32 local_pref;
+    u32 as_path_length;
+    u32 med;
+    u32 attr_set;                 // Interned AS path and communities
+    u8 origin;
+    u8 is_ebgp;
+    u8 is_rr_client;              // Learned from a route reflector client
+} bgp_path_t;
+
+// Everything known about one prefix
+typedef struct {
+    ip4_address_t prefix;
+    u8 mask_length;
+    u8 is_dirty;                  // Queued in bgp_loc_rib_t.dirty
+    u32 best;                     // Index of the selected path, ~0 if unreachable
+    u32 new_best;                 // Written by the decision partition owning this prefix
+    u32 route_index;              // Loc-RIB entry in bgp_main.routes, ~0 if none
+    bgp_path_t best_path;         // Copy of the selected path, survives path removal
+    bgp_path_t *paths;            // vec of candidate paths
+} bgp_dest_t;
+
+typedef struct {
+    ip4_address_t prefix;
+    ip4_address_t next_hop;
+    u8 mask_length;
+    u8 is_delete;
+} bgp_fib_update_t;
+
+typedef struct {
+    bgp_dest_t *dests;                 // Pool of destinations
+    uword *dest_by_prefix;             // (prefix << 8 | length) -> dest index
+    u32 *dirty;                        // Destinations awaiting best-path selection
+    bgp_fib_update_t *fib_queue;       // Best-path changes awaiting FIB download
+    u32 fib_queue_head;                // First fib_queue entry not yet downloaded
+} bgp_loc_rib_t;
+
+// A contiguous prefix range of the sorted dirty set
+typedef struct {
+    bgp_dest_t *dests;
+    u32 *indices;
+    u32 n_dests;
+    volatile u32 *pending;             // Decremented by a worker when it finishes
+} bgp_decision_partition_t;
+
+// Immutable copy of the RIB for readers off the main thread
+typedef struct {
+    u32 version;                       // Bumped on every publish
+    bgp_route_t *routes;               // vec of routes
+    uword *route_by_key;               // bgp_dest_key() -> index in routes
+} bgp_rib_snapshot_t;
+
+static_always_inline uword bgp_dest_key(ip4_address_t prefix, u8 mask_length) {
+    return ((u64)clib_net_to_host_u32(prefix.as_u32) << 8) | mask_length;
+}
+
+/*
+ * Neighbors with the same outbound policy share one Adj-RIB-Out. The group
+ * diffs it against each new RIB snapshot and encodes the UPDATEs once; the
+ * members get copies of the result.
+ */
+typedef struct {
+    u32 neighbor_index;
+    struct bgp_update_batch_t *batch;
+} bgp_update_deferred_t;
+
+// Which members get one encoded UPDATE, and what is filled in per member
+typedef struct {
+    u32 split_source;                  // Member its prefixes were learned from, ~0 if none
+    u8 source_only;                    // Only split_source gets it; otherwise everyone else does
+    u16 next_hop_offset;               // NEXT_HOP set to the member's own address, 0 if none
+} bgp_update_info_t;
+
+typedef struct {
+    u8 is_ebgp;
+    u8 is_route_reflector_client;
+    char route_filter_name[64];
+    u32 route_filter;                  // Prefix list ID, ~0 if none
+    u32 route_map_out;                 // Outbound route-map, ~0 if none
+    u32 *members;                      // Neighbor pool indices
+    u32 *full_waiters;                 // Members that asked for the full table
+    uword *synced;                     // Bitmap of members holding the full table
+    uword *adj_rib_out;                // bgp_dest_key() -> attribute fingerprint
+    u32 rib_version;                   // Snapshot version the pending set was computed from
+    uword *pending;                    // bgp_dest_key() set of prefixes to re-advertise at MRAI
+    f64 mrai_deadline;                 // Earliest time the pending set may be flushed
+    u32 seq;                           // Bumped for every non-empty incremental batch
+    u32 base_seq;                      // Sequence the incremental updates apply on top of
+    u8 **updates;                      // Incremental UPDATEs from the last build (vec of vecs)
+    bgp_update_info_t *update_info;    // Delivery of each of updates
+    u8 **full_updates;                 // Whole-table UPDATEs, kept for members that join later
+    bgp_update_info_t *full_update_info;
+    u32 full_rib_version;              // Snapshot full_updates was encoded from, 0 if none
+    bgp_update_deferred_t *deferred;   // Batches a full handoff ring refused, in order
+    u64 n_encoded;                     // UPDATE messages encoded by this group
+    u64 n_table_reused;                // Full tables handed out without encoding
+} bgp_update_group_t;
+
+/*
+ * A peer group is a named configuration template. Members copy its
+ * outbound policy when they join, so they land in the same update group
+ * and share its Adj-RIB-Out and encoded table.
+ */
+typedef struct {
+    char name[64];
+    u32 remote_as;                     // 0 if members give their own
+    u8 is_route_reflector_client;
+    char route_filter_name[64];
+    u32 route_map_in;                  // Route-maps copied to members, ~0 if none
+    u32 route_map_out;
+    u32 *members;                      // Neighbor pool indices
+} bgp_peer_group_t;
+
+// Encoded UPDATEs for one member, applied on the neighbor's owner thread
+#define BGP_UPDATE_BATCH_RESTART (~0U) // base_seq of withdrawals that precede a new full table
+
+typedef struct bgp_update_batch_t {
+    u32 base_seq;                      // Member must be at this sequence; 0 = full table
+    u32 seq;                           // Member's sequence once applied
+    bgp_message_t **messages;          // vec of queued-message copies
+} bgp_update_batch_t;
+
+// Update groups encoded by one thread
+typedef struct {
+    u32 *groups;
+    bgp_rib_snapshot_t *rib;
+    f64 now;                           // Main thread time, for MRAI
+    volatile u32 *pending;             // Decremented by a worker when it finishes
+} bgp_update_task_t;
+
+// Inputs that can move a neighbor's FSM; posted to the owner thread
+typedef enum {
+    BGP_FSM_EVENT_START = 0,      // Neighbor configured or reset
+    BGP_FSM_EVENT_TCP_CONNECTED,  // Outbound connect completed
+    BGP_FSM_EVENT_TCP_FAILED,     // Outbound connect attempt failed
+    BGP_FSM_EVENT_MESSAGE,        // OPEN, KEEPALIVE or NOTIFICATION received (rx_flags)
+    BGP_FSM_EVENT_CONNECT_RETRY,  // ConnectRetry timer expired
+    BGP_FSM_EVENT_RESET,          // Operator reset: drop the transport, keep the neighbor
+    BGP_FSM_EVENT_LINK_DOWN,      // Interface to a directly connected peer failed
+    BGP_FSM_N_EVENTS,
+} bgp_fsm_event_t;
+
+typedef struct {
+    u32 neighbor_index;
+    u32 event;                    // bgp_fsm_event_t
+} bgp_fsm_event_elt_t;
+
+// Neighbors owned by one thread when sharding is enabled
+typedef struct {
+    CLIB_CACHE_LINE_ALIGN_MARK(cacheline0);
+    u32 state_head[BGP_N_STATES];      // Owned neighbors by state, linked through state_next
+    u32 n_in_state[BGP_N_STATES];      // Length of each state list
+    bgp_fsm_event_elt_t *fsm_events;   // FSM events for the owned neighbors, in arrival order
+    bgp_fsm_event_elt_t *fsm_running;  // Events being handled; handlers may post more
+    u64 n_fsm_events;                  // Events handled by this thread
+    tw_timer_wheel_4t_3w_256sl_t timer_wheel; // Session timers of the owned neighbors, 1 s ticks
+    u32 *expired;                      // Scratch vec of expired timer handles
+    u32 random_seed;                   // Seed for this thread's timer jitter
+    u16 timer_load[BGP_TIMER_SPREAD_SLOTS]; // Running timers due in each slot
+    u64 tx_tick;                       // Wheel tick tx_in_tick belongs to
+    u32 tx_in_tick;                    // Messages written to the wire during tx_tick
+    u64 tx_histogram[BGP_TX_HISTOGRAM_BUCKETS]; // Ticks by messages written
+    u64 keepalives_suppressed;         // Keepalives skipped because an UPDATE went out
+    u32 n_peer_down_pending;           // Owned neighbors with peer_down_pending set
+} bgp_shard_t;
+
 typedef struct {
     u16 msg_id_base;                   // Message ID base for API messages
     u8 periodic_timer_enabled;         // Periodic timer status
@@ -96,24 +541,80 @@ typedef struct {
     u32 hold_time;                     // Default hold timer
     u32 keepalive_time;                // Default keepalive timer
     u32 cluster_id;                    // Cluster ID for route reflector
-    u32 bgp_enabled_interfaces; // Bitmap for enabled interfaces
+    uword *bgp_enabled_interfaces;     // clib_bitmap of sw_if_index with BGP enabled
+    u8 fast_external_fallover;         // Drop directly connected eBGP sessions when their link fails
+    u64 n_fast_fallovers;              // Sessions dropped by fast external fallover
+    u8 transport;                      // bgp_transport_t used for new sessions
+    u32 connect_retry_time;            // Base ConnectRetryTime, jittered per attempt
+    u32 output_queue_byte_limit;       // Default per-neighbor output queue budget
+    int listen_fd;                     // Passive listener on BGP_PORT, -1 if closed
+    u32 listen_file_index;             // Poller registration for listen_fd
+
+    bgp_handoff_rings_t *handoff;      // Cross-thread rings, one set per thread
+    u8 sharding_enabled;               // Neighbors are pinned to worker threads
+    bgp_shard_t *shards;               // Per-thread neighbor ownership
 
-    clib_spinlock_t lock;              // Spinlock for thread safety
+    /*
+     * Ownership: a neighbor's session state belongs to its owner_thread.
+     * The neighbor pool, shard lists and configuration change only on the
+     * main thread under the worker barrier (CLI and API handlers already
+     * hold it). The RIB belongs to the main thread; everyone else reads
+     * rib_snapshot.
+     */
     bgp_neighbor_t *neighbors;         // Pool of BGP neighbors
+    clib_bihash_8_8_t neighbor_by_addr; // Neighbor address -> pool index
     bgp_route_t *routes;               // Pool of BGP routes
+    bgp_rib_snapshot_t *rib_snapshot;  // Latest published RIB copy
+    bgp_rib_snapshot_t *rib_spare;     // Copy it replaced, brought up to date for the next publish
+    u32 rib_version;                   // Version of rib_snapshot
+    uword *rib_changes;                // bgp_dest_key() -> routes index (~0 removed) since the last publish
+    uword *rib_changes_prev;           // The same for the publish before, which rib_spare lacks
+    bgp_loc_rib_t loc_rib;             // Adj-RIB-In paths and best-path state
+    fib_source_t fib_source;           // Source for routes we download
+    u32 decision_threads;              // Threads used for best-path selection
+    u32 decision_last_changes;         // Best paths changed by the last run
+    u32 decision_last_partitions;      // Prefix ranges in the last run
+    f64 decision_last_seconds;         // Duration of the last run
+    bgp_update_group_t *update_groups; // Pool of outbound update groups
+    u32 update_threads;                // Threads used for UPDATE encoding
+    bgp_peer_group_t *peer_groups;     // Pool of peer group templates
+    u32 mrai_ibgp;                     // Minimum route advertisement interval, iBGP groups (s)
+    u32 mrai_ebgp;                     // Minimum route advertisement interval, eBGP groups (s)
+    u8 withdraw_immediate;             // Send withdrawals without waiting for MRAI
+    u32 update_last_groups;            // Groups encoded by the last run
+    f64 update_last_seconds;           // Duration of the last run
     bgp_aggregate_t *aggregates;       // Pool of BGP aggregates
-    bgp_prefix_list_t **prefix_lists;  // Array of prefix lists
+    bgp_prefix_list_t *prefix_lists;   // Pool of prefix lists; the index is the list's ID
+    uword *prefix_list_by_name;        // Name -> ID
+    bgp_route_map_t *route_maps;       // Pool of route-maps; the index is the map's ID
+    uword *route_map_by_name;          // Name -> ID
+    bgp_attr_set_t *attr_sets;         // Pool of interned attribute sets
+    uword *attr_set_by_key;            // Encoded set -> ID
+    u32 *attr_sets_unused;             // IDs whose refcount reached 0, freed by the next sweep
+    bgp_as_path_regex_t *as_path_regexes; // Pool of compiled AS-path regexes, never freed
+    uword *as_path_regex_by_pattern;   // Pattern -> ID
 } bgp_main_t;
 
-// === BGP Session States ===
-typedef enum {
-    BGP_STATE_IDLE = 0,
-    BGP_STATE_CONNECT = 1,
-    BGP_STATE_ACTIVE = 2,
-    BGP_STATE_OPEN_SENT = 3,
-    BGP_STATE_OPEN_CONFIRM = 4,
-    BGP_STATE_ESTABLISHED = 5
-} bgp_state_t;
+// === Benchmarks and Self-Tests ===
+/*
+ * Shared by the 'test bgp ...-benchmark' commands: helper threads held at
+ * a start gate, timing of the phase being measured, and one line format
+ * for the results.
+ */
+typedef struct {
+    vlib_main_t *vm;
+    volatile u32 go;              // Helper threads spin until this is set
+    pthread_t *threads;           // Helpers started by the last bgp_bench_spawn()
+    f64 start;                    // Start of the phase being timed
+} bgp_bench_t;
+
+// Tally of 'test bgp self-test'; failures are printed as they happen
+typedef struct {
+    vlib_main_t *vm;
+    const char *suite;            // Module being checked
+    u32 n_checks;
+    u32 n_failed;
+} bgp_check_t;
 
 // === Global BGP Instance ===
 extern bgp_main_t bgp_main;
@@ -122,9 +623,10 @@ extern vlib_node_registration_t bgp_node;
 extern vlib_node_registration_t bgp_periodic_node;
 
 // Periodic function events
-#define BGP_EVENT1 1
-#define BGP_EVENT2 2
 #define BGP_EVENT_PERIODIC_ENABLE_DISABLE 3
+#define BGP_EVENT_HANDOFF 4
+#define BGP_EVENT_FSM 5
+#define BGP_EVENT_FIB_DOWNLOAD 6
 
 
 void bgp_create_periodic_process(bgp_main_t *);
@@ -137,8 +639,7 @@ void bgp_initialize(vlib_main_t *vm);
 // bgp_neighbors.c
 void bgp_neighbor_init(bgp_neighbor_t *neighbor, ip4_address_t neighbor_ip, u32 remote_as);
 void bgp_start_session(bgp_main_t *bmp, ip4_address_t neighbor_ip);
-void bgp_stop_session(bgp_main_t *bmp, ip4_address_t neighbor_ip);
-void bgp_add_neighbor(bgp_main_t *bmp, ip4_address_t neighbor_ip, u32 remote_as);
+void bgp_add_neighbor(bgp_main_t *bmp, ip4_address_t neighbor_ip, u32 remote_as, u32 peer_group);
 void bgp_remove_neighbor(bgp_main_t *bmp, bgp_neighbor_t *neighbor);
 bgp_neighbor_t *bgp_find_neighbor(bgp_main_t *bmp, ip4_address_t neighbor_ip);
 void bgp_reset_neighbor(bgp_main_t *bmp, ip4_address_t neighbor_ip);
@@ -150,15 +651,86 @@ void bgp_clear_rib_in_for_neighbor(bgp_main_t *bmp, ip4_address_t neighbor_ip);
 void bgp_clear_rib_out_for_neighbor(bgp_main_t *bmp, ip4_address_t neighbor_ip);
 
 // bgp_routes.c
-void bgp_add_route(bgp_main_t *bmp, ip4_address_t prefix, u8 mask_length, ip4_address_t next_hop);
-void bgp_remove_route(bgp_main_t *bmp, ip4_address_t prefix, u8 mask_length);
+int bgp_add_route(bgp_main_t *bmp, ip4_address_t prefix, u8 mask_length, ip4_address_t next_hop);
+int bgp_remove_route(bgp_main_t *bmp, ip4_address_t prefix, u8 mask_length);
+void bgp_rib_publish(bgp_main_t *bmp);
+void bgp_rib_snapshots_free(bgp_main_t *bmp);
+
+/* Record a RIB entry the next publish copies (route_index ~0 when it was removed) */
+static_always_inline void bgp_rib_changed(bgp_main_t *bmp, uword key, u32 route_index) {
+    if (!bmp->rib_changes) {
+        bmp->rib_changes = hash_create(0, sizeof(uword));
+    }
+    hash_set(bmp->rib_changes, key, route_index);
+}
+
+static_always_inline bgp_rib_snapshot_t *bgp_rib_snapshot(bgp_main_t *bmp) {
+    return clib_atomic_load_acq_n(&bmp->rib_snapshot);
+}
 void bgp_show_routes(bgp_main_t *bmp);
 int bgp_advertise_network(bgp_main_t *bmp, ip4_address_t prefix, u8 mask_length);
 
 // bgp_prefix_list.c
-bgp_prefix_list_t *bgp_find_or_create_prefix_list(bgp_main_t *bmp, const char *list_name);
-void bgp_update_prefix_list(bgp_main_t *bmp, const char *list_name, ip4_address_t *prefix, u8 mask_length, bool permit);
+u32 bgp_prefix_list_intern(bgp_main_t *bmp, const char *list_name);
+int bgp_update_prefix_list(bgp_main_t *bmp, const char *list_name, u32 seq, ip4_address_t *prefix,
+                           u8 mask_length, u8 ge, u8 le, bool permit);
+int bgp_delete_prefix_list_entry(bgp_main_t *bmp, const char *list_name, u32 seq);
 void bgp_free_prefix_lists(bgp_main_t *bmp);
+bgp_prefix_list_t *bgp_find_prefix_list(bgp_main_t *bmp, const char *list_name);
+bgp_prefix_t *bgp_prefix_list_entries(bgp_prefix_list_t *list);
+bool bgp_prefix_list_permits(bgp_prefix_list_t *list, ip4_address_t prefix, u8 mask_length);
+void bgp_prefix_list_self_test(bgp_check_t *check);
+
+// bgp_attr.c
+void bgp_attr_sets_init(bgp_main_t *bmp);
+void bgp_attr_sets_free(bgp_main_t *bmp);
+u32 bgp_attr_set_intern(bgp_main_t *bmp, u32 *as_path, u32 *communities);
+u32 bgp_attr_set_prepend(bgp_main_t *bmp, u32 attr_set, u32 as, u32 count);
+u32 bgp_attr_set_replace_communities(bgp_main_t *bmp, u32 attr_set, u32 communities_set);
+void bgp_attr_sets_sweep(bgp_main_t *bmp);
+bool bgp_attr_set_has_as(bgp_attr_set_t *set, u32 as);
+bool bgp_attr_set_has_community(bgp_attr_set_t *set, u32 community);
+format_function_t format_bgp_attr_set;
+unformat_function_t unformat_bgp_community;
+
+static_always_inline bgp_attr_set_t *bgp_attr_set_get(bgp_main_t *bmp, u32 attr_set) {
+    return pool_elt_at_index(bmp->attr_sets, attr_set);
+}
+
+/* Main thread: keep a set alive while an ID is stored */
+static_always_inline void bgp_attr_set_lock(bgp_main_t *bmp, u32 attr_set) {
+    if (attr_set) {
+        bgp_attr_set_get(bmp, attr_set)->refcount++;
+    }
+}
+
+static_always_inline void bgp_attr_set_unlock(bgp_main_t *bmp, u32 attr_set) {
+    if (attr_set && --bgp_attr_set_get(bmp, attr_set)->refcount == 0) {
+        vec_add1(bmp->attr_sets_unused, attr_set);
+    }
+}
+
+// bgp_as_path.c
+clib_error_t *bgp_as_path_regex_intern(bgp_main_t *bmp, const char *pattern, u32 *id);
+bool bgp_as_path_regex_match(bgp_as_path_regex_t *regex, u32 *as_path);
+bool bgp_as_path_regex_match_set(bgp_main_t *bmp, bgp_as_path_regex_t *regex, u32 attr_set);
+void bgp_as_path_regexes_free(bgp_main_t *bmp);
+void bgp_as_path_regexes_forget_attr_sets(bgp_main_t *bmp, uword *freed);
+void bgp_as_path_self_test(bgp_check_t *check);
+
+// bgp_route_map.c
+u32 bgp_route_map_intern(bgp_main_t *bmp, const char *name);
+void bgp_route_maps_forget_attr_sets(bgp_main_t *bmp, uword *freed);
+bgp_route_map_t *bgp_find_route_map(bgp_main_t *bmp, const char *name);
+void bgp_route_map_compile(bgp_main_t *bmp, bgp_route_map_t *map);
+bool bgp_route_map_apply(bgp_main_t *bmp, bgp_route_map_t *map, bgp_route_t *route,
+                         bgp_route_map_result_t *result);
+bool bgp_route_map_apply_path(bgp_main_t *bmp, u32 map, ip4_address_t prefix, u8 mask_length,
+                              bgp_path_t *path);
+bool bgp_route_map_uses_prefix_list(bgp_route_map_t *map, u32 prefix_list);
+void bgp_neighbor_set_route_map(bgp_main_t *bmp, bgp_neighbor_t *neighbor, u32 map, bool inbound);
+void bgp_route_maps_free(bgp_main_t *bmp);
+void bgp_route_map_self_test(bgp_check_t *check);
 
 // bgp_aggregates.c
 bgp_aggregate_t *bgp_find_or_create_aggregate(bgp_main_t *bmp, ip4_address_t prefix, u8 prefix_length);
@@ -169,22 +741,31 @@ void bgp_remove_aggregate(bgp_main_t *bmp, ip4_address_t prefix, u8 prefix_lengt
 int ip4_address_cmp(const ip4_address_t *a, const ip4_address_t *b);
 int unformat_fib_prefix(unformat_input_t *input, fib_prefix_t *prefix);
 const char *bgp_state_to_string(bgp_state_t state);
-int bgp_construct_route_update(bgp_main_t *bmp, bgp_neighbor_t *neighbor, u8 **data, u16 *length);
 int bgp_enqueue_message(bgp_neighbor_t *neighbor, bgp_message_t *message);
 void *safe_mem_alloc(size_t size);
 bgp_message_t *bgp_dequeue_message(bgp_neighbor_t *neighbor);
 void queue_init(custom_queue_t *queue, int capacity);
 int queue_enqueue(custom_queue_t *queue, bgp_message_t *message) ;
 bgp_message_t *queue_dequeue(custom_queue_t *queue);
+void queue_requeue_head(custom_queue_t *queue, bgp_message_t *message);
+bgp_message_t *queue_peek(custom_queue_t *queue);
+bgp_message_t *queue_peek_nth(custom_queue_t *queue, int n);
 void queue_free(custom_queue_t *queue);
 bool queue_is_empty(custom_queue_t *queue);
 bool queue_is_full(custom_queue_t *queue);
-int bgp_create_open_message(u8 **message, u16 as_number, u32 bgp_identifier);
+bool queue_over_budget(custom_queue_t *queue);
+bool bgp_rib_out_blocked(bgp_neighbor_t *neighbor);
+void bgp_output_schedule(bgp_neighbor_t *neighbor);
+void bgp_output_retire(bgp_neighbor_t *neighbor);
+int bgp_create_open_message(u8 **message, u16 as_number, u32 bgp_identifier, u16 hold_time);
+void bgp_message_free(bgp_message_t *message);
+void bgp_discard_output(bgp_neighbor_t *neighbor);
 
 void bgp_request_full_update(bgp_neighbor_t *neighbor, bool rib_in);
 void bgp_recompute_rib_out(bgp_neighbor_t *neighbor);
 void bgp_send_open_message(bgp_main_t *bmp, bgp_neighbor_t *neighbor);
 void bgp_stop_route_exchange(bgp_main_t *bmp, bgp_neighbor_t *neighbor);
+bool bgp_peer_down_flush(bgp_main_t *bmp, bgp_neighbor_t *neighbor);
 bool bgp_tcp_is_connected(bgp_neighbor_t *neighbor);
 
 bool bgp_received_open(bgp_neighbor_t *neighbor);
@@ -192,6 +773,26 @@ bool bgp_received_notification(bgp_neighbor_t *neighbor);
 bool bgp_received_keepalive(bgp_neighbor_t *neighbor);
 
 void bgp_send_keepalive_message(bgp_neighbor_t *neighbor);
+void bgp_send_notification_message(bgp_neighbor_t *neighbor, u8 error_code, u8 error_subcode);
+u32 bgp_jittered_interval(u32 *seed, u32 interval);
+
+// bgp_bench.c
+void bgp_bench_init(bgp_bench_t *bench, vlib_main_t *vm);
+u32 bgp_bench_spawn(bgp_bench_t *bench, void *(*fn)(void *), void *args, uword arg_size, u32 n);
+void bgp_bench_start(bgp_bench_t *bench);
+f64 bgp_bench_stop(bgp_bench_t *bench);
+void bgp_bench_join(bgp_bench_t *bench);
+void bgp_bench_report(bgp_bench_t *bench, const char *label, u64 n, const char *unit, f64 seconds,
+                      char *fmt, ...);
+void bgp_bench_free(bgp_bench_t *bench);
+void bgp_check(bgp_check_t *check, bool ok, char *fmt, ...);
+
+/* Helper thread side of the start gate */
+static_always_inline void bgp_bench_wait(volatile u32 *go) {
+    while (!clib_atomic_load_acq_n(go)) {
+        CLIB_PAUSE();
+    }
+}
 
 // bgp_cli.c
 // void bgp_show_config(vlib_main_t *vm, bgp_main_t *bmp);
@@ -212,19 +813,47 @@ typedef enum {
     BGP_MSG_KEEPALIVE = 4
 } bgp_message_type_t;
 
+#define BGP_HEADER_LEN       19    // Marker + length + type on the wire
+
+#define BGP_ERR_MESSAGE_HEADER    1 // NOTIFICATION error codes (RFC 4271)
+#define BGP_ERR_OPEN_MESSAGE      2
+#define BGP_ERR_CEASE             6
+#define BGP_HDR_ERR_BAD_LENGTH    2 // Message Header Error subcodes
+#define BGP_OPEN_ERR_BAD_HOLD_TIME 6 // OPEN Message Error subcodes
+
+#define BGP_OPEN_SENT_HOLD_TIME   240 // Hold time while awaiting the peer's OPEN (RFC 4271 8.2.2)
+#define BGP_CEASE_ADMIN_SHUTDOWN  2 // Cease subcodes (RFC 4486)
+#define BGP_CEASE_PEER_DECONFIGURED 3
+#define BGP_CEASE_ADMIN_RESET     4
+#define BGP_CEASE_COLLISION       7
+#define BGP_CEASE_OUT_OF_RESOURCES 8
+
+// UPDATE path attributes (RFC 4271 4.3)
+#define BGP_ATTR_FLAG_OPTIONAL   0x80
+#define BGP_ATTR_FLAG_TRANSITIVE 0x40
+#define BGP_ATTR_ORIGIN          1
+#define BGP_ATTR_AS_PATH         2
+#define BGP_ATTR_NEXT_HOP        3
+#define BGP_ATTR_MED             4
+#define BGP_ATTR_LOCAL_PREF      5
+#define BGP_ATTR_COMMUNITIES     8 // RFC 1997
+#define BGP_ATTR_FLAG_EXTENDED   0x10
+#define BGP_AS_SEQUENCE          2
+#define BGP_MAX_MESSAGE_LEN  4096  // RFC 4271 maximum message size
+
 /**
  * BGP Message Header
  */
-typedef struct {
+typedef CLIB_PACKED (struct {
     u8 marker[16];    // All bits set to 1
     u16 length;       // Total length of the message
     u8 type;          // BGP message type
-} bgp_message_header_t;
+}) bgp_message_header_t;
 
 /**
  * BGP OPEN Message
  */
-typedef struct {
+typedef CLIB_PACKED (struct {
     bgp_message_header_t header;
     u8 version;
     u16 my_as;
@@ -232,34 +861,42 @@ typedef struct {
     ip4_address_t bgp_identifier;
     u8 opt_param_length;
     u8 optional_parameters[];
-} bgp_open_message_t;
+}) bgp_open_message_t;
+
+/* Adopt the peer's OPEN, negotiating the hold time; -1 if it was refused */
+int bgp_open_negotiate(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_open_message_t *open);
 
 /**
  * BGP UPDATE Message
  */
-typedef struct {
+typedef CLIB_PACKED (struct {
     bgp_message_header_t header;
     u16 withdrawn_routes_length;
     u8 withdrawn_routes[];
     // Path attributes and NLRI follow
-} bgp_update_message_t;
+}) bgp_update_message_t;
 
 /**
  * BGP KEEPALIVE Message
  */
-typedef struct {
+typedef CLIB_PACKED (struct {
     bgp_message_header_t header;
-} bgp_keepalive_message_t;
+}) bgp_keepalive_message_t;
 
 /**
  * BGP NOTIFICATION Message
  */
-typedef struct {
+typedef CLIB_PACKED (struct {
     bgp_message_header_t header;
     u8 error_code;
     u8 error_subcode;
     u8 data[];
-} bgp_notification_message_t;
+}) bgp_notification_message_t;
+
+void *bgp_create_keepalive_message(size_t *out_length);
+void *bgp_create_notification_message(u8 error_code, u8 error_subcode, size_t *out_length);
+bgp_message_type_t bgp_parse_message(void *data, size_t length);
+void bgp_handle_received_message(bgp_main_t *bmp, bgp_neighbor_t *neighbor, u8 *data, u16 length);
 
 //bgp_socket
 #define BGP_PORT 179
@@ -276,23 +913,141 @@ bgp_socket_t *bgp_socket_init(ip4_address_t *peer_ip);
 /* Establish a connection to the BGP peer */
 int bgp_socket_connect(bgp_socket_t *sock);
 
+/* Gather-write limit for one flush syscall */
+#define BGP_SOCKET_TX_IOV_MAX 64
+
 /* Send a BGP message */
 int bgp_socket_send(bgp_socket_t *sock, void *message, size_t length);
 
+/* Send a whole message now, bypassing the queues; -1 unless all of it went out */
+int bgp_socket_write_now(bgp_socket_t *sock, u8 *data, u32 length);
+
+/* Send several buffers in one syscall */
+int bgp_socket_sendv(bgp_socket_t *sock, struct iovec *iov, int iov_count);
+
 /* Receive a BGP message */
 int bgp_socket_receive(bgp_socket_t *sock, void *buffer, size_t buffer_size);
 
 /* Close the BGP socket */
 void bgp_socket_close(bgp_socket_t *sock);
 
+/* Wrap a connected descriptor accepted by the listener */
+bgp_socket_t *bgp_socket_from_fd(int fd, struct sockaddr_in *peer_addr);
+
+/* Open the passive listener on BGP_PORT */
+int bgp_socket_listen(bgp_main_t *bmp);
+
+/* Register the socket with the VPP file poller on behalf of a neighbor */
+void bgp_socket_register(bgp_socket_t *sock, u32 neighbor_index);
+
+/* Enable or disable write-ready notifications for the socket */
+void bgp_socket_want_write(bgp_socket_t *sock, int enable);
+
+/* Transmit as much of the neighbor's output queue as the socket accepts */
+void bgp_socket_flush(bgp_neighbor_t *neighbor);
+
+/* Write a NOTIFICATION ahead of queued output on a connection about to close */
+void bgp_socket_send_notification(bgp_neighbor_t *neighbor, bgp_socket_t *sock, u8 error_code,
+                                  u8 error_subcode);
+
+/* Tear down the transport after a failure and return the neighbor to Idle */
+void bgp_socket_handle_down(bgp_main_t *bmp, bgp_neighbor_t *neighbor);
+
+/* Helpers shared by the transport backends */
+void bgp_socket_input(bgp_main_t *bmp, bgp_neighbor_t *neighbor);
+void bgp_socket_connected(bgp_main_t *bmp, bgp_neighbor_t *neighbor);
+void bgp_socket_tx_advance(bgp_neighbor_t *neighbor, u32 written);
+void bgp_socket_rx_ready(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_socket_t *sock);
+void bgp_socket_drop_collision(bgp_neighbor_t *neighbor);
+int bgp_socket_local_address(bgp_socket_t *sock, ip4_address_t *addr);
+
+//bgp_uring
+clib_error_t *bgp_uring_init(bgp_main_t *bmp);
+int bgp_uring_connect(bgp_socket_t *sock);
+int bgp_uring_register(bgp_socket_t *sock);
+void bgp_uring_flush(bgp_neighbor_t *neighbor);
+void bgp_uring_close(bgp_socket_t *sock);
+void bgp_uring_submit(bgp_main_t *bmp);
+
+// bgp_handoff.c
+int bgp_handoff_to_main(bgp_main_t *bmp, u32 kind, u32 neighbor_index, void *data);
+int bgp_handoff_to_worker(bgp_main_t *bmp, u32 thread_index, u32 kind, u32 neighbor_index, void *data);
+void bgp_handoff_purge_neighbor(bgp_main_t *bmp, u32 neighbor_index);
+u32 bgp_handoff_drain_main(bgp_main_t *bmp);
+u32 bgp_handoff_drain_worker(bgp_main_t *bmp, u32 thread_index);
+void bgp_handoff_self_test(bgp_check_t *check);
+
+// bgp_shard.c
+u32 bgp_shard_thread_for(bgp_main_t *bmp, ip4_address_t neighbor_ip);
+void bgp_shard_add_neighbor(bgp_main_t *bmp, bgp_neighbor_t *neighbor);
+void bgp_shard_del_neighbor(bgp_main_t *bmp, bgp_neighbor_t *neighbor);
+void bgp_neighbor_set_state(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_state_t state);
+
+// Walk one thread's neighbors in a state; the body must not change their state
+#define bgp_foreach_neighbor_in_state(bmp, thread_index, st, neighbor)                          \
+    for (u32 _bgp_ni = vec_elt_at_index((bmp)->shards, (thread_index))->state_head[st];          \
+         _bgp_ni != ~0 && ((neighbor) = pool_elt_at_index((bmp)->neighbors, _bgp_ni), 1);        \
+         _bgp_ni = (neighbor)->state_next)
+clib_error_t *bgp_shard_enable_disable(bgp_main_t *bmp, int enable);
+void bgp_shard_update_node_state(bgp_main_t *bmp);
+
+// bgp_timer.c
+void bgp_timer_start(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_timer_type_t timer, u32 seconds);
+void bgp_timer_start_jittered(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_timer_type_t timer, u32 seconds);
+void bgp_timer_stop(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_timer_type_t timer);
+void bgp_timer_stop_all(bgp_main_t *bmp, bgp_neighbor_t *neighbor);
+u32 bgp_timer_remaining(bgp_neighbor_t *neighbor, bgp_timer_type_t timer, f64 now);
+void bgp_timer_expire(bgp_main_t *bmp, u32 thread_index, f64 now);
+
+static_always_inline int bgp_timer_is_running(bgp_neighbor_t *neighbor, bgp_timer_type_t timer) {
+    return neighbor->timers[timer] != ~0;
+}
+
+// bgp_decision.c
+void bgp_rib_path_update(bgp_loc_rib_t *rib, ip4_address_t prefix, u8 mask_length, bgp_path_t *path);
+void bgp_rib_path_withdraw(bgp_loc_rib_t *rib, ip4_address_t prefix, u8 mask_length, u32 neighbor_index);
+void bgp_rib_peer_down(bgp_loc_rib_t *rib, u32 neighbor_index);
+bgp_decision_partition_t *bgp_decision_partition(bgp_loc_rib_t *rib, u32 n_parts);
+void bgp_decision_eval_partition(bgp_decision_partition_t *part);
+u32 bgp_decision_merge(bgp_loc_rib_t *rib, u32 **changed);
+void bgp_decision_run(bgp_main_t *bmp);
+void bgp_fib_download(bgp_main_t *bmp);
+
+// bgp_update_group.c
+void bgp_update_group_join(bgp_main_t *bmp, bgp_neighbor_t *neighbor);
+void bgp_update_group_leave(bgp_main_t *bmp, bgp_neighbor_t *neighbor);
+void bgp_update_group_rejoin(bgp_main_t *bmp, bgp_neighbor_t *neighbor);
+void bgp_update_group_request_full(bgp_main_t *bmp, u32 neighbor_index);
+void bgp_update_group_resync(bgp_main_t *bmp, u32 neighbor_index);
+void bgp_update_group_reevaluate(bgp_main_t *bmp, bgp_update_group_t *group, uword *keys);
+void bgp_update_group_reevaluate_all(bgp_update_group_t *group);
+void bgp_update_group_encode(bgp_update_task_t *task);
+void bgp_update_batch_apply(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_update_batch_t *batch);
+void bgp_update_batch_free(bgp_update_batch_t *batch);
+void bgp_update_groups_run(bgp_main_t *bmp);
+void bgp_update_groups_free(bgp_main_t *bmp);
+void bgp_update_group_self_test(bgp_check_t *check);
+
+// bgp_peer_group.c
+bgp_peer_group_t *bgp_find_peer_group(bgp_main_t *bmp, const char *name);
+void bgp_peer_group_inherit(bgp_main_t *bmp, bgp_neighbor_t *neighbor, u32 peer_group);
+void bgp_peer_group_forget(bgp_main_t *bmp, bgp_neighbor_t *neighbor);
+void bgp_peer_group_join(bgp_main_t *bmp, bgp_neighbor_t *neighbor, u32 peer_group);
+void bgp_peer_groups_free(bgp_main_t *bmp);
+
+//bgp_session
+clib_error_t *bgp_session_init(bgp_main_t *bmp, u8 *namespace_id, u64 secret);
+int bgp_session_connect(bgp_socket_t *sock);
+void bgp_session_flush(bgp_neighbor_t *neighbor);
+int bgp_session_write_now(bgp_socket_t *sock, u8 *data, u32 length);
+void bgp_session_close(bgp_socket_t *sock);
+int bgp_session_local_address(bgp_socket_t *sock, ip4_address_t *addr);
+void bgp_session_handoff_dispatch(bgp_main_t *bmp, u32 kind, u32 neighbor_index, void *data);
+void bgp_session_handoff_release(u32 kind, void *data);
+
 //bgp_state_machine
 void bgp_handle_route_update(bgp_main_t *bmp, bgp_neighbor_t *neighbor);
 
-/**
- * Handles sending and receiving Keepalive messages for a BGP neighbor.
- */
-void bgp_handle_keepalive(bgp_neighbor_t *neighbor);
-
 
 /* Handle entering a specific state */
 void bgp_enter_state(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_state_t new_state);
@@ -303,11 +1058,23 @@ void bgp_exit_state(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_state_t old_s
 /* Transition neighbor to a new state */
 void bgp_transition_state(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_state_t new_state);
 
-/* Periodic processing of state transitions */
+/* Evaluate a neighbor's state against its socket and received messages */
 void bgp_process_state(bgp_main_t *bmp, bgp_neighbor_t *neighbor);
 
-/* Timer events for managing neighbor state */
-void bgp_handle_timers(bgp_main_t *bmp, bgp_neighbor_t *neighbor);
+/* Queue an FSM event on the neighbor's owner thread */
+void bgp_fsm_post(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_fsm_event_t event);
+
+/* Run the FSM events queued for a thread's neighbors */
+u32 bgp_fsm_dispatch(bgp_main_t *bmp, u32 thread_index);
+
+/* A neighbor's session timer fired */
+void bgp_handle_timer_expired(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_timer_type_t timer);
+
+/* Attach an accepted connection to its neighbor, resolving collisions */
+void bgp_handle_incoming_connection(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_socket_t *sock);
+
+/* Pick the surviving connection once the colliding connection's OPEN arrives */
+void bgp_resolve_collision(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_open_message_t *open);
 
 
 #endif /* __INCLUDED_BGP_H__ */
\ No newline at end of file
@@ -0,0 +1,740 @@
+/*
+ * bgp_as_path.c - AS-path regular expressions compiled to DFAs
+ *
+ * Copyright (c) <current-year> <your-organization>
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ctype.h>
+#include <vlib/vlib.h>
+#include <vppinfra/unix.h>
+#include <bgp/bgp.h>
+
+/*
+ * Patterns use the usual AS-path syntax, but are matched against the AS
+ * numbers of the path rather than its text: an ASN matches that AS, '.'
+ * any one AS, and '(' ')', '|', '*', '+' and '?' work as in POSIX regular
+ * expressions. '_' and blanks only separate ASNs. A branch matches
+ * anywhere in the path unless anchored with '^' (nearest AS) or '$'
+ * (origin); anchors are only allowed at the ends of top-level branches.
+ *
+ * Compilation goes pattern -> Thompson NFA -> DFA by subset construction,
+ * once per distinct pattern. Matching is then one table step per AS with
+ * no backtracking, and stops early once the DFA reaches a state that
+ * every AS leads back to. Results are cached per thread by attribute set,
+ * so each distinct AS path is matched once per pattern.
+ */
+
+enum {
+    BGP_AS_PATH_NFA_EPSILON = 0,
+    BGP_AS_PATH_NFA_AS,
+    BGP_AS_PATH_NFA_ANY,
+};
+
+typedef struct {
+    u8 kind;                      // BGP_AS_PATH_NFA_*
+    u8 n_eps;
+    u32 as;                       // NFA_AS: the AS, then its class once literals are known
+    u32 next;                     // NFA_AS and NFA_ANY: state after consuming one AS
+    u32 eps[2];                   // Epsilon transitions
+} bgp_as_path_nfa_state_t;
+
+typedef struct {
+    u32 start;
+    u32 end;                      // No outgoing transitions until the fragment is joined
+} bgp_as_path_frag_t;
+
+typedef struct {
+    const char *pattern;
+    u32 pos;
+    u32 depth;
+    bgp_as_path_nfa_state_t *states;
+    clib_error_t *error;
+} bgp_as_path_parser_t;
+
+#define BGP_AS_PATH_REGEX_MAX_DEPTH 32
+
+static u32 bgp_as_path_nfa_new(bgp_as_path_parser_t *p, u8 kind, u32 as) {
+    bgp_as_path_nfa_state_t *state;
+
+    vec_add2(p->states, state, 1);
+    clib_memset(state, 0, sizeof(*state));
+    state->kind = kind;
+    state->as = as;
+    state->next = ~0;
+    return state - p->states;
+}
+
+static_always_inline void bgp_as_path_nfa_eps(bgp_as_path_parser_t *p, u32 from, u32 to) {
+    bgp_as_path_nfa_state_t *state = vec_elt_at_index(p->states, from);
+
+    ASSERT(state->n_eps < ARRAY_LEN(state->eps));
+    state->eps[state->n_eps++] = to;
+}
+
+static bgp_as_path_frag_t bgp_as_path_frag_atom(bgp_as_path_parser_t *p, u8 kind, u32 as) {
+    bgp_as_path_frag_t f = { .start = bgp_as_path_nfa_new(p, kind, as) };
+
+    f.end = bgp_as_path_nfa_new(p, BGP_AS_PATH_NFA_EPSILON, 0);
+    p->states[f.start].next = f.end;
+    return f;
+}
+
+static bgp_as_path_frag_t bgp_as_path_frag_empty(bgp_as_path_parser_t *p) {
+    u32 s = bgp_as_path_nfa_new(p, BGP_AS_PATH_NFA_EPSILON, 0);
+
+    return (bgp_as_path_frag_t){ s, s };
+}
+
+static bgp_as_path_frag_t bgp_as_path_frag_concat(bgp_as_path_parser_t *p, bgp_as_path_frag_t a,
+                                                  bgp_as_path_frag_t b) {
+    bgp_as_path_nfa_eps(p, a.end, b.start);
+    return (bgp_as_path_frag_t){ a.start, b.end };
+}
+
+static bgp_as_path_frag_t bgp_as_path_frag_alt(bgp_as_path_parser_t *p, bgp_as_path_frag_t a,
+                                               bgp_as_path_frag_t b) {
+    bgp_as_path_frag_t f = { bgp_as_path_nfa_new(p, 0, 0), bgp_as_path_nfa_new(p, 0, 0) };
+
+    bgp_as_path_nfa_eps(p, f.start, a.start);
+    bgp_as_path_nfa_eps(p, f.start, b.start);
+    bgp_as_path_nfa_eps(p, a.end, f.end);
+    bgp_as_path_nfa_eps(p, b.end, f.end);
+    return f;
+}
+
+/* a*, a+ or a? */
+static bgp_as_path_frag_t bgp_as_path_frag_repeat(bgp_as_path_parser_t *p, bgp_as_path_frag_t a, char op) {
+    bgp_as_path_frag_t f = { bgp_as_path_nfa_new(p, 0, 0), bgp_as_path_nfa_new(p, 0, 0) };
+
+    bgp_as_path_nfa_eps(p, f.start, a.start);
+    if (op != '+') {
+        bgp_as_path_nfa_eps(p, f.start, f.end);
+    }
+    if (op != '?') {
+        bgp_as_path_nfa_eps(p, a.end, a.start);
+    }
+    bgp_as_path_nfa_eps(p, a.end, f.end);
+    return f;
+}
+
+static char bgp_as_path_peek(bgp_as_path_parser_t *p) {
+    while (p->pattern[p->pos] == '_' || p->pattern[p->pos] == ' ' || p->pattern[p->pos] == '\t') {
+        p->pos++;
+    }
+    return p->pattern[p->pos];
+}
+
+static void bgp_as_path_parse_error(bgp_as_path_parser_t *p, const char *what) {
+    if (!p->error) {
+        p->error = clib_error_return(0, "%s at position %u of '%s'", what, p->pos + 1, p->pattern);
+    }
+}
+
+static bgp_as_path_frag_t bgp_as_path_parse_alt(bgp_as_path_parser_t *p);
+
+static bgp_as_path_frag_t bgp_as_path_parse_atom(bgp_as_path_parser_t *p) {
+    bgp_as_path_frag_t f;
+    char c = bgp_as_path_peek(p);
+    u64 as = 0;
+
+    if (isdigit(c)) {
+        while (isdigit(p->pattern[p->pos]) && as <= 0xffffffffULL) {
+            as = as * 10 + (p->pattern[p->pos++] - '0');
+        }
+        if (as > 0xffffffffULL) {
+            bgp_as_path_parse_error(p, "AS number out of range");
+        }
+        return bgp_as_path_frag_atom(p, BGP_AS_PATH_NFA_AS, as);
+    }
+    if (c == '.') {
+        p->pos++;
+        return bgp_as_path_frag_atom(p, BGP_AS_PATH_NFA_ANY, 0);
+    }
+    if (c == '(') {
+        if (++p->depth > BGP_AS_PATH_REGEX_MAX_DEPTH) {
+            bgp_as_path_parse_error(p, "Groups nested too deeply");
+            return bgp_as_path_frag_empty(p);
+        }
+        p->pos++;
+        f = bgp_as_path_parse_alt(p);
+        if (bgp_as_path_peek(p) != ')') {
+            bgp_as_path_parse_error(p, "Expected ')'");
+        } else {
+            p->pos++;
+        }
+        p->depth--;
+        return f;
+    }
+    bgp_as_path_parse_error(p, c ? "Unexpected character" : "Unexpected end");
+    if (c) {
+        p->pos++;
+    }
+    return bgp_as_path_frag_empty(p);
+}
+
+static bgp_as_path_frag_t bgp_as_path_parse_seq(bgp_as_path_parser_t *p) {
+    bgp_as_path_frag_t f = bgp_as_path_frag_empty(p), atom;
+    char c;
+
+    while ((c = bgp_as_path_peek(p)) && c != '|' && c != ')' && c != '$' && !p->error) {
+        atom = bgp_as_path_parse_atom(p);
+        while ((c = bgp_as_path_peek(p)) == '*' || c == '+' || c == '?') {
+            p->pos++;
+            atom = bgp_as_path_frag_repeat(p, atom, c);
+        }
+        f = bgp_as_path_frag_concat(p, f, atom);
+    }
+    return f;
+}
+
+static bgp_as_path_frag_t bgp_as_path_parse_alt(bgp_as_path_parser_t *p) {
+    bgp_as_path_frag_t f = bgp_as_path_parse_seq(p);
+
+    while (bgp_as_path_peek(p) == '|' && !p->error) {
+        p->pos++;
+        f = bgp_as_path_frag_alt(p, f, bgp_as_path_parse_seq(p));
+    }
+    return f;
+}
+
+/* Top level: branches, each unanchored unless it starts with '^' or ends with '$' */
+static bgp_as_path_frag_t bgp_as_path_parse(bgp_as_path_parser_t *p) {
+    bgp_as_path_frag_t f = { ~0, ~0 }, branch;
+    bool anchored_start, anchored_end;
+
+    while (1) {
+        if ((anchored_start = bgp_as_path_peek(p) == '^')) {
+            p->pos++;
+        }
+        branch = bgp_as_path_parse_seq(p);
+        if ((anchored_end = bgp_as_path_peek(p) == '$')) {
+            p->pos++;
+        }
+        if (!anchored_start) {
+            branch = bgp_as_path_frag_concat(
+                p, bgp_as_path_frag_repeat(p, bgp_as_path_frag_atom(p, BGP_AS_PATH_NFA_ANY, 0), '*'), branch);
+        }
+        if (!anchored_end) {
+            branch = bgp_as_path_frag_concat(
+                p, branch, bgp_as_path_frag_repeat(p, bgp_as_path_frag_atom(p, BGP_AS_PATH_NFA_ANY, 0), '*'));
+        }
+        f = f.start == ~0 ? branch : bgp_as_path_frag_alt(p, f, branch);
+        if (bgp_as_path_peek(p) != '|' || p->error) {
+            break;
+        }
+        p->pos++;
+    }
+
+    if (bgp_as_path_peek(p)) {
+        bgp_as_path_parse_error(p, "Unexpected character");
+    }
+    return f;
+}
+
+static int bgp_as_path_u32_cmp(void *a1, void *a2) {
+    u32 *a = a1, *b = a2;
+
+    return *a < *b ? -1 : *a > *b;
+}
+
+/* Sorted NFA states reachable from seeds through epsilon transitions; seeds is consumed */
+static u32 *bgp_as_path_closure(bgp_as_path_nfa_state_t *states, u32 *seeds, uword **seen) {
+    u32 *set = 0, s, i;
+
+    clib_bitmap_zero(*seen);
+    while (vec_len(seeds)) {
+        s = vec_pop(seeds);
+        if (clib_bitmap_get(*seen, s)) {
+            continue;
+        }
+        *seen = clib_bitmap_set(*seen, s, 1);
+        vec_add1(set, s);
+        for (i = 0; i < states[s].n_eps; i++) {
+            vec_add1(seeds, states[s].eps[i]);
+        }
+    }
+    vec_free(seeds);
+    vec_sort_with_function(set, bgp_as_path_u32_cmp);
+    return set;
+}
+
+static_always_inline u32 bgp_as_path_regex_class(bgp_as_path_regex_t *regex, u32 as) {
+    u32 lo = 0, hi = vec_len(regex->literals);
+
+    while (lo < hi) {
+        u32 mid = (lo + hi) / 2;
+        if (regex->literals[mid] == as) {
+            return mid;
+        }
+        if (regex->literals[mid] < as) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return regex->n_classes - 1;
+}
+
+static clib_error_t *bgp_as_path_regex_compile(bgp_as_path_regex_t *regex, const char *pattern) {
+    bgp_as_path_parser_t parser = { .pattern = pattern }, *p = &parser;
+    bgp_as_path_nfa_state_t *state;
+    bgp_as_path_frag_t nfa;
+    u32 **sets = 0, *set, *seeds, *s, dead = ~0, i, n, c, target;
+    uword *dfa_by_set = 0, *seen = 0, *q;
+    clib_error_t *error = 0;
+
+    nfa = bgp_as_path_parse(p);
+    if ((error = p->error)) {
+        goto done;
+    }
+
+    // Every AS the pattern names is its own input class, all others share the last one
+    vec_foreach (state, p->states) {
+        if (state->kind == BGP_AS_PATH_NFA_AS) {
+            vec_add1(regex->literals, state->as);
+        }
+    }
+    vec_sort_with_function(regex->literals, bgp_as_path_u32_cmp);
+    for (i = 0, n = 0; i < vec_len(regex->literals); i++) {
+        if (n == 0 || regex->literals[i] != regex->literals[n - 1]) {
+            regex->literals[n++] = regex->literals[i];
+        }
+    }
+    vec_set_len(regex->literals, n);
+    regex->n_classes = vec_len(regex->literals) + 1;
+    vec_foreach (state, p->states) {
+        if (state->kind == BGP_AS_PATH_NFA_AS) {
+            state->as = bgp_as_path_regex_class(regex, state->as);
+        }
+    }
+
+    // Subset construction; the empty set is the dead state and has no hash key
+    dfa_by_set = hash_create_vec(0, sizeof(u32), sizeof(uword));
+    seeds = 0;
+    vec_add1(seeds, nfa.start);
+    vec_add1(sets, bgp_as_path_closure(p->states, seeds, &seen));
+    hash_set_mem(dfa_by_set, sets[0], 0);
+
+    for (i = 0; i < vec_len(sets); i++) {
+        vec_validate(regex->next, (i + 1) * regex->n_classes - 1);
+        for (c = 0; c < regex->n_classes; c++) {
+            seeds = 0;
+            vec_foreach (s, sets[i]) {
+                state = &p->states[*s];
+                if (state->kind == BGP_AS_PATH_NFA_ANY || (state->kind == BGP_AS_PATH_NFA_AS && state->as == c)) {
+                    vec_add1(seeds, state->next);
+                }
+            }
+            set = bgp_as_path_closure(p->states, seeds, &seen);
+
+            if (!vec_len(set) && dead != ~0) {
+                target = dead;
+                vec_free(set);
+            } else if (vec_len(set) && (q = hash_get_mem(dfa_by_set, set))) {
+                target = q[0];
+                vec_free(set);
+            } else {
+                target = vec_len(sets);
+                if (target >= BGP_AS_PATH_REGEX_MAX_STATES) {
+                    vec_free(set);
+                    error = clib_error_return(0, "'%s' needs more than %u DFA states", pattern,
+                                              BGP_AS_PATH_REGEX_MAX_STATES);
+                    goto done;
+                }
+                vec_add1(sets, set);
+                if (vec_len(set)) {
+                    hash_set_mem(dfa_by_set, set, target);
+                } else {
+                    dead = target;
+                }
+            }
+            regex->next[i * regex->n_classes + c] = target;
+        }
+    }
+
+    vec_validate(regex->accepting, vec_len(sets) - 1);
+    vec_validate(regex->decided, vec_len(sets) - 1);
+    for (i = 0; i < vec_len(sets); i++) {
+        regex->accepting[i] = vec_search(sets[i], nfa.end) != ~0;
+        regex->decided[i] = 1;
+        for (c = 0; c < regex->n_classes; c++) {
+            regex->decided[i] &= regex->next[i * regex->n_classes + c] == i;
+        }
+    }
+
+done:
+    for (i = 0; i < vec_len(sets); i++) {
+        vec_free(sets[i]);
+    }
+    vec_free(sets);
+    hash_free(dfa_by_set);
+    clib_bitmap_free(seen);
+    vec_free(p->states);
+    return error;
+}
+
+static void bgp_as_path_regex_cache_clear(bgp_as_path_regex_cache_t *cache) {
+    clib_bitmap_free(cache->known);
+    clib_bitmap_free(cache->matched);
+}
+
+static void bgp_as_path_regex_release(bgp_as_path_regex_t *regex) {
+    bgp_as_path_regex_cache_t *cache;
+
+    vec_foreach (cache, regex->caches) {
+        bgp_as_path_regex_cache_clear(cache);
+    }
+    vec_free(regex->caches);
+    vec_free(regex->pattern);
+    vec_free(regex->literals);
+    vec_free(regex->next);
+    vec_free(regex->accepting);
+    vec_free(regex->decided);
+}
+
+/* Compile a pattern into a regex the caller owns, with empty per-thread caches */
+static clib_error_t *bgp_as_path_regex_create(bgp_as_path_regex_t *regex, const char *pattern) {
+    clib_error_t *error;
+
+    clib_memset(regex, 0, sizeof(*regex));
+    if ((error = bgp_as_path_regex_compile(regex, pattern))) {
+        bgp_as_path_regex_release(regex);
+        return error;
+    }
+    regex->pattern = format(0, "%s%c", pattern, 0);
+    vec_validate_aligned(regex->caches, vlib_num_workers(), CLIB_CACHE_LINE_BYTES);
+    return 0;
+}
+
+/* ID of the compiled pattern, compiling it on first use */
+clib_error_t *bgp_as_path_regex_intern(bgp_main_t *bmp, const char *pattern, u32 *id) {
+    bgp_as_path_regex_t regex, *r;
+    clib_error_t *error;
+    uword *p;
+
+    if ((p = hash_get_mem(bmp->as_path_regex_by_pattern, pattern))) {
+        *id = p[0];
+        return 0;
+    }
+    if ((error = bgp_as_path_regex_create(&regex, pattern))) {
+        return error;
+    }
+
+    pool_get(bmp->as_path_regexes, r);
+    *r = regex;
+    *id = r - bmp->as_path_regexes;
+    hash_set_mem(bmp->as_path_regex_by_pattern, r->pattern, *id);
+    return 0;
+}
+
+bool bgp_as_path_regex_match(bgp_as_path_regex_t *regex, u32 *as_path) {
+    u32 state = 0, *as;
+
+    vec_foreach (as, as_path) {
+        if (regex->decided[state]) {
+            break;
+        }
+        state = regex->next[state * regex->n_classes + bgp_as_path_regex_class(regex, *as)];
+    }
+    return regex->accepting[state];
+}
+
+/* Match through this thread's cache; a set never changes, so a result holds until the set is freed */
+bool bgp_as_path_regex_match_set(bgp_main_t *bmp, bgp_as_path_regex_t *regex, u32 attr_set) {
+    bgp_as_path_regex_cache_t *cache = vec_elt_at_index(regex->caches, vlib_get_thread_index());
+    bool matched;
+
+    if (clib_bitmap_get(cache->known, attr_set)) {
+        cache->hits++;
+        return clib_bitmap_get(cache->matched, attr_set);
+    }
+    cache->misses++;
+    matched = bgp_as_path_regex_match(regex, bgp_attr_set_get(bmp, attr_set)->as_path);
+    cache->known = clib_bitmap_set(cache->known, attr_set, 1);
+    cache->matched = clib_bitmap_set(cache->matched, attr_set, matched);
+    return matched;
+}
+
+/* Attribute sets were freed; their IDs may come back with other paths */
+void bgp_as_path_regexes_forget_attr_sets(bgp_main_t *bmp, uword *freed) {
+    bgp_as_path_regex_t *regex;
+    bgp_as_path_regex_cache_t *cache;
+
+    pool_foreach (regex, bmp->as_path_regexes) {
+        vec_foreach (cache, regex->caches) {
+            cache->known = clib_bitmap_andnot(cache->known, freed);
+        }
+    }
+}
+
+void bgp_as_path_regexes_free(bgp_main_t *bmp) {
+    bgp_as_path_regex_t *regex;
+
+    pool_foreach (regex, bmp->as_path_regexes) {
+        bgp_as_path_regex_release(regex);
+    }
+    pool_free(bmp->as_path_regexes);
+    hash_free(bmp->as_path_regex_by_pattern);
+}
+
+// === CLI ===
+
+static clib_error_t *
+bgp_show_as_path_regexes_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    bgp_main_t *bmp = &bgp_main;
+    bgp_as_path_regex_cache_t *cache;
+    bgp_as_path_regex_t *regex;
+
+    pool_foreach (regex, bmp->as_path_regexes) {
+        u64 hits = 0, misses = 0;
+
+        vec_foreach (cache, regex->caches) {
+            hits += cache->hits;
+            misses += cache->misses;
+        }
+        vlib_cli_output(vm, "AS-path regex %s (id %u): %u DFA states, %u input classes", regex->pattern,
+                        regex - bmp->as_path_regexes, vec_len(regex->accepting), regex->n_classes);
+        vlib_cli_output(vm, "  attribute-set cache: %llu hits, %llu misses", hits, misses);
+    }
+    return 0;
+}
+
+VLIB_CLI_COMMAND(bgp_show_as_path_regexes_command, static) = {
+    .path = "show bgp as-path-regexes",
+    .short_help = "show bgp as-path-regexes",
+    .function = bgp_show_as_path_regexes_command_fn,
+};
+
+// === Matching benchmark ===
+
+/* One AS path per line, ASNs separated by anything that is not a digit, as in a table dump */
+static clib_error_t *bgp_as_path_corpus_load(char *file, u32 ***paths) {
+    u8 *contents = 0, *c;
+    u32 *path = 0, as = 0;
+    bool in_as = false;
+    clib_error_t *error;
+
+    if ((error = clib_file_contents(file, &contents))) {
+        return error;
+    }
+    vec_add1(contents, '\n');
+    vec_foreach (c, contents) {
+        if (isdigit(*c)) {
+            as = in_as ? as * 10 + (*c - '0') : (u32)(*c - '0');
+            in_as = true;
+            continue;
+        }
+        if (in_as) {
+            vec_add1(path, as);
+            in_as = false;
+        }
+        if (*c == '\n' && vec_len(path)) {
+            vec_add1(*paths, path);
+            path = 0;
+        }
+    }
+    vec_free(contents);
+    return 0;
+}
+
+/*
+ * Without a corpus, paths are shaped like a full table seen from one
+ * transit session: a tier-1 next to us, zero to four intermediate ASes,
+ * an origin, and now and then origin prepending.
+ */
+static void bgp_as_path_corpus_synthesize(u32 n_paths, u32 ***paths) {
+    static const u32 transit[] = { 174, 1299, 2914, 3257, 3356, 6453, 6762, 6939 };
+    u32 seed = 0x5eed, *path, origin, i, j, n;
+
+    for (i = 0; i < n_paths; i++) {
+        path = 0;
+        vec_add1(path, transit[random_u32(&seed) % ARRAY_LEN(transit)]);
+        n = random_u32(&seed) % 5;
+        for (j = 0; j < n; j++) {
+            vec_add1(path, 1 + random_u32(&seed) % 64511);
+        }
+        origin = 1 + random_u32(&seed) % 400000;
+        n = random_u32(&seed) % 8 == 0 ? 1 + random_u32(&seed) % 3 : 0;
+        for (j = 0; j <= n; j++) {
+            vec_add1(path, origin);
+        }
+        vec_add1(*paths, path);
+    }
+}
+
+/*
+ * Times one pattern over an AS-path corpus: every path through the DFA,
+ * then a table of routes whose paths are the interned corpus, through the
+ * per-attribute-set cache from cold. The pattern is compiled privately so
+ * neither the regex pool nor a configured regex's cache is touched. Routes cycle over the distinct
+ * paths, the way a full table repeats a much smaller set of paths.
+ */
+static clib_error_t *
+bgp_as_path_regex_benchmark_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    bgp_main_t *bmp = &bgp_main;
+    u32 n_paths = 100000, n_routes = 1000000, n_matched = 0, i;
+    u32 **paths = 0, **path, *sets = 0;
+    u64 n_as = 0;
+    bgp_as_path_regex_cache_t *cache;
+    bgp_as_path_regex_t regex = { 0 };
+    u8 *pattern = 0, *file = 0;
+    clib_error_t *error = 0;
+    bgp_bench_t bench;
+    f64 seconds;
+
+    bgp_bench_init(&bench, vm);
+    if (!unformat(input, "%s", &pattern)) {
+        return clib_error_return(0, "Usage: test bgp as-path-regex-benchmark <regex> "
+                                    "[corpus <file>|paths <n>] [routes <n>]");
+    }
+    vec_add1(pattern, 0);
+    while (unformat_check_input(input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat(input, "corpus %s", &file))
+            ;
+        else if (unformat(input, "paths %u", &n_paths))
+            ;
+        else if (unformat(input, "routes %u", &n_routes))
+            ;
+        else {
+            error = clib_error_return(0, "unknown input `%U'", format_unformat_error, input);
+            goto done;
+        }
+    }
+    if (n_paths == 0 || n_routes == 0) {
+        error = clib_error_return(0, "paths and routes must be non-zero");
+        goto done;
+    }
+
+    bgp_bench_start(&bench);
+    if ((error = bgp_as_path_regex_create(&regex, (char *)pattern))) {
+        goto done;
+    }
+    seconds = bgp_bench_stop(&bench);
+    vlib_cli_output(vm, "%s: %u DFA states, %u input classes, compiled in %.1fus", regex.pattern,
+                    vec_len(regex.accepting), regex.n_classes, seconds * 1e6);
+
+    if (file) {
+        vec_add1(file, 0);
+        if ((error = bgp_as_path_corpus_load((char *)file, &paths))) {
+            goto done;
+        }
+        if (!vec_len(paths)) {
+            error = clib_error_return(0, "No AS paths in %s", file);
+            goto done;
+        }
+    } else {
+        bgp_as_path_corpus_synthesize(n_paths, &paths);
+    }
+    vec_foreach (path, paths) {
+        n_as += vec_len(*path);
+        vec_add1(sets, bgp_attr_set_intern(bmp, *path, 0));
+    }
+    vlib_cli_output(vm, "  corpus: %u paths, %.1f ASes per path", vec_len(paths), (f64)n_as / vec_len(paths));
+
+    bgp_bench_start(&bench);
+    vec_foreach (path, paths) {
+        n_matched += bgp_as_path_regex_match(&regex, *path);
+    }
+    bgp_bench_report(&bench, "dfa", vec_len(paths), "paths", bgp_bench_stop(&bench), "%u match", n_matched);
+
+    cache = vec_elt_at_index(regex.caches, vlib_get_thread_index());
+    n_matched = 0;
+    bgp_bench_start(&bench);
+    for (i = 0; i < n_routes; i++) {
+        n_matched += bgp_as_path_regex_match_set(bmp, &regex, sets[i % vec_len(sets)]);
+    }
+    bgp_bench_report(&bench, "cached", n_routes, "routes", bgp_bench_stop(&bench),
+                     "%u match, %llu hits, %llu misses", n_matched, cache->hits, cache->misses);
+
+done:
+    bgp_as_path_regex_release(&regex);
+    bgp_bench_free(&bench);
+    vec_foreach (path, paths) {
+        vec_free(*path);
+    }
+    vec_free(paths);
+    vec_free(sets);
+    vec_free(pattern);
+    vec_free(file);
+    return error;
+}
+
+VLIB_CLI_COMMAND(bgp_as_path_regex_benchmark_command, static) = {
+    .path = "test bgp as-path-regex-benchmark",
+    .short_help = "test bgp as-path-regex-benchmark <regex> [corpus <file>|paths <n>] [routes <n>]",
+    .function = bgp_as_path_regex_benchmark_command_fn,
+};
+
+// === Self-test ===
+
+void bgp_as_path_self_test(bgp_check_t *check) {
+    static const struct {
+        const char *pattern;
+        u32 n;
+        u32 path[4];
+        bool matches;
+    } cases[] = {
+        { "^174", 2, { 174, 3356 }, true },
+        { "^174", 2, { 3356, 174 }, false },
+        { "174$", 2, { 3356, 174 }, true },
+        { "174$", 2, { 174, 3356 }, false },
+        { "^174$", 1, { 174 }, true },
+        { "^174$", 2, { 174, 174 }, false },
+        { "^174$", 0, { 0 }, false },
+        { "^$", 0, { 0 }, true },
+        { "^$", 1, { 174 }, false },
+        { "174", 3, { 1, 174, 2 }, true },
+        { "_174_3356_", 3, { 65000, 174, 3356 }, true },
+        { "^174_3356", 3, { 65000, 174, 3356 }, false },
+        { "^(174|3356)+$", 3, { 174, 3356, 174 }, true },
+        { "^(174|3356)+$", 2, { 174, 1 }, false },
+        { "^174 .* 65000$", 2, { 174, 65000 }, true },
+        { "^174 .* 65000$", 4, { 174, 5, 6, 65000 }, true },
+        { "^174 .* 65000$", 3, { 174, 65000, 1 }, false },
+        { "^174$|^3356$", 1, { 3356 }, true },
+        { "^174$|^3356$", 2, { 174, 3356 }, false },
+        { "^174|65000$", 2, { 1, 65000 }, true },
+        { "^174|65000$", 2, { 65000, 1 }, false },
+    };
+    // Anchors belong at the ends of top-level branches only
+    static const char *invalid[] = { "1^2", "1$2", "(^1)", "(1$)", "^^1" };
+    bgp_as_path_regex_t regex;
+    clib_error_t *error;
+    u32 *path = 0, i, j;
+
+    for (i = 0; i < ARRAY_LEN(cases); i++) {
+        if ((error = bgp_as_path_regex_create(&regex, cases[i].pattern))) {
+            bgp_check(check, false, "'%s' does not compile: %U", cases[i].pattern, format_clib_error, error);
+            clib_error_free(error);
+            continue;
+        }
+        vec_reset_length(path);
+        for (j = 0; j < cases[i].n; j++) {
+            vec_add1(path, cases[i].path[j]);
+        }
+        bgp_check(check, bgp_as_path_regex_match(&regex, path) == cases[i].matches, "'%s' %s path %U",
+                  cases[i].pattern, cases[i].matches ? "misses" : "matches", format_vec32, path, "%u");
+        bgp_as_path_regex_release(&regex);
+    }
+    for (i = 0; i < ARRAY_LEN(invalid); i++) {
+        error = bgp_as_path_regex_create(&regex, invalid[i]);
+        bgp_check(check, error != 0, "'%s' compiles", invalid[i]);
+        if (error) {
+            clib_error_free(error);
+        } else {
+            bgp_as_path_regex_release(&regex);
+        }
+    }
+    vec_free(path);
+}
@@ -0,0 +1,212 @@
+/*
+ * bgp_attr.c - interned AS paths and communities
+ *
+ * Copyright (c) <current-year> <your-organization>
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vlib/vlib.h>
+#include <bgp/bgp.h>
+
+/*
+ * A full table carries a few hundred thousand prefixes but far fewer
+ * distinct attribute sets, so the variable-length attributes are stored
+ * once and routes refer to them by ID. Interning only happens on the main
+ * thread; other threads read sets by ID while the main thread waits for
+ * them, as the update encoders do.
+ *
+ * Whatever stores an ID beyond the current pass takes a reference. A set
+ * is interned without one and lives at least until the next sweep, so a
+ * caller can intern, look at and drop a set (as the benchmarks do)
+ * without releasing anything.
+ */
+
+// Key: AS path length, the AS path, then the communities
+static u32 *bgp_attr_set_encode(u32 *as_path, u32 *communities) {
+    u32 *key = 0;
+
+    vec_add1(key, vec_len(as_path));
+    vec_append(key, as_path);
+    vec_append(key, communities);
+    return key;
+}
+
+static int bgp_community_cmp(void *a1, void *a2) {
+    u32 *a = a1, *b = a2;
+
+    return *a < *b ? -1 : *a > *b;
+}
+
+void bgp_attr_sets_init(bgp_main_t *bmp) {
+    bmp->attr_set_by_key = hash_create_vec(0, sizeof(u32), sizeof(uword));
+    bgp_attr_set_intern(bmp, 0, 0); // Set 0: no AS path, no communities
+}
+
+void bgp_attr_sets_free(bgp_main_t *bmp) {
+    bgp_attr_set_t *set;
+
+    pool_foreach (set, bmp->attr_sets) {
+        vec_free(set->as_path);
+        vec_free(set->communities);
+        vec_free(set->key);
+    }
+    pool_free(bmp->attr_sets);
+    hash_free(bmp->attr_set_by_key);
+    vec_free(bmp->attr_sets_unused);
+}
+
+/* ID of the set with these attributes; the vecs are copied, communities need not be sorted */
+u32 bgp_attr_set_intern(bgp_main_t *bmp, u32 *as_path, u32 *communities) {
+    bgp_attr_set_t *set;
+    u32 *sorted = vec_dup(communities), *key;
+    uword *p;
+
+    vec_sort_with_function(sorted, bgp_community_cmp);
+    key = bgp_attr_set_encode(as_path, sorted);
+    if ((p = hash_get_mem(bmp->attr_set_by_key, key))) {
+        vec_free(sorted);
+        vec_free(key);
+        return p[0];
+    }
+
+    ASSERT(vlib_get_thread_index() == 0);
+    pool_get_zero(bmp->attr_sets, set);
+    set->as_path = vec_dup(as_path);
+    set->communities = sorted;
+    set->key = key;
+    set->hash = hash_memory(key, vec_bytes(key), 0);
+    hash_set_mem(bmp->attr_set_by_key, set->key, set - bmp->attr_sets);
+    vec_add1(bmp->attr_sets_unused, set - bmp->attr_sets); // Until someone locks it
+    return set - bmp->attr_sets;
+}
+
+/*
+ * Free the sets nothing references and drop them from the caches keyed by
+ * ID. Runs from the periodic process after the update groups: no encoder
+ * is reading sets, and the published snapshot matches the routes, which
+ * hold references to every set it names.
+ */
+void bgp_attr_sets_sweep(bgp_main_t *bmp) {
+    uword *freed = 0;
+    u32 *unused, *id;
+
+    // Forgetting a cached rewrite releases its result, which may free more
+    while (vec_len(bmp->attr_sets_unused)) {
+        unused = bmp->attr_sets_unused;
+        bmp->attr_sets_unused = 0;
+        vec_foreach (id, unused) {
+            bgp_attr_set_t *set;
+
+            if (*id == 0 || pool_is_free_index(bmp->attr_sets, *id)) {
+                continue;
+            }
+            set = bgp_attr_set_get(bmp, *id);
+            if (set->refcount) {
+                continue;
+            }
+            hash_unset_mem(bmp->attr_set_by_key, set->key);
+            vec_free(set->as_path);
+            vec_free(set->communities);
+            vec_free(set->key);
+            pool_put(bmp->attr_sets, set);
+            freed = clib_bitmap_set(freed, *id, 1);
+        }
+        vec_free(unused);
+        if (freed) {
+            bgp_route_maps_forget_attr_sets(bmp, freed);
+            bgp_as_path_regexes_forget_attr_sets(bmp, freed);
+        }
+    }
+    clib_bitmap_free(freed);
+}
+
+/* The set with count copies of as in front of its AS path */
+u32 bgp_attr_set_prepend(bgp_main_t *bmp, u32 attr_set, u32 as, u32 count) {
+    bgp_attr_set_t *set = bgp_attr_set_get(bmp, attr_set);
+    u32 *as_path = 0, *communities = vec_dup(set->communities), result, i;
+
+    for (i = 0; i < count; i++) {
+        vec_add1(as_path, as);
+    }
+    vec_append(as_path, set->as_path);
+    result = bgp_attr_set_intern(bmp, as_path, communities); // May move set
+    vec_free(as_path);
+    vec_free(communities);
+    return result;
+}
+
+/* The set with its communities taken from communities_set */
+u32 bgp_attr_set_replace_communities(bgp_main_t *bmp, u32 attr_set, u32 communities_set) {
+    u32 *as_path = vec_dup(bgp_attr_set_get(bmp, attr_set)->as_path);
+    u32 *communities = vec_dup(bgp_attr_set_get(bmp, communities_set)->communities);
+    u32 result = bgp_attr_set_intern(bmp, as_path, communities);
+
+    vec_free(as_path);
+    vec_free(communities);
+    return result;
+}
+
+bool bgp_attr_set_has_as(bgp_attr_set_t *set, u32 as) {
+    u32 *p;
+
+    vec_foreach (p, set->as_path) {
+        if (*p == as) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool bgp_attr_set_has_community(bgp_attr_set_t *set, u32 community) {
+    u32 lo = 0, hi = vec_len(set->communities);
+
+    while (lo < hi) {
+        u32 mid = (lo + hi) / 2;
+        if (set->communities[mid] == community) {
+            return true;
+        }
+        if (set->communities[mid] < community) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return false;
+}
+
+u8 *format_bgp_attr_set(u8 *s, va_list *args) {
+    bgp_attr_set_t *set = va_arg(*args, bgp_attr_set_t *);
+    u32 *p;
+
+    s = format(s, "as-path [");
+    vec_foreach (p, set->as_path) {
+        s = format(s, "%s%u", p == set->as_path ? "" : " ", *p);
+    }
+    s = format(s, "] communities [");
+    vec_foreach (p, set->communities) {
+        s = format(s, "%s%u:%u", p == set->communities ? "" : " ", *p >> 16, *p & 0xffff);
+    }
+    return format(s, "]");
+}
+
+/* <as>:<value> into the 32-bit community value */
+uword unformat_bgp_community(unformat_input_t *input, va_list *args) {
+    u32 *community = va_arg(*args, u32 *);
+    u32 as, value;
+
+    if (!unformat(input, "%u:%u", &as, &value) || as > 0xffff || value > 0xffff) {
+        return 0;
+    }
+    *community = (as << 16) | value;
+    return 1;
+}
@@ -0,0 +1,143 @@
+/*
+ * bgp_bench.c - shared benchmark harness and the BGP self-test command
+ *
+ * Copyright (c) <current-year> <your-organization>
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vlib/vlib.h>
+#include <bgp/bgp.h>
+#include <pthread.h>
+
+/*
+ * The plugin has no unit test target, so its checks and measurements are
+ * 'test bgp' CLI commands run inside a live VPP. Benchmarks sit next to
+ * the code they measure and use the helpers here for threads, timing and
+ * output; 'test bgp self-test' runs every module's correctness checks
+ * against private state, leaving the running configuration alone.
+ */
+
+void bgp_bench_init(bgp_bench_t *bench, vlib_main_t *vm) {
+    clib_memset(bench, 0, sizeof(*bench));
+    bench->vm = vm;
+}
+
+/* Start helpers on n consecutive argument blocks, stopping at the first failure; returns how many run */
+u32 bgp_bench_spawn(bgp_bench_t *bench, void *(*fn)(void *), void *args, uword arg_size, u32 n) {
+    pthread_t thread;
+    u32 i;
+
+    for (i = 0; i < n; i++) {
+        if (pthread_create(&thread, 0, fn, (u8 *)args + i * arg_size)) {
+            break;
+        }
+        vec_add1(bench->threads, thread);
+    }
+    return i;
+}
+
+/* Start timing a phase and open the gate for helpers waiting in bgp_bench_wait() */
+void bgp_bench_start(bgp_bench_t *bench) {
+    bench->start = vlib_time_now(bench->vm);
+    clib_atomic_store_rel_n(&bench->go, 1);
+}
+
+/* Seconds since bgp_bench_start() */
+f64 bgp_bench_stop(bgp_bench_t *bench) {
+    return vlib_time_now(bench->vm) - bench->start;
+}
+
+/* Wait for the helpers and close the gate for the next round */
+void bgp_bench_join(bgp_bench_t *bench) {
+    pthread_t *thread;
+
+    vec_foreach (thread, bench->threads) {
+        pthread_join(*thread, 0);
+    }
+    vec_reset_length(bench->threads);
+    bench->go = 0;
+}
+
+/* One result line: n units in so many seconds and the rate, then whatever fmt adds */
+void bgp_bench_report(bgp_bench_t *bench, const char *label, u64 n, const char *unit, f64 seconds,
+                      char *fmt, ...) {
+    u8 *extra = 0;
+    va_list va;
+
+    if (fmt) {
+        va_start(va, fmt);
+        extra = va_format(0, fmt, &va);
+        va_end(va);
+    }
+    vlib_cli_output(bench->vm, "  %-18s %10llu %-8s %10.3f ms %10.3f M/s  %v", label, n, unit, seconds * 1e3,
+                    seconds > 0 ? n / seconds / 1e6 : 0.0, extra);
+    vec_free(extra);
+}
+
+void bgp_bench_free(bgp_bench_t *bench) {
+    vec_free(bench->threads);
+}
+
+/* Count one check, printing it if it failed */
+void bgp_check(bgp_check_t *check, bool ok, char *fmt, ...) {
+    u8 *s;
+    va_list va;
+
+    check->n_checks++;
+    if (ok) {
+        return;
+    }
+    check->n_failed++;
+    va_start(va, fmt);
+    s = va_format(0, fmt, &va);
+    va_end(va);
+    vlib_cli_output(check->vm, "  FAIL %s: %v", check->suite, s);
+    vec_free(s);
+}
+
+// === Self-test ===
+
+static clib_error_t *
+bgp_self_test_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    static const struct {
+        const char *name;
+        void (*fn)(bgp_check_t *check);
+    } suites[] = {
+        { "handoff-rings", bgp_handoff_self_test },
+        { "as-path-regex", bgp_as_path_self_test },
+        { "prefix-list", bgp_prefix_list_self_test },
+        { "route-map", bgp_route_map_self_test },
+        { "update-group", bgp_update_group_self_test },
+    };
+    bgp_check_t check = { .vm = vm };
+    u32 i, n_checks, n_failed;
+
+    for (i = 0; i < ARRAY_LEN(suites); i++) {
+        n_checks = check.n_checks;
+        n_failed = check.n_failed;
+        check.suite = suites[i].name;
+        suites[i].fn(&check);
+        vlib_cli_output(vm, "%-16s %4u checks  %s", suites[i].name, check.n_checks - n_checks,
+                        check.n_failed > n_failed ? "FAILED" : "ok");
+    }
+    if (check.n_failed) {
+        return clib_error_return(0, "%u of %u checks failed", check.n_failed, check.n_checks);
+    }
+    return 0;
+}
+
+VLIB_CLI_COMMAND(bgp_self_test_command, static) = {
+    .path = "test bgp self-test",
+    .short_help = "test bgp self-test",
+    .function = bgp_self_test_command_fn,
+};
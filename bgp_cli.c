@@ -6,21 +6,68 @@
 
 
 
-void bgp_show_summary(vlib_main_t *vm, bgp_main_t *bmp) {
+static void bgp_show_neighbor_summary(vlib_main_t *vm, bgp_neighbor_t *neighbor, f64 now, f64 ms_per_clock) {
+    int class;
+
+    vlib_cli_output(vm, "  Neighbor: %U, Remote AS: %u, State: %s, Hold Timer: %u, Keepalive Timer: %u",
+                    format_ip4_address, &neighbor->neighbor_ip,
+                    neighbor->remote_as,
+                    bgp_state_to_string(neighbor->state),
+                    bgp_timer_remaining(neighbor, BGP_TIMER_HOLD, now),
+                    bgp_timer_remaining(neighbor, BGP_TIMER_KEEPALIVE, now));
+    vlib_cli_output(vm, "    Received %lu UPDATEs", neighbor->updates_received);
+    vlib_cli_output(vm, "    OutQ: wire %d, control %d, bulk %d messages (%u/%u bytes)%s",
+                    neighbor->output_queue.count,
+                    neighbor->control_queue.count,
+                    neighbor->bulk_queue.count,
+                    neighbor->bulk_queue.bytes,
+                    neighbor->bulk_queue.byte_limit,
+                    neighbor->rib_out_paused ? " (updates paused)" : "");
+    for (class = 0; class < BGP_OUTPUT_N_CLASSES; class++) {
+        bgp_output_stats_t *stats = &neighbor->output_stats[class];
+        vlib_cli_output(vm, "    %-8s sent %lu, max depth %u, latency avg %.3f ms max %.3f ms",
+                        class == BGP_OUTPUT_CONTROL ? "control" : "bulk",
+                        stats->messages, stats->max_depth,
+                        stats->messages ? stats->latency_clocks * ms_per_clock / stats->messages : 0.0,
+                        stats->latency_max * ms_per_clock);
+    }
+}
+
+/* Summary of all neighbors, or with state < BGP_N_STATES only those in that state */
+void bgp_show_summary(vlib_main_t *vm, bgp_main_t *bmp, u32 state) {
+    f64 ms_per_clock = 1e3 / vm->clib_time.clocks_per_second;
+    f64 now = vlib_time_now(vm);
     bgp_neighbor_t *neighbor;
+    bgp_shard_t *shard;
+    u32 n_in_state[BGP_N_STATES] = { 0 };
+    u32 s, thread_index;
 
     vlib_cli_output(vm, "BGP Summary:");
     vlib_cli_output(vm, "  Router ID: %U", format_ip4_address, &bmp->bgp_router_id);
     vlib_cli_output(vm, "  Local AS Number: %u", bmp->bgp_as_number);
 
+    vec_foreach (shard, bmp->shards) {
+        for (s = 0; s < BGP_N_STATES; s++) {
+            n_in_state[s] += shard->n_in_state[s];
+        }
+    }
+    vlib_cli_output(vm, "  Sessions: %u established, %u idle, %u connecting, %u in OPEN exchange",
+                    n_in_state[BGP_STATE_ESTABLISHED], n_in_state[BGP_STATE_IDLE],
+                    n_in_state[BGP_STATE_CONNECT] + n_in_state[BGP_STATE_ACTIVE],
+                    n_in_state[BGP_STATE_OPEN_SENT] + n_in_state[BGP_STATE_OPEN_CONFIRM]);
+
     vlib_cli_output(vm, "Neighbors:");
+    if (state < BGP_N_STATES) {
+        // The per-state lists skip everyone else; CLI runs under the barrier
+        vec_foreach_index (thread_index, bmp->shards) {
+            bgp_foreach_neighbor_in_state(bmp, thread_index, state, neighbor) {
+                bgp_show_neighbor_summary(vm, neighbor, now, ms_per_clock);
+            }
+        }
+        return;
+    }
     pool_foreach (neighbor, bmp->neighbors) {
-        vlib_cli_output(vm, "  Neighbor: %U, Remote AS: %u, State: %s, Hold Timer: %u, Keepalive Timer: %u",
-                        format_ip4_address, &neighbor->neighbor_ip,
-                        neighbor->remote_as,
-                        bgp_state_to_string(neighbor->state),
-                        neighbor->hold_timer,
-                        neighbor->keepalive_timer);
+        bgp_show_neighbor_summary(vm, neighbor, now, ms_per_clock);
     }
 }
 
@@ -34,6 +81,9 @@ void bgp_show_config(vlib_main_t *vm, bgp_main_t *bmp) {
     vlib_cli_output(vm, "  Hold Time: %u", bmp->hold_time);
     vlib_cli_output(vm, "  Keepalive Time: %u", bmp->keepalive_time);
     vlib_cli_output(vm, "  Cluster ID: %u", bmp->cluster_id);
+    vlib_cli_output(vm, "  Enabled interfaces: %U", format_bitmap_list, bmp->bgp_enabled_interfaces);
+    vlib_cli_output(vm, "  Fast external fallover: %s (%llu sessions dropped)",
+                    bmp->fast_external_fallover ? "enabled" : "disabled", bmp->n_fast_fallovers);
 
     vlib_cli_output(vm, "\nNeighbors:");
     pool_foreach(neighbor, bmp->neighbors) {
@@ -43,20 +93,23 @@ void bgp_show_config(vlib_main_t *vm, bgp_main_t *bmp) {
                         bgp_state_to_string(neighbor->state),
                         neighbor->is_route_reflector_client ? "Yes" : "No",
                         neighbor->route_filter_name[0] ? neighbor->route_filter_name : "None");
+        vlib_cli_output(vm, "    Route-map in: %s, out: %s",
+                        neighbor->route_map_in != ~0 ? bmp->route_maps[neighbor->route_map_in].name : "None",
+                        neighbor->route_map_out != ~0 ? bmp->route_maps[neighbor->route_map_out].name : "None");
     }
 
     vlib_cli_output(vm, "\nPrefix Lists:");
-    bgp_prefix_list_t **list; // Pointer to a pointer for vec_foreach compatibility
-    vec_foreach(list, bmp->prefix_lists) {  // Iterate over pointers to prefix lists
-        bgp_prefix_list_t *prefix_list = *list; // Dereference to get the actual prefix list
+    bgp_prefix_list_t *prefix_list;
+    pool_foreach(prefix_list, bmp->prefix_lists) {
         vlib_cli_output(vm, "  Prefix List: %s", prefix_list->name);
 
-        bgp_prefix_t **entry;
-        vec_foreach(entry, prefix_list->entries) {  // Iterate over entries in the prefix list
-            vlib_cli_output(vm, "    %s %U/%d",
-                            (*entry)->permit ? "permit" : "deny",
-                            format_ip4_address, &(*entry)->prefix, (*entry)->mask_length);
+        bgp_prefix_t *entries = bgp_prefix_list_entries(prefix_list), *entry;
+        vec_foreach(entry, entries) {  // In seq order
+            vlib_cli_output(vm, "    seq %u %s %U/%d ge %u le %u", entry->seq,
+                            entry->permit ? "permit" : "deny",
+                            format_ip4_address, &entry->prefix, entry->mask_length, entry->ge, entry->le);
         }
+        vec_free(entries);
     }
 
     vlib_cli_output(vm, "\nAdvertised Networks:");
@@ -135,24 +188,171 @@ VLIB_CLI_COMMAND(bgp_set_as_command, static) = {
 /* Command: Add Neighbor */
 static clib_error_t *
 bgp_add_neighbor_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    bgp_main_t *bmp = &bgp_main;
+    bgp_peer_group_t *group = 0;
+    bgp_neighbor_t *neighbor;
     ip4_address_t neighbor_ip;
-    u32 remote_as;
+    u32 remote_as = 0, map = ~0;
+    u8 *group_name = 0, *map_name = 0;
+    int map_dir = -1;
+
+    if (!unformat(input, "%U", unformat_ip4_address, &neighbor_ip)) {
+        return clib_error_return(0, "Usage: set bgp neighbor <IPv4> [remote-as <AS-number>] [peer-group <name>] "
+                                    "[route-map <name> <in|out>|no-route-map <in|out>]");
+    }
+    while (unformat_check_input(input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat(input, "remote-as %u", &remote_as))
+            ;
+        else if (unformat(input, "peer-group %s", &group_name))
+            ;
+        else if (unformat(input, "no-route-map in"))
+            map_dir = 1;
+        else if (unformat(input, "no-route-map out"))
+            map_dir = 0;
+        else if (unformat(input, "route-map %s", &map_name) &&
+                 (map_dir = unformat(input, "in") ? 1 : unformat(input, "out") ? 0 : -1) >= 0)
+            ;
+        else {
+            vec_free(group_name);
+            vec_free(map_name);
+            return clib_error_return(0, "Unknown input '%U'", format_unformat_error, input);
+        }
+    }
+    if (map_name) {
+        vec_add1(map_name, 0);
+        if (vec_len(map_name) > sizeof(((bgp_route_map_t *)0)->name)) {
+            vec_free(group_name);
+            vec_free(map_name);
+            return clib_error_return(0, "Route-map names are limited to %u characters",
+                                     sizeof(((bgp_route_map_t *)0)->name) - 1);
+        }
+        map = bgp_route_map_intern(bmp, (char *)map_name);
+        vec_free(map_name);
+    }
 
-    if (!unformat(input, "%U remote-as %d", unformat_ip4_address, &neighbor_ip, &remote_as)) {
-        return clib_error_return(0, "Usage: set bgp neighbor <IPv4> remote-as <AS-number>");
+    if (group_name) {
+        vec_add1(group_name, 0);
+        group = bgp_find_peer_group(bmp, (char *)group_name);
+        vec_free(group_name);
+        if (!group) {
+            return clib_error_return(0, "Unknown peer group");
+        }
+        if (group->remote_as && remote_as && remote_as != group->remote_as) {
+            return clib_error_return(0, "Peer group %s sets remote-as %u", group->name, group->remote_as);
+        }
+        if (!remote_as) {
+            remote_as = group->remote_as;
+        }
     }
 
-    bgp_add_neighbor(&bgp_main, neighbor_ip, remote_as);
+    // A configured neighbor can still be moved into a peer group or given route-maps
+    neighbor = bgp_find_neighbor(bmp, neighbor_ip);
+    if (neighbor) {
+        if (!group && map_dir < 0) {
+            return clib_error_return(0, "Neighbor %U already exists", format_ip4_address, &neighbor_ip);
+        }
+        if (group) {
+            bgp_peer_group_join(bmp, neighbor, group - bmp->peer_groups);
+        }
+        if (map_dir >= 0) {
+            bgp_neighbor_set_route_map(bmp, neighbor, map, map_dir);
+        }
+        return 0;
+    }
+    if (!remote_as) {
+        return clib_error_return(0, "remote-as is required unless the peer group sets it");
+    }
+
+    bgp_add_neighbor(bmp, neighbor_ip, remote_as, group ? group - bmp->peer_groups : ~0);
+    if (map_dir >= 0 && (neighbor = bgp_find_neighbor(bmp, neighbor_ip))) {
+        bgp_neighbor_set_route_map(bmp, neighbor, map, map_dir);
+    }
     clib_warning("Added BGP neighbor %U with remote AS %u", format_ip4_address, &neighbor_ip, remote_as);
     return 0;
 }
 
 VLIB_CLI_COMMAND(bgp_add_neighbor_command, static) = {
     .path = "set bgp neighbor",
-    .short_help = "set bgp neighbor <IPv4> remote-as <AS-number>",
+    .short_help = "set bgp neighbor <IPv4> [remote-as <AS-number>] [peer-group <name>] "
+                  "[route-map <name> <in|out>|no-route-map <in|out>]",
     .function = bgp_add_neighbor_command_fn,
 };
 
+/* Command: Set Output Queue Limit */
+static clib_error_t *
+bgp_set_output_queue_limit_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    bgp_main_t *bmp = &bgp_main;
+    bgp_neighbor_t *neighbor;
+    u32 limit;
+
+    if (!unformat(input, "%u", &limit) || limit < BGP_MAX_MESSAGE_LEN) {
+        return clib_error_return(0, "Usage: set bgp output-queue-limit <bytes> (minimum %u)", BGP_MAX_MESSAGE_LEN);
+    }
+
+    // CLI handlers run under the worker barrier, so owner threads are parked
+    bmp->output_queue_byte_limit = limit;
+    pool_foreach (neighbor, bmp->neighbors) {
+        neighbor->bulk_queue.byte_limit = limit;
+    }
+
+    clib_warning("BGP output queue limit set to %u bytes", limit);
+    return 0;
+}
+
+VLIB_CLI_COMMAND(bgp_set_output_queue_limit_command, static) = {
+    .path = "set bgp output-queue-limit",
+    .short_help = "set bgp output-queue-limit <bytes>",
+    .function = bgp_set_output_queue_limit_command_fn,
+};
+
+/* Command: Set Transport */
+static clib_error_t *
+bgp_set_transport_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    static const char *transport_names[] = { "socket", "io-uring", "session" };
+    bgp_main_t *bmp = &bgp_main;
+    clib_error_t *error;
+    u8 *namespace_id = 0;
+    u64 secret = 0;
+
+    if (unformat(input, "socket")) {
+        bmp->transport = BGP_TRANSPORT_SOCKET;
+    } else if (bmp->sharding_enabled) {
+        return clib_error_return(0, "Sharded neighbors only support the socket transport");
+    } else if (unformat(input, "io-uring")) {
+        // Stay on sockets if the kernel or build lacks io_uring
+        if ((error = bgp_uring_init(bmp))) {
+            return error;
+        }
+        bmp->transport = BGP_TRANSPORT_IO_URING;
+    } else if (unformat(input, "session")) {
+        while (unformat_check_input(input) != UNFORMAT_END_OF_INPUT) {
+            if (unformat(input, "namespace %_%v%_", &namespace_id))
+                ;
+            else if (unformat(input, "secret %lu", &secret))
+                ;
+            else
+                break;
+        }
+        error = bgp_session_init(bmp, namespace_id, secret);
+        vec_free(namespace_id);
+        if (error) {
+            return error;
+        }
+        bmp->transport = BGP_TRANSPORT_SESSION;
+    } else {
+        return clib_error_return(0, "Usage: set bgp transport <socket|io-uring|session [namespace <id>] [secret <n>]>");
+    }
+
+    clib_warning("BGP transport for new sessions set to %s", transport_names[bmp->transport]);
+    return 0;
+}
+
+VLIB_CLI_COMMAND(bgp_set_transport_command, static) = {
+    .path = "set bgp transport",
+    .short_help = "set bgp transport <socket|io-uring|session [namespace <id>] [secret <n>]>",
+    .function = bgp_set_transport_command_fn,
+};
+
 /* Command: Enable Interface */
 static clib_error_t *
 bgp_enable_interface_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
@@ -173,6 +373,25 @@ VLIB_CLI_COMMAND(bgp_enable_interface_command, static) = {
     .function = bgp_enable_interface_command_fn,
 };
 
+/* Command: Fast External Fallover */
+static clib_error_t *
+bgp_set_fast_external_fallover_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    if (unformat(input, "enable")) {
+        bgp_main.fast_external_fallover = 1;
+    } else if (unformat(input, "disable")) {
+        bgp_main.fast_external_fallover = 0;
+    } else {
+        return clib_error_return(0, "Usage: set bgp fast-external-fallover <enable|disable>");
+    }
+    return 0;
+}
+
+VLIB_CLI_COMMAND(bgp_set_fast_external_fallover_command, static) = {
+    .path = "set bgp fast-external-fallover",
+    .short_help = "set bgp fast-external-fallover <enable|disable>",
+    .function = bgp_set_fast_external_fallover_command_fn,
+};
+
 /* Command: Advertise Network */
 static clib_error_t *
 bgp_advertise_network_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
@@ -212,13 +431,33 @@ VLIB_CLI_COMMAND(bgp_show_config_command, static) = {
 /* Command: Show Summary */
 static clib_error_t *
 bgp_show_summary_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
-    bgp_show_summary(vm, &bgp_main);
+    static const char *state_keywords[BGP_N_STATES] = {
+        "idle", "connect", "active", "opensent", "openconfirm", "established",
+    };
+    u32 state = ~0, s;
+
+    if (unformat_check_input(input) == UNFORMAT_END_OF_INPUT) {
+        bgp_show_summary(vm, &bgp_main, state);
+        return 0;
+    }
+    if (unformat(input, "state")) {
+        for (s = 0; s < BGP_N_STATES; s++) {
+            if (unformat(input, state_keywords[s])) {
+                state = s;
+                break;
+            }
+        }
+    }
+    if (state == ~0) {
+        return clib_error_return(0, "Usage: show bgp summary [state <idle|connect|active|opensent|openconfirm|established>]");
+    }
+    bgp_show_summary(vm, &bgp_main, state);
     return 0;
 }
 
 VLIB_CLI_COMMAND(bgp_show_summary_command, static) = {
     .path = "show bgp summary",
-    .short_help = "show bgp summary",
+    .short_help = "show bgp summary [state <idle|connect|active|opensent|openconfirm|established>]",
     .function = bgp_show_summary_command_fn,
 };
 
@@ -0,0 +1,549 @@
+/*
+ * bgp_decision.c - best-path selection, Loc-RIB and FIB download
+ *
+ * Copyright (c) <current-year> <your-organization>
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vlib/vlib.h>
+#include <vlib/threads.h>
+#include <vnet/fib/fib_table.h>
+#include <vnet/fib/fib_source.h>
+#include <bgp/bgp.h>
+
+/*
+ * Paths learned from peers are kept per destination (prefix). Any change
+ * marks the destination dirty; bgp_decision_run() sorts the dirty set by
+ * prefix, splits it into disjoint prefix ranges and evaluates the ranges in
+ * parallel. Each range only writes new_best of its own destinations, so no
+ * locking is needed. The main thread then merges the results into the
+ * Loc-RIB (bmp->routes) and the FIB download queue.
+ */
+
+#define BGP_DECISION_MIN_PARTITION 4096  // Smaller ranges are not worth a handoff
+#define BGP_FIB_DOWNLOAD_BATCH     1024  // FIB updates per barrier hold
+
+static bgp_dest_t *bgp_dest_get(bgp_loc_rib_t *rib, ip4_address_t prefix, u8 mask_length, int create) {
+    uword key = bgp_dest_key(prefix, mask_length);
+    uword *p = hash_get(rib->dest_by_prefix, key);
+    bgp_dest_t *dest;
+
+    if (p) {
+        return pool_elt_at_index(rib->dests, p[0]);
+    }
+    if (!create) {
+        return 0;
+    }
+    pool_get_zero(rib->dests, dest);
+    dest->prefix = prefix;
+    dest->mask_length = mask_length;
+    dest->best = ~0;
+    dest->route_index = ~0;
+    hash_set(rib->dest_by_prefix, key, dest - rib->dests);
+    return dest;
+}
+
+static_always_inline void bgp_dest_mark_dirty(bgp_loc_rib_t *rib, bgp_dest_t *dest) {
+    if (!dest->is_dirty) {
+        dest->is_dirty = 1;
+        vec_add1(rib->dirty, dest - rib->dests);
+    }
+}
+
+/* Add or replace the path a peer advertised for a prefix */
+void bgp_rib_path_update(bgp_loc_rib_t *rib, ip4_address_t prefix, u8 mask_length, bgp_path_t *path) {
+    bgp_dest_t *dest = bgp_dest_get(rib, prefix, mask_length, 1);
+    bgp_path_t *p;
+
+    bgp_attr_set_lock(&bgp_main, path->attr_set);
+    vec_foreach (p, dest->paths) {
+        if (p->neighbor_index == path->neighbor_index) {
+            bgp_attr_set_unlock(&bgp_main, p->attr_set);
+            *p = *path;
+            bgp_dest_mark_dirty(rib, dest);
+            return;
+        }
+    }
+    vec_add1(dest->paths, *path);
+    bgp_dest_mark_dirty(rib, dest);
+}
+
+static int bgp_dest_remove_path(bgp_dest_t *dest, u32 neighbor_index) {
+    u32 i;
+
+    for (i = 0; i < vec_len(dest->paths); i++) {
+        if (dest->paths[i].neighbor_index == neighbor_index) {
+            bgp_attr_set_unlock(&bgp_main, dest->paths[i].attr_set);
+            vec_delete(dest->paths, 1, i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Withdraw one peer's path for a prefix */
+void bgp_rib_path_withdraw(bgp_loc_rib_t *rib, ip4_address_t prefix, u8 mask_length, u32 neighbor_index) {
+    bgp_dest_t *dest = bgp_dest_get(rib, prefix, mask_length, 0);
+
+    if (dest && bgp_dest_remove_path(dest, neighbor_index)) {
+        bgp_dest_mark_dirty(rib, dest);
+    }
+}
+
+/* A peer went down: every path it advertised is gone */
+void bgp_rib_peer_down(bgp_loc_rib_t *rib, u32 neighbor_index) {
+    bgp_dest_t *dest;
+
+    pool_foreach (dest, rib->dests) {
+        if (bgp_dest_remove_path(dest, neighbor_index)) {
+            bgp_dest_mark_dirty(rib, dest);
+        }
+    }
+}
+
+/* RFC 4271 9.1.2.2 tie breaking, minus the steps that need attributes we do not keep; < 0 if a is better */
+static_always_inline int bgp_path_compare(bgp_path_t *a, bgp_path_t *b) {
+    if (a->local_pref != b->local_pref) {
+        return a->local_pref > b->local_pref ? -1 : 1;
+    }
+    if (a->as_path_length != b->as_path_length) {
+        return a->as_path_length < b->as_path_length ? -1 : 1;
+    }
+    if (a->origin != b->origin) {
+        return a->origin < b->origin ? -1 : 1;
+    }
+    if (a->med != b->med) {
+        return a->med < b->med ? -1 : 1;
+    }
+    if (a->is_ebgp != b->is_ebgp) {
+        return a->is_ebgp ? -1 : 1;
+    }
+    if (a->peer_router_id != b->peer_router_id) {
+        return a->peer_router_id < b->peer_router_id ? -1 : 1;
+    }
+    return clib_net_to_host_u32(a->peer_addr.as_u32) < clib_net_to_host_u32(b->peer_addr.as_u32) ? -1 : 1;
+}
+
+/* Select the best path for one prefix range; only writes new_best of its own destinations */
+void bgp_decision_eval_partition(bgp_decision_partition_t *part) {
+    u32 i, j;
+
+    for (i = 0; i < part->n_dests; i++) {
+        bgp_dest_t *dest = pool_elt_at_index(part->dests, part->indices[i]);
+        u32 best = ~0;
+
+        for (j = 0; j < vec_len(dest->paths); j++) {
+            if (best == ~0 || bgp_path_compare(&dest->paths[j], &dest->paths[best]) < 0) {
+                best = j;
+            }
+        }
+        dest->new_best = best;
+    }
+}
+
+typedef struct {
+    u64 key;
+    u32 index;
+} bgp_dest_sort_t;
+
+static int bgp_dest_sort_cmp(void *a1, void *a2) {
+    bgp_dest_sort_t *a = a1, *b = a2;
+    return a->key < b->key ? -1 : a->key > b->key;
+}
+
+// Order the dirty set by prefix so each partition covers one contiguous range
+static void bgp_decision_sort_dirty(bgp_loc_rib_t *rib) {
+    bgp_dest_sort_t *keys = 0;
+    u32 i;
+
+    vec_validate(keys, vec_len(rib->dirty) - 1);
+    for (i = 0; i < vec_len(rib->dirty); i++) {
+        bgp_dest_t *dest = pool_elt_at_index(rib->dests, rib->dirty[i]);
+        keys[i].key = bgp_dest_key(dest->prefix, dest->mask_length);
+        keys[i].index = rib->dirty[i];
+    }
+    vec_sort_with_function(keys, bgp_dest_sort_cmp);
+    for (i = 0; i < vec_len(keys); i++) {
+        rib->dirty[i] = keys[i].index;
+    }
+    vec_free(keys);
+}
+
+/* Sort the dirty set and cut it into at most n_parts contiguous prefix ranges */
+bgp_decision_partition_t *bgp_decision_partition(bgp_loc_rib_t *rib, u32 n_parts) {
+    bgp_decision_partition_t *parts = 0, *part;
+    u32 n_dirty = vec_len(rib->dirty);
+    u32 i, chunk;
+
+    n_parts = clib_max(1, clib_min(n_parts, n_dirty / BGP_DECISION_MIN_PARTITION));
+    if (n_parts > 1) {
+        bgp_decision_sort_dirty(rib);
+    }
+
+    chunk = (n_dirty + n_parts - 1) / n_parts;
+    for (i = 0; i < n_parts && i * chunk < n_dirty; i++) {
+        vec_add2(parts, part, 1);
+        part->dests = rib->dests;
+        part->indices = rib->dirty + i * chunk;
+        part->n_dests = clib_min(chunk, n_dirty - i * chunk);
+    }
+    return parts;
+}
+
+/* Fold partition results into the FIB queue; returns the number of forwarding changes */
+u32 bgp_decision_merge(bgp_loc_rib_t *rib, u32 **changed) {
+    u32 *index, n_changed = 0;
+
+    vec_foreach (index, rib->dirty) {
+        bgp_dest_t *dest = pool_elt_at_index(rib->dests, *index);
+        bgp_path_t *old = dest->best != ~0 ? &dest->best_path : 0;
+        bgp_path_t *new = dest->new_best != ~0 ? &dest->paths[dest->new_best] : 0;
+        bgp_fib_update_t *update;
+
+        dest->is_dirty = 0;
+        if (!old && !new) {
+            // Never reachable and now pathless; let the caller reclaim it
+            if (changed && vec_len(dest->paths) == 0) {
+                vec_add1(*changed, *index);
+            }
+            continue;
+        }
+        if (old && new && old->neighbor_index == new->neighbor_index &&
+            old->next_hop.as_u32 == new->next_hop.as_u32) {
+            // Same forwarding, but the attributes may differ: the FIB is untouched, the Loc-RIB is not
+            dest->best = dest->new_best;
+            dest->best_path = *new;
+            if (changed) {
+                vec_add1(*changed, *index);
+            }
+            continue;
+        }
+
+        vec_add2(rib->fib_queue, update, 1);
+        update->prefix = dest->prefix;
+        update->mask_length = dest->mask_length;
+        update->is_delete = new == 0;
+        update->next_hop = new ? new->next_hop : dest->best_path.next_hop;
+
+        dest->best = dest->new_best;
+        if (new) {
+            dest->best_path = *new;
+        }
+        if (changed) {
+            vec_add1(*changed, *index);
+        }
+        n_changed++;
+    }
+    vec_reset_length(rib->dirty);
+    return n_changed;
+}
+
+/* Mirror changed best paths into the Loc-RIB route pool and drop empty destinations */
+static void bgp_decision_update_loc_rib(bgp_main_t *bmp, u32 *changed) {
+    bgp_loc_rib_t *rib = &bmp->loc_rib;
+    u32 *index;
+
+    vec_foreach (index, changed) {
+        bgp_dest_t *dest = pool_elt_at_index(rib->dests, *index);
+        bgp_route_t *route;
+
+        if (dest->best == ~0) {
+            if (dest->route_index != ~0) {
+                bgp_attr_set_unlock(bmp, pool_elt_at_index(bmp->routes, dest->route_index)->attr_set);
+                pool_put_index(bmp->routes, dest->route_index);
+                bgp_rib_changed(bmp, bgp_dest_key(dest->prefix, dest->mask_length), ~0);
+            }
+            hash_unset(rib->dest_by_prefix, bgp_dest_key(dest->prefix, dest->mask_length));
+            vec_free(dest->paths);
+            pool_put(rib->dests, dest);
+            continue;
+        }
+
+        if (dest->route_index == ~0) {
+            pool_get_zero(bmp->routes, route);
+            dest->route_index = route - bmp->routes;
+        }
+        route = pool_elt_at_index(bmp->routes, dest->route_index);
+        route->prefix = dest->prefix;
+        route->mask_length = dest->mask_length;
+        route->next_hop = dest->best_path.next_hop;
+        route->local_pref = dest->best_path.local_pref;
+        route->as_path_length = dest->best_path.as_path_length;
+        route->origin = dest->best_path.origin;
+        route->med = dest->best_path.med;
+        bgp_attr_set_lock(bmp, dest->best_path.attr_set);
+        bgp_attr_set_unlock(bmp, route->attr_set);
+        route->attr_set = dest->best_path.attr_set;
+        route->source_neighbor = dest->best_path.neighbor_index;
+        route->source_is_ebgp = dest->best_path.is_ebgp;
+        route->source_is_rr_client = dest->best_path.is_rr_client;
+        bgp_rib_changed(bmp, bgp_dest_key(dest->prefix, dest->mask_length), dest->route_index);
+    }
+}
+
+/* Run best-path selection over every dirty destination */
+void bgp_decision_run(bgp_main_t *bmp) {
+    bgp_loc_rib_t *rib = &bmp->loc_rib;
+    bgp_decision_partition_t *parts, *part;
+    u32 n_threads = clib_min(bmp->decision_threads, vlib_num_workers() + 1);
+    u32 *changed = 0;
+    volatile u32 pending = 0;
+    f64 start;
+
+    if (vec_len(rib->dirty) == 0) {
+        return;
+    }
+    start = vlib_time_now(bmp->vlib_main);
+
+    parts = bgp_decision_partition(rib, n_threads);
+
+    // Partition 0 stays here; the rest go to workers 1..n over the handoff rings
+    vec_foreach (part, parts) {
+        u32 thread_index = part - parts;
+
+        part->pending = &pending;
+        if (thread_index == 0) {
+            continue;
+        }
+        clib_atomic_fetch_add(&pending, 1);
+        if (bgp_handoff_to_worker(bmp, thread_index, BGP_HANDOFF_DECISION, ~0, part) < 0) {
+            clib_atomic_fetch_sub(&pending, 1);
+            bgp_decision_eval_partition(part);
+        }
+    }
+    bgp_decision_eval_partition(&parts[0]);
+    while (clib_atomic_load_acq_n(&pending)) {
+        CLIB_PAUSE();
+    }
+
+    bmp->decision_last_changes = bgp_decision_merge(rib, &changed);
+    bgp_decision_update_loc_rib(bmp, changed);
+    bmp->decision_last_seconds = vlib_time_now(bmp->vlib_main) - start;
+    bmp->decision_last_partitions = vec_len(parts);
+
+    vec_free(changed);
+    vec_free(parts);
+}
+
+/*
+ * Program queued best-path changes into the FIB, a batch per barrier hold.
+ * A large failover takes many batches; while some remain the process is
+ * woken again at once instead of waiting out its clock.
+ */
+void bgp_fib_download(bgp_main_t *bmp) {
+    bgp_loc_rib_t *rib = &bmp->loc_rib;
+    u32 end = clib_min(vec_len(rib->fib_queue), rib->fib_queue_head + BGP_FIB_DOWNLOAD_BATCH);
+    u32 i;
+
+    if (rib->fib_queue_head == end) {
+        return;
+    }
+
+    vlib_worker_thread_barrier_sync(bmp->vlib_main);
+    for (i = rib->fib_queue_head; i < end; i++) {
+        bgp_fib_update_t *update = &rib->fib_queue[i];
+        fib_prefix_t pfx = {
+            .fp_proto = FIB_PROTOCOL_IP4,
+            .fp_len = update->mask_length,
+            .fp_addr.ip4 = update->prefix,
+        };
+        ip46_address_t nh = { .ip4 = update->next_hop };
+
+        if (update->is_delete) {
+            fib_table_entry_delete(0, &pfx, bmp->fib_source);
+        } else {
+            fib_table_entry_update_one_path(0, &pfx, bmp->fib_source, FIB_ENTRY_FLAG_NONE,
+                                            DPO_PROTO_IP4, &nh, ~0, 0, 1, NULL,
+                                            FIB_ROUTE_PATH_FLAG_NONE);
+        }
+    }
+    vlib_worker_thread_barrier_release(bmp->vlib_main);
+    rib->fib_queue_head = end;
+
+    if (end == vec_len(rib->fib_queue)) {
+        vec_reset_length(rib->fib_queue);
+        rib->fib_queue_head = 0;
+        return;
+    }
+    // Merges keep appending under churn; compact once the consumed half dominates
+    if (rib->fib_queue_head > vec_len(rib->fib_queue) / 2) {
+        vec_delete(rib->fib_queue, rib->fib_queue_head, 0);
+        rib->fib_queue_head = 0;
+    }
+    vlib_process_signal_event(bmp->vlib_main, bmp->periodic_node_index, BGP_EVENT_FIB_DOWNLOAD, 0);
+}
+
+static clib_error_t *bgp_decision_init(vlib_main_t *vm) {
+    bgp_main_t *bmp = &bgp_main;
+
+    bmp->loc_rib.dest_by_prefix = hash_create(0, sizeof(uword));
+    bmp->fib_source = fib_source_allocate("bgp", FIB_SOURCE_PRIORITY_HI, FIB_SOURCE_BH_API);
+    bmp->decision_threads = 1;
+    return 0;
+}
+
+VLIB_INIT_FUNCTION(bgp_decision_init) = {
+    .runs_after = VLIB_INITS("bgp_init"),
+};
+
+static clib_error_t *
+bgp_set_decision_threads_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    bgp_main_t *bmp = &bgp_main;
+    u32 n_threads;
+
+    if (!unformat(input, "%u", &n_threads) || n_threads == 0) {
+        return clib_error_return(0, "Usage: set bgp decision-threads <n>");
+    }
+    if (n_threads > vlib_num_workers() + 1) {
+        return clib_error_return(0, "Only %u threads (main + workers) available", vlib_num_workers() + 1);
+    }
+    bmp->decision_threads = n_threads;
+    bgp_shard_update_node_state(bmp);
+    return 0;
+}
+
+VLIB_CLI_COMMAND(bgp_set_decision_threads_command, static) = {
+    .path = "set bgp decision-threads",
+    .short_help = "set bgp decision-threads <n>",
+    .function = bgp_set_decision_threads_command_fn,
+};
+
+static clib_error_t *
+bgp_show_decision_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    bgp_main_t *bmp = &bgp_main;
+    bgp_loc_rib_t *rib = &bmp->loc_rib;
+
+    vlib_cli_output(vm, "Destinations: %u, dirty: %u, FIB queue: %u",
+                    pool_elts(rib->dests), vec_len(rib->dirty),
+                    vec_len(rib->fib_queue) - rib->fib_queue_head);
+    vlib_cli_output(vm, "Decision threads: %u, last run: %u changes in %u partitions, %.3f ms",
+                    bmp->decision_threads, bmp->decision_last_changes,
+                    bmp->decision_last_partitions, bmp->decision_last_seconds * 1e3);
+    return 0;
+}
+
+VLIB_CLI_COMMAND(bgp_show_decision_command, static) = {
+    .path = "show bgp decision",
+    .short_help = "show bgp decision",
+    .function = bgp_show_decision_command_fn,
+};
+
+// === Failover convergence benchmark ===
+
+static void *bgp_decision_bench_thread(void *arg) {
+    bgp_decision_eval_partition(arg);
+    return 0;
+}
+
+/*
+ * Two peers advertise every prefix; peer 0 wins on LOCAL_PREF. Peer 0 then
+ * fails, and the timer covers withdrawing its paths, re-selecting every
+ * prefix across the partitions, and merging into the FIB queue.
+ */
+static clib_error_t *
+bgp_decision_benchmark_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    u32 n_prefixes = 1000000, max_threads = 8, n_threads, n_started, i;
+    bgp_loc_rib_t rib = { 0 };
+    bgp_path_t primary = { .neighbor_index = 0, .local_pref = 200, .peer_router_id = 1 };
+    bgp_path_t backup = { .neighbor_index = 1, .local_pref = 100, .peer_router_id = 2 };
+    bgp_bench_t bench;
+    u8 *label = 0;
+
+    while (unformat_check_input(input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat(input, "prefixes %u", &n_prefixes))
+            ;
+        else if (unformat(input, "threads %u", &max_threads))
+            ;
+        else
+            return clib_error_return(0, "unknown input `%U'", format_unformat_error, input);
+    }
+    if (n_prefixes == 0 || max_threads == 0 || max_threads > 64) {
+        return clib_error_return(0, "prefixes must be non-zero, threads 1-64");
+    }
+
+    rib.dest_by_prefix = hash_create(n_prefixes, sizeof(uword));
+    primary.next_hop.as_u32 = clib_host_to_net_u32(0x0a000001);
+    backup.next_hop.as_u32 = clib_host_to_net_u32(0x0a000002);
+
+    bgp_bench_init(&bench, vm);
+    vlib_cli_output(vm, "%u prefixes, failover from peer 0 to peer 1", n_prefixes);
+
+    for (n_threads = 1; n_threads <= max_threads; n_threads *= 2) {
+        bgp_decision_partition_t *parts;
+        f64 t1, t2, t3;
+        u32 n_changes;
+
+        // Converge on the primary (untimed)
+        for (i = 0; i < n_prefixes; i++) {
+            ip4_address_t prefix = { .as_u32 = clib_host_to_net_u32(0x01000000 + (i << 8)) };
+            bgp_rib_path_update(&rib, prefix, 24, &primary);
+            bgp_rib_path_update(&rib, prefix, 24, &backup);
+        }
+        parts = bgp_decision_partition(&rib, 1);
+        bgp_decision_eval_partition(parts);
+        bgp_decision_merge(&rib, 0);
+        vec_free(parts);
+        vec_reset_length(rib.fib_queue);
+
+        bgp_bench_start(&bench);
+        bgp_rib_peer_down(&rib, 0);
+        t1 = bgp_bench_stop(&bench);
+
+        // Partition 0 and any a thread could not be started for run here
+        parts = bgp_decision_partition(&rib, n_threads);
+        n_started = bgp_bench_spawn(&bench, bgp_decision_bench_thread, parts + 1, sizeof(parts[0]),
+                                    vec_len(parts) - 1);
+        for (i = 1 + n_started; i < vec_len(parts); i++) {
+            bgp_decision_eval_partition(&parts[i]);
+        }
+        bgp_decision_eval_partition(&parts[0]);
+        bgp_bench_join(&bench);
+        t2 = bgp_bench_stop(&bench);
+
+        n_changes = bgp_decision_merge(&rib, 0);
+        t3 = bgp_bench_stop(&bench);
+
+        vec_reset_length(label);
+        label = format(label, "%u thread%s%c", vec_len(parts), vec_len(parts) == 1 ? "" : "s", 0);
+        bgp_bench_report(&bench, (char *)label, n_prefixes, "prefixes", t3,
+                         "withdraw %.1fms, select %.1fms, merge %.1fms, %u changes", t1 * 1e3, (t2 - t1) * 1e3,
+                         (t3 - t2) * 1e3, n_changes);
+        vec_free(parts);
+        vec_reset_length(rib.fib_queue);
+    }
+
+    {
+        bgp_dest_t *dest;
+        bgp_path_t *path;
+        pool_foreach (dest, rib.dests) {
+            // bgp_rib_path_update() took a reference in bgp_main for each stored path
+            vec_foreach (path, dest->paths) {
+                bgp_attr_set_unlock(&bgp_main, path->attr_set);
+            }
+            vec_free(dest->paths);
+        }
+    }
+    pool_free(rib.dests);
+    hash_free(rib.dest_by_prefix);
+    vec_free(rib.dirty);
+    vec_free(rib.fib_queue);
+    vec_free(label);
+    bgp_bench_free(&bench);
+    return 0;
+}
+
+VLIB_CLI_COMMAND(bgp_decision_benchmark_command, static) = {
+    .path = "test bgp decision-benchmark",
+    .short_help = "test bgp decision-benchmark [prefixes <n>] [threads <max>]",
+    .function = bgp_decision_benchmark_command_fn,
+};
@@ -0,0 +1,587 @@
+/*
+ * bgp_handoff.c - cross-thread message and route handoff
+ *
+ * Copyright (c) <current-year> <your-organization>
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vlib/vlib.h>
+#include <vlib/threads.h>
+#include <bgp/bgp.h>
+
+#define BGP_HANDOFF_RING_SIZE  4096
+#define BGP_HANDOFF_BURST      64
+
+/*
+ * Each thread owns one set of rings. to_main is written only by that
+ * worker; to_worker may be written by the main thread and by any other
+ * worker, so it is the MPSC flavour. Thread 0 (main) has no to_main ring.
+ */
+static clib_error_t *bgp_handoff_init(vlib_main_t *vm) {
+    bgp_main_t *bmp = &bgp_main;
+    u32 n_threads = vlib_get_n_threads();
+    bgp_handoff_rings_t *rings;
+
+    vec_validate_aligned(bmp->handoff, n_threads - 1, CLIB_CACHE_LINE_BYTES);
+    vec_foreach (rings, bmp->handoff) {
+        if (rings - bmp->handoff) {
+            bgp_spsc_ring_init(&rings->to_main, BGP_HANDOFF_RING_SIZE);
+            rings->main_idle = 1;
+        }
+        bgp_mpsc_ring_init(&rings->to_worker, BGP_HANDOFF_RING_SIZE);
+    }
+    return 0;
+}
+
+VLIB_MAIN_LOOP_ENTER_FUNCTION(bgp_handoff_init);
+
+static void bgp_route_changes_free(bgp_route_change_t *changes) {
+    bgp_route_change_t *change;
+
+    vec_foreach (change, changes) {
+        vec_free(change->as_path);
+        vec_free(change->communities);
+    }
+    vec_free(changes);
+}
+
+static void bgp_handoff_dispatch(bgp_main_t *bmp, bgp_handoff_elt_t *elt) {
+    bgp_neighbor_t *neighbor = 0;
+
+    if (!pool_is_free_index(bmp->neighbors, elt->neighbor_index)) {
+        neighbor = pool_elt_at_index(bmp->neighbors, elt->neighbor_index);
+    }
+
+    switch (elt->kind) {
+        case BGP_HANDOFF_RX_MESSAGE: {
+            bgp_message_t *message = elt->data;
+            if (neighbor) {
+                bgp_handle_received_message(bmp, neighbor, message->data, message->length);
+                if (neighbor->rx_flags) {
+                    bgp_fsm_post(bmp, neighbor, BGP_FSM_EVENT_MESSAGE);
+                }
+            }
+            bgp_message_free(message);
+            break;
+        }
+
+        case BGP_HANDOFF_ROUTE_BATCH: {
+            bgp_route_change_t *changes = elt->data, *change;
+            vec_foreach (change, changes) {
+                if (elt->neighbor_index == ~0) {
+                    // Local route forwarded by bgp_add_route()/bgp_remove_route()
+                    if (change->is_withdraw) {
+                        bgp_remove_route(bmp, change->prefix, change->mask_length);
+                    } else {
+                        bgp_add_route(bmp, change->prefix, change->mask_length, change->next_hop);
+                    }
+                } else if (change->is_withdraw) {
+                    bgp_rib_path_withdraw(&bmp->loc_rib, change->prefix, change->mask_length,
+                                          elt->neighbor_index);
+                } else if (neighbor) {
+                    // Only the main thread interns, so workers pass the attributes themselves
+                    bgp_path_t path = {
+                        .neighbor_index = elt->neighbor_index,
+                        .next_hop = change->next_hop,
+                        .peer_addr = neighbor->neighbor_ip,
+                        .peer_router_id = neighbor->remote_router_id,
+                        .local_pref = change->local_pref ? change->local_pref : 100,
+                        .as_path_length = change->as_path_length,
+                        .med = change->med,
+                        .origin = change->origin,
+                        .attr_set = bgp_attr_set_intern(bmp, change->as_path, change->communities),
+                        .is_ebgp = neighbor->remote_as != bmp->bgp_as_number,
+                        .is_rr_client = neighbor->is_route_reflector_client,
+                    };
+                    if (neighbor->route_map_in != ~0 &&
+                        !bgp_route_map_apply_path(bmp, neighbor->route_map_in, change->prefix,
+                                                  change->mask_length, &path)) {
+                        // Denied; drop what an earlier version of the map let in
+                        bgp_rib_path_withdraw(&bmp->loc_rib, change->prefix, change->mask_length,
+                                              elt->neighbor_index);
+                        continue;
+                    }
+                    // The Adj-RIB-In entry takes the reference; a denied set goes at the next sweep
+                    bgp_rib_path_update(&bmp->loc_rib, change->prefix, change->mask_length, &path);
+                }
+            }
+            bgp_route_changes_free(changes);
+            break;
+        }
+
+        case BGP_HANDOFF_PEER_DOWN:
+            bgp_rib_peer_down(&bmp->loc_rib, elt->neighbor_index);
+            bgp_update_group_resync(bmp, elt->neighbor_index);
+            break;
+
+        case BGP_HANDOFF_DECISION: {
+            bgp_decision_partition_t *part = elt->data;
+            bgp_decision_eval_partition(part);
+            clib_atomic_fetch_sub(part->pending, 1);
+            break;
+        }
+
+        case BGP_HANDOFF_ENCODE: {
+            bgp_update_task_t *task = elt->data;
+            bgp_update_group_encode(task);
+            clib_atomic_fetch_sub(task->pending, 1);
+            break;
+        }
+
+        case BGP_HANDOFF_UPDATE_BATCH:
+            if (neighbor) {
+                bgp_update_batch_apply(bmp, neighbor, elt->data);
+            } else {
+                bgp_update_batch_free(elt->data);
+            }
+            break;
+
+        case BGP_HANDOFF_RIB_OUT_REQUEST:
+            bgp_update_group_request_full(bmp, elt->neighbor_index);
+            break;
+
+        case BGP_HANDOFF_TX_MESSAGE:
+            // The thread draining this ring owns the neighbor's socket
+            if (neighbor && bgp_enqueue_message(neighbor, elt->data) == 0) {
+                bgp_socket_flush(neighbor);
+            } else {
+                bgp_message_free(elt->data);
+            }
+            break;
+
+        case BGP_HANDOFF_ACCEPT:
+            // Connection accepted on main; the collision logic runs on the owner
+            if (neighbor) {
+                bgp_handle_incoming_connection(bmp, neighbor, elt->data);
+            } else {
+                bgp_socket_close(elt->data);
+            }
+            break;
+
+        case BGP_HANDOFF_SESSION_EVENT:
+            bgp_session_handoff_dispatch(bmp, elt->kind, elt->neighbor_index, elt->data);
+            break;
+
+        default:
+            clib_warning("Unknown handoff kind %u", elt->kind);
+            break;
+    }
+}
+
+/* Free what an element carries without acting on it */
+static void bgp_handoff_release(bgp_handoff_elt_t *elt) {
+    switch (elt->kind) {
+        case BGP_HANDOFF_RX_MESSAGE:
+        case BGP_HANDOFF_TX_MESSAGE:
+            bgp_message_free(elt->data);
+            break;
+        case BGP_HANDOFF_ROUTE_BATCH:
+            bgp_route_changes_free(elt->data);
+            break;
+        case BGP_HANDOFF_UPDATE_BATCH:
+            bgp_update_batch_free(elt->data);
+            break;
+        case BGP_HANDOFF_ACCEPT:
+            bgp_socket_close(elt->data);
+            break;
+        case BGP_HANDOFF_SESSION_EVENT:
+            bgp_session_handoff_release(elt->kind, elt->data);
+            break;
+        default:
+            break;
+    }
+}
+
+static void bgp_handoff_account(bgp_handoff_rings_t *rings, bgp_handoff_elt_t *elts, u32 n) {
+    u64 now = clib_cpu_time_now();
+    u32 i;
+
+    rings->dequeued += n;
+    for (i = 0; i < n; i++) {
+        rings->latency_clocks += now - elts[i].timestamp;
+    }
+}
+
+/* Worker side: hand a message or route batch to the main thread */
+int bgp_handoff_to_main(bgp_main_t *bmp, u32 kind, u32 neighbor_index, void *data) {
+    u32 thread_index = vlib_get_thread_index();
+    bgp_handoff_elt_t elt = {
+        .kind = kind,
+        .neighbor_index = neighbor_index,
+        .data = data,
+        .timestamp = clib_cpu_time_now(),
+    };
+    bgp_handoff_rings_t *rings;
+
+    // Already on the RIB thread: no ring needed
+    if (thread_index == 0) {
+        bgp_handoff_dispatch(bmp, &elt);
+        return 0;
+    }
+
+    rings = vec_elt_at_index(bmp->handoff, thread_index);
+    if (bgp_spsc_ring_enqueue(&rings->to_main, &elt) < 0) {
+        rings->drops++;
+        return -1; // Caller keeps ownership of data
+    }
+
+    /*
+     * Wake the main thread only if it said it would sleep. The enqueue is
+     * ordered before the flag read, and the main thread re-checks the ring
+     * after raising the flag, so one side always sees the other.
+     */
+    CLIB_MEMORY_BARRIER();
+    if (rings->main_idle && clib_atomic_swap_acq_n(&rings->main_idle, 0) && bmp->periodic_node_index) {
+        vlib_process_signal_event_mt(vlib_get_main(), bmp->periodic_node_index,
+                                     BGP_EVENT_HANDOFF, thread_index);
+    }
+    return 0;
+}
+
+/* Any thread: hand work to the thread that owns a neighbor */
+int bgp_handoff_to_worker(bgp_main_t *bmp, u32 thread_index, u32 kind, u32 neighbor_index, void *data) {
+    bgp_handoff_elt_t elt = {
+        .kind = kind,
+        .neighbor_index = neighbor_index,
+        .data = data,
+        .timestamp = clib_cpu_time_now(),
+    };
+    bgp_handoff_rings_t *rings = vec_elt_at_index(bmp->handoff, thread_index);
+
+    if (bgp_mpsc_ring_enqueue(&rings->to_worker, &elt) < 0) {
+        clib_atomic_fetch_add_relax(&rings->drops, 1);
+        return -1;
+    }
+    return 0;
+}
+
+/* Main thread: drain every worker's to_main ring */
+u32 bgp_handoff_drain_main(bgp_main_t *bmp) {
+    bgp_handoff_elt_t elts[BGP_HANDOFF_BURST];
+    bgp_handoff_rings_t *rings;
+    u32 n, i, total = 0;
+
+    vec_foreach (rings, bmp->handoff) {
+        if (rings == bmp->handoff) {
+            continue;
+        }
+        while (1) {
+            while ((n = bgp_spsc_ring_dequeue_burst(&rings->to_main, elts, BGP_HANDOFF_BURST))) {
+                bgp_handoff_account(rings, elts, n);
+                for (i = 0; i < n; i++) {
+                    bgp_handoff_dispatch(bmp, &elts[i]);
+                }
+                total += n;
+            }
+            // Announce the sleep, then look once more for an enqueue that missed it
+            clib_atomic_store_rel_n(&rings->main_idle, 1);
+            CLIB_MEMORY_BARRIER();
+            if (bgp_spsc_ring_count(&rings->to_main) == 0) {
+                break;
+            }
+            clib_atomic_store_rel_n(&rings->main_idle, 0);
+        }
+    }
+    return total;
+}
+
+/*
+ * Main thread, under the barrier, before a neighbor's pool slot is freed:
+ * apply everything its owner already sent towards the RIB, and drop what
+ * is still queued for the owner, so nothing reaches a neighbor that reuses
+ * the index.
+ */
+void bgp_handoff_purge_neighbor(bgp_main_t *bmp, u32 neighbor_index) {
+    bgp_neighbor_t *neighbor = pool_elt_at_index(bmp->neighbors, neighbor_index);
+    bgp_handoff_rings_t *rings = vec_elt_at_index(bmp->handoff, neighbor->owner_thread);
+    bgp_handoff_elt_t elts[BGP_HANDOFF_BURST], *keep = 0, *elt;
+    u32 n, i;
+
+    ASSERT(vlib_worker_thread_barrier_held());
+
+    bgp_handoff_drain_main(bmp);
+
+    // The owner is parked, so the main thread may stand in as the ring's consumer
+    while ((n = bgp_mpsc_ring_dequeue_burst(&rings->to_worker, elts, BGP_HANDOFF_BURST))) {
+        for (i = 0; i < n; i++) {
+            if (elts[i].neighbor_index == neighbor_index) {
+                bgp_handoff_release(&elts[i]);
+            } else {
+                vec_add1(keep, elts[i]);
+            }
+        }
+    }
+    vec_foreach (elt, keep) {
+        bgp_mpsc_ring_enqueue(&rings->to_worker, elt);
+    }
+    vec_free(keep);
+}
+
+/* Owning thread: drain work handed to it */
+u32 bgp_handoff_drain_worker(bgp_main_t *bmp, u32 thread_index) {
+    bgp_handoff_elt_t elts[BGP_HANDOFF_BURST];
+    bgp_handoff_rings_t *rings = vec_elt_at_index(bmp->handoff, thread_index);
+    u32 n, i, total = 0;
+
+    while ((n = bgp_mpsc_ring_dequeue_burst(&rings->to_worker, elts, BGP_HANDOFF_BURST))) {
+        for (i = 0; i < n; i++) {
+            bgp_handoff_dispatch(bmp, &elts[i]);
+        }
+        total += n;
+    }
+    return total;
+}
+
+static clib_error_t *
+bgp_show_handoff_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    bgp_main_t *bmp = &bgp_main;
+    f64 ns_per_clock = 1e9 / vm->clib_time.clocks_per_second;
+    bgp_handoff_rings_t *rings;
+
+    vlib_cli_output(vm, "%-8s %12s %12s %10s %12s", "Thread", "Pending", "Dequeued", "Drops", "Avg latency");
+    vec_foreach (rings, bmp->handoff) {
+        u32 thread_index = rings - bmp->handoff;
+        u32 pending = thread_index ? bgp_spsc_ring_count(&rings->to_main) : 0;
+        vlib_cli_output(vm, "%-8u %12u %12lu %10lu %9.0f ns",
+                        thread_index, pending, rings->dequeued, rings->drops,
+                        rings->dequeued ? rings->latency_clocks * ns_per_clock / rings->dequeued : 0.0);
+    }
+    return 0;
+}
+
+VLIB_CLI_COMMAND(bgp_show_handoff_command, static) = {
+    .path = "show bgp handoff",
+    .short_help = "show bgp handoff",
+    .function = bgp_show_handoff_command_fn,
+};
+
+// === Handoff microbenchmark ===
+
+typedef struct {
+    bgp_spsc_ring_t *spsc;
+    bgp_mpsc_ring_t *mpsc;
+    u64 count;
+    volatile u32 *go;
+} bgp_handoff_bench_producer_t;
+
+static void *bgp_handoff_bench_producer(void *arg) {
+    bgp_handoff_bench_producer_t *p = arg;
+    bgp_handoff_elt_t elt = { .kind = BGP_HANDOFF_RX_MESSAGE };
+    u64 i;
+
+    bgp_bench_wait(p->go);
+    for (i = 0; i < p->count; i++) {
+        elt.neighbor_index = i;
+        elt.timestamp = clib_cpu_time_now();
+        if (p->spsc) {
+            while (bgp_spsc_ring_enqueue(p->spsc, &elt) < 0) {
+                CLIB_PAUSE();
+            }
+        } else {
+            while (bgp_mpsc_ring_enqueue(p->mpsc, &elt) < 0) {
+                CLIB_PAUSE();
+            }
+        }
+    }
+    return 0;
+}
+
+static clib_error_t *
+bgp_handoff_benchmark_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    u32 n_producers = 1, ring_size = BGP_HANDOFF_RING_SIZE, burst = BGP_HANDOFF_BURST;
+    u64 count = 10000000, received = 0, latency_sum = 0, latency_max = 0;
+    u64 histogram[64] = { 0 };
+    bgp_handoff_bench_producer_t *producers = 0;
+    bgp_handoff_elt_t *elts = 0;
+    bgp_spsc_ring_t spsc;
+    bgp_mpsc_ring_t mpsc;
+    bgp_bench_t bench;
+    f64 ns_per_clock = 1e9 / vm->clib_time.clocks_per_second;
+    f64 seconds;
+    u64 p50 = 0, p99 = 0, seen = 0;
+    u8 use_spsc;
+    u32 i, n;
+
+    while (unformat_check_input(input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat(input, "count %lu", &count))
+            ;
+        else if (unformat(input, "ring-size %u", &ring_size))
+            ;
+        else if (unformat(input, "producers %u", &n_producers))
+            ;
+        else if (unformat(input, "burst %u", &burst))
+            ;
+        else
+            return clib_error_return(0, "unknown input `%U'", format_unformat_error, input);
+    }
+    if (n_producers == 0 || n_producers > 64 || burst == 0 || ring_size < 2) {
+        return clib_error_return(0, "producers must be 1-64, burst and ring-size non-zero");
+    }
+
+    // One producer exercises the SPSC ring, several the MPSC ring
+    use_spsc = n_producers == 1;
+    if (use_spsc) {
+        bgp_spsc_ring_init(&spsc, ring_size);
+    } else {
+        bgp_mpsc_ring_init(&mpsc, ring_size);
+    }
+    bgp_bench_init(&bench, vm);
+    vec_validate(producers, n_producers - 1);
+    vec_validate(elts, burst - 1);
+
+    for (i = 0; i < n_producers; i++) {
+        producers[i].spsc = use_spsc ? &spsc : 0;
+        producers[i].mpsc = use_spsc ? 0 : &mpsc;
+        producers[i].count = count / n_producers + (i < count % n_producers);
+        producers[i].go = &bench.go;
+    }
+    n = bgp_bench_spawn(&bench, bgp_handoff_bench_producer, producers, sizeof(producers[0]), n_producers);
+    if (n < n_producers) {
+        for (count = 0, i = 0; i < n; i++) {
+            count += producers[i].count;
+        }
+        n_producers = n;
+    }
+
+    bgp_bench_start(&bench);
+
+    while (received < count) {
+        u64 now;
+        n = use_spsc ? bgp_spsc_ring_dequeue_burst(&spsc, elts, burst)
+                             : bgp_mpsc_ring_dequeue_burst(&mpsc, elts, burst);
+        if (n == 0) {
+            CLIB_PAUSE();
+            continue;
+        }
+        now = clib_cpu_time_now();
+        for (i = 0; i < n; i++) {
+            u64 latency = now - elts[i].timestamp;
+            latency_sum += latency;
+            latency_max = clib_max(latency_max, latency);
+            histogram[latency ? max_log2(latency) : 0]++;
+        }
+        received += n;
+    }
+    seconds = bgp_bench_stop(&bench);
+    bgp_bench_join(&bench);
+
+    // Log2 buckets: report the upper bound of the bucket holding the percentile
+    for (i = 0; i < ARRAY_LEN(histogram) && received; i++) {
+        seen += histogram[i];
+        if (!p50 && seen * 2 >= received) {
+            p50 = 1ULL << i;
+        }
+        if (!p99 && seen * 100 >= received * 99) {
+            p99 = 1ULL << i;
+            break;
+        }
+    }
+
+    vlib_cli_output(vm, "%s ring, %u producer(s), %lu elements, ring size %u, burst %u",
+                    use_spsc ? "SPSC" : "MPSC", n_producers, received, ring_size, burst);
+    bgp_bench_report(&bench, "handoff", received, "elements", seconds,
+                     "latency avg %.0f ns, p50 <= %.0f ns, p99 <= %.0f ns, max %.0f ns",
+                     received ? latency_sum * ns_per_clock / received : 0.0,
+                     p50 * ns_per_clock, p99 * ns_per_clock, latency_max * ns_per_clock);
+
+    if (use_spsc) {
+        bgp_spsc_ring_free(&spsc);
+    } else {
+        bgp_mpsc_ring_free(&mpsc);
+    }
+    vec_free(producers);
+    vec_free(elts);
+    bgp_bench_free(&bench);
+    return 0;
+}
+
+VLIB_CLI_COMMAND(bgp_handoff_benchmark_command, static) = {
+    .path = "test bgp handoff-benchmark",
+    .short_help = "test bgp handoff-benchmark [count <n>] [producers <n>] [ring-size <n>] [burst <n>]",
+    .function = bgp_handoff_benchmark_command_fn,
+};
+
+// === Self-test ===
+
+#define BGP_HANDOFF_TEST_SIZE 8
+
+static u32 bgp_handoff_test_enqueue(bgp_spsc_ring_t *spsc, bgp_mpsc_ring_t *mpsc, bgp_handoff_elt_t *elts, u32 n) {
+    u32 i;
+
+    if (spsc) {
+        return bgp_spsc_ring_enqueue_burst(spsc, elts, n);
+    }
+    for (i = 0; i < n && bgp_mpsc_ring_enqueue(mpsc, &elts[i]) == 0; i++)
+        ;
+    return i;
+}
+
+/*
+ * Uneven bursts in and out of a small ring whose positions start just
+ * short of 2^32: every burst moves as much as fits or is there, elements
+ * come out in order, and the positions carry on across the wrap.
+ */
+static void bgp_handoff_ring_check(bgp_check_t *check, const char *name, bgp_spsc_ring_t *spsc,
+                                   bgp_mpsc_ring_t *mpsc, u32 start) {
+    bgp_handoff_elt_t in[BGP_HANDOFF_TEST_SIZE + 2], out[BGP_HANDOFF_TEST_SIZE + 2];
+    u32 next_in = 0, next_out = 0, step, want, expected, n, i, n_misordered = 0;
+
+    for (step = 0; step < 64; step++) {
+        want = (step * 7) % ARRAY_LEN(in);
+        expected = clib_min(want, BGP_HANDOFF_TEST_SIZE - (next_in - next_out));
+        for (i = 0; i < want; i++) {
+            in[i].neighbor_index = next_in + i;
+        }
+        n = bgp_handoff_test_enqueue(spsc, mpsc, in, want);
+        bgp_check(check, n == expected, "%s step %u: enqueued %u of %u, expected %u", name, step, n, want,
+                  expected);
+        next_in += n;
+
+        want = (step * 3) % ARRAY_LEN(out);
+        expected = clib_min(want, next_in - next_out);
+        n = spsc ? bgp_spsc_ring_dequeue_burst(spsc, out, want) : bgp_mpsc_ring_dequeue_burst(mpsc, out, want);
+        bgp_check(check, n == expected, "%s step %u: dequeued %u of %u, expected %u", name, step, n, want,
+                  expected);
+        for (i = 0; i < n; i++) {
+            n_misordered += out[i].neighbor_index != next_out + i;
+        }
+        next_out += n;
+    }
+    bgp_check(check, n_misordered == 0, "%s: %u elements out of order", name, n_misordered);
+    bgp_check(check, start + next_in < start, "%s: positions never wrapped (%u elements from %u)", name,
+              next_in, start);
+}
+
+void bgp_handoff_self_test(bgp_check_t *check) {
+    u32 start = 0U - 2 * BGP_HANDOFF_TEST_SIZE, i;
+    bgp_spsc_ring_t spsc;
+    bgp_mpsc_ring_t mpsc;
+
+    bgp_spsc_ring_init(&spsc, BGP_HANDOFF_TEST_SIZE);
+    bgp_check(check, spsc.mask + 1 == BGP_HANDOFF_TEST_SIZE, "SPSC ring of %u has %u slots",
+              BGP_HANDOFF_TEST_SIZE, spsc.mask + 1);
+    spsc.head = spsc.cached_tail = spsc.tail = spsc.cached_head = start;
+    bgp_handoff_ring_check(check, "SPSC", &spsc, 0, start);
+    bgp_spsc_ring_free(&spsc);
+
+    // Sizes round up to a power of two
+    bgp_mpsc_ring_init(&mpsc, BGP_HANDOFF_TEST_SIZE - 1);
+    bgp_check(check, mpsc.mask + 1 == BGP_HANDOFF_TEST_SIZE, "MPSC ring of %u has %u slots",
+              BGP_HANDOFF_TEST_SIZE - 1, mpsc.mask + 1);
+    mpsc.head = mpsc.tail = start;
+    for (i = 0; i <= mpsc.mask; i++) {
+        mpsc.slots[(start + i) & mpsc.mask].sequence = start + i;
+    }
+    bgp_handoff_ring_check(check, "MPSC", 0, &mpsc, start);
+    bgp_mpsc_ring_free(&mpsc);
+}
@@ -15,6 +15,20 @@ void *bgp_create_keepalive_message(size_t *out_length) {
     return msg;
 }
 
+/* Create a BGP NOTIFICATION message without data */
+void *bgp_create_notification_message(u8 error_code, u8 error_subcode, size_t *out_length) {
+    bgp_notification_message_t *msg = clib_mem_alloc(sizeof(bgp_notification_message_t));
+    memset(msg, 0, sizeof(*msg));
+    memset(msg->header.marker, 0xFF, 16);  // Set marker
+    msg->header.length = clib_host_to_net_u16(sizeof(*msg));
+    msg->header.type = BGP_MSG_NOTIFICATION;
+    msg->error_code = error_code;
+    msg->error_subcode = error_subcode;
+
+    *out_length = sizeof(*msg);
+    return msg;
+}
+
 /* Parse a BGP message */
 bgp_message_type_t bgp_parse_message(void *data, size_t length) {
     if (length < sizeof(bgp_message_header_t)) {
@@ -30,3 +44,71 @@ bgp_message_type_t bgp_parse_message(void *data, size_t length) {
 
     return header->type;
 }
+
+/*
+ * Adopt the peer's OPEN: the hold time is the lower of both proposals and
+ * 0 turns off the hold and keepalive timers (RFC 4271 4.2). A peer asking
+ * for 1 or 2 seconds is refused with a NOTIFICATION; returns -1 then.
+ */
+int bgp_open_negotiate(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_open_message_t *open) {
+    u16 peer_hold_time = clib_net_to_host_u16(open->hold_time);
+
+    if (peer_hold_time == 1 || peer_hold_time == 2) {
+        clib_warning("Neighbor %U proposed an unacceptable hold time of %u seconds",
+                     format_ip4_address, &neighbor->neighbor_ip, peer_hold_time);
+        bgp_send_notification_message(neighbor, BGP_ERR_OPEN_MESSAGE, BGP_OPEN_ERR_BAD_HOLD_TIME);
+        return -1;
+    }
+
+    neighbor->remote_router_id = clib_net_to_host_u32(open->bgp_identifier.as_u32);
+    neighbor->hold_time = clib_min(bmp->hold_time, peer_hold_time);
+    neighbor->keepalive_time = neighbor->hold_time ? clib_min(bmp->keepalive_time, neighbor->hold_time / 3) : 0;
+    return 0;
+}
+
+/* Handle one complete message received from a neighbor */
+void bgp_handle_received_message(bgp_main_t *bmp, bgp_neighbor_t *neighbor, u8 *data, u16 length) {
+    bgp_message_type_t type = bgp_parse_message(data, length);
+
+    switch (type) {
+        case BGP_MSG_OPEN:
+            if (length < sizeof(bgp_open_message_t)) {
+                clib_warning("OPEN from neighbor %U is too short (%u bytes)",
+                             format_ip4_address, &neighbor->neighbor_ip, length);
+                bgp_send_notification_message(neighbor, BGP_ERR_MESSAGE_HEADER, BGP_HDR_ERR_BAD_LENGTH);
+                neighbor->rx_flags |= BGP_RX_NOTIFICATION;
+                return;
+            }
+            if (bgp_open_negotiate(bmp, neighbor, (bgp_open_message_t *)data) < 0) {
+                // The session ends as if the peer had sent the NOTIFICATION
+                neighbor->rx_flags |= BGP_RX_NOTIFICATION;
+                return;
+            }
+            neighbor->rx_flags |= BGP_RX_OPEN;
+            break;
+
+        case BGP_MSG_KEEPALIVE:
+            neighbor->rx_flags |= BGP_RX_KEEPALIVE;
+            break;
+
+        case BGP_MSG_NOTIFICATION:
+            neighbor->rx_flags |= BGP_RX_NOTIFICATION;
+            clib_warning("Received NOTIFICATION from neighbor %U",
+                         format_ip4_address, &neighbor->neighbor_ip);
+            break;
+
+        case BGP_MSG_UPDATE:
+            neighbor->updates_received++; // Counted, not logged: a full table is hundreds of thousands
+            break;
+
+        default:
+            break;
+    }
+
+    // Any valid message from the peer restarts the hold timer, at the value the OPEN just set
+    if (neighbor->hold_time) {
+        bgp_timer_start(bmp, neighbor, BGP_TIMER_HOLD, neighbor->hold_time);
+    } else {
+        bgp_timer_stop(bmp, neighbor, BGP_TIMER_HOLD);
+    }
+}
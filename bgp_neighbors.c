@@ -4,6 +4,9 @@
 #include <vlibmemory/api.h>
 #include <bgp/bgp.h>
 #include <vpp/app/version.h>
+#include <vnet/fib/fib_table.h>
+#include <vnet/fib/fib_entry.h>
+#include <vppinfra/bihash_template.c>
 
 #define REPLY_MSG_ID_BASE bmp->msg_id_base
 #include <vlibapi/api_helper_macros.h>
@@ -80,8 +83,15 @@ void bgp_neighbor_init(bgp_neighbor_t *neighbor, ip4_address_t neighbor_ip, u32
     neighbor->neighbor_ip = neighbor_ip;
     neighbor->remote_as = remote_as;
     neighbor->state = BGP_STATE_IDLE;
+    clib_memset(neighbor->timers, 0xff, sizeof(neighbor->timers)); // All stopped
+    neighbor->peer_group = ~0;
+    neighbor->route_map_in = ~0;
+    neighbor->route_map_out = ~0;
 
-    queue_init(&neighbor->output_queue, 16); // Initialize the queue with capacity 16
+    queue_init(&neighbor->output_queue, 16); // Initial capacity; grows on demand
+    queue_init(&neighbor->control_queue, 16);
+    queue_init(&neighbor->bulk_queue, 16);
+    neighbor->bulk_queue.byte_limit = bgp_main.output_queue_byte_limit;
 
     clib_warning("Initialized BGP neighbor: %U with remote AS %u", 
                  format_ip4_address, &neighbor_ip, remote_as);
@@ -96,67 +106,108 @@ void bgp_start_session(bgp_main_t *bmp, ip4_address_t neighbor_ip) {
     }
 
     // Transition to Connect state
-    neighbor->state = BGP_STATE_CONNECT;
-    clib_warning("Started BGP session with neighbor: %U.", format_ip4_address, &neighbor_ip);
+    bgp_neighbor_set_state(bmp, neighbor, BGP_STATE_CONNECT);
 
-    // Simulate sending an Open message
-    u8 *open_message;
-    bgp_create_open_message(&open_message, bmp->bgp_as_number, bmp->bgp_router_id);
-    bgp_socket_send(neighbor->socket, open_message, vec_len(open_message));
-}
+    if (!neighbor->socket) {
+        neighbor->socket = bgp_socket_init(&neighbor_ip);
+        if (!neighbor->socket) {
+            return;
+        }
+    }
 
-/* Stop a BGP session with a neighbor */
-void bgp_stop_session(bgp_main_t *bmp, ip4_address_t neighbor_ip) {
-    bgp_neighbor_t *neighbor = bgp_find_neighbor(bmp, neighbor_ip);
-    if (!neighbor) {
-        clib_warning("Neighbor %U not found, cannot stop session.", format_ip4_address, &neighbor_ip);
+    // Start a non-blocking connect; the transport reports completion
+    bgp_socket_register(neighbor->socket, neighbor - bmp->neighbors);
+    if (bgp_socket_connect(neighbor->socket) < 0) {
+        bgp_socket_close(neighbor->socket);
+        neighbor->socket = NULL;
         return;
     }
 
-    // Transition to Idle state
-    neighbor->state = BGP_STATE_IDLE;
-    clib_warning("Stopped BGP session with neighbor: %U.", format_ip4_address, &neighbor_ip);
-
-    // Clear session-specific resources
-    bgp_clear_session_resources(neighbor);
+    clib_warning("Started BGP session with neighbor: %U.", format_ip4_address, &neighbor_ip);
 }
 
-/* Add a new BGP neighbor */
-void bgp_add_neighbor(bgp_main_t *bmp, ip4_address_t neighbor_ip, u32 remote_as) {
-    clib_spinlock_lock(&bmp->lock);
+/* Add a new BGP neighbor, taking its policy from a peer group unless peer_group is ~0 */
+void bgp_add_neighbor(bgp_main_t *bmp, ip4_address_t neighbor_ip, u32 remote_as, u32 peer_group) {
+    // Workers index the pool from their shard lists; stop them while it may move
+    vlib_worker_thread_barrier_sync(bmp->vlib_main);
 
     bgp_neighbor_t *neighbor;
+    clib_bihash_kv_8_8_t kv;
+
+    if (bgp_find_neighbor(bmp, neighbor_ip)) {
+        vlib_worker_thread_barrier_release(bmp->vlib_main);
+        clib_warning("Neighbor %U already exists", format_ip4_address, &neighbor_ip);
+        return;
+    }
     pool_get_zero(bmp->neighbors, neighbor);
 
+    bgp_neighbor_init(neighbor, neighbor_ip, remote_as);
+    kv.key = neighbor_ip.as_u32;
+    kv.value = neighbor - bmp->neighbors;
+    clib_bihash_add_del_8_8(&bmp->neighbor_by_addr, &kv, 1 /* is_add */);
+    if (peer_group != ~0) {
+        bgp_peer_group_inherit(bmp, neighbor, peer_group);
+    }
+    bgp_shard_add_neighbor(bmp, neighbor);
+    bgp_update_group_join(bmp, neighbor);
     neighbor->socket = bgp_socket_init(&neighbor_ip);
-    neighbor->neighbor_ip = neighbor_ip;
-    neighbor->remote_as = remote_as;
-    neighbor->state = BGP_STATE_IDLE;
 
     if (!neighbor->socket) {
         clib_warning("Failed to initialize socket for neighbor %U", format_ip4_address, &neighbor_ip);
     }
 
-    clib_warning("Added BGP neighbor: %U (AS %u)", format_ip4_address, &neighbor_ip, remote_as);
+    clib_warning("Added BGP neighbor: %U (AS %u) on thread %u",
+                 format_ip4_address, &neighbor_ip, remote_as, neighbor->owner_thread);
+    bgp_fsm_post(bmp, neighbor, BGP_FSM_EVENT_START);
+
+    vlib_worker_thread_barrier_release(bmp->vlib_main);
 
-    clib_spinlock_unlock(&bmp->lock);
+    // Accept inbound sessions and start driving the FSM once there is a peer
+    bgp_socket_listen(bmp);
+    if (!bmp->periodic_timer_enabled) {
+        bgp_create_periodic_process(bmp);
+        vlib_process_signal_event(bmp->vlib_main, bmp->periodic_node_index,
+                                  BGP_EVENT_PERIODIC_ENABLE_DISABLE, 1);
+    }
 }
 
 void bgp_remove_neighbor(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
+    clib_bihash_kv_8_8_t kv = { .key = neighbor->neighbor_ip.as_u32 };
+    u32 neighbor_index = neighbor - bmp->neighbors;
+
+    vlib_worker_thread_barrier_sync(bmp->vlib_main);
+    clib_bihash_add_del_8_8(&bmp->neighbor_by_addr, &kv, 0 /* is_add */);
+    if (neighbor->state == BGP_STATE_OPEN_CONFIRM || neighbor->state == BGP_STATE_ESTABLISHED) {
+        bgp_send_notification_message(neighbor, BGP_ERR_CEASE, BGP_CEASE_PEER_DECONFIGURED);
+    }
+
+    // Nothing queued may outlive the slot; the handoffs can still touch sockets and timers
+    bgp_handoff_purge_neighbor(bmp, neighbor_index);
+    if (neighbor->collision_socket) {
+        bgp_socket_close(neighbor->collision_socket);
+        neighbor->collision_socket = NULL;
+    }
     bgp_clear_session_resources(neighbor);
-    pool_put(bmp->neighbors, neighbor);
+    bgp_timer_stop_all(bmp, neighbor);
+
+    // The peer's paths leave the RIB now, not when the next user of the index goes down
+    bgp_rib_peer_down(&bmp->loc_rib, neighbor_index);
+    bgp_shard_del_neighbor(bmp, neighbor);
+    bgp_update_group_leave(bmp, neighbor);
+    bgp_peer_group_forget(bmp, neighbor);
     clib_warning("Removed neighbor %U", format_ip4_address, &neighbor->neighbor_ip);
+    pool_put(bmp->neighbors, neighbor);
+    vlib_worker_thread_barrier_release(bmp->vlib_main);
 }
 
-/* Find a BGP neighbor by its IP */
+/* Find a BGP neighbor by its IP; lock-free, so workers may call it too */
 bgp_neighbor_t *bgp_find_neighbor(bgp_main_t *bmp, ip4_address_t neighbor_ip) {
-    bgp_neighbor_t *neighbor;
-    pool_foreach(neighbor, bmp->neighbors) {
-        if (ip4_address_cmp(&neighbor->neighbor_ip, &neighbor_ip) == 0) {
-            return neighbor;
-        }
-    };
-    return NULL;
+    clib_bihash_kv_8_8_t kv = { .key = neighbor_ip.as_u32 };
+
+    if (clib_bihash_search_8_8(&bmp->neighbor_by_addr, &kv, &kv) < 0) {
+        return NULL;
+    }
+    return pool_elt_at_index(bmp->neighbors, kv.value);
 }
 
 /* Reset a BGP neighbor session */
@@ -168,25 +219,13 @@ void bgp_reset_neighbor(bgp_main_t *bmp, ip4_address_t neighbor_ip) {
         return;
     }
 
-    clib_warning("Resetting BGP neighbor: %U...", format_ip4_address, &neighbor_ip);
-
-    // Transition to Idle state
-    neighbor->state = BGP_STATE_IDLE;
-
-    // Clear queued messages for this neighbor
-    vec_free(neighbor->output_queue);
-
-    // Clear RIB-in and RIB-out entries for this neighbor
-    bgp_clear_rib_in_for_neighbor(bmp, neighbor_ip);
-    bgp_clear_rib_out_for_neighbor(bmp, neighbor_ip);
-
-    // Restart the session by transitioning to Connect state
-    neighbor->state = BGP_STATE_CONNECT;
-
-    // Notify the periodic process to handle re-connection
-    vlib_process_signal_event(bmp->vlib_main, bmp->periodic_node_index, BGP_EVENT1, (uword)neighbor);
-
-    clib_warning("BGP neighbor %U reset complete.", format_ip4_address, &neighbor_ip);
+    /*
+     * The owner thread drops the session through Idle, which withdraws the
+     * peer's routes and forgets its Adj-RIB-Out position, then reconnects.
+     * The neighbor keeps its pool slot, queues and group memberships.
+     */
+    bgp_fsm_post(bmp, neighbor, BGP_FSM_EVENT_RESET);
+    clib_warning("Resetting BGP neighbor %U", format_ip4_address, &neighbor_ip);
 }
 
 int bgp_enable_disable(bgp_main_t *bmp, u32 sw_if_index, int enable_disable) {
@@ -200,59 +239,94 @@ int bgp_enable_disable(bgp_main_t *bmp, u32 sw_if_index, int enable_disable) {
         return -1;
     }
 
-    // Add logic to enable or disable BGP on the interface
-    if (enable_disable) {
-        // Logic to enable BGP (e.g., adding interface to BGP processing)
-        bmp->bgp_enabled_interfaces |= (1 << sw_if_index);
-        clib_warning("BGP enabled on interface: %u", sw_if_index);
-    } else {
-        // Logic to disable BGP (e.g., removing interface from BGP processing)
-        bmp->bgp_enabled_interfaces &= ~(1 << sw_if_index);
-        clib_warning("BGP disabled on interface: %u", sw_if_index);
-    }
+    bmp->bgp_enabled_interfaces = clib_bitmap_set(bmp->bgp_enabled_interfaces, sw_if_index, enable_disable != 0);
+    clib_warning("BGP %s on interface: %u", enable_disable ? "enabled" : "disabled", sw_if_index);
 
     return 0;
 }
 
+/* Interface a neighbor is directly attached through, ~0 if it is reached via a gateway */
+static u32 bgp_neighbor_attached_interface(bgp_neighbor_t *neighbor) {
+    fib_prefix_t pfx = {
+        .fp_proto = FIB_PROTOCOL_IP4,
+        .fp_len = 32,
+        .fp_addr.ip4 = neighbor->neighbor_ip,
+    };
+    fib_node_index_t fei = fib_table_lookup(0, &pfx);
 
-void bgp_hard_reset_neighbor(bgp_main_t *bmp, ip4_address_t neighbor_ip) {
-    bgp_neighbor_t *neighbor = bgp_find_neighbor(bmp, neighbor_ip);
+    if (fei == FIB_NODE_INDEX_INVALID || !(fib_entry_get_flags(fei) & FIB_ENTRY_FLAG_ATTACHED)) {
+        return ~0;
+    }
+    return fib_entry_get_resolving_interface(fei);
+}
 
-    if (!neighbor) {
-        clib_warning("Neighbor %U not found.", format_ip4_address, &neighbor_ip);
+/*
+ * Fast external fallover: when a link fails, eBGP sessions to peers that
+ * are directly attached through it go down now rather than when the hold
+ * timer runs out. The callbacks run at high priority, before IP removes
+ * the interface's connected routes, so the FIB still shows which peers
+ * were reached through it. iBGP sessions usually run between loopbacks
+ * and are left to the IGP and the hold timer.
+ */
+static void bgp_fast_fallover(bgp_main_t *bmp, u32 sw_if_index, u32 hw_if_index) {
+    vnet_main_t *vnm = vnet_get_main();
+    bgp_neighbor_t *neighbor;
+    u32 attached;
+
+    if (!bmp->fast_external_fallover || pool_elts(bmp->neighbors) == 0) {
         return;
     }
 
-    clib_warning("Performing hard reset for BGP neighbor %U...", format_ip4_address, &neighbor_ip);
+    // Link events may come from a process without the barrier; posts to workers need it
+    vlib_worker_thread_barrier_sync(bmp->vlib_main);
+    pool_foreach (neighbor, bmp->neighbors) {
+        if (neighbor->remote_as == bmp->bgp_as_number || neighbor->state == BGP_STATE_IDLE) {
+            continue;
+        }
+        attached = bgp_neighbor_attached_interface(neighbor);
+        if (attached == ~0) {
+            continue;
+        }
+        if (sw_if_index != ~0 ? attached == sw_if_index
+                              : vnet_get_sup_hw_interface(vnm, attached)->hw_if_index == hw_if_index) {
+            bgp_fsm_post(bmp, neighbor, BGP_FSM_EVENT_LINK_DOWN);
+            bmp->n_fast_fallovers++;
+        }
+    }
+    vlib_worker_thread_barrier_release(bmp->vlib_main);
+}
 
-    // Transition neighbor to Idle state
-    neighbor->state = BGP_STATE_IDLE;
+static clib_error_t *bgp_sw_interface_admin_up_down(vnet_main_t *vnm, u32 sw_if_index, u32 flags) {
+    if (!(flags & VNET_SW_INTERFACE_FLAG_ADMIN_UP)) {
+        bgp_fast_fallover(&bgp_main, sw_if_index, ~0);
+    }
+    return 0;
+}
 
-    // Clear RIB-in and RIB-out for the neighbor
-    bgp_clear_rib_in_for_neighbor(bmp, neighbor_ip);
-    bgp_clear_rib_out_for_neighbor(bmp, neighbor_ip);
+VNET_SW_INTERFACE_ADMIN_UP_DOWN_FUNCTION_PRIO(bgp_sw_interface_admin_up_down, VNET_ITF_FUNC_PRIORITY_HIGH);
 
-    // Clear session-specific resources
-    bgp_clear_session_resources(neighbor);
+static clib_error_t *bgp_hw_interface_link_up_down(vnet_main_t *vnm, u32 hw_if_index, u32 flags) {
+    if (!(flags & VNET_HW_INTERFACE_FLAG_LINK_UP)) {
+        bgp_fast_fallover(&bgp_main, ~0, hw_if_index);
+    }
+    return 0;
+}
 
-    // Remove the neighbor
-    bgp_remove_neighbor(bmp, neighbor);
+VNET_HW_INTERFACE_LINK_UP_DOWN_FUNCTION_PRIO(bgp_hw_interface_link_up_down, VNET_ITF_FUNC_PRIORITY_HIGH);
 
-    // Reinitialize the neighbor
-    u32 remote_as = neighbor->remote_as; // Save the remote AS number
-    bgp_add_neighbor(bmp, neighbor_ip, remote_as);
 
-    // Transition to the Connect state to restart the session
-    neighbor = bgp_find_neighbor(bmp, neighbor_ip);
-    if (neighbor) {
-        neighbor->state = BGP_STATE_CONNECT;
+void bgp_hard_reset_neighbor(bgp_main_t *bmp, ip4_address_t neighbor_ip) {
+    bgp_neighbor_t *neighbor = bgp_find_neighbor(bmp, neighbor_ip);
 
-        // Notify periodic process to handle reconnection
-        vlib_process_signal_event(bmp->vlib_main, bmp->periodic_node_index, BGP_EVENT1, (uword) neighbor);
-        clib_warning("Hard reset for BGP neighbor %U completed.", format_ip4_address, &neighbor_ip);
-    } else {
-        clib_warning("Failed to reinitialize neighbor %U after hard reset.", format_ip4_address, &neighbor_ip);
+    if (!neighbor) {
+        clib_warning("Neighbor %U not found.", format_ip4_address, &neighbor_ip);
+        return;
     }
+
+    // Same in-place reset, but the new session starts its statistics from zero
+    clib_memset(neighbor->output_stats, 0, sizeof(neighbor->output_stats));
+    bgp_fsm_post(bmp, neighbor, BGP_FSM_EVENT_RESET);
+    clib_warning("Performing hard reset for BGP neighbor %U", format_ip4_address, &neighbor_ip);
 }
 
 void bgp_soft_reset_neighbor(bgp_main_t *bmp, ip4_address_t neighbor_ip, bool inbound) {
@@ -285,16 +359,30 @@ void bgp_clear_session_resources(bgp_neighbor_t *neighbor) {
         bgp_socket_close(neighbor->socket); // Close the neighbor's socket
         neighbor->socket = NULL;
     }
-    queue_free(&neighbor->output_queue); // Free the neighbor's message queue
+    bgp_discard_output(neighbor);
+    queue_free(&neighbor->output_queue); // Free the neighbor's message queues
+    queue_free(&neighbor->control_queue);
+    queue_free(&neighbor->bulk_queue);
     clib_warning("Cleared session resources for neighbor %U", format_ip4_address, &neighbor->neighbor_ip);
 }
 
 void bgp_clear_rib_in_for_neighbor(bgp_main_t *bmp, ip4_address_t neighbor_ip) {
-    // Placeholder for clearing inbound RIB
+    /*
+     * Placeholder: without ROUTE-REFRESH the peer never re-sends what it
+     * advertised, so purging its paths here would lose them until the
+     * session resets. The session going down withdraws them instead.
+     */
     clib_warning("Cleared inbound RIB for neighbor %U", format_ip4_address, &neighbor_ip);
 }
 
 void bgp_clear_rib_out_for_neighbor(bgp_main_t *bmp, ip4_address_t neighbor_ip) {
-    // Placeholder for clearing outbound RIB
+    bgp_neighbor_t *neighbor = bgp_find_neighbor(bmp, neighbor_ip);
+
+    // The next FSM pass asks the update group for a full table
+    if (neighbor) {
+        bgp_update_group_resync(bmp, neighbor - bmp->neighbors);
+        neighbor->rib_out_version = 0;
+        neighbor->rib_out_requested = 0;
+    }
     clib_warning("Cleared outbound RIB for neighbor %U", format_ip4_address, &neighbor_ip);
 }
\ No newline at end of file
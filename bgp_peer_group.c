@@ -0,0 +1,255 @@
+/*
+ * bgp_peer_group.c - peer group configuration templates
+ *
+ * Copyright (c) <current-year> <your-organization>
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vlib/vlib.h>
+#include <bgp/bgp.h>
+
+/*
+ * Members copy the group's remote AS, route-reflector-client flag, route
+ * filter and route-maps. Identical outbound policy puts them all in one update
+ * group, so the Adj-RIB-Out is kept and encoded once for the whole peer
+ * group, and a member whose session comes up gets the group's encoded
+ * table as is. Everything here runs on the main thread under the worker
+ * barrier.
+ */
+
+bgp_peer_group_t *bgp_find_peer_group(bgp_main_t *bmp, const char *name) {
+    bgp_peer_group_t *group;
+
+    pool_foreach (group, bmp->peer_groups) {
+        if (!strcmp(group->name, name)) {
+            return group;
+        }
+    }
+    return NULL;
+}
+
+/* Copy the template into a neighbor that is not in an update group yet */
+void bgp_peer_group_inherit(bgp_main_t *bmp, bgp_neighbor_t *neighbor, u32 peer_group) {
+    bgp_peer_group_t *group = pool_elt_at_index(bmp->peer_groups, peer_group);
+
+    if (group->remote_as) {
+        neighbor->remote_as = group->remote_as;
+    }
+    neighbor->is_route_reflector_client = group->is_route_reflector_client;
+    clib_memcpy(neighbor->route_filter_name, group->route_filter_name, sizeof(neighbor->route_filter_name));
+    neighbor->route_map_in = group->route_map_in;
+    neighbor->route_map_out = group->route_map_out;
+    neighbor->peer_group = peer_group;
+    vec_add1(group->members, neighbor - bmp->neighbors);
+}
+
+void bgp_peer_group_forget(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
+    bgp_peer_group_t *group;
+    u32 i;
+
+    if (neighbor->peer_group == ~0) {
+        return;
+    }
+    group = pool_elt_at_index(bmp->peer_groups, neighbor->peer_group);
+    if ((i = vec_search(group->members, neighbor - bmp->neighbors)) != ~0) {
+        vec_del1(group->members, i);
+    }
+    neighbor->peer_group = ~0;
+}
+
+/*
+ * Move a configured neighbor into a peer group. The session switches to
+ * its new update group's table, with prefixes the new policy filters
+ * withdrawn; a changed remote AS cannot apply to a live session, which is
+ * reset.
+ */
+void bgp_peer_group_join(bgp_main_t *bmp, bgp_neighbor_t *neighbor, u32 peer_group) {
+    u32 remote_as = neighbor->remote_as;
+
+    bgp_peer_group_forget(bmp, neighbor);
+    bgp_peer_group_inherit(bmp, neighbor, peer_group);
+    bgp_update_group_rejoin(bmp, neighbor);
+    if (neighbor->remote_as != remote_as && neighbor->state != BGP_STATE_IDLE) {
+        clib_warning("Remote AS of neighbor %U changed to %u, resetting session",
+                     format_ip4_address, &neighbor->neighbor_ip, neighbor->remote_as);
+        bgp_fsm_post(bmp, neighbor, BGP_FSM_EVENT_RESET);
+    }
+}
+
+static_always_inline int bgp_peer_group_matches(bgp_peer_group_t *group, bgp_neighbor_t *neighbor) {
+    return (!group->remote_as || neighbor->remote_as == group->remote_as) &&
+           neighbor->is_route_reflector_client == group->is_route_reflector_client &&
+           !strcmp(neighbor->route_filter_name, group->route_filter_name) &&
+           neighbor->route_map_in == group->route_map_in && neighbor->route_map_out == group->route_map_out;
+}
+
+/* Re-apply a changed template to the members it now differs from */
+static void bgp_peer_group_apply(bgp_main_t *bmp, bgp_peer_group_t *group) {
+    u32 *members = vec_dup(group->members);
+    u32 *index;
+
+    vec_foreach (index, members) {
+        bgp_neighbor_t *neighbor = pool_elt_at_index(bmp->neighbors, *index);
+        if (!bgp_peer_group_matches(group, neighbor)) {
+            bgp_peer_group_join(bmp, neighbor, group - bmp->peer_groups);
+        }
+    }
+    vec_free(members);
+}
+
+void bgp_peer_groups_free(bgp_main_t *bmp) {
+    bgp_peer_group_t *group;
+
+    pool_foreach (group, bmp->peer_groups) {
+        vec_free(group->members);
+    }
+    pool_free(bmp->peer_groups);
+}
+
+// === CLI ===
+
+static clib_error_t *
+bgp_set_peer_group_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    bgp_main_t *bmp = &bgp_main;
+    bgp_peer_group_t *group;
+    u8 *name = 0, *filter = 0, *map_name = 0;
+    u32 remote_as = ~0, map = ~0;
+    int rr_client = -1, is_del = 0, map_dir = -1;
+    clib_error_t *error = 0;
+
+    if (!unformat(input, "%s", &name)) {
+        return clib_error_return(0, "Usage: set bgp peer-group <name> [remote-as <AS>] "
+                                    "[route-reflector-client|no-route-reflector-client] "
+                                    "[route-filter <prefix-list>|no-route-filter] "
+                                    "[route-map <name> <in|out>|no-route-map <in|out>] [del]");
+    }
+    while (unformat_check_input(input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat(input, "remote-as %u", &remote_as))
+            ;
+        else if (unformat(input, "no-route-reflector-client"))
+            rr_client = 0;
+        else if (unformat(input, "route-reflector-client"))
+            rr_client = 1;
+        else if (unformat(input, "no-route-filter"))
+            vec_validate(filter, 0); // Empty name clears the filter
+        else if (unformat(input, "route-filter %s", &filter))
+            ;
+        else if (unformat(input, "no-route-map in"))
+            map_dir = 1;
+        else if (unformat(input, "no-route-map out"))
+            map_dir = 0;
+        else if (unformat(input, "route-map %s", &map_name) &&
+                 (map_dir = unformat(input, "in") ? 1 : unformat(input, "out") ? 0 : -1) >= 0)
+            ;
+        else if (unformat(input, "del"))
+            is_del = 1;
+        else {
+            error = clib_error_return(0, "Unknown input '%U'", format_unformat_error, input);
+            goto done;
+        }
+    }
+    vec_add1(name, 0);
+    if (vec_len(name) > sizeof(group->name) || vec_len(filter) >= sizeof(group->route_filter_name) ||
+        vec_len(map_name) >= sizeof(group->name)) {
+        error = clib_error_return(0, "Names are limited to %u characters", sizeof(group->name) - 1);
+        goto done;
+    }
+
+    group = bgp_find_peer_group(bmp, (char *)name);
+    if (is_del) {
+        if (!group) {
+            error = clib_error_return(0, "Unknown peer group %s", name);
+        } else if (vec_len(group->members)) {
+            error = clib_error_return(0, "Peer group %s still has %u members", name, vec_len(group->members));
+        } else {
+            vec_free(group->members);
+            pool_put(bmp->peer_groups, group);
+        }
+        goto done;
+    }
+
+    if (map_name) {
+        vec_add1(map_name, 0);
+        map = bgp_route_map_intern(bmp, (char *)map_name);
+    }
+    if (!group) {
+        pool_get_zero(bmp->peer_groups, group);
+        clib_memcpy(group->name, name, vec_len(name));
+        group->route_map_in = ~0;
+        group->route_map_out = ~0;
+    }
+    if (map_dir == 1) {
+        group->route_map_in = map;
+    } else if (map_dir == 0) {
+        group->route_map_out = map;
+    }
+    if (remote_as != ~0) {
+        group->remote_as = remote_as;
+    }
+    if (rr_client >= 0) {
+        group->is_route_reflector_client = rr_client;
+    }
+    if (filter) {
+        clib_memset(group->route_filter_name, 0, sizeof(group->route_filter_name));
+        clib_memcpy(group->route_filter_name, filter, vec_len(filter));
+    }
+
+    // Members follow the template; those whose policy is unchanged keep their update group
+    bgp_peer_group_apply(bmp, group);
+
+done:
+    vec_free(name);
+    vec_free(filter);
+    vec_free(map_name);
+    return error;
+}
+
+VLIB_CLI_COMMAND(bgp_set_peer_group_command, static) = {
+    .path = "set bgp peer-group",
+    .short_help = "set bgp peer-group <name> [remote-as <AS>] "
+                  "[route-reflector-client|no-route-reflector-client] "
+                  "[route-filter <prefix-list>|no-route-filter] "
+                  "[route-map <name> <in|out>|no-route-map <in|out>] [del]",
+    .function = bgp_set_peer_group_command_fn,
+};
+
+static clib_error_t *
+bgp_show_peer_groups_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    bgp_main_t *bmp = &bgp_main;
+    bgp_peer_group_t *group;
+    u32 *index;
+
+    pool_foreach (group, bmp->peer_groups) {
+        vlib_cli_output(vm, "Peer group %s: remote AS %u%s%s%s%s%s%s%s, %u members", group->name,
+                        group->remote_as, group->is_route_reflector_client ? ", rr-client" : "",
+                        group->route_filter_name[0] ? ", filter " : "", group->route_filter_name,
+                        group->route_map_in != ~0 ? ", route-map in " : "",
+                        group->route_map_in != ~0 ? bmp->route_maps[group->route_map_in].name : "",
+                        group->route_map_out != ~0 ? ", route-map out " : "",
+                        group->route_map_out != ~0 ? bmp->route_maps[group->route_map_out].name : "",
+                        vec_len(group->members));
+        vec_foreach (index, group->members) {
+            bgp_neighbor_t *neighbor = pool_elt_at_index(bmp->neighbors, *index);
+            vlib_cli_output(vm, "  %U (AS %u) %s, update group %d", format_ip4_address, &neighbor->neighbor_ip,
+                            neighbor->remote_as, bgp_state_to_string(neighbor->state),
+                            (int)neighbor->update_group);
+        }
+    }
+    return 0;
+}
+
+VLIB_CLI_COMMAND(bgp_show_peer_groups_command, static) = {
+    .path = "show bgp peer-groups",
+    .short_help = "show bgp peer-groups",
+    .function = bgp_show_peer_groups_command_fn,
+};
@@ -19,18 +19,6 @@
 #include <vppinfra/error.h>
 #include <bgp/bgp.h>
 
-static void
-handle_event1 (bgp_main_t *pm, f64 now, uword event_data)
-{
-  clib_warning ("received BGP_EVENT1");
-}
-
-static void
-handle_event2 (bgp_main_t *pm, f64 now, uword event_data)
-{
-  clib_warning ("received BGP_EVENT2");
-}
-
 static void
 handle_periodic_enable_disable (bgp_main_t *pm, f64 now, uword event_data)
 {
@@ -42,7 +30,9 @@ handle_periodic_enable_disable (bgp_main_t *pm, f64 now, uword event_data)
 static void
 handle_timeout (bgp_main_t *pm, f64 now)
 {
-  clib_warning ("timeout at %.2f", now);
+  /* Session timers: a tick with nothing due only advances the wheel.
+     Expiries post FSM events like everything else */
+  bgp_timer_expire (pm, 0, now);
 }
 
 static uword
@@ -51,7 +41,7 @@ bgp_periodic_process (vlib_main_t * vm,
 {
   bgp_main_t *pm = &bgp_main;
   f64 now;
-  f64 timeout = 10.0;
+  f64 timeout = 1.0;		/* neighbor timers count in seconds */
   uword *event_data = 0;
   uword event_type;
   int i;
@@ -69,28 +59,47 @@ bgp_periodic_process (vlib_main_t * vm,
 
       switch (event_type)
 	{
-	  /* Handle BGP_EVENT1 */
-	case BGP_EVENT1:
-	  for (i = 0; i < vec_len (event_data); i++)
-	    handle_event1 (pm, now, event_data[i]);
-	  break;
-
-	  /* Handle BGP_EVENT2 */
-	case BGP_EVENT2:
-	  for (i = 0; i < vec_len (event_data); i++)
-	    handle_event2 (pm, now, event_data[i]);
-	  break;
           /* Handle the periodic timer on/off event */
 	case BGP_EVENT_PERIODIC_ENABLE_DISABLE:
 	  for (i = 0; i < vec_len (event_data); i++)
 	    handle_periodic_enable_disable (pm, now, event_data[i]);
 	  break;
 
-          /* Handle periodic timeouts */
+          /* Workers queued messages or route batches for the RIB */
+	case BGP_EVENT_HANDOFF:
+	  break;
+
+          /* FSM events were posted for main-thread neighbors */
+	case BGP_EVENT_FSM:
+	  break;
+
+          /* The FIB queue still holds batches from the last wakeup */
+	case BGP_EVENT_FIB_DOWNLOAD:
+	  break;
+
+          /* Nothing arrived within the tick */
 	case ~0:
-	  handle_timeout (pm, now);
 	  break;
 	}
+
+      /* The wheel runs off the clock, so advance it on every wakeup; a
+         steady stream of events must not starve hold timers */
+      handle_timeout (pm, now);
+
+      /* Run the FSM for neighbors that had something happen, and only those */
+      bgp_fsm_dispatch (pm, 0);
+
+      /* Apply worker handoffs, select best paths, let readers see the result
+         and encode it for the update groups */
+      bgp_handoff_drain_main (pm);
+      bgp_decision_run (pm);
+      bgp_fib_download (pm);
+      bgp_rib_publish (pm);
+      bgp_update_groups_run (pm);
+      bgp_attr_sets_sweep (pm);
+
+      /* Push any io_uring work queued during this wakeup in one batch */
+      bgp_uring_submit (pm);
       vec_reset_length (event_data);
     }
   return 0;			/* or not */
@@ -1,45 +1,519 @@
 #include <bgp/bgp.h>
 #include <vlib/vlib.h>
 
-bgp_prefix_list_t *bgp_find_or_create_prefix_list(bgp_main_t *bmp, const char *list_name) {
-    bgp_prefix_list_t **list;
+/*
+ * Prefix lists are kept compiled as a binary trie over the prefix bits.
+ * Each entry hangs off the node for its prefix, so matching a route walks
+ * at most mask_length + 1 nodes, whatever the size of the list, and
+ * entries are added or removed in O(mask_length) as well. Lists are
+ * interned: users hold the pool index, and names are only resolved when
+ * configuration changes.
+ */
 
-    vec_foreach(list, bmp->prefix_lists) {
-        if (!strcmp((*list)->name, list_name)) {
-            return *list; // Dereference to get the actual prefix list
-        }
+static_always_inline u32 bgp_prefix_bit(u32 addr, u32 depth) {
+    return (addr >> (31 - depth)) & 1;
+}
+
+static bgp_prefix_list_t *bgp_prefix_list_get(bgp_main_t *bmp, const char *list_name) {
+    uword *p = hash_get_mem(bmp->prefix_list_by_name, list_name);
+
+    return p ? pool_elt_at_index(bmp->prefix_lists, p[0]) : NULL;
+}
+
+/* ID of the named list, creating an empty one if needed; an empty list permits everything */
+u32 bgp_prefix_list_intern(bgp_main_t *bmp, const char *list_name) {
+    bgp_prefix_list_t *list = bgp_prefix_list_get(bmp, list_name);
+
+    if (list) {
+        return list - bmp->prefix_lists;
     }
 
-    bgp_prefix_list_t *new_list = clib_mem_alloc(sizeof(bgp_prefix_list_t));
-    memset(new_list, 0, sizeof(*new_list));
-    strncpy(new_list->name, list_name, sizeof(new_list->name) - 1);
-    vec_add1(bmp->prefix_lists, new_list); // Add the new list pointer to the vector
+    pool_get_zero(bmp->prefix_lists, list);
+    strncpy(list->name, list_name, sizeof(list->name) - 1);
+    vec_validate(list->nodes, 0); // Root
+    // The pool may move, so the key is a copy of the name rather than list->name
+    hash_set_mem(bmp->prefix_list_by_name, format(0, "%s%c", list->name, 0), list - bmp->prefix_lists);
 
     clib_warning("Created new prefix list: %s", list_name);
-    return new_list;
+    return list - bmp->prefix_lists;
+}
+
+/* Take the entry with this seq out of the trie; false if there is none */
+static bool bgp_prefix_list_remove(bgp_prefix_list_t *list, u32 seq, bgp_prefix_t *removed) {
+    bgp_prefix_trie_node_t *node;
+    uword *p;
+    u32 i;
+
+    if (!(p = hash_get(list->node_by_seq, seq))) {
+        return false;
+    }
+    // Emptied nodes stay; they cost a step only for routes below them
+    node = vec_elt_at_index(list->nodes, p[0]);
+    for (i = 0; i < vec_len(node->entries); i++) {
+        if (node->entries[i].seq == seq) {
+            *removed = node->entries[i];
+            vec_delete(node->entries, 1, i);
+            break;
+        }
+    }
+    hash_unset(list->node_by_seq, seq);
+    list->n_entries--;
+    return true;
+}
+
+/* Snapshot keys of the routes an entry can match: inside its prefix with a length in ge..le */
+static void bgp_prefix_range_collect(bgp_rib_snapshot_t *rib, bgp_prefix_t *range, uword **keys) {
+    u32 base = clib_net_to_host_u32(range->prefix.as_u32), mask, length;
+    u64 n_candidates = 0, i;
+    bgp_route_t *route;
+    uword key;
+
+    for (length = range->ge; length <= range->le; length++) {
+        n_candidates += 1ULL << (length - range->mask_length);
+    }
+
+    // Few enough more-specifics to look each one up
+    if (n_candidates <= vec_len(rib->routes)) {
+        for (length = range->ge; length <= range->le; length++) {
+            for (i = 0; i < (1ULL << (length - range->mask_length)); i++) {
+                key = ((u64)(base | (u32)(i << (32 - length))) << 8) | length;
+                if (hash_get(rib->route_by_key, key)) {
+                    vec_add1(*keys, key);
+                }
+            }
+        }
+        return;
+    }
+
+    // Too wide to enumerate: one pass of address compares, no policy runs outside the range
+    mask = range->mask_length ? ~0u << (32 - range->mask_length) : 0;
+    vec_foreach (route, rib->routes) {
+        if (route->mask_length >= range->ge && route->mask_length <= range->le &&
+            (clib_net_to_host_u32(route->prefix.as_u32) & mask) == base) {
+            vec_add1(*keys, bgp_dest_key(route->prefix, route->mask_length));
+        }
+    }
+}
+
+static_always_inline bool bgp_prefix_list_used_by_group(bgp_main_t *bmp, bgp_update_group_t *group, u32 id) {
+    return group->route_filter == id ||
+           (group->route_map_out != ~0 &&
+            bgp_route_map_uses_prefix_list(pool_elt_at_index(bmp->route_maps, group->route_map_out), id));
+}
+
+static_always_inline bool bgp_prefix_list_used_inbound(bgp_main_t *bmp, bgp_neighbor_t *neighbor, u32 id) {
+    return neighbor->route_map_in != ~0 &&
+           bgp_route_map_uses_prefix_list(pool_elt_at_index(bmp->route_maps, neighbor->route_map_in), id);
+}
+
+/*
+ * Entries in ranges were added, replaced or removed. A list decides each
+ * route by the entries that match it, so only routes some changed entry
+ * matches can be treated differently now; the update groups using the
+ * list re-check just those. Emptying a list, or adding to an empty one,
+ * toggles permit-all and affects every route.
+ */
+static void bgp_prefix_list_changed(bgp_main_t *bmp, bgp_prefix_list_t *list, bgp_prefix_t *ranges,
+                                    u32 n_before) {
+    bgp_rib_snapshot_t *rib = bmp->rib_snapshot;
+    u32 id = list - bmp->prefix_lists, *groups = 0, *index, n_inbound = 0;
+    bool unbounded = (n_before == 0) != (list->n_entries == 0);
+    bgp_update_group_t *group;
+    bgp_neighbor_t *neighbor;
+    bgp_prefix_t *range;
+    uword *keys = 0;
+
+    pool_foreach (group, bmp->update_groups) {
+        if (bgp_prefix_list_used_by_group(bmp, group, id)) {
+            vec_add1(groups, group - bmp->update_groups);
+        }
+    }
+    pool_foreach (neighbor, bmp->neighbors) {
+        n_inbound += bgp_prefix_list_used_inbound(bmp, neighbor, id);
+    }
+    if (n_inbound) {
+        // Only post-policy paths are kept, so there is nothing to re-run inbound policy on
+        clib_warning("Prefix list %s is used inbound by %u neighbors; received routes keep their "
+                     "result until their sessions reset", list->name, n_inbound);
+    }
+    if (!vec_len(groups) || !rib) {
+        vec_free(groups);
+        return;
+    }
+
+    if (!unbounded) {
+        vec_foreach (range, ranges) {
+            bgp_prefix_range_collect(rib, range, &keys);
+        }
+    }
+    vec_foreach (index, groups) {
+        group = pool_elt_at_index(bmp->update_groups, *index);
+        if (unbounded) {
+            bgp_update_group_reevaluate_all(group);
+        } else {
+            bgp_update_group_reevaluate(bmp, group, keys);
+        }
+    }
+    list->n_rechecked += unbounded ? vec_len(rib->routes) : vec_len(keys);
+
+    vec_free(keys);
+    vec_free(groups);
+}
+
+/* Fill in the lengths a range leaves out; false if they are inconsistent */
+static bool bgp_prefix_range_resolve(u8 mask_length, u8 *ge, u8 *le) {
+    // No ge/le matches the exact length; ge alone extends to /32, le alone starts at the prefix length
+    if (!*ge && !*le) {
+        *ge = *le = mask_length;
+    } else if (!*le) {
+        *le = 32;
+    } else if (!*ge) {
+        *ge = mask_length;
+    }
+    return mask_length <= 32 && *ge >= mask_length && *le <= 32 && *ge <= *le;
+}
+
+/* Hang a new entry off the node for its prefix; seq must not be in use */
+static bgp_prefix_t *bgp_prefix_list_insert(bgp_prefix_list_t *list, u32 seq, ip4_address_t *prefix,
+                                            u8 mask_length, u8 ge, u8 le, bool permit) {
+    bgp_prefix_t entry = { 0 };
+    u32 addr, node = 0, depth, next, i;
+
+    addr = mask_length ? clib_net_to_host_u32(prefix->as_u32) & (~0u << (32 - mask_length)) : 0;
+    entry.seq = seq;
+    entry.prefix.as_u32 = clib_host_to_net_u32(addr);
+    entry.mask_length = mask_length;
+    entry.ge = ge;
+    entry.le = le;
+    entry.permit = permit;
+
+    for (depth = 0; depth < mask_length; depth++) {
+        next = list->nodes[node].child[bgp_prefix_bit(addr, depth)];
+        if (!next) {
+            next = vec_len(list->nodes);
+            vec_validate(list->nodes, next); // May move the vec; index again below
+            list->nodes[node].child[bgp_prefix_bit(addr, depth)] = next;
+        }
+        node = next;
+    }
+
+    // Keep the node's entries in seq order so the first length match is the lowest seq
+    for (i = 0; i < vec_len(list->nodes[node].entries); i++) {
+        if (list->nodes[node].entries[i].seq > seq) {
+            break;
+        }
+    }
+    vec_insert_elts(list->nodes[node].entries, &entry, 1, i);
+
+    hash_set(list->node_by_seq, seq, node);
+    list->n_entries++;
+    list->last_seq = clib_max(list->last_seq, seq);
+    return &list->nodes[node].entries[i];
+}
+
+/* Add or replace the entry with this seq (0 picks the next multiple of 5); -1 on bad lengths */
+int bgp_update_prefix_list(bgp_main_t *bmp, const char *list_name, u32 seq, ip4_address_t *prefix,
+                           u8 mask_length, u8 ge, u8 le, bool permit) {
+    bgp_prefix_list_t *list;
+    bgp_prefix_t *e, *ranges = 0, removed;
+    u32 n_before;
+
+    if (!bgp_prefix_range_resolve(mask_length, &ge, &le)) {
+        return -1;
+    }
+
+    list = pool_elt_at_index(bmp->prefix_lists, bgp_prefix_list_intern(bmp, list_name));
+    if (!seq) {
+        seq = (list->last_seq / 5 + 1) * 5;
+    }
+    n_before = list->n_entries;
+    if (bgp_prefix_list_remove(list, seq, &removed)) {
+        vec_add1(ranges, removed);
+    }
+    e = bgp_prefix_list_insert(list, seq, prefix, mask_length, ge, le, permit);
+
+    clib_warning("Added seq %u %s %U/%u ge %u le %u to list %s.", e->seq, permit ? "permit" : "deny",
+                 format_ip4_address, &e->prefix, mask_length, ge, le, list_name);
+
+    vec_add1(ranges, *e);
+    bgp_prefix_list_changed(bmp, list, ranges, n_before);
+    vec_free(ranges);
+    return 0;
 }
 
-void bgp_update_prefix_list(bgp_main_t *bmp, const char *list_name, ip4_address_t *prefix, u8 mask_length, bool permit) {
-    bgp_prefix_list_t *list = bgp_find_or_create_prefix_list(bmp, list_name);
-    bgp_prefix_t *entry;
+int bgp_delete_prefix_list_entry(bgp_main_t *bmp, const char *list_name, u32 seq) {
+    bgp_prefix_list_t *list = bgp_prefix_list_get(bmp, list_name);
+    bgp_prefix_t removed, *ranges = 0;
+
+    if (!list || !bgp_prefix_list_remove(list, seq, &removed)) {
+        return -1;
+    }
+    vec_add1(ranges, removed);
+    bgp_prefix_list_changed(bmp, list, ranges, list->n_entries + 1);
+    vec_free(ranges);
+    return 0;
+}
 
-    entry = clib_mem_alloc(sizeof(bgp_prefix_t));
-    entry->prefix = *prefix;
-    entry->mask_length = mask_length;
-    entry->permit = permit;
+static void bgp_prefix_list_release(bgp_prefix_list_t *list) {
+    bgp_prefix_trie_node_t *node;
 
-    vec_add1(list->entries, entry); // Add the new entry to the vector
-    clib_warning("Added prefix %U/%u (%s) to list %s.",
-                 format_ip4_address, prefix, mask_length,
-                 permit ? "permit" : "deny", list_name);
+    vec_foreach (node, list->nodes) {
+        vec_free(node->entries);
+    }
+    vec_free(list->nodes);
+    hash_free(list->node_by_seq);
 }
 
 void bgp_free_prefix_lists(bgp_main_t *bmp) {
-    bgp_prefix_list_t **list;
+    bgp_prefix_list_t *list;
+    hash_pair_t *hp;
+
+    pool_foreach (list, bmp->prefix_lists) {
+        bgp_prefix_list_release(list);
+    }
+    pool_free(bmp->prefix_lists);
+    hash_foreach_pair (hp, bmp->prefix_list_by_name, ({
+        u8 *key = (u8 *)hp->key;
+        vec_free(key);
+    }));
+    hash_free(bmp->prefix_list_by_name);
+}
+
+bgp_prefix_list_t *bgp_find_prefix_list(bgp_main_t *bmp, const char *list_name) {
+    return bgp_prefix_list_get(bmp, list_name);
+}
+
+static int bgp_prefix_seq_cmp(void *a1, void *a2) {
+    bgp_prefix_t *a = a1, *b = a2;
+
+    return a->seq < b->seq ? -1 : a->seq > b->seq;
+}
+
+/* All entries in seq order, for display; the caller frees the vec */
+bgp_prefix_t *bgp_prefix_list_entries(bgp_prefix_list_t *list) {
+    bgp_prefix_trie_node_t *node;
+    bgp_prefix_t *entries = 0;
+
+    vec_foreach (node, list->nodes) {
+        vec_append(entries, node->entries);
+    }
+    vec_sort_with_function(entries, bgp_prefix_seq_cmp);
+    return entries;
+}
+
+/* The lowest-seq entry covering the prefix with a matching length decides; no match is denied */
+bool bgp_prefix_list_permits(bgp_prefix_list_t *list, ip4_address_t prefix, u8 mask_length) {
+    u32 addr = clib_net_to_host_u32(prefix.as_u32);
+    bgp_prefix_t *entry, *best = 0;
+    u32 node = 0, depth = 0;
+
+    if (list->n_entries == 0) {
+        return true; // Referenced but not defined
+    }
+
+    while (1) {
+        vec_foreach (entry, list->nodes[node].entries) {
+            if (mask_length >= entry->ge && mask_length <= entry->le) {
+                if (!best || entry->seq < best->seq) {
+                    best = entry;
+                }
+                break;
+            }
+        }
+        if (depth == mask_length || !(node = list->nodes[node].child[bgp_prefix_bit(addr, depth)])) {
+            break;
+        }
+        depth++;
+    }
+    return best ? best->permit : false;
+}
+
+// === CLI ===
+
+static clib_error_t *
+bgp_set_prefix_list_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    bgp_main_t *bmp = &bgp_main;
+    ip4_address_t prefix;
+    u32 seq = 0, mask_length = ~0, ge = 0, le = 0;
+    int permit = -1, is_del = 0;
+    u8 *name = 0;
+    clib_error_t *error = 0;
+
+    if (!unformat(input, "%s", &name)) {
+        return clib_error_return(0, "Usage: set bgp prefix-list <name> [seq <n>] <permit|deny> "
+                                    "<prefix>/<len> [ge <n>] [le <n>] | <name> del seq <n>");
+    }
+    vec_add1(name, 0);
+    while (unformat_check_input(input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat(input, "seq %u", &seq))
+            ;
+        else if (unformat(input, "permit"))
+            permit = 1;
+        else if (unformat(input, "deny"))
+            permit = 0;
+        else if (unformat(input, "%U/%u", unformat_ip4_address, &prefix, &mask_length))
+            ;
+        else if (unformat(input, "ge %u", &ge))
+            ;
+        else if (unformat(input, "le %u", &le))
+            ;
+        else if (unformat(input, "del"))
+            is_del = 1;
+        else {
+            error = clib_error_return(0, "Unknown input '%U'", format_unformat_error, input);
+            goto done;
+        }
+    }
+    if (vec_len(name) > sizeof(((bgp_prefix_list_t *)0)->name)) {
+        error = clib_error_return(0, "Prefix list names are limited to %u characters",
+                                  sizeof(((bgp_prefix_list_t *)0)->name) - 1);
+        goto done;
+    }
+
+    if (is_del) {
+        if (!seq || bgp_delete_prefix_list_entry(bmp, (char *)name, seq) < 0) {
+            error = clib_error_return(0, "No entry seq %u in prefix list %s", seq, name);
+        }
+        goto done;
+    }
+    if (permit < 0 || mask_length == ~0 || ge > 32 || le > 32 ||
+        bgp_update_prefix_list(bmp, (char *)name, seq, &prefix, mask_length, ge, le, permit) < 0) {
+        error = clib_error_return(0, "Need permit|deny and <prefix>/<len> with len <= ge <= le <= 32");
+    }
+
+done:
+    vec_free(name);
+    return error;
+}
+
+VLIB_CLI_COMMAND(bgp_set_prefix_list_command, static) = {
+    .path = "set bgp prefix-list",
+    .short_help = "set bgp prefix-list <name> [seq <n>] <permit|deny> <prefix>/<len> [ge <n>] [le <n>] "
+                  "| <name> del seq <n>",
+    .function = bgp_set_prefix_list_command_fn,
+};
+
+static clib_error_t *
+bgp_show_prefix_lists_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    bgp_main_t *bmp = &bgp_main;
+    bgp_prefix_list_t *list;
+    bgp_prefix_t *entries, *entry;
+
+    pool_foreach (list, bmp->prefix_lists) {
+        u32 id = list - bmp->prefix_lists, n_groups = 0, n_inbound = 0;
+        bgp_update_group_t *group;
+        bgp_neighbor_t *neighbor;
+
+        pool_foreach (group, bmp->update_groups) {
+            n_groups += bgp_prefix_list_used_by_group(bmp, group, id);
+        }
+        pool_foreach (neighbor, bmp->neighbors) {
+            n_inbound += bgp_prefix_list_used_inbound(bmp, neighbor, id);
+        }
+        vlib_cli_output(vm, "Prefix list %s (id %u): %u entries, %u trie nodes", list->name, id,
+                        list->n_entries, vec_len(list->nodes));
+        vlib_cli_output(vm, "  used by %u update groups, %u neighbors inbound; %llu prefixes re-checked",
+                        n_groups, n_inbound, list->n_rechecked);
+        entries = bgp_prefix_list_entries(list);
+        vec_foreach (entry, entries) {
+            vlib_cli_output(vm, "  seq %u %s %U/%u ge %u le %u", entry->seq, entry->permit ? "permit" : "deny",
+                            format_ip4_address, &entry->prefix, entry->mask_length, entry->ge, entry->le);
+        }
+        vec_free(entries);
+    }
+    return 0;
+}
+
+VLIB_CLI_COMMAND(bgp_show_prefix_lists_command, static) = {
+    .path = "show bgp prefix-lists",
+    .short_help = "show bgp prefix-lists",
+    .function = bgp_show_prefix_lists_command_fn,
+};
+
+// === Self-test ===
+
+void bgp_prefix_list_self_test(bgp_check_t *check) {
+    static const struct {
+        u8 mask_length, ge, le;
+        u8 want_ge, want_le;
+        bool valid;
+    } ranges[] = {
+        { 8, 0, 0, 8, 8, true },     // Exact length
+        { 8, 16, 0, 16, 32, true },  // ge alone runs to /32
+        { 8, 0, 16, 8, 16, true },   // le alone starts at the prefix length
+        { 8, 16, 24, 16, 24, true },
+        { 16, 8, 0, 0, 0, false },   // ge below the prefix length
+        { 8, 24, 16, 0, 0, false },  // ge above le
+        { 8, 0, 33, 0, 0, false },
+    };
+    static const struct {
+        u32 seq, addr;
+        u8 mask_length, ge, le;
+        bool permit;
+    } entries[] = {
+        { 10, 0x0a000000, 8, 16, 24, true },
+        { 20, 0x0a010000, 16, 0, 0, false },   // Shadowed by seq 10
+        { 5, 0x0a020000, 16, 0, 32, false },   // Deeper and lower seq, so it wins over seq 10
+        { 30, 0xc0a80000, 16, 24, 0, true },
+    };
+    static const struct {
+        u32 addr;
+        u8 mask_length;
+        bool permit;
+    } routes[] = {
+        { 0x0a000000, 8, false },      // Below ge
+        { 0x0a050000, 16, true },      // At ge
+        { 0x0a050500, 24, true },      // At le
+        { 0x0a050580, 25, false },     // Above le
+        { 0x0a010000, 16, true },      // Lowest seq decides
+        { 0x0a020300, 24, false },
+        { 0x0a020000, 16, false },
+        { 0xc0a80100, 24, true },
+        { 0xc0a80101, 32, true },
+        { 0xc0a80000, 16, false },
+        { 0xc0a80000, 23, false },
+        { 0x0b000000, 16, false },     // No entry covers it
+    };
+    bgp_prefix_list_t list = { 0 };
+    bgp_prefix_t removed;
+    ip4_address_t prefix;
+    u8 ge, le;
+    u32 i;
+
+    for (i = 0; i < ARRAY_LEN(ranges); i++) {
+        bool valid;
 
-    vec_foreach(list, bmp->prefix_lists) {
-        vec_free((*list)->entries); // Free the entries vector
-        clib_mem_free(*list);      // Free the prefix list itself
+        ge = ranges[i].ge;
+        le = ranges[i].le;
+        valid = bgp_prefix_range_resolve(ranges[i].mask_length, &ge, &le);
+        bgp_check(check, valid == ranges[i].valid && (!valid || (ge == ranges[i].want_ge && le == ranges[i].want_le)),
+                  "/%u ge %u le %u resolves to %s ge %u le %u", ranges[i].mask_length, ranges[i].ge, ranges[i].le,
+                  valid ? "valid" : "invalid", ge, le);
     }
-    vec_free(bmp->prefix_lists);   // Free the prefix lists vector
-}
\ No newline at end of file
+
+    vec_validate(list.nodes, 0);
+    prefix.as_u32 = clib_host_to_net_u32(0x0a000000);
+    bgp_check(check, bgp_prefix_list_permits(&list, prefix, 8), "empty list denies 10.0.0.0/8");
+
+    for (i = 0; i < ARRAY_LEN(entries); i++) {
+        ge = entries[i].ge;
+        le = entries[i].le;
+        bgp_prefix_range_resolve(entries[i].mask_length, &ge, &le);
+        prefix.as_u32 = clib_host_to_net_u32(entries[i].addr);
+        bgp_prefix_list_insert(&list, entries[i].seq, &prefix, entries[i].mask_length, ge, le, entries[i].permit);
+    }
+    for (i = 0; i < ARRAY_LEN(routes); i++) {
+        prefix.as_u32 = clib_host_to_net_u32(routes[i].addr);
+        bgp_check(check, bgp_prefix_list_permits(&list, prefix, routes[i].mask_length) == routes[i].permit,
+                  "%U/%u should be %s", format_ip4_address, &prefix, routes[i].mask_length,
+                  routes[i].permit ? "permitted" : "denied");
+    }
+
+    // Without seq 5, seq 10 covers 10.2.3.0/24
+    bgp_check(check, bgp_prefix_list_remove(&list, 5, &removed) && removed.seq == 5, "seq 5 not removed");
+    prefix.as_u32 = clib_host_to_net_u32(0x0a020300);
+    bgp_check(check, bgp_prefix_list_permits(&list, prefix, 24), "10.2.3.0/24 denied after removing seq 5");
+    bgp_check(check, list.n_entries == ARRAY_LEN(entries) - 1, "%u entries left", list.n_entries);
+
+    bgp_prefix_list_release(&list);
+}
@@ -0,0 +1,217 @@
+/*
+ * bgp_ring.h - lock-free rings for cross-thread BGP handoff
+ *
+ * Copyright (c) <current-year> <your-organization>
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __included_bgp_ring_h__
+#define __included_bgp_ring_h__
+
+#include <vppinfra/clib.h>
+#include <vppinfra/mem.h>
+#include <vppinfra/atomics.h>
+#include <vppinfra/cache.h>
+
+// What a handoff element carries
+typedef enum {
+    BGP_HANDOFF_RX_MESSAGE = 0,   // Worker -> main: one framed message (bgp_message_t *)
+    BGP_HANDOFF_ROUTE_BATCH,      // Worker -> main: vec of bgp_route_change_t
+    BGP_HANDOFF_TX_MESSAGE,       // Main -> worker: message to encode/send (bgp_message_t *)
+    BGP_HANDOFF_ACCEPT,           // Listener -> owner: inbound connection (bgp_socket_t *)
+    BGP_HANDOFF_DECISION,         // Main -> worker: best-path prefix range (bgp_decision_partition_t *)
+    BGP_HANDOFF_PEER_DOWN,        // Worker -> main: withdraw every path from neighbor_index
+    BGP_HANDOFF_ENCODE,           // Main -> worker: update groups to encode (bgp_update_task_t *)
+    BGP_HANDOFF_UPDATE_BATCH,     // Main -> worker: encoded UPDATEs for a member (bgp_update_batch_t *)
+    BGP_HANDOFF_RIB_OUT_REQUEST,  // Worker -> main: neighbor_index needs its full table
+    BGP_HANDOFF_SESSION_EVENT,    // Session thread -> owner: session layer callback (bgp_session.c)
+    BGP_HANDOFF_N_KINDS,
+} bgp_handoff_kind_t;
+
+typedef struct {
+    u32 kind;             // bgp_handoff_kind_t
+    u32 neighbor_index;   // Pool index in bgp_main.neighbors
+    void *data;           // Owned by the consumer once dequeued
+    u64 timestamp;        // clib_cpu_time_now() at enqueue, for latency accounting
+} bgp_handoff_elt_t;
+
+/*
+ * Single-producer single-consumer ring. Producer and consumer indices live
+ * on separate cache lines, and each side caches the other's index so the
+ * shared line is only touched when the ring looks full or empty.
+ */
+typedef struct {
+    CLIB_CACHE_LINE_ALIGN_MARK(cacheline0);
+    u32 head;             // Consumer position
+    u32 cached_tail;      // Consumer's last view of tail
+
+    CLIB_CACHE_LINE_ALIGN_MARK(cacheline1);
+    u32 tail;             // Producer position
+    u32 cached_head;      // Producer's last view of head
+
+    CLIB_CACHE_LINE_ALIGN_MARK(cacheline2);
+    u32 mask;             // Size - 1, size is a power of two
+    bgp_handoff_elt_t *elts;
+} bgp_spsc_ring_t;
+
+/*
+ * Multi-producer single-consumer ring (bounded, per-slot sequence numbers).
+ * Producers claim a slot with one CAS on tail; the consumer never writes a
+ * shared index other than the slot sequence it releases.
+ */
+typedef struct {
+    u32 sequence;
+    bgp_handoff_elt_t elt;
+} bgp_mpsc_slot_t;
+
+typedef struct {
+    CLIB_CACHE_LINE_ALIGN_MARK(cacheline0);
+    u32 head;             // Consumer position
+
+    CLIB_CACHE_LINE_ALIGN_MARK(cacheline1);
+    u32 tail;             // Next slot producers will claim
+
+    CLIB_CACHE_LINE_ALIGN_MARK(cacheline2);
+    u32 mask;
+    bgp_mpsc_slot_t *slots;
+} bgp_mpsc_ring_t;
+
+// === SPSC ===
+
+static_always_inline void bgp_spsc_ring_init(bgp_spsc_ring_t *r, u32 size) {
+    size = 1 << max_log2(size);
+    clib_memset(r, 0, sizeof(*r));
+    r->mask = size - 1;
+    r->elts = clib_mem_alloc_aligned(size * sizeof(bgp_handoff_elt_t), CLIB_CACHE_LINE_BYTES);
+}
+
+static_always_inline void bgp_spsc_ring_free(bgp_spsc_ring_t *r) {
+    if (r->elts) {
+        clib_mem_free(r->elts);
+    }
+    r->elts = 0;
+}
+
+// Producer side; returns the number of elements enqueued (may be < n)
+static_always_inline u32 bgp_spsc_ring_enqueue_burst(bgp_spsc_ring_t *r, bgp_handoff_elt_t *elts, u32 n) {
+    u32 tail = r->tail;
+    u32 free = r->mask + 1 - (tail - r->cached_head);
+    u32 i;
+
+    if (free < n) {
+        r->cached_head = clib_atomic_load_acq_n(&r->head);
+        free = r->mask + 1 - (tail - r->cached_head);
+        n = clib_min(n, free);
+    }
+    for (i = 0; i < n; i++) {
+        r->elts[(tail + i) & r->mask] = elts[i];
+    }
+    if (n) {
+        clib_atomic_store_rel_n(&r->tail, tail + n);
+    }
+    return n;
+}
+
+static_always_inline int bgp_spsc_ring_enqueue(bgp_spsc_ring_t *r, bgp_handoff_elt_t *elt) {
+    return bgp_spsc_ring_enqueue_burst(r, elt, 1) ? 0 : -1;
+}
+
+// Consumer side; returns the number of elements dequeued
+static_always_inline u32 bgp_spsc_ring_dequeue_burst(bgp_spsc_ring_t *r, bgp_handoff_elt_t *elts, u32 n) {
+    u32 head = r->head;
+    u32 avail = r->cached_tail - head;
+    u32 i;
+
+    if (avail < n) {
+        r->cached_tail = clib_atomic_load_acq_n(&r->tail);
+        avail = r->cached_tail - head;
+        n = clib_min(n, avail);
+    }
+    for (i = 0; i < n; i++) {
+        elts[i] = r->elts[(head + i) & r->mask];
+    }
+    if (n) {
+        clib_atomic_store_rel_n(&r->head, head + n);
+    }
+    return n;
+}
+
+static_always_inline u32 bgp_spsc_ring_count(bgp_spsc_ring_t *r) {
+    return clib_atomic_load_acq_n(&r->tail) - clib_atomic_load_acq_n(&r->head);
+}
+
+// === MPSC ===
+
+static_always_inline void bgp_mpsc_ring_init(bgp_mpsc_ring_t *r, u32 size) {
+    u32 i;
+
+    size = 1 << max_log2(size);
+    clib_memset(r, 0, sizeof(*r));
+    r->mask = size - 1;
+    r->slots = clib_mem_alloc_aligned(size * sizeof(bgp_mpsc_slot_t), CLIB_CACHE_LINE_BYTES);
+    for (i = 0; i < size; i++) {
+        r->slots[i].sequence = i;
+    }
+}
+
+static_always_inline void bgp_mpsc_ring_free(bgp_mpsc_ring_t *r) {
+    if (r->slots) {
+        clib_mem_free(r->slots);
+    }
+    r->slots = 0;
+}
+
+// Any thread; returns 0 on success, -1 if the ring is full
+static_always_inline int bgp_mpsc_ring_enqueue(bgp_mpsc_ring_t *r, bgp_handoff_elt_t *elt) {
+    u32 pos = clib_atomic_load_relax_n(&r->tail);
+    bgp_mpsc_slot_t *slot;
+
+    while (1) {
+        slot = &r->slots[pos & r->mask];
+        i32 diff = (i32)(clib_atomic_load_acq_n(&slot->sequence) - pos);
+
+        if (diff == 0) {
+            if (clib_atomic_bool_cmp_and_swap(&r->tail, pos, pos + 1)) {
+                break;
+            }
+            pos = clib_atomic_load_relax_n(&r->tail);
+        } else if (diff < 0) {
+            return -1; // Consumer has not released this slot yet
+        } else {
+            pos = clib_atomic_load_relax_n(&r->tail);
+        }
+    }
+
+    slot->elt = *elt;
+    clib_atomic_store_rel_n(&slot->sequence, pos + 1);
+    return 0;
+}
+
+// Owning thread only; returns the number of elements dequeued
+static_always_inline u32 bgp_mpsc_ring_dequeue_burst(bgp_mpsc_ring_t *r, bgp_handoff_elt_t *elts, u32 n) {
+    u32 head = r->head;
+    u32 i;
+
+    for (i = 0; i < n; i++) {
+        bgp_mpsc_slot_t *slot = &r->slots[(head + i) & r->mask];
+        if (clib_atomic_load_acq_n(&slot->sequence) != head + i + 1) {
+            break; // Empty, or a producer is still filling this slot
+        }
+        elts[i] = slot->elt;
+        clib_atomic_store_rel_n(&slot->sequence, head + i + r->mask + 1);
+    }
+    r->head = head + i;
+    return i;
+}
+
+#endif /* __included_bgp_ring_h__ */
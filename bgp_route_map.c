@@ -0,0 +1,833 @@
+/*
+ * bgp_route_map.c - route-maps compiled to match/set programs
+ *
+ * Copyright (c) <current-year> <your-organization>
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vlib/vlib.h>
+#include <bgp/bgp.h>
+
+/*
+ * A route-map is configured as entries ordered by seq, each with match
+ * clauses and set actions. Every change recompiles the whole map into one
+ * flat instruction array: an entry's matches, each jumping to the next
+ * entry on failure, then its sets and a PERMIT or DENY. Evaluation is a
+ * single forward pass over the array with no configuration lookups; all
+ * names are resolved to IDs at compile time.
+ *
+ * Maps are applied to received routes before they reach the Adj-RIB-In,
+ * and to advertised routes by the update group, so all members of a group
+ * share one outbound map. A map that is referenced but has no entries
+ * permits everything.
+ *
+ * Routes from a peer share a handful of attribute sets, so the matches
+ * that depend only on the set (AS path, community) are decided once per
+ * set and map version, as a bit per entry, and only the prefix and next
+ * hop matches run per route. The memo is per thread, since outbound maps
+ * run on whichever threads encode the update groups. Inbound rewrites of
+ * the attribute set are memoized the same way on the main thread.
+ */
+
+static bgp_route_map_t *bgp_route_map_get(bgp_main_t *bmp, const char *name) {
+    uword *p = hash_get_mem(bmp->route_map_by_name, name);
+
+    return p ? pool_elt_at_index(bmp->route_maps, p[0]) : NULL;
+}
+
+bgp_route_map_t *bgp_find_route_map(bgp_main_t *bmp, const char *name) {
+    return bgp_route_map_get(bmp, name);
+}
+
+/* ID of the named map, creating an empty one if needed */
+u32 bgp_route_map_intern(bgp_main_t *bmp, const char *name) {
+    bgp_route_map_t *map = bgp_route_map_get(bmp, name);
+
+    if (map) {
+        return map - bmp->route_maps;
+    }
+    pool_get_zero(bmp->route_maps, map);
+    strncpy(map->name, name, sizeof(map->name) - 1);
+    hash_set_mem(bmp->route_map_by_name, format(0, "%s%c", map->name, 0), map - bmp->route_maps);
+    bgp_route_map_compile(bmp, map);
+    return map - bmp->route_maps;
+}
+
+static_always_inline void bgp_route_map_emit(bgp_route_map_insn_t **program, u8 op, u32 arg) {
+    bgp_route_map_insn_t *insn;
+
+    vec_add2(*program, insn, 1);
+    clib_memset(insn, 0, sizeof(*insn));
+    insn->op = op;
+    insn->arg = arg;
+}
+
+/* Rebuild the program from the entries */
+static void bgp_route_map_build(bgp_route_map_t *map) {
+    bgp_route_map_insn_t *program = 0, *insn;
+    bgp_route_map_entry_t *entry;
+    u32 start;
+
+    map->has_attr_matches = 0;
+    vec_foreach (entry, map->entries) {
+        start = vec_len(program);
+        bgp_route_map_emit(&program, BGP_ROUTE_MAP_OP_ENTRY, entry - map->entries);
+        if (entry->match_as) {
+            bgp_route_map_emit(&program, BGP_ROUTE_MAP_OP_MATCH_AS_PATH, entry->match_as);
+        }
+        if (entry->match_as_path_regex != ~0) {
+            bgp_route_map_emit(&program, BGP_ROUTE_MAP_OP_MATCH_AS_PATH_REGEX, entry->match_as_path_regex);
+        }
+        if (entry->match_community) {
+            bgp_route_map_emit(&program, BGP_ROUTE_MAP_OP_MATCH_COMMUNITY, entry->match_community);
+        }
+        program[start].count = vec_len(program) - start - 1;
+        map->has_attr_matches |= program[start].count != 0;
+
+        if (entry->match_prefix_list != ~0) {
+            bgp_route_map_emit(&program, BGP_ROUTE_MAP_OP_MATCH_PREFIX_LIST, entry->match_prefix_list);
+        }
+        if (entry->match_next_hop_length != 0xff) {
+            u32 mask = entry->match_next_hop_length ? ~0u << (32 - entry->match_next_hop_length) : 0;
+            bgp_route_map_emit(&program, BGP_ROUTE_MAP_OP_MATCH_NEXT_HOP,
+                               entry->match_next_hop.as_u32 & clib_host_to_net_u32(mask));
+            vec_elt(program, vec_len(program) - 1).mask = clib_host_to_net_u32(mask);
+        }
+
+        // Sets of a deny entry would never be seen
+        if (entry->permit) {
+            if (entry->set_flags & BGP_ROUTE_MAP_SET_LOCAL_PREF) {
+                bgp_route_map_emit(&program, BGP_ROUTE_MAP_OP_SET_LOCAL_PREF, entry->local_pref);
+            }
+            if (entry->set_flags & BGP_ROUTE_MAP_SET_MED) {
+                bgp_route_map_emit(&program, BGP_ROUTE_MAP_OP_SET_MED, entry->med);
+            }
+            if (entry->set_flags & BGP_ROUTE_MAP_SET_PREPEND) {
+                bgp_route_map_emit(&program, BGP_ROUTE_MAP_OP_SET_PREPEND, entry->prepend_as);
+                vec_elt(program, vec_len(program) - 1).count = entry->prepend_count;
+            }
+            if (entry->set_flags & BGP_ROUTE_MAP_SET_COMMUNITY) {
+                bgp_route_map_emit(&program, BGP_ROUTE_MAP_OP_SET_COMMUNITY, entry->communities);
+            }
+        }
+        bgp_route_map_emit(&program, entry->permit ? BGP_ROUTE_MAP_OP_PERMIT : BGP_ROUTE_MAP_OP_DENY, 0);
+
+        for (insn = program + start; insn < vec_end(program); insn++) {
+            insn->fail = vec_len(program);
+        }
+    }
+    // Nothing matched: deny, unless the map has no entries at all
+    bgp_route_map_emit(&program, vec_len(map->entries) ? BGP_ROUTE_MAP_OP_DENY : BGP_ROUTE_MAP_OP_PERMIT, 0);
+
+    vec_free(map->program);
+    map->program = program;
+    map->version++; // Retires every memoized result
+    vec_validate_aligned(map->caches, vlib_num_workers(), CLIB_CACHE_LINE_BYTES);
+}
+
+/* Rebuild the program from the entries and make every user pick it up */
+void bgp_route_map_compile(bgp_main_t *bmp, bgp_route_map_t *map) {
+    bgp_update_group_t *group;
+
+    bgp_route_map_build(map);
+
+    // Groups advertising through the map diff their whole Adj-RIB-Out again
+    pool_foreach (group, bmp->update_groups) {
+        if (group->route_map_out == map - bmp->route_maps) {
+            bgp_update_group_reevaluate_all(group);
+        }
+    }
+}
+
+static_always_inline int bgp_route_map_match_attr(bgp_main_t *bmp, bgp_route_map_insn_t *insn, u32 attr_set) {
+    switch (insn->op) {
+    case BGP_ROUTE_MAP_OP_MATCH_AS_PATH:
+        return bgp_attr_set_has_as(bgp_attr_set_get(bmp, attr_set), insn->arg);
+    case BGP_ROUTE_MAP_OP_MATCH_AS_PATH_REGEX:
+        // Has its own per-set cache, which outlives map versions
+        return bgp_as_path_regex_match_set(bmp, pool_elt_at_index(bmp->as_path_regexes, insn->arg), attr_set);
+    default:
+        return bgp_attr_set_has_community(bgp_attr_set_get(bmp, attr_set), insn->arg);
+    }
+}
+
+/* Bit per cached entry whose attribute-set matches all pass */
+static u64 bgp_route_map_attr_mask(bgp_main_t *bmp, bgp_route_map_t *map, u32 attr_set) {
+    bgp_route_map_insn_t *insn;
+    u64 mask = 0;
+    u32 i;
+
+    vec_foreach (insn, map->program) {
+        if (insn->op != BGP_ROUTE_MAP_OP_ENTRY || insn->arg >= BGP_ROUTE_MAP_CACHED_ENTRIES) {
+            continue;
+        }
+        for (i = 1; i <= insn->count && bgp_route_map_match_attr(bmp, insn + i, attr_set); i++)
+            ;
+        if (i > insn->count) {
+            mask |= 1ULL << insn->arg;
+        }
+    }
+    return mask;
+}
+
+/* The attribute-set mask from this thread's memo, computing it on a miss */
+static_always_inline u64 bgp_route_map_cached_mask(bgp_main_t *bmp, bgp_route_map_t *map, u32 attr_set) {
+    bgp_route_map_cache_t *cache = vec_elt_at_index(map->caches, vlib_get_thread_index());
+    uword *p;
+    u64 mask;
+
+    if (cache->version != map->version) {
+        hash_free(cache->mask_by_attr_set);
+        cache->version = map->version;
+    }
+    if (!cache->mask_by_attr_set) {
+        cache->mask_by_attr_set = hash_create(0, sizeof(uword));
+    }
+    if ((p = hash_get(cache->mask_by_attr_set, attr_set))) {
+        cache->hits++;
+        return p[0];
+    }
+    cache->misses++;
+    mask = bgp_route_map_attr_mask(bmp, map, attr_set);
+    hash_set(cache->mask_by_attr_set, attr_set, mask);
+    return mask;
+}
+
+/* One pass over the program with the attribute-set matches of cached entries already decided */
+static bool bgp_route_map_run(bgp_main_t *bmp, bgp_route_map_t *map, bgp_route_t *route, u64 attr_mask,
+                              bgp_route_map_result_t *result) {
+    bgp_route_map_insn_t *insn = map->program;
+
+    result->local_pref = route->local_pref;
+    result->med = route->med;
+    result->prepend_as = 0;
+    result->prepend_count = 0;
+    result->communities = route->attr_set;
+    result->entry = ~0;
+
+    while (1) {
+        switch (insn->op) {
+        case BGP_ROUTE_MAP_OP_ENTRY:
+            result->entry = insn->arg;
+            if (insn->arg < BGP_ROUTE_MAP_CACHED_ENTRIES) {
+                if (!(attr_mask & (1ULL << insn->arg))) {
+                    insn = map->program + insn->fail;
+                    continue;
+                }
+                insn += insn->count; // Decided by the mask
+            }
+            break;
+        case BGP_ROUTE_MAP_OP_MATCH_AS_PATH:
+        case BGP_ROUTE_MAP_OP_MATCH_AS_PATH_REGEX:
+        case BGP_ROUTE_MAP_OP_MATCH_COMMUNITY:
+            if (!bgp_route_map_match_attr(bmp, insn, route->attr_set)) {
+                insn = map->program + insn->fail;
+                continue;
+            }
+            break;
+        case BGP_ROUTE_MAP_OP_MATCH_PREFIX_LIST:
+            if (!bgp_prefix_list_permits(pool_elt_at_index(bmp->prefix_lists, insn->arg),
+                                         route->prefix, route->mask_length)) {
+                insn = map->program + insn->fail;
+                continue;
+            }
+            break;
+        case BGP_ROUTE_MAP_OP_MATCH_NEXT_HOP:
+            if ((route->next_hop.as_u32 & insn->mask) != insn->arg) {
+                insn = map->program + insn->fail;
+                continue;
+            }
+            break;
+        case BGP_ROUTE_MAP_OP_SET_LOCAL_PREF:
+            result->local_pref = insn->arg;
+            break;
+        case BGP_ROUTE_MAP_OP_SET_MED:
+            result->med = insn->arg;
+            break;
+        case BGP_ROUTE_MAP_OP_SET_PREPEND:
+            result->prepend_as = insn->arg;
+            result->prepend_count = insn->count;
+            break;
+        case BGP_ROUTE_MAP_OP_SET_COMMUNITY:
+            result->communities = insn->arg;
+            break;
+        case BGP_ROUTE_MAP_OP_PERMIT:
+            return true;
+        default:
+            if (insn == vec_end(map->program) - 1) {
+                result->entry = ~0; // Fell off the end
+            }
+            return false;
+        }
+        insn++;
+    }
+}
+
+/* Run the map over a route; on permit, result holds the attributes to use */
+bool bgp_route_map_apply(bgp_main_t *bmp, bgp_route_map_t *map, bgp_route_t *route,
+                         bgp_route_map_result_t *result) {
+    u64 attr_mask = map->has_attr_matches ? bgp_route_map_cached_mask(bmp, map, route->attr_set) : ~0ULL;
+
+    return bgp_route_map_run(bmp, map, route, attr_mask, result);
+}
+
+bool bgp_route_map_uses_prefix_list(bgp_route_map_t *map, u32 prefix_list) {
+    bgp_route_map_insn_t *insn;
+
+    vec_foreach (insn, map->program) {
+        if (insn->op == BGP_ROUTE_MAP_OP_MATCH_PREFIX_LIST && insn->arg == prefix_list) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Drop the memoized rewrites and the references they hold */
+static void bgp_route_map_rewrites_free(bgp_main_t *bmp, bgp_route_map_t *map) {
+    uword key, attr_set;
+
+    hash_foreach (key, attr_set, map->rewrite_by_key, ({
+        bgp_attr_set_unlock(bmp, attr_set);
+    }));
+    hash_free(map->rewrite_by_key);
+}
+
+/* Attribute sets were freed; forget what was memoized under their IDs */
+void bgp_route_maps_forget_attr_sets(bgp_main_t *bmp, uword *freed) {
+    bgp_route_map_cache_t *cache;
+    bgp_route_map_t *map;
+    uword key, attr_set, *stale = 0, *k;
+    u32 id;
+
+    pool_foreach (map, bmp->route_maps) {
+        vec_foreach (cache, map->caches) {
+            clib_bitmap_foreach (id, freed) {
+                hash_unset(cache->mask_by_attr_set, id);
+            }
+        }
+        hash_foreach (key, attr_set, map->rewrite_by_key, ({
+            if (clib_bitmap_get(freed, key >> 32)) {
+                vec_add1(stale, key);
+            }
+        }));
+        vec_foreach (k, stale) {
+            bgp_attr_set_unlock(bmp, hash_get(map->rewrite_by_key, *k)[0]);
+            hash_unset(map->rewrite_by_key, *k);
+        }
+        vec_reset_length(stale);
+    }
+    vec_free(stale);
+}
+
+/* Inbound policy on the main thread: rewrite a received path in place, false if denied */
+bool bgp_route_map_apply_path(bgp_main_t *bmp, u32 map, ip4_address_t prefix, u8 mask_length,
+                              bgp_path_t *path) {
+    bgp_route_map_t *m = pool_elt_at_index(bmp->route_maps, map);
+    bgp_route_map_result_t result;
+    uword key, *p;
+    bgp_route_t route = {
+        .prefix = prefix,
+        .mask_length = mask_length,
+        .next_hop = path->next_hop,
+        .local_pref = path->local_pref,
+        .as_path_length = path->as_path_length,
+        .origin = path->origin,
+        .med = path->med,
+        .attr_set = path->attr_set,
+    };
+
+    if (!bgp_route_map_apply(bmp, m, &route, &result)) {
+        return false;
+    }
+    path->local_pref = result.local_pref;
+    path->med = result.med;
+    if (result.communities == path->attr_set && !result.prepend_count) {
+        return true;
+    }
+
+    // The new set depends only on the old one and the entry's sets
+    if (m->rewrite_version != m->version) {
+        bgp_route_map_rewrites_free(bmp, m);
+        m->rewrite_by_key = hash_create(0, sizeof(uword));
+        m->rewrite_version = m->version;
+    }
+    key = ((u64)path->attr_set << 32) | result.entry;
+    if ((p = hash_get(m->rewrite_by_key, key))) {
+        path->attr_set = p[0];
+    } else {
+        if (result.communities != path->attr_set) {
+            path->attr_set = bgp_attr_set_replace_communities(bmp, path->attr_set, result.communities);
+        }
+        if (result.prepend_count) {
+            path->attr_set = bgp_attr_set_prepend(bmp, path->attr_set, result.prepend_as, result.prepend_count);
+        }
+        hash_set(m->rewrite_by_key, key, path->attr_set);
+        bgp_attr_set_lock(bmp, path->attr_set);
+    }
+    path->as_path_length += result.prepend_count;
+    return true;
+}
+
+/*
+ * Attach a map (~0 to detach); outbound changes move the neighbor to a
+ * matching update group, which withdraws what the new map filters
+ */
+void bgp_neighbor_set_route_map(bgp_main_t *bmp, bgp_neighbor_t *neighbor, u32 map, bool inbound) {
+    if (inbound) {
+        // Routes already received keep their result until the session resets (no ROUTE-REFRESH)
+        neighbor->route_map_in = map;
+        return;
+    }
+    if (neighbor->route_map_out == map) {
+        return;
+    }
+    neighbor->route_map_out = map;
+    bgp_update_group_rejoin(bmp, neighbor);
+}
+
+static void bgp_route_map_release(bgp_route_map_t *map) {
+    bgp_route_map_cache_t *cache;
+
+    vec_free(map->entries);
+    vec_free(map->program);
+    vec_foreach (cache, map->caches) {
+        hash_free(cache->mask_by_attr_set);
+    }
+    vec_free(map->caches);
+    hash_free(map->rewrite_by_key);
+}
+
+void bgp_route_maps_free(bgp_main_t *bmp) {
+    bgp_route_map_t *map;
+    hash_pair_t *hp;
+
+    pool_foreach (map, bmp->route_maps) {
+        bgp_route_map_release(map);
+    }
+    pool_free(bmp->route_maps);
+    hash_foreach_pair (hp, bmp->route_map_by_name, ({
+        u8 *key = (u8 *)hp->key;
+        vec_free(key);
+    }));
+    hash_free(bmp->route_map_by_name);
+}
+
+// === CLI ===
+
+static u8 *format_bgp_route_map_entry(u8 *s, va_list *args) {
+    bgp_main_t *bmp = va_arg(*args, bgp_main_t *);
+    bgp_route_map_entry_t *entry = va_arg(*args, bgp_route_map_entry_t *);
+
+    s = format(s, "seq %u %s", entry->seq, entry->permit ? "permit" : "deny");
+    if (entry->match_prefix_list != ~0) {
+        s = format(s, " match prefix-list %s",
+                   pool_elt_at_index(bmp->prefix_lists, entry->match_prefix_list)->name);
+    }
+    if (entry->match_as) {
+        s = format(s, " match as-path %u", entry->match_as);
+    }
+    if (entry->match_as_path_regex != ~0) {
+        s = format(s, " match as-path regex %s",
+                   pool_elt_at_index(bmp->as_path_regexes, entry->match_as_path_regex)->pattern);
+    }
+    if (entry->match_community) {
+        s = format(s, " match community %u:%u", entry->match_community >> 16, entry->match_community & 0xffff);
+    }
+    if (entry->match_next_hop_length != 0xff) {
+        s = format(s, " match next-hop %U/%u", format_ip4_address, &entry->match_next_hop,
+                   entry->match_next_hop_length);
+    }
+    if (entry->set_flags & BGP_ROUTE_MAP_SET_LOCAL_PREF) {
+        s = format(s, " set local-preference %u", entry->local_pref);
+    }
+    if (entry->set_flags & BGP_ROUTE_MAP_SET_MED) {
+        s = format(s, " set metric %u", entry->med);
+    }
+    if (entry->set_flags & BGP_ROUTE_MAP_SET_PREPEND) {
+        s = format(s, " set as-path prepend %u %u", entry->prepend_as, entry->prepend_count);
+    }
+    if (entry->set_flags & BGP_ROUTE_MAP_SET_COMMUNITY) {
+        u32 *communities = bgp_attr_set_get(bmp, entry->communities)->communities, *c;
+
+        s = format(s, " set community");
+        vec_foreach (c, communities) {
+            s = format(s, " %u:%u", *c >> 16, *c & 0xffff);
+        }
+        if (!vec_len(communities)) {
+            s = format(s, " none");
+        }
+    }
+    return s;
+}
+
+static clib_error_t *
+bgp_set_route_map_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    bgp_main_t *bmp = &bgp_main;
+    bgp_route_map_entry_t entry = { .match_prefix_list = ~0, .match_next_hop_length = 0xff,
+                                    .match_as_path_regex = ~0 };
+    bgp_route_map_t *map;
+    u32 *communities = 0, community, length = ~0, prepend_count = 0, value, i;
+    u8 *name = 0, *list_name = 0, *regex = 0;
+    int permit = -1, is_del = 0;
+    clib_error_t *error = 0;
+
+    if (!unformat(input, "%s", &name)) {
+        return clib_error_return(0, "Usage: set bgp route-map <name> [seq <n>] <permit|deny> "
+                                    "[match ...] [set ...] | <name> del seq <n>");
+    }
+    vec_add1(name, 0);
+    while (unformat_check_input(input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat(input, "seq %u", &entry.seq))
+            ;
+        else if (unformat(input, "permit"))
+            permit = 1;
+        else if (unformat(input, "deny"))
+            permit = 0;
+        else if (unformat(input, "del"))
+            is_del = 1;
+        else if (unformat(input, "match prefix-list %s", &list_name))
+            ;
+        else if (unformat(input, "match as-path regex %s", &regex))
+            ;
+        else if (unformat(input, "match as-path %u", &entry.match_as))
+            ;
+        else if (unformat(input, "match community %U", unformat_bgp_community, &entry.match_community))
+            ;
+        else if (unformat(input, "match next-hop %U/%u", unformat_ip4_address, &entry.match_next_hop, &length))
+            ;
+        else if (unformat(input, "set local-preference %u", &value)) {
+            entry.local_pref = value;
+            entry.set_flags |= BGP_ROUTE_MAP_SET_LOCAL_PREF;
+        } else if (unformat(input, "set metric %u", &value)) {
+            entry.med = value;
+            entry.set_flags |= BGP_ROUTE_MAP_SET_MED;
+        } else if (unformat(input, "set as-path prepend %u %u", &entry.prepend_as, &prepend_count)) {
+            entry.set_flags |= BGP_ROUTE_MAP_SET_PREPEND;
+        } else if (unformat(input, "set community none"))
+            entry.set_flags |= BGP_ROUTE_MAP_SET_COMMUNITY;
+        else if (unformat(input, "set community %U", unformat_bgp_community, &community)) {
+            vec_add1(communities, community);
+            while (unformat(input, "%U", unformat_bgp_community, &community)) {
+                vec_add1(communities, community);
+            }
+            entry.set_flags |= BGP_ROUTE_MAP_SET_COMMUNITY;
+        } else {
+            error = clib_error_return(0, "Unknown input '%U'", format_unformat_error, input);
+            goto done;
+        }
+    }
+    if (vec_len(name) > sizeof(map->name) || vec_len(list_name) >= sizeof(map->name)) {
+        error = clib_error_return(0, "Names are limited to %u characters", sizeof(map->name) - 1);
+        goto done;
+    }
+
+    if (is_del) {
+        if (!(map = bgp_find_route_map(bmp, (char *)name))) {
+            error = clib_error_return(0, "Unknown route-map %s", name);
+            goto done;
+        }
+        for (i = 0; i < vec_len(map->entries); i++) {
+            if (map->entries[i].seq == entry.seq) {
+                break;
+            }
+        }
+        if (!entry.seq || i == vec_len(map->entries)) {
+            error = clib_error_return(0, "No entry seq %u in route-map %s", entry.seq, name);
+            goto done;
+        }
+        bgp_attr_set_unlock(bmp, map->entries[i].communities);
+        vec_delete(map->entries, 1, i);
+        bgp_route_map_compile(bmp, map);
+        goto done;
+    }
+    if (permit < 0) {
+        error = clib_error_return(0, "Need permit or deny");
+        goto done;
+    }
+    if ((length != ~0 && length > 32) || ((entry.set_flags & BGP_ROUTE_MAP_SET_PREPEND) &&
+                                          (prepend_count == 0 || prepend_count > 16))) {
+        error = clib_error_return(0, "Next hop length is at most 32, prepend count 1-16");
+        goto done;
+    }
+
+    if (regex) {
+        vec_add1(regex, 0);
+        if ((error = bgp_as_path_regex_intern(bmp, (char *)regex, &entry.match_as_path_regex))) {
+            goto done;
+        }
+    }
+
+    map = pool_elt_at_index(bmp->route_maps, bgp_route_map_intern(bmp, (char *)name));
+    entry.permit = permit;
+    if (length != ~0) {
+        entry.match_next_hop_length = length;
+    }
+    entry.prepend_count = prepend_count;
+    if (list_name) {
+        vec_add1(list_name, 0);
+        entry.match_prefix_list = bgp_prefix_list_intern(bmp, (char *)list_name);
+    }
+    if (entry.set_flags & BGP_ROUTE_MAP_SET_COMMUNITY) {
+        entry.communities = bgp_attr_set_intern(bmp, 0, communities);
+        bgp_attr_set_lock(bmp, entry.communities);
+    }
+    if (!entry.seq) {
+        entry.seq = vec_len(map->entries) ? (vec_end(map->entries)[-1].seq / 10 + 1) * 10 : 10;
+    }
+
+    // Replace an entry with the same seq, otherwise insert in seq order
+    for (i = 0; i < vec_len(map->entries) && map->entries[i].seq < entry.seq; i++)
+        ;
+    if (i < vec_len(map->entries) && map->entries[i].seq == entry.seq) {
+        bgp_attr_set_unlock(bmp, map->entries[i].communities);
+        map->entries[i] = entry;
+    } else {
+        vec_insert_elts(map->entries, &entry, 1, i);
+    }
+    bgp_route_map_compile(bmp, map);
+
+done:
+    vec_free(name);
+    vec_free(list_name);
+    vec_free(regex);
+    vec_free(communities);
+    return error;
+}
+
+VLIB_CLI_COMMAND(bgp_set_route_map_command, static) = {
+    .path = "set bgp route-map",
+    .short_help = "set bgp route-map <name> [seq <n>] <permit|deny> [match prefix-list <name>] "
+                  "[match as-path <AS>] [match as-path regex <regex>] [match community <AS:value>] "
+                  "[match next-hop <prefix>/<len>] "
+                  "[set local-preference <n>] [set metric <n>] [set as-path prepend <AS> <count>] "
+                  "[set community <AS:value>...|none] | <name> del seq <n>",
+    .function = bgp_set_route_map_command_fn,
+};
+
+static clib_error_t *
+bgp_show_route_maps_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    bgp_main_t *bmp = &bgp_main;
+    bgp_route_map_entry_t *entry;
+    bgp_route_map_cache_t *cache;
+    bgp_route_map_t *map;
+
+    pool_foreach (map, bmp->route_maps) {
+        u64 hits = 0, misses = 0;
+
+        vec_foreach (cache, map->caches) {
+            hits += cache->hits;
+            misses += cache->misses;
+        }
+        vlib_cli_output(vm, "Route-map %s (id %u): %u entries, %u instructions, version %u", map->name,
+                        map - bmp->route_maps, vec_len(map->entries), vec_len(map->program), map->version);
+        vlib_cli_output(vm, "  attribute-set memo: %llu hits, %llu misses, %u inbound rewrites",
+                        hits, misses, hash_elts(map->rewrite_by_key));
+        vec_foreach (entry, map->entries) {
+            vlib_cli_output(vm, "  %U", format_bgp_route_map_entry, bmp, entry);
+        }
+    }
+    return 0;
+}
+
+VLIB_CLI_COMMAND(bgp_show_route_maps_command, static) = {
+    .path = "show bgp route-maps",
+    .short_help = "show bgp route-maps",
+    .function = bgp_show_route_maps_command_fn,
+};
+
+// === Evaluation benchmark ===
+
+/*
+ * Runs a configured map over synthetic routes: sequential /24s spread over
+ * a handful of interned attribute sets and next hops, as a full table from
+ * a few upstreams looks. Only evaluation is timed, once deciding the
+ * attribute-set matches for every route and once through the memo.
+ */
+static clib_error_t *
+bgp_route_map_benchmark_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    bgp_main_t *bmp = &bgp_main;
+    u32 n_routes = 1000000, n_sets = 64, n_permitted = 0, n_uncached = 0, i;
+    u32 *sets = 0, as_path[3], community;
+    bgp_route_t *routes = 0, *route;
+    bgp_route_map_result_t result;
+    bgp_route_map_t *map;
+    bgp_bench_t bench;
+    u8 *name = 0;
+
+    if (!unformat(input, "%s", &name)) {
+        return clib_error_return(0, "Usage: test bgp route-map-benchmark <name> [routes <n>] [attr-sets <n>]");
+    }
+    vec_add1(name, 0);
+    map = bgp_find_route_map(bmp, (char *)name);
+    vec_free(name);
+    if (!map) {
+        return clib_error_return(0, "Unknown route-map");
+    }
+    while (unformat_check_input(input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat(input, "routes %u", &n_routes))
+            ;
+        else if (unformat(input, "attr-sets %u", &n_sets))
+            ;
+        else
+            return clib_error_return(0, "unknown input `%U'", format_unformat_error, input);
+    }
+    if (n_routes == 0 || n_sets == 0 || n_sets > 4096) {
+        return clib_error_return(0, "routes must be non-zero, attr-sets 1-4096");
+    }
+
+    // Nothing locks these sets; the next sweep frees those no live route shares
+    for (i = 0; i < n_sets; i++) {
+        u32 *path = 0, *communities = 0;
+
+        as_path[0] = 64512 + i % 8;
+        as_path[1] = 3356 + i % 5;
+        as_path[2] = 65000 + i;
+        vec_add(path, as_path, 1 + i % 3);
+        community = (65000 << 16) | (i % 4);
+        vec_add1(communities, community);
+        vec_add1(sets, bgp_attr_set_intern(bmp, path, communities));
+        vec_free(path);
+        vec_free(communities);
+    }
+
+    vec_validate(routes, n_routes - 1);
+    vec_foreach (route, routes) {
+        u32 n = route - routes;
+
+        clib_memset(route, 0, sizeof(*route));
+        route->prefix.as_u32 = clib_host_to_net_u32(0x01000000 + (n << 8));
+        route->mask_length = 24;
+        route->next_hop.as_u32 = clib_host_to_net_u32(0x0a000001 + (n % 4));
+        route->local_pref = 100;
+        route->attr_set = sets[n % n_sets];
+    }
+
+    bgp_bench_init(&bench, vm);
+    vlib_cli_output(vm, "route-map %s: %u instructions, %u routes over %u attribute sets",
+                    map->name, vec_len(map->program), n_routes, n_sets);
+
+    bgp_bench_start(&bench);
+    vec_foreach (route, routes) {
+        u64 attr_mask = bgp_route_map_attr_mask(bmp, map, route->attr_set);
+        n_uncached += bgp_route_map_run(bmp, map, route, attr_mask, &result);
+    }
+    bgp_bench_report(&bench, "uncached", n_routes, "routes", bgp_bench_stop(&bench), "%u permitted", n_uncached);
+
+    bgp_bench_start(&bench);
+    vec_foreach (route, routes) {
+        n_permitted += bgp_route_map_apply(bmp, map, route, &result);
+    }
+    bgp_bench_report(&bench, "memoized", n_routes, "routes", bgp_bench_stop(&bench), "%u permitted", n_permitted);
+
+    vec_free(routes);
+    vec_free(sets);
+    bgp_bench_free(&bench);
+    return 0;
+}
+
+VLIB_CLI_COMMAND(bgp_route_map_benchmark_command, static) = {
+    .path = "test bgp route-map-benchmark",
+    .short_help = "test bgp route-map-benchmark <name> [routes <n>] [attr-sets <n>]",
+    .function = bgp_route_map_benchmark_command_fn,
+};
+
+// === Self-test ===
+
+static void bgp_route_map_test_entry(bgp_route_map_t *map, u32 seq, bool permit, u32 next_hop, u8 length,
+                                     u32 as, u32 community) {
+    bgp_route_map_entry_t entry = { .seq = seq, .permit = permit, .match_prefix_list = ~0,
+                                    .match_next_hop_length = length, .match_as_path_regex = ~0,
+                                    .match_as = as, .match_community = community };
+
+    entry.match_next_hop.as_u32 = clib_host_to_net_u32(next_hop);
+    vec_add1(map->entries, entry);
+}
+
+/* Run a route through the memo and without it; both must give the expected entry and verdict */
+static void bgp_route_map_test_route(bgp_check_t *check, bgp_main_t *bmp, bgp_route_map_t *map, u32 next_hop,
+                                     u32 attr_set, u32 entry, bool permit, u32 local_pref, u32 med) {
+    bgp_route_t route = { .mask_length = 24, .local_pref = 100, .attr_set = attr_set };
+    bgp_route_map_result_t result;
+    bool permitted;
+    u32 pass;
+
+    route.prefix.as_u32 = clib_host_to_net_u32(0xc6336400);
+    route.next_hop.as_u32 = clib_host_to_net_u32(next_hop);
+    for (pass = 0; pass < 3; pass++) {
+        // Pass 0 fills the memo, pass 1 hits it, pass 2 skips it
+        if (pass < 2) {
+            permitted = bgp_route_map_apply(bmp, map, &route, &result);
+        } else {
+            permitted = bgp_route_map_run(bmp, map, &route, bgp_route_map_attr_mask(bmp, map, attr_set), &result);
+        }
+        bgp_check(check,
+                  permitted == permit && result.entry == entry &&
+                      (!permit || (result.local_pref == local_pref && result.med == med)),
+                  "%s: next hop %U set %u pass %u: %s by entry %d (lp %u med %u), expected entry %d",
+                  map->name, format_ip4_address, &route.next_hop, attr_set, pass,
+                  permitted ? "permitted" : "denied", result.entry, result.local_pref, result.med, entry);
+    }
+}
+
+void bgp_route_map_self_test(bgp_check_t *check) {
+    bgp_main_t *bmp = &bgp_main;
+    bgp_route_map_t map = { .name = "self-test" };
+    u32 transit_tagged, origin_tagged, origin, i;
+    u32 *path = 0, *communities = 0;
+
+    // Unreferenced, so the next sweep frees them unless live routes share them
+    vec_add1(path, 65001);
+    vec_add1(communities, (65000 << 16) | 1);
+    transit_tagged = bgp_attr_set_intern(bmp, path, communities);
+    path[0] = 65002;
+    origin_tagged = bgp_attr_set_intern(bmp, path, communities);
+    origin = bgp_attr_set_intern(bmp, path, 0);
+
+    // No entries permits everything
+    bgp_route_map_build(&map);
+    bgp_route_map_test_route(check, bmp, &map, 0xac100001, origin, ~0, true, 100, 0);
+
+    // The first entry that matches decides, even where later ones match too
+    bgp_route_map_test_entry(&map, 10, true, 0x0a000000, 8, 0, 0);
+    vec_end(map.entries)[-1].set_flags = BGP_ROUTE_MAP_SET_LOCAL_PREF;
+    vec_end(map.entries)[-1].local_pref = 200;
+    bgp_route_map_test_entry(&map, 20, false, 0x0a010000, 16, 0, 0);
+    bgp_route_map_test_entry(&map, 30, false, 0, 0xff, 65001, 0);
+    bgp_route_map_test_entry(&map, 40, true, 0, 0xff, 0, (65000 << 16) | 1);
+    vec_end(map.entries)[-1].set_flags = BGP_ROUTE_MAP_SET_MED;
+    vec_end(map.entries)[-1].med = 5;
+    bgp_route_map_test_entry(&map, 50, true, 0xc0000200, 24, 0, 0);
+    vec_end(map.entries)[-1].set_flags = BGP_ROUTE_MAP_SET_LOCAL_PREF;
+    vec_end(map.entries)[-1].local_pref = 50;
+    bgp_route_map_build(&map);
+
+    bgp_route_map_test_route(check, bmp, &map, 0x0a010203, transit_tagged, 0, true, 200, 0);
+    bgp_route_map_test_route(check, bmp, &map, 0xac100001, transit_tagged, 2, false, 0, 0);
+    bgp_route_map_test_route(check, bmp, &map, 0xac100001, origin_tagged, 3, true, 100, 5);
+    bgp_route_map_test_route(check, bmp, &map, 0xc0000207, origin, 4, true, 50, 0);
+    bgp_route_map_test_route(check, bmp, &map, 0xac100001, origin, ~0, false, 0, 0);
+
+    // Entries past the memoized ones are matched per route
+    vec_reset_length(map.entries);
+    for (i = 0; i < BGP_ROUTE_MAP_CACHED_ENTRIES + 2; i++) {
+        bgp_route_map_test_entry(&map, 10 * (i + 1), false, 0, 0xff, 1 + i, 0);
+    }
+    bgp_route_map_test_entry(&map, 10 * (i + 1), true, 0, 0xff, 65002, 0);
+    bgp_route_map_build(&map);
+    bgp_route_map_test_route(check, bmp, &map, 0xac100001, origin, i, true, 100, 0);
+    bgp_route_map_test_route(check, bmp, &map, 0xac100001, transit_tagged, ~0, false, 0, 0);
+
+    bgp_route_map_release(&map);
+    vec_free(path);
+    vec_free(communities);
+}
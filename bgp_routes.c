@@ -1,41 +1,188 @@
 #include <bgp/bgp.h>
 #include <vlib/vlib.h>
 
-// Add a new route
-void bgp_add_route(bgp_main_t *bmp, ip4_address_t prefix, u8 mask_length, ip4_address_t next_hop) {
+/*
+ * The RIB (bmp->routes) is owned by the main thread. Workers never touch
+ * the pool: changes arrive as route batches over the handoff rings, and
+ * readers use the immutable snapshot published by bgp_rib_publish().
+ */
+
+// Workers forward a single change to the RIB owner: 1 if handed off, 0 on the owner, -1 if the ring is full
+static int bgp_route_forward(bgp_main_t *bmp, ip4_address_t prefix, u8 mask_length,
+                             ip4_address_t next_hop, u8 is_withdraw) {
+    bgp_route_change_t *changes = 0;
+    bgp_route_change_t change = {
+        .prefix = prefix,
+        .next_hop = next_hop,
+        .mask_length = mask_length,
+        .is_withdraw = is_withdraw,
+    };
+
+    if (vlib_get_thread_index() == 0) {
+        return 0;
+    }
+    vec_add1(changes, change); // Local routes carry no received attributes
+    if (bgp_handoff_to_main(bmp, BGP_HANDOFF_ROUTE_BATCH, ~0, changes) < 0) {
+        clib_warning("RIB handoff ring full, change for %U/%d not applied",
+                     format_ip4_address, &prefix, mask_length);
+        vec_free(changes);
+        return -1;
+    }
+    return 1;
+}
+
+// Add a new route; -1 if a worker could not hand it to the RIB owner, and nothing changed
+int bgp_add_route(bgp_main_t *bmp, ip4_address_t prefix, u8 mask_length, ip4_address_t next_hop) {
     bgp_route_t *route;
+    int rv;
 
-    clib_spinlock_lock(&bmp->lock);
-    pool_get(bmp->routes, route);
+    if ((rv = bgp_route_forward(bmp, prefix, mask_length, next_hop, 0))) {
+        return rv < 0 ? -1 : 0;
+    }
+
+    pool_get_zero(bmp->routes, route);
 
     route->prefix = prefix;
     route->mask_length = mask_length;
     route->next_hop = next_hop;
+    route->source_neighbor = ~0;
+    bgp_rib_changed(bmp, bgp_dest_key(prefix, mask_length), route - bmp->routes);
 
     clib_warning("Added BGP route: %U/%d -> Next Hop: %U",
                  format_ip4_address, &prefix, mask_length,
                  format_ip4_address, &next_hop);
-
-    clib_spinlock_unlock(&bmp->lock);
+    return 0;
 }
 
-// Remove a route
-void bgp_remove_route(bgp_main_t *bmp, ip4_address_t prefix, u8 mask_length) {
+// Remove a route; -1 if a worker could not hand it to the RIB owner, and nothing changed
+int bgp_remove_route(bgp_main_t *bmp, ip4_address_t prefix, u8 mask_length) {
+    ip4_address_t unused = { 0 };
     bgp_route_t *route;
+    int rv;
 
-    clib_spinlock_lock(&bmp->lock);
+    if ((rv = bgp_route_forward(bmp, prefix, mask_length, unused, 1))) {
+        return rv < 0 ? -1 : 0;
+    }
 
     pool_foreach(route, bmp->routes) {
         if (!ip4_address_cmp(&route->prefix, &prefix) && route->mask_length == mask_length) {
             pool_put(bmp->routes, route);
+            bgp_rib_changed(bmp, bgp_dest_key(prefix, mask_length), ~0);
             clib_warning("Removed BGP route: %U/%d", format_ip4_address, &prefix, mask_length);
-            clib_spinlock_unlock(&bmp->lock);
-            return;
+            return 0;
         }
     }
 
     clib_warning("BGP route not found: %U/%d", format_ip4_address, &prefix, mask_length);
-    clib_spinlock_unlock(&bmp->lock);
+    return 0;
+}
+
+static bgp_rib_snapshot_t *bgp_rib_snapshot_create(bgp_main_t *bmp) {
+    bgp_rib_snapshot_t *snapshot = clib_mem_alloc(sizeof(*snapshot));
+    bgp_route_t *route;
+
+    clib_memset(snapshot, 0, sizeof(*snapshot));
+    vec_validate(snapshot->routes, pool_elts(bmp->routes));
+    vec_reset_length(snapshot->routes);
+    snapshot->route_by_key = hash_create(pool_elts(bmp->routes), sizeof(uword));
+    pool_foreach(route, bmp->routes) {
+        hash_set(snapshot->route_by_key, bgp_dest_key(route->prefix, route->mask_length),
+                 vec_len(snapshot->routes));
+        vec_add1(snapshot->routes, *route);
+    }
+    return snapshot;
+}
+
+static void bgp_rib_snapshot_free(bgp_rib_snapshot_t *snapshot) {
+    if (snapshot) {
+        vec_free(snapshot->routes);
+        hash_free(snapshot->route_by_key);
+        clib_mem_free(snapshot);
+    }
+}
+
+/* Bring one entry of a snapshot nobody reads up to date with the RIB */
+static void bgp_rib_snapshot_apply(bgp_main_t *bmp, bgp_rib_snapshot_t *snapshot, uword key, uword route_index) {
+    uword *p = hash_get(snapshot->route_by_key, key);
+    bgp_route_t *route;
+    u32 i;
+
+    if (route_index != ~0) {
+        route = pool_elt_at_index(bmp->routes, route_index);
+        if (p) {
+            snapshot->routes[p[0]] = *route;
+        } else {
+            hash_set(snapshot->route_by_key, key, vec_len(snapshot->routes));
+            vec_add1(snapshot->routes, *route);
+        }
+        return;
+    }
+    if (!p) {
+        return;
+    }
+    // vec_del1() moves the last route into the hole
+    i = p[0];
+    hash_unset(snapshot->route_by_key, key);
+    vec_del1(snapshot->routes, i);
+    if (i < vec_len(snapshot->routes)) {
+        route = &snapshot->routes[i];
+        hash_set(snapshot->route_by_key, bgp_dest_key(route->prefix, route->mask_length), i);
+    }
+}
+
+/*
+ * Publish a new read-only copy of the RIB if it changed. Workers load the
+ * snapshot pointer at the start of a pass and drop it before their node
+ * returns, so once every worker has completed one more main loop iteration
+ * nobody can still hold the old one.
+ *
+ * Two copies alternate: the one just replaced becomes the spare, and the
+ * next publish patches it with the entries changed since it was current
+ * (the previous publish's changes and this one's) instead of copying the
+ * whole RIB again.
+ */
+void bgp_rib_publish(bgp_main_t *bmp) {
+    bgp_rib_snapshot_t *snapshot = bmp->rib_spare, *old;
+    uword key, route_index;
+
+    if (hash_elts(bmp->rib_changes) == 0) {
+        return;
+    }
+
+    if (!snapshot) {
+        snapshot = bgp_rib_snapshot_create(bmp);
+    } else {
+        // An entry changed in both rounds takes this round's value
+        hash_foreach (key, route_index, bmp->rib_changes_prev, ({
+            if (!hash_get(bmp->rib_changes, key)) {
+                bgp_rib_snapshot_apply(bmp, snapshot, key, route_index);
+            }
+        }));
+        hash_foreach (key, route_index, bmp->rib_changes, ({
+            bgp_rib_snapshot_apply(bmp, snapshot, key, route_index);
+        }));
+    }
+    snapshot->version = ++bmp->rib_version;
+
+    old = bmp->rib_snapshot;
+    clib_atomic_store_rel_n(&bmp->rib_snapshot, snapshot);
+    if (old && vlib_num_workers()) {
+        vlib_worker_wait_one_loop();
+    }
+    bmp->rib_spare = old;
+
+    hash_free(bmp->rib_changes_prev);
+    bmp->rib_changes_prev = bmp->rib_changes;
+    bmp->rib_changes = 0;
+}
+
+void bgp_rib_snapshots_free(bgp_main_t *bmp) {
+    bgp_rib_snapshot_free(bmp->rib_snapshot);
+    bgp_rib_snapshot_free(bmp->rib_spare);
+    bmp->rib_snapshot = 0;
+    bmp->rib_spare = 0;
+    hash_free(bmp->rib_changes);
+    hash_free(bmp->rib_changes_prev);
 }
 
 // Show all routes
@@ -70,6 +217,8 @@ int bgp_advertise_network(bgp_main_t *bmp, ip4_address_t prefix, u8 mask_length)
     route->prefix = prefix;
     route->mask_length = mask_length;
     route->next_hop.as_u32 = bmp->bgp_router_id; // Use the router ID as the next hop for advertised networks
+    route->source_neighbor = ~0;
+    bgp_rib_changed(bmp, bgp_dest_key(prefix, mask_length), route - bmp->routes);
 
     clib_warning("Advertised BGP network: %U/%d", format_ip4_address, &prefix, mask_length);
 
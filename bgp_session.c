@@ -0,0 +1,510 @@
+/*
+ * bgp_session.c - VPP host-stack (session layer) transport for BGP sessions
+ *
+ * Copyright (c) <current-year> <your-organization>
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vnet/vnet.h>
+#include <vnet/session/application.h>
+#include <vnet/session/application_interface.h>
+#include <vnet/session/session.h>
+#include <vlibmemory/api.h>
+#include <bgp/bgp.h>
+
+#define BGP_SESSION_FIFO_SIZE    (64 << 10)
+#define BGP_SESSION_SEGMENT_SIZE (128 << 20)
+
+typedef struct {
+    u32 app_index;      // Builtin application attached to the session layer
+    u64 listener_handle; // Passive session on BGP_PORT
+    u8 *namespace_id;   // App namespace the sessions are opened in (vec)
+    u8 enabled;
+} bgp_session_main_t;
+
+static bgp_session_main_t bgp_session_main;
+
+/*
+ * Session layer callbacks run on whichever thread owns the session, which
+ * need not be the neighbor's owner. They only describe what happened and
+ * hand it to the owner over the handoff rings; the owner reads and writes
+ * the fifos, whose pointers the socket caches, and never looks the session
+ * up. A close goes back to the session's thread.
+ */
+typedef enum {
+    BGP_SESSION_EVENT_CONNECTED,
+    BGP_SESSION_EVENT_CONNECT_FAILED,
+    BGP_SESSION_EVENT_RX,
+    BGP_SESSION_EVENT_TX,
+    BGP_SESSION_EVENT_DOWN,
+} bgp_session_event_type_t;
+
+typedef struct {
+    u8 type;                      // bgp_session_event_type_t
+    u64 handle;                   // Session the callback was for
+    svm_fifo_t *rx_fifo;          // CONNECTED only
+    svm_fifo_t *tx_fifo;
+    ip4_address_t local_addr;
+} bgp_session_event_t;
+
+/* Disconnect on the session's own thread; handle travels as the RPC argument */
+static void bgp_session_disconnect_rpc(void *arg) {
+    vnet_disconnect_args_t a = { .handle = pointer_to_uword(arg), .app_index = bgp_session_main.app_index };
+
+    vnet_disconnect_session(&a);
+}
+
+static void bgp_session_disconnect(u64 handle) {
+    u32 thread_index = session_thread_from_handle(handle);
+
+    if (thread_index == vlib_get_thread_index()) {
+        bgp_session_disconnect_rpc(uword_to_pointer(handle, void *));
+    } else {
+        session_send_rpc_evt_to_thread(thread_index, bgp_session_disconnect_rpc, uword_to_pointer(handle, void *));
+    }
+}
+
+/* Main thread, barrier held: the owner's ring was full, so act for it */
+static void bgp_session_post_rpc(bgp_handoff_elt_t *elt) {
+    bgp_main_t *bmp = &bgp_main;
+    bgp_neighbor_t *neighbor;
+
+    if (pool_is_free_index(bmp->neighbors, elt->neighbor_index)) {
+        bgp_session_handoff_release(elt->kind, elt->data);
+        return;
+    }
+    neighbor = pool_elt_at_index(bmp->neighbors, elt->neighbor_index);
+    if (neighbor->owner_thread != 0 &&
+        bgp_handoff_to_worker(bmp, neighbor->owner_thread, elt->kind, elt->neighbor_index, elt->data) == 0) {
+        return;
+    }
+    bgp_session_handoff_dispatch(bmp, elt->kind, elt->neighbor_index, elt->data);
+}
+
+/*
+ * Session thread: hand a session event or accepted socket to the owner of
+ * the neighbor. Returns -1 if the ring is full and the caller may retry
+ * later; with must_deliver the event falls back to an RPC instead.
+ */
+static int bgp_session_post(u32 kind, u32 neighbor_index, void *data, int must_deliver) {
+    bgp_main_t *bmp = &bgp_main;
+    u32 thread_index = vlib_get_thread_index(), owner;
+    int rv;
+
+    if (pool_is_free_index(bmp->neighbors, neighbor_index)) {
+        bgp_session_handoff_release(kind, data);
+        return 0;
+    }
+    owner = pool_elt_at_index(bmp->neighbors, neighbor_index)->owner_thread;
+    if (owner == thread_index) {
+        bgp_session_handoff_dispatch(bmp, kind, neighbor_index, data);
+        return 0;
+    }
+    if (owner == 0) {
+        rv = bgp_handoff_to_main(bmp, kind, neighbor_index, data);
+    } else {
+        rv = bgp_handoff_to_worker(bmp, owner, kind, neighbor_index, data);
+    }
+    if (rv < 0 && must_deliver) {
+        bgp_handoff_elt_t elt = { .kind = kind, .neighbor_index = neighbor_index, .data = data };
+        vlib_rpc_call_main_thread(bgp_session_post_rpc, (u8 *)&elt, sizeof(elt));
+        return 0;
+    }
+    if (rv < 0) {
+        bgp_session_handoff_release(kind, data);
+    }
+    return rv;
+}
+
+static int bgp_session_post_event(session_t *s, u8 type, int must_deliver) {
+    bgp_session_event_t *event = clib_mem_alloc(sizeof(*event));
+
+    clib_memset(event, 0, sizeof(*event));
+    event->type = type;
+    event->handle = session_handle(s);
+    if (type == BGP_SESSION_EVENT_CONNECTED) {
+        event->rx_fifo = s->rx_fifo;
+        event->tx_fifo = s->tx_fifo;
+        event->local_addr = session_get_transport(s)->lcl_ip.ip4;
+    }
+    return bgp_session_post(BGP_HANDOFF_SESSION_EVENT, s->opaque, event, must_deliver);
+}
+
+static int bgp_session_rx_callback(session_t *s) {
+    // The owner clears the fifo event before it drains, so new data always notifies again
+    if (bgp_session_post_event(s, BGP_SESSION_EVENT_RX, 0) < 0) {
+        svm_fifo_unset_event(s->rx_fifo); // Retried with the next segment
+    }
+    return 0;
+}
+
+/* The tx fifo has room again */
+static int bgp_session_tx_callback(session_t *s) {
+    if (bgp_session_post_event(s, BGP_SESSION_EVENT_TX, 0) < 0) {
+        svm_fifo_add_want_deq_ntf(s->tx_fifo, SVM_FIFO_WANT_DEQ_NOTIF);
+    }
+    return 0;
+}
+
+static int bgp_session_connected_callback(u32 app_wrk_index, u32 opaque, session_t *s,
+                                          session_error_t err) {
+    bgp_session_event_t *event;
+
+    if (err) {
+        event = clib_mem_alloc(sizeof(*event));
+        clib_memset(event, 0, sizeof(*event));
+        event->type = BGP_SESSION_EVENT_CONNECT_FAILED;
+        event->handle = SESSION_INVALID_HANDLE;
+        bgp_session_post(BGP_HANDOFF_SESSION_EVENT, opaque, event, 1);
+        return 0;
+    }
+
+    s->opaque = opaque;
+    s->session_state = SESSION_STATE_READY;
+    bgp_session_post_event(s, BGP_SESSION_EVENT_CONNECTED, 1);
+    return 0;
+}
+
+static void bgp_session_disconnect_callback(session_t *s) {
+    bgp_session_post_event(s, BGP_SESSION_EVENT_DOWN, 1);
+}
+
+static void bgp_session_reset_callback(session_t *s) {
+    bgp_session_disconnect_callback(s);
+}
+
+/* Inbound session: accept it for a configured neighbor and let the owner run collision handling */
+static int bgp_session_accept_callback(session_t *s) {
+    bgp_main_t *bmp = &bgp_main;
+    transport_connection_t *tc = session_get_transport(s);
+    bgp_neighbor_t *neighbor = bgp_find_neighbor(bmp, tc->rmt_ip.ip4);
+    bgp_socket_t *sock;
+
+    if (!neighbor) {
+        clib_warning("Rejected BGP session from unconfigured peer %U", format_ip4_address, &tc->rmt_ip.ip4);
+        return -1;
+    }
+
+    sock = clib_mem_alloc(sizeof(*sock));
+    clib_memset(sock, 0, sizeof(*sock));
+    sock->socket_fd = -1;
+    sock->clib_file_index = ~0;
+    sock->neighbor_index = ~0;
+    sock->tx_slot = ~0;
+    sock->backend = BGP_TRANSPORT_SESSION;
+    sock->peer_addr.sin_family = AF_INET;
+    sock->peer_addr.sin_port = tc->rmt_port;
+    sock->peer_addr.sin_addr.s_addr = tc->rmt_ip.ip4.as_u32;
+    sock->is_connected = 1;
+    sock->is_inbound = 1;
+    sock->session_handle = session_handle(s);
+    sock->rx_fifo = s->rx_fifo;
+    sock->tx_fifo = s->tx_fifo;
+    sock->local_addr = tc->lcl_ip.ip4;
+
+    s->opaque = neighbor - bmp->neighbors;
+    s->session_state = SESSION_STATE_READY;
+    bgp_session_post(BGP_HANDOFF_ACCEPT, s->opaque, sock, 1);
+    return 0;
+}
+
+static int bgp_session_add_segment_callback(u32 app_wrk_index, u64 segment_handle) {
+    return 0;
+}
+
+static session_cb_vft_t bgp_session_cb_vft = {
+    .session_accept_callback = bgp_session_accept_callback,
+    .session_disconnect_callback = bgp_session_disconnect_callback,
+    .session_connected_callback = bgp_session_connected_callback,
+    .add_segment_callback = bgp_session_add_segment_callback,
+    .builtin_app_rx_callback = bgp_session_rx_callback,
+    .builtin_app_tx_callback = bgp_session_tx_callback,
+    .session_reset_callback = bgp_session_reset_callback,
+};
+
+// === Owner thread ===
+
+/* Which of the neighbor's connections a session belongs to, or NULL if it has moved on */
+static bgp_socket_t *bgp_session_socket(bgp_neighbor_t *neighbor, u64 handle) {
+    if (neighbor->socket && neighbor->socket->backend == BGP_TRANSPORT_SESSION &&
+        neighbor->socket->session_handle == handle) {
+        return neighbor->socket;
+    }
+    if (neighbor->collision_socket && neighbor->collision_socket->backend == BGP_TRANSPORT_SESSION &&
+        neighbor->collision_socket->session_handle == handle) {
+        return neighbor->collision_socket;
+    }
+    return NULL;
+}
+
+/* Move everything readable from the rx fifo into the socket's rx buffer */
+static void bgp_session_rx(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_socket_t *sock) {
+    svm_fifo_t *f = sock->rx_fifo;
+    u32 len, n;
+
+    svm_fifo_unset_event(f);
+    n = svm_fifo_max_dequeue_cons(f);
+    if (!n) {
+        return;
+    }
+
+    len = vec_len(sock->rx_buffer);
+    vec_validate(sock->rx_buffer, len + n - 1);
+    svm_fifo_dequeue(f, n, sock->rx_buffer + len);
+
+    // Let TCP reopen the window now that the fifo has drained
+    if (svm_fifo_needs_deq_ntf(f, n)) {
+        svm_fifo_clear_deq_ntf(f);
+        session_send_io_evt_to_thread(f, SESSION_IO_EVT_RX);
+    }
+
+    bgp_socket_rx_ready(bmp, neighbor, sock);
+}
+
+static void bgp_session_event_dispatch(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_session_event_t *event) {
+    bgp_socket_t *sock;
+
+    switch (event->type) {
+        case BGP_SESSION_EVENT_CONNECTED:
+            sock = neighbor ? neighbor->socket : 0;
+            if (!sock || sock->backend != BGP_TRANSPORT_SESSION || !sock->is_connecting) {
+                // The attempt was abandoned while the handshake ran
+                bgp_session_disconnect(event->handle);
+                break;
+            }
+            sock->session_handle = event->handle;
+            sock->rx_fifo = event->rx_fifo;
+            sock->tx_fifo = event->tx_fifo;
+            sock->local_addr = event->local_addr;
+            bgp_socket_connected(bmp, neighbor);
+            break;
+
+        case BGP_SESSION_EVENT_CONNECT_FAILED:
+            sock = neighbor ? neighbor->socket : 0;
+            if (sock && sock->backend == BGP_TRANSPORT_SESSION && sock->is_connecting) {
+                clib_warning("Session connect to neighbor %U failed",
+                             format_ip4_address, &neighbor->neighbor_ip);
+                sock->is_connecting = 0;
+                bgp_fsm_post(bmp, neighbor, BGP_FSM_EVENT_TCP_FAILED);
+            }
+            break;
+
+        case BGP_SESSION_EVENT_RX:
+            if (neighbor && (sock = bgp_session_socket(neighbor, event->handle))) {
+                bgp_session_rx(bmp, neighbor, sock);
+            }
+            break;
+
+        case BGP_SESSION_EVENT_TX:
+            if (neighbor && (sock = bgp_session_socket(neighbor, event->handle)) && sock == neighbor->socket) {
+                bgp_socket_flush(neighbor);
+            }
+            break;
+
+        case BGP_SESSION_EVENT_DOWN:
+            if (!neighbor || !(sock = bgp_session_socket(neighbor, event->handle))) {
+                // Nobody owns it any more; just confirm the disconnect
+                bgp_session_disconnect(event->handle);
+            } else if (sock == neighbor->collision_socket) {
+                bgp_socket_drop_collision(neighbor);
+            } else {
+                bgp_socket_handle_down(bmp, neighbor);
+            }
+            break;
+    }
+}
+
+/* Owner thread: act on what a session callback handed over */
+void bgp_session_handoff_dispatch(bgp_main_t *bmp, u32 kind, u32 neighbor_index, void *data) {
+    bgp_neighbor_t *neighbor = 0;
+
+    if (!pool_is_free_index(bmp->neighbors, neighbor_index)) {
+        neighbor = pool_elt_at_index(bmp->neighbors, neighbor_index);
+    }
+    if (kind == BGP_HANDOFF_ACCEPT) {
+        if (neighbor) {
+            bgp_handle_incoming_connection(bmp, neighbor, data);
+        } else {
+            bgp_socket_close(data);
+        }
+        return;
+    }
+    bgp_session_event_dispatch(bmp, neighbor, data);
+    clib_mem_free(data);
+}
+
+/* Drop what a callback handed over without acting on it; sessions nobody will own are closed */
+void bgp_session_handoff_release(u32 kind, void *data) {
+    bgp_session_event_t *event = data;
+
+    if (kind == BGP_HANDOFF_ACCEPT) {
+        bgp_socket_close(data);
+        return;
+    }
+    if (event->type == BGP_SESSION_EVENT_CONNECTED || event->type == BGP_SESSION_EVENT_DOWN) {
+        bgp_session_disconnect(event->handle);
+    }
+    clib_mem_free(event);
+}
+
+/* Attach BGP to the session layer as a builtin app in the given namespace */
+clib_error_t *bgp_session_init(bgp_main_t *bmp, u8 *namespace_id, u64 secret) {
+    bgp_session_main_t *sm = &bgp_session_main;
+    vnet_app_attach_args_t _a, *a = &_a;
+    vnet_listen_args_t listen_args;
+    u64 options[APP_OPTIONS_N_OPTIONS];
+    int rv;
+
+    if (sm->enabled) {
+        return 0;
+    }
+
+    clib_memset(a, 0, sizeof(*a));
+    clib_memset(options, 0, sizeof(options));
+
+    a->api_client_index = APP_INVALID_INDEX;
+    a->name = format(0, "bgp");
+    a->session_cb_vft = &bgp_session_cb_vft;
+    a->options = options;
+    a->namespace_id = namespace_id;
+    options[APP_OPTIONS_SEGMENT_SIZE] = BGP_SESSION_SEGMENT_SIZE;
+    options[APP_OPTIONS_ADD_SEGMENT_SIZE] = BGP_SESSION_SEGMENT_SIZE;
+    options[APP_OPTIONS_RX_FIFO_SIZE] = BGP_SESSION_FIFO_SIZE;
+    options[APP_OPTIONS_TX_FIFO_SIZE] = BGP_SESSION_FIFO_SIZE;
+    options[APP_OPTIONS_FLAGS] = APP_OPTIONS_FLAGS_IS_BUILTIN;
+    options[APP_OPTIONS_NAMESPACE_SECRET] = secret;
+
+    rv = vnet_application_attach(a);
+    vec_free(a->name);
+    if (rv) {
+        return clib_error_return(0, "session layer attach failed: %U", format_session_error, rv);
+    }
+
+    sm->app_index = a->app_index;
+    sm->namespace_id = vec_dup(namespace_id);
+    sm->enabled = 1;
+
+    // Peers that connect to us arrive through bgp_session_accept_callback()
+    clib_memset(&listen_args, 0, sizeof(listen_args));
+    listen_args.app_index = sm->app_index;
+    listen_args.sep_ext.transport_proto = TRANSPORT_PROTO_TCP;
+    listen_args.sep_ext.is_ip4 = 1;
+    listen_args.sep_ext.port = clib_host_to_net_u16(BGP_PORT);
+    rv = vnet_listen(&listen_args);
+    if (rv) {
+        clib_warning("Session listen on port %u failed: %U", BGP_PORT, format_session_error, rv);
+        sm->listener_handle = SESSION_INVALID_HANDLE;
+    } else {
+        sm->listener_handle = listen_args.handle;
+    }
+
+    clib_warning("BGP attached to the session layer (app %u, namespace %v)",
+                 sm->app_index, namespace_id ? namespace_id : (u8 *)"default");
+    return 0;
+}
+
+int bgp_session_connect(bgp_socket_t *sock) {
+    bgp_session_main_t *sm = &bgp_session_main;
+    vnet_connect_args_t _a, *a = &_a;
+    int rv;
+
+    if (!sm->enabled) {
+        return -1;
+    }
+
+    clib_memset(a, 0, sizeof(*a));
+    a->sep_ext.transport_proto = TRANSPORT_PROTO_TCP;
+    a->sep_ext.is_ip4 = 1;
+    a->sep_ext.ip.ip4.as_u32 = sock->peer_addr.sin_addr.s_addr;
+    a->sep_ext.port = sock->peer_addr.sin_port;
+    a->api_context = sock->neighbor_index;
+    a->app_index = sm->app_index;
+
+    rv = vnet_connect(a);
+    if (rv) {
+        clib_warning("Session connect failed: %U", format_session_error, rv);
+        return -1;
+    }
+    sock->is_connecting = 1;
+    return 0;
+}
+
+/* Copy queued messages straight into the session's tx fifo; runs on the owner thread */
+void bgp_session_flush(bgp_neighbor_t *neighbor) {
+    bgp_socket_t *sock = neighbor->socket;
+    svm_fifo_seg_t segs[BGP_SOCKET_TX_IOV_MAX];
+    svm_fifo_t *f = sock->tx_fifo;
+    bgp_message_t *message;
+    int n_segs = 0, rv;
+
+    if (!f) {
+        return;
+    }
+
+    while (n_segs < BGP_SOCKET_TX_IOV_MAX &&
+           (message = queue_peek_nth(&neighbor->output_queue, n_segs)) != NULL) {
+        u32 skip = n_segs == 0 ? sock->tx_offset : 0;
+        segs[n_segs].data = message->data + skip;
+        segs[n_segs].len = message->length - skip;
+        n_segs++;
+    }
+    if (!n_segs) {
+        return;
+    }
+
+    rv = svm_fifo_enqueue_segments(f, segs, n_segs, 1 /* allow partial */);
+    if (rv > 0) {
+        bgp_socket_tx_advance(neighbor, rv);
+        if (svm_fifo_set_event(f)) {
+            session_send_io_evt_to_thread(f, SESSION_IO_EVT_TX);
+        }
+    }
+
+    // Fifo full: ask the session layer to call back once it drains
+    if (!queue_is_empty(&neighbor->output_queue)) {
+        svm_fifo_add_want_deq_ntf(f, SVM_FIFO_WANT_DEQ_NOTIF);
+    }
+}
+
+/* Put bytes into the tx fifo only if all of them fit; the disconnect sends them before FIN */
+int bgp_session_write_now(bgp_socket_t *sock, u8 *data, u32 length) {
+    svm_fifo_t *f = sock->tx_fifo;
+
+    if (!f || svm_fifo_max_enqueue_prod(f) < length) {
+        return -1;
+    }
+    svm_fifo_enqueue(f, length, data);
+    if (svm_fifo_set_event(f)) {
+        session_send_io_evt_to_thread(f, SESSION_IO_EVT_TX);
+    }
+    return 0;
+}
+
+int bgp_session_local_address(bgp_socket_t *sock, ip4_address_t *addr) {
+    if (!sock->tx_fifo) {
+        return -1;
+    }
+    *addr = sock->local_addr;
+    return 0;
+}
+
+/* The fifos stay valid until the session's thread has processed the disconnect */
+void bgp_session_close(bgp_socket_t *sock) {
+    if (sock->session_handle == SESSION_INVALID_HANDLE) {
+        return;
+    }
+    bgp_session_disconnect(sock->session_handle);
+    sock->session_handle = SESSION_INVALID_HANDLE;
+    sock->rx_fifo = 0;
+    sock->tx_fifo = 0;
+}
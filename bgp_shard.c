@@ -0,0 +1,433 @@
+/*
+ * bgp_shard.c - distribute BGP neighbors across VPP worker threads
+ *
+ * Copyright (c) <current-year> <your-organization>
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vlib/vlib.h>
+#include <vlib/threads.h>
+#include <vppinfra/xxhash.h>
+#include <bgp/bgp.h>
+
+/*
+ * With sharding enabled every neighbor is owned by one worker, chosen by a
+ * hash of its address. The owner runs the neighbor's socket callbacks,
+ * framing, FSM, timers and UPDATE encoding. The RIB stays on the main
+ * thread and is fed through the handoff rings.
+ */
+
+vlib_node_registration_t bgp_shard_input_node;
+
+static clib_error_t *bgp_shard_init(vlib_main_t *vm) {
+    bgp_main_t *bmp = &bgp_main;
+    bgp_shard_t *shard;
+
+    vec_validate_aligned(bmp->shards, vlib_get_n_threads() - 1, CLIB_CACHE_LINE_BYTES);
+
+    // Every thread, main included, runs its own neighbors' session timers
+    vec_foreach (shard, bmp->shards) {
+        tw_timer_wheel_init_4t_3w_256sl(&shard->timer_wheel, 0 /* expired handles returned as a vec */,
+                                        BGP_TIMER_TICK_SECONDS, ~0);
+        shard->random_seed = clib_cpu_time_now() ^ (shard - bmp->shards);
+        clib_memset(shard->state_head, 0xff, sizeof(shard->state_head));
+    }
+    return 0;
+}
+
+VLIB_MAIN_LOOP_ENTER_FUNCTION(bgp_shard_init);
+
+/* Thread that owns a neighbor with this address */
+u32 bgp_shard_thread_for(bgp_main_t *bmp, ip4_address_t neighbor_ip) {
+    u32 n_workers = vlib_num_workers();
+
+    if (!bmp->sharding_enabled || n_workers == 0) {
+        return 0;
+    }
+    return 1 + clib_xxhash(neighbor_ip.as_u32) % n_workers;
+}
+
+/* Link a neighbor into its owner's list for its current state */
+static void bgp_shard_link_state(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
+    bgp_shard_t *shard = vec_elt_at_index(bmp->shards, neighbor->owner_thread);
+    u32 index = neighbor - bmp->neighbors;
+
+    neighbor->state_prev = ~0;
+    neighbor->state_next = shard->state_head[neighbor->state];
+    if (neighbor->state_next != ~0) {
+        pool_elt_at_index(bmp->neighbors, neighbor->state_next)->state_prev = index;
+    }
+    shard->state_head[neighbor->state] = index;
+    shard->n_in_state[neighbor->state]++;
+}
+
+static void bgp_shard_unlink_state(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
+    bgp_shard_t *shard = vec_elt_at_index(bmp->shards, neighbor->owner_thread);
+
+    if (neighbor->state_prev != ~0) {
+        pool_elt_at_index(bmp->neighbors, neighbor->state_prev)->state_next = neighbor->state_next;
+    } else {
+        shard->state_head[neighbor->state] = neighbor->state_next;
+    }
+    if (neighbor->state_next != ~0) {
+        pool_elt_at_index(bmp->neighbors, neighbor->state_next)->state_prev = neighbor->state_prev;
+    }
+    shard->n_in_state[neighbor->state]--;
+}
+
+/* Record a new neighbor in its owner's shard; caller holds the worker barrier */
+void bgp_shard_add_neighbor(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
+    neighbor->owner_thread = bgp_shard_thread_for(bmp, neighbor->neighbor_ip);
+    bgp_shard_link_state(bmp, neighbor);
+}
+
+/* Forget a neighbor; caller holds the worker barrier */
+void bgp_shard_del_neighbor(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
+    bgp_shard_t *shard = vec_elt_at_index(bmp->shards, neighbor->owner_thread);
+    u32 neighbor_index = neighbor - bmp->neighbors;
+    u32 i, n = 0;
+
+    bgp_shard_unlink_state(bmp, neighbor);
+    if (neighbor->peer_down_pending) {
+        neighbor->peer_down_pending = 0; // bgp_remove_neighbor() takes its paths out directly
+        shard->n_peer_down_pending--;
+    }
+
+    // Posted events would otherwise run against whoever reuses the pool slot
+    for (i = 0; i < vec_len(shard->fsm_events); i++) {
+        if (shard->fsm_events[i].neighbor_index != neighbor_index) {
+            shard->fsm_events[n++] = shard->fsm_events[i];
+        }
+    }
+    vec_set_len(shard->fsm_events, n);
+}
+
+/*
+ * Every state change goes through here so the per-state lists stay exact:
+ * walks over, say, established peers visit only those. Runs on the owner
+ * thread or under the worker barrier.
+ */
+void bgp_neighbor_set_state(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_state_t state) {
+    if (neighbor->state == state) {
+        return;
+    }
+    bgp_shard_unlink_state(bmp, neighbor);
+    neighbor->state = state;
+    bgp_shard_link_state(bmp, neighbor);
+}
+
+/* Retry the PEER_DOWN handoffs a full ring refused; those neighbors wait in Idle */
+static void bgp_shard_retry_peer_down(bgp_main_t *bmp, bgp_shard_t *shard) {
+    bgp_neighbor_t *neighbor;
+    u32 index;
+
+    for (index = shard->state_head[BGP_STATE_IDLE]; index != ~0 && shard->n_peer_down_pending;
+         index = neighbor->state_next) {
+        neighbor = pool_elt_at_index(bmp->neighbors, index);
+        if (neighbor->peer_down_pending && bgp_peer_down_flush(bmp, neighbor) &&
+            !bgp_timer_is_running(neighbor, BGP_TIMER_CONNECT_RETRY)) {
+            bgp_fsm_post(bmp, neighbor, BGP_FSM_EVENT_START); // Its restart was held back
+        }
+    }
+}
+
+/* Per-worker loop: drain handed-off work, fire due timers and run posted FSM events */
+static uword bgp_shard_input(vlib_main_t *vm, vlib_node_runtime_t *node, vlib_frame_t *frame) {
+    bgp_main_t *bmp = &bgp_main;
+    bgp_shard_t *shard = vec_elt_at_index(bmp->shards, vm->thread_index);
+    uword n_work = bgp_handoff_drain_worker(bmp, vm->thread_index);
+
+    if (shard->n_peer_down_pending) {
+        bgp_shard_retry_peer_down(bmp, shard);
+    }
+    bgp_timer_expire(bmp, vm->thread_index, vlib_time_now(vm));
+    return n_work + bgp_fsm_dispatch(bmp, vm->thread_index);
+}
+
+VLIB_REGISTER_NODE(bgp_shard_input_node) = {
+    .function = bgp_shard_input,
+    .name = "bgp-shard-input",
+    .type = VLIB_NODE_TYPE_INPUT,
+    .state = VLIB_NODE_STATE_DISABLED,
+};
+
+/* Workers poll bgp-shard-input while they own neighbors or take decision or encoding work */
+void bgp_shard_update_node_state(bgp_main_t *bmp) {
+    int enable = bmp->sharding_enabled || bmp->decision_threads > 1 || bmp->update_threads > 1;
+
+    vlib_worker_thread_barrier_sync(bmp->vlib_main);
+    foreach_vlib_main () {
+        if (this_vlib_main->thread_index) {
+            vlib_node_set_state(this_vlib_main, bgp_shard_input_node.index,
+                                enable ? VLIB_NODE_STATE_POLLING : VLIB_NODE_STATE_DISABLED);
+        }
+    }
+    vlib_worker_thread_barrier_release(bmp->vlib_main);
+}
+
+clib_error_t *bgp_shard_enable_disable(bgp_main_t *bmp, int enable) {
+    if (enable && vlib_num_workers() == 0) {
+        return clib_error_return(0, "BGP sharding needs at least one worker thread");
+    }
+    if (pool_elts(bmp->neighbors)) {
+        return clib_error_return(0, "Remove all BGP neighbors before changing sharding");
+    }
+    // The io_uring ring and session app are single-threaded; workers use plain sockets
+    if (enable && bmp->transport != BGP_TRANSPORT_SOCKET) {
+        return clib_error_return(0, "BGP sharding requires the socket transport");
+    }
+
+    bmp->sharding_enabled = enable;
+    bgp_shard_update_node_state(bmp);
+
+    clib_warning("BGP neighbor sharding %s across %u workers",
+                 enable ? "enabled" : "disabled", vlib_num_workers());
+    return 0;
+}
+
+static clib_error_t *
+bgp_set_sharding_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    if (unformat(input, "enable")) {
+        return bgp_shard_enable_disable(&bgp_main, 1);
+    }
+    if (unformat(input, "disable")) {
+        return bgp_shard_enable_disable(&bgp_main, 0);
+    }
+    return clib_error_return(0, "Usage: set bgp sharding <enable|disable>");
+}
+
+VLIB_CLI_COMMAND(bgp_set_sharding_command, static) = {
+    .path = "set bgp sharding",
+    .short_help = "set bgp sharding <enable|disable>",
+    .function = bgp_set_sharding_command_fn,
+};
+
+static clib_error_t *
+bgp_show_shards_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    bgp_main_t *bmp = &bgp_main;
+    bgp_shard_t *shard;
+    bgp_state_t state;
+
+    vlib_cli_output(vm, "Sharding: %s", bmp->sharding_enabled ? "enabled" : "disabled");
+    vec_foreach (shard, bmp->shards) {
+        u32 n_neighbors = 0;
+        for (state = 0; state < BGP_N_STATES; state++) {
+            n_neighbors += shard->n_in_state[state];
+        }
+        vlib_cli_output(vm, "  thread %u: %u neighbors (%u established), %llu FSM events", shard - bmp->shards,
+                        n_neighbors, shard->n_in_state[BGP_STATE_ESTABLISHED], shard->n_fsm_events);
+    }
+    return 0;
+}
+
+VLIB_CLI_COMMAND(bgp_show_shards_command, static) = {
+    .path = "show bgp shards",
+    .short_help = "show bgp shards",
+    .function = bgp_show_shards_command_fn,
+};
+
+// === Sharding scaling benchmark ===
+
+/*
+ * Simulated peers: each has a receive buffer of pre-encoded KEEPALIVEs and
+ * UPDATEs. A shard thread frames and parses its peers' input, encodes a
+ * KEEPALIVE reply per KEEPALIVE, and hands every UPDATE to the RIB owner
+ * (the CLI thread here) over its SPSC ring, as a real worker would.
+ */
+#define BGP_SHARD_BENCH_UPDATE_LEN 64
+
+typedef struct {
+    u8 *rx;                     // Encoded input for this peer
+    u32 peer_id;
+} bgp_shard_bench_peer_t;
+
+typedef struct {
+    CLIB_CACHE_LINE_ALIGN_MARK(cacheline0);
+    bgp_shard_bench_peer_t *peers;
+    bgp_spsc_ring_t ring;       // Shard -> RIB owner
+    u32 shard_index;
+    u32 n_shards;
+    u64 parsed;
+    u64 encoded;
+    volatile u32 done;
+    volatile u32 *go;
+} bgp_shard_bench_thread_t;
+
+static void *bgp_shard_bench_worker(void *arg) {
+    bgp_shard_bench_thread_t *t = arg;
+    u8 reply[BGP_HEADER_LEN];
+    bgp_shard_bench_peer_t *peer;
+
+    bgp_bench_wait(t->go);
+
+    vec_foreach (peer, t->peers) {
+        u32 offset = 0;
+
+        // Same ownership rule as bgp_shard_thread_for()
+        if (clib_xxhash(peer->peer_id) % t->n_shards != t->shard_index) {
+            continue;
+        }
+        while (offset + BGP_HEADER_LEN <= vec_len(peer->rx)) {
+            u8 *msg = peer->rx + offset;
+            u16 length = clib_net_to_host_u16(clib_mem_unaligned(msg + 16, u16));
+            bgp_handoff_elt_t elt;
+
+            switch (bgp_parse_message(msg, length)) {
+                case BGP_MSG_KEEPALIVE:
+                    clib_memset(reply, 0xff, 16);
+                    clib_mem_unaligned(reply + 16, u16) = clib_host_to_net_u16(BGP_HEADER_LEN);
+                    reply[18] = BGP_MSG_KEEPALIVE;
+                    t->encoded++;
+                    break;
+
+                case BGP_MSG_UPDATE:
+                    elt.kind = BGP_HANDOFF_ROUTE_BATCH;
+                    elt.neighbor_index = peer->peer_id;
+                    elt.data = msg;
+                    elt.timestamp = clib_cpu_time_now();
+                    while (bgp_spsc_ring_enqueue(&t->ring, &elt) < 0) {
+                        CLIB_PAUSE();
+                    }
+                    break;
+
+                default:
+                    break;
+            }
+            t->parsed++;
+            offset += length;
+        }
+    }
+
+    clib_atomic_store_rel_n(&t->done, 1);
+    return 0;
+}
+
+static void bgp_shard_bench_encode(u8 **rx, u8 type, u16 length) {
+    u8 *msg;
+
+    vec_add2(*rx, msg, length);
+    clib_memset(msg, 0, length);
+    clib_memset(msg, 0xff, 16);
+    clib_mem_unaligned(msg + 16, u16) = clib_host_to_net_u16(length);
+    msg[18] = type;
+}
+
+static clib_error_t *
+bgp_shard_benchmark_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    u32 n_peers = 1000, n_messages = 200, max_threads = vlib_num_workers();
+    bgp_shard_bench_peer_t *peers = 0, *peer;
+    bgp_shard_bench_thread_t *threads = 0;
+    bgp_bench_t bench;
+    f64 baseline = 0;
+    u8 *label = 0;
+    u32 n_shards, i, j;
+
+    if (max_threads == 0) {
+        max_threads = 4;
+    }
+    while (unformat_check_input(input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat(input, "peers %u", &n_peers))
+            ;
+        else if (unformat(input, "messages %u", &n_messages))
+            ;
+        else if (unformat(input, "threads %u", &max_threads))
+            ;
+        else
+            return clib_error_return(0, "unknown input `%U'", format_unformat_error, input);
+    }
+    if (n_peers == 0 || n_messages == 0 || max_threads == 0 || max_threads > 64) {
+        return clib_error_return(0, "peers and messages must be non-zero, threads 1-64");
+    }
+
+    // Three KEEPALIVEs per UPDATE, roughly a steady-state mix
+    vec_validate(peers, n_peers - 1);
+    vec_foreach (peer, peers) {
+        peer->peer_id = peer - peers;
+        for (j = 0; j < n_messages; j++) {
+            if (j % 4 == 3) {
+                bgp_shard_bench_encode(&peer->rx, BGP_MSG_UPDATE, BGP_SHARD_BENCH_UPDATE_LEN);
+            } else {
+                bgp_shard_bench_encode(&peer->rx, BGP_MSG_KEEPALIVE, BGP_HEADER_LEN);
+            }
+        }
+    }
+
+    bgp_bench_init(&bench, vm);
+    vlib_cli_output(vm, "%u simulated peers, %u messages each", n_peers, n_messages);
+
+    for (n_shards = 1; n_shards <= max_threads; n_shards++) {
+        u64 rib_updates = 0, parsed = 0;
+        u32 n_done = 0, n_started;
+        f64 seconds;
+
+        vec_validate_aligned(threads, n_shards - 1, CLIB_CACHE_LINE_BYTES);
+        for (i = 0; i < n_shards; i++) {
+            bgp_shard_bench_thread_t *t = &threads[i];
+            clib_memset(t, 0, sizeof(*t));
+            t->peers = peers;
+            t->shard_index = i;
+            t->n_shards = n_shards;
+            t->go = &bench.go;
+            bgp_spsc_ring_init(&t->ring, 4096);
+        }
+        n_started = bgp_bench_spawn(&bench, bgp_shard_bench_worker, threads, sizeof(threads[0]), n_shards);
+        bgp_bench_start(&bench);
+
+        // RIB owner: consume every shard's ring until all shards finish
+        while (n_done < n_started) {
+            bgp_handoff_elt_t elts[64];
+            n_done = 0;
+            for (i = 0; i < n_started; i++) {
+                u32 done = clib_atomic_load_acq_n(&threads[i].done);
+                u32 n;
+                while ((n = bgp_spsc_ring_dequeue_burst(&threads[i].ring, elts, ARRAY_LEN(elts)))) {
+                    rib_updates += n;
+                }
+                n_done += done;
+            }
+        }
+        seconds = bgp_bench_stop(&bench);
+        bgp_bench_join(&bench);
+
+        for (i = 0; i < n_shards; i++) {
+            parsed += threads[i].parsed;
+            bgp_spsc_ring_free(&threads[i].ring);
+        }
+        if (n_started < n_shards) {
+            vlib_cli_output(vm, "  could only start %u of %u threads", n_started, n_shards);
+            break;
+        }
+        if (n_shards == 1) {
+            baseline = seconds;
+        }
+        vec_reset_length(label);
+        label = format(label, "%u shard%s%c", n_shards, n_shards == 1 ? "" : "s", 0);
+        bgp_bench_report(&bench, (char *)label, parsed, "messages", seconds, "%lu rib updates, %.2fx speedup",
+                         rib_updates, baseline / seconds);
+    }
+
+    vec_foreach (peer, peers) {
+        vec_free(peer->rx);
+    }
+    vec_free(peers);
+    vec_free(threads);
+    vec_free(label);
+    bgp_bench_free(&bench);
+    return 0;
+}
+
+VLIB_CLI_COMMAND(bgp_shard_benchmark_command, static) = {
+    .path = "test bgp shard-benchmark",
+    .short_help = "test bgp shard-benchmark [peers <n>] [messages <n>] [threads <n>]",
+    .function = bgp_shard_benchmark_command_fn,
+};
@@ -1,14 +1,37 @@
 #include <vnet/vnet.h>
 #include <vnet/ip/ip.h>
+#include <vlib/unix/unix.h>
 #include <vppinfra/socket.h>
+#include <vppinfra/file.h>
+#include <vlibmemory/api.h>
 #include <fcntl.h>
 #include <bgp/bgp.h>
 
+#define BGP_SOCKET_RX_CHUNK 4096
+
+static clib_error_t *bgp_socket_read_ready(clib_file_t *uf);
+static clib_error_t *bgp_socket_write_ready(clib_file_t *uf);
+static clib_error_t *bgp_socket_error(clib_file_t *uf);
 
 /* Initialize the BGP socket */
 bgp_socket_t *bgp_socket_init(ip4_address_t *peer_ip) {
     bgp_socket_t *sock = clib_mem_alloc(sizeof(bgp_socket_t));
     memset(sock, 0, sizeof(*sock));
+    sock->clib_file_index = ~0;
+    sock->neighbor_index = ~0;
+    sock->tx_slot = ~0;
+    sock->session_handle = ~0ULL;
+    sock->backend = bgp_main.transport;
+
+    sock->peer_addr.sin_family = AF_INET;
+    sock->peer_addr.sin_port = htons(BGP_PORT);
+    sock->peer_addr.sin_addr.s_addr = peer_ip->as_u32;
+
+    // Host stack sessions live in VPP's TCP, not the kernel
+    if (sock->backend == BGP_TRANSPORT_SESSION) {
+        sock->socket_fd = -1;
+        return sock;
+    }
 
     sock->socket_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (sock->socket_fd < 0) {
@@ -17,51 +40,712 @@ bgp_socket_t *bgp_socket_init(ip4_address_t *peer_ip) {
         return NULL;
     }
 
-    sock->peer_addr.sin_family = AF_INET;
-    sock->peer_addr.sin_port = htons(BGP_PORT);
-    sock->peer_addr.sin_addr.s_addr = peer_ip->as_u32;
+    // The poller drives all I/O; the socket must never block the process node
+    int flags = fcntl(sock->socket_fd, F_GETFL, 0);
+    fcntl(sock->socket_fd, F_SETFL, flags | O_NONBLOCK);
+
+    return sock;
+}
+
+/* Wrap a connected descriptor accepted by the listener */
+bgp_socket_t *bgp_socket_from_fd(int fd, struct sockaddr_in *peer_addr) {
+    bgp_socket_t *sock = clib_mem_alloc(sizeof(bgp_socket_t));
+    memset(sock, 0, sizeof(*sock));
+    sock->clib_file_index = ~0;
+    sock->neighbor_index = ~0;
+    sock->tx_slot = ~0;
+    sock->session_handle = ~0ULL;
+
+    // Kernel descriptors can use the ring; only host stack sessions cannot
+    sock->backend = bgp_main.transport == BGP_TRANSPORT_IO_URING ?
+        BGP_TRANSPORT_IO_URING : BGP_TRANSPORT_SOCKET;
+    sock->socket_fd = fd;
+    sock->peer_addr = *peer_addr;
+    sock->is_connected = 1;
+    sock->is_inbound = 1;
 
     return sock;
 }
 
 /* Establish a connection to the BGP peer */
 int bgp_socket_connect(bgp_socket_t *sock) {
-    int flags = fcntl(sock->socket_fd, F_GETFL, 0);
-    fcntl(sock->socket_fd, F_SETFL, flags | O_NONBLOCK);
+    if (sock->backend == BGP_TRANSPORT_IO_URING) {
+        return bgp_uring_connect(sock);
+    }
+    if (sock->backend == BGP_TRANSPORT_SESSION) {
+        return bgp_session_connect(sock);
+    }
 
     if (connect(sock->socket_fd, (struct sockaddr *)&sock->peer_addr, sizeof(sock->peer_addr)) < 0) {
         if (errno != EINPROGRESS) {
             clib_warning("Failed to connect to BGP peer: %s", strerror(errno));
             return -1;
         }
+        // Completion is reported by the write-ready callback
+        sock->is_connecting = 1;
+        bgp_socket_want_write(sock, 1);
+        return 0;
     }
+    sock->is_connected = 1;
     return 0;
 }
 
-/* Send a BGP message */
+/* Send a BGP message; returns bytes sent, 0 if the socket would block, -1 on error */
 int bgp_socket_send(bgp_socket_t *sock, void *message, size_t length) {
-    ssize_t sent = send(sock->socket_fd, message, length, 0);
+    if (sock->backend == BGP_TRANSPORT_SESSION) {
+        return bgp_session_write_now(sock, message, length) < 0 ? 0 : length;
+    }
+
+    ssize_t sent = send(sock->socket_fd, message, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+        clib_warning("Failed to send message: %s", strerror(errno));
+        return -1;
+    }
+    return sent;
+}
+
+/* Send several buffers in one syscall; returns bytes sent, 0 if the socket would block, -1 on error */
+int bgp_socket_sendv(bgp_socket_t *sock, struct iovec *iov, int iov_count) {
+    struct msghdr msg = { 0 };
+
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iov_count;
+
+    ssize_t sent = sendmsg(sock->socket_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
     if (sent < 0) {
-        clib_warning("Failed to send message");
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+        clib_warning("Failed to send messages: %s", strerror(errno));
         return -1;
     }
     return sent;
 }
 
-/* Receive a BGP message */
+/* Receive a BGP message; returns bytes read, 0 if nothing is pending, -1 on error or EOF */
 int bgp_socket_receive(bgp_socket_t *sock, void *buffer, size_t buffer_size) {
-    ssize_t received = recv(sock->socket_fd, buffer, buffer_size, 0);
+    ssize_t received = recv(sock->socket_fd, buffer, buffer_size, MSG_DONTWAIT);
     if (received < 0) {
-        clib_warning("Failed to receive message");
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+        clib_warning("Failed to receive message: %s", strerror(errno));
+        return -1;
+    }
+    if (received == 0) {
+        // Orderly shutdown by the peer
         return -1;
     }
     return received;
 }
 
+/*
+ * Every thread's epoll input reads file_main, so a descriptor polled by a
+ * worker is added and removed under the worker barrier. Workers cannot take
+ * the barrier themselves and ask the main thread to do it.
+ */
+static void bgp_socket_file_add(bgp_socket_t *sock, u32 neighbor_index, u32 polling_thread) {
+    clib_file_t template = { 0 };
+
+    template.read_function = bgp_socket_read_ready;
+    template.write_function = bgp_socket_write_ready;
+    template.error_function = bgp_socket_error;
+    template.file_descriptor = sock->socket_fd;
+    template.private_data = neighbor_index;
+    template.polling_thread_index = polling_thread;
+    template.description = format(0, "bgp peer %U", format_ip4_address,
+                                  &sock->peer_addr.sin_addr.s_addr);
+
+    if (polling_thread) {
+        vlib_worker_thread_barrier_sync(bgp_main.vlib_main);
+    }
+    sock->clib_file_index = clib_file_add(&file_main, &template);
+    if (polling_thread) {
+        vlib_worker_thread_barrier_release(bgp_main.vlib_main);
+    }
+}
+
+static void bgp_socket_file_del(u32 file_index) {
+    clib_file_t *f = pool_elt_at_index(file_main.file_pool, file_index);
+    u32 polling_thread = f->polling_thread_index;
+
+    if (polling_thread) {
+        vlib_worker_thread_barrier_sync(bgp_main.vlib_main);
+    }
+    // clib_file_del closes the descriptor for us
+    clib_file_del_by_index(&file_main, file_index);
+    if (polling_thread) {
+        vlib_worker_thread_barrier_release(bgp_main.vlib_main);
+    }
+}
+
+static void bgp_socket_file_del_rpc(void *arg) {
+    bgp_socket_file_del(*(u32 *)arg);
+}
+
+typedef struct {
+    u32 neighbor_index;
+    int fd;
+    bgp_socket_t *sock;
+} bgp_socket_register_args_t;
+
+static void bgp_socket_register_rpc(void *arg) {
+    bgp_socket_register_args_t *a = arg;
+    bgp_main_t *bmp = &bgp_main;
+    bgp_neighbor_t *neighbor;
+
+    // The owner may have closed the socket, or the neighbor gone, before the request got here
+    vlib_worker_thread_barrier_sync(bmp->vlib_main);
+    if (pool_is_free_index(bmp->neighbors, a->neighbor_index)) {
+        vlib_worker_thread_barrier_release(bmp->vlib_main);
+        return;
+    }
+    neighbor = pool_elt_at_index(bmp->neighbors, a->neighbor_index);
+    if ((neighbor->socket == a->sock || neighbor->collision_socket == a->sock) &&
+        a->sock->socket_fd == a->fd && a->sock->clib_file_index == ~0) {
+        bgp_socket_file_add(a->sock, a->neighbor_index, neighbor->owner_thread);
+        // A connect or output started while unregistered resumes as write-ready
+        clib_file_set_data_available_to_write(&file_main, a->sock->clib_file_index, 1);
+    }
+    vlib_worker_thread_barrier_release(bmp->vlib_main);
+}
+
 /* Close the BGP socket */
 void bgp_socket_close(bgp_socket_t *sock) {
-    if (sock->socket_fd >= 0) {
+    if (sock->backend != BGP_TRANSPORT_SOCKET) {
+        if (sock->backend == BGP_TRANSPORT_IO_URING) {
+            bgp_uring_close(sock);
+        } else {
+            bgp_session_close(sock);
+        }
+        vec_free(sock->rx_buffer);
+        clib_mem_free(sock);
+        return;
+    }
+
+    if (sock->clib_file_index != ~0) {
+        u32 file_index = sock->clib_file_index;
+        if (vlib_get_thread_index() != 0) {
+            vlib_rpc_call_main_thread(bgp_socket_file_del_rpc, (u8 *)&file_index, sizeof(file_index));
+        } else {
+            bgp_socket_file_del(file_index);
+        }
+        sock->clib_file_index = ~0;
+    } else if (sock->socket_fd >= 0) {
         close(sock->socket_fd);
     }
+    vec_free(sock->rx_buffer);
     clib_mem_free(sock);
 }
+
+/* Register the socket with the VPP file poller on behalf of a neighbor */
+void bgp_socket_register(bgp_socket_t *sock, u32 neighbor_index) {
+    if (sock->clib_file_index != ~0) {
+        return;
+    }
+
+    sock->neighbor_index = neighbor_index;
+
+    // Session layer callbacks are registered once for the whole app
+    if (sock->backend == BGP_TRANSPORT_SESSION) {
+        return;
+    }
+
+    // Falls back to the poller when the ring has no free transmit buffer
+    if (sock->backend == BGP_TRANSPORT_IO_URING && bgp_uring_register(sock) == 0) {
+        return;
+    }
+
+    // Sharded neighbors register from their worker; the main thread does the add
+    if (vlib_get_thread_index() != 0) {
+        bgp_socket_register_args_t args = {
+            .neighbor_index = neighbor_index,
+            .fd = sock->socket_fd,
+            .sock = sock,
+        };
+        vlib_rpc_call_main_thread(bgp_socket_register_rpc, (u8 *)&args, sizeof(args));
+        return;
+    }
+
+    bgp_socket_file_add(sock, neighbor_index,
+                        pool_elt_at_index(bgp_main.neighbors, neighbor_index)->owner_thread);
+
+    // A pending connect completes as write-readiness
+    if (sock->is_connecting) {
+        bgp_socket_want_write(sock, 1);
+    }
+}
+
+/* Enable or disable write-ready notifications for the socket */
+void bgp_socket_want_write(bgp_socket_t *sock, int enable) {
+    if (sock->clib_file_index == ~0) {
+        return;
+    }
+    clib_file_set_data_available_to_write(&file_main, sock->clib_file_index, enable != 0);
+}
+
+/* Retire fully written messages and remember how far into the next one we got */
+void bgp_socket_tx_advance(bgp_neighbor_t *neighbor, u32 written) {
+    bgp_socket_t *sock = neighbor->socket;
+    bgp_message_t *message;
+
+    written += sock->tx_offset;
+    sock->tx_offset = 0;
+    while ((message = queue_peek(&neighbor->output_queue)) != NULL) {
+        if (written < message->length) {
+            sock->tx_offset = written;
+            break;
+        }
+        written -= message->length;
+        bgp_output_retire(neighbor);
+    }
+
+    // Top the wire queue back up, control messages first
+    bgp_output_schedule(neighbor);
+
+    // Drained below half the budget: resume and generate the UPDATEs that were held back
+    if (neighbor->rib_out_paused && neighbor->bulk_queue.bytes <= neighbor->bulk_queue.byte_limit / 2) {
+        neighbor->rib_out_paused = 0;
+        clib_warning("Output queue for neighbor %U drained, resuming updates",
+                     format_ip4_address, &neighbor->neighbor_ip);
+        if (neighbor->state == BGP_STATE_ESTABLISHED) {
+            bgp_handle_route_update(&bgp_main, neighbor);
+        }
+    }
+}
+
+/* Transmit as much of the neighbor's output queue as the socket accepts */
+void bgp_socket_flush(bgp_neighbor_t *neighbor) {
+    bgp_socket_t *sock = neighbor->socket;
+    struct iovec iov[BGP_SOCKET_TX_IOV_MAX];
+    bgp_message_t *message;
+
+    if (!sock || !sock->is_connected) {
+        return;
+    }
+
+    bgp_output_schedule(neighbor);
+
+    if (sock->backend == BGP_TRANSPORT_IO_URING) {
+        bgp_uring_flush(neighbor);
+        return;
+    }
+    if (sock->backend == BGP_TRANSPORT_SESSION) {
+        bgp_session_flush(neighbor);
+        return;
+    }
+
+    while (!queue_is_empty(&neighbor->output_queue)) {
+        int iov_count = 0;
+        int rv;
+
+        // Gather queued messages, resuming the head one where the last write stopped
+        while (iov_count < BGP_SOCKET_TX_IOV_MAX &&
+               (message = queue_peek_nth(&neighbor->output_queue, iov_count)) != NULL) {
+            u32 skip = iov_count == 0 ? sock->tx_offset : 0;
+            iov[iov_count].iov_base = message->data + skip;
+            iov[iov_count].iov_len = message->length - skip;
+            iov_count++;
+        }
+
+        rv = bgp_socket_sendv(sock, iov, iov_count);
+        if (rv < 0) {
+            // A broken stream cannot be resumed mid-message
+            bgp_socket_handle_down(&bgp_main, neighbor);
+            return;
+        }
+        if (rv == 0) {
+            // Socket buffer is full; resume from the write-ready callback
+            bgp_socket_want_write(sock, 1);
+            return;
+        }
+
+        bgp_socket_tx_advance(neighbor, rv);
+
+        if (sock->tx_offset) {
+            // Short write: the kernel buffer is full
+            bgp_socket_want_write(sock, 1);
+            return;
+        }
+    }
+
+    bgp_socket_want_write(sock, 0);
+}
+
+/* Write bytes to the transport now, without queueing; -1 unless all of them went out */
+int bgp_socket_write_now(bgp_socket_t *sock, u8 *data, u32 length) {
+    int rv;
+
+    if (sock->backend == BGP_TRANSPORT_SESSION) {
+        return bgp_session_write_now(sock, data, length);
+    }
+    while (length) {
+        rv = bgp_socket_send(sock, data, length);
+        if (rv <= 0) {
+            return -1;
+        }
+        data += rv;
+        length -= rv;
+    }
+    return 0;
+}
+
+/* Our end's address of a connection, the next hop we advertise as self; -1 if unknown */
+int bgp_socket_local_address(bgp_socket_t *sock, ip4_address_t *addr) {
+    struct sockaddr_in local;
+    socklen_t len = sizeof(local);
+
+    if (sock->backend == BGP_TRANSPORT_SESSION) {
+        return bgp_session_local_address(sock, addr);
+    }
+    if (sock->socket_fd < 0 || getsockname(sock->socket_fd, (struct sockaddr *)&local, &len) < 0) {
+        return -1;
+    }
+    addr->as_u32 = local.sin_addr.s_addr;
+    return 0;
+}
+
+/*
+ * Write a NOTIFICATION on a connection that is about to close. The close
+ * discards queued output, so the message goes out ahead of it: only the
+ * partly written head message is finished first, to keep the stream
+ * framed. Best effort; a full socket buffer loses it. neighbor is NULL for
+ * a connection that never carried queued output (a collision loser).
+ */
+void bgp_socket_send_notification(bgp_neighbor_t *neighbor, bgp_socket_t *sock, u8 error_code,
+                                  u8 error_subcode) {
+    bgp_message_t *head;
+    size_t length;
+    u8 *data;
+
+    if (!sock || !sock->is_connected) {
+        return;
+    }
+    // A ring write still in flight owns the stream position; writing around it could interleave
+    if (sock->tx_in_flight) {
+        return;
+    }
+    if (neighbor && sock == neighbor->socket && sock->tx_offset &&
+        (head = queue_peek(&neighbor->output_queue)) != NULL) {
+        if (bgp_socket_write_now(sock, head->data + sock->tx_offset, head->length - sock->tx_offset) < 0) {
+            return;
+        }
+        sock->tx_offset = 0;
+        bgp_output_retire(neighbor);
+    }
+
+    data = bgp_create_notification_message(error_code, error_subcode, &length);
+    if (bgp_socket_write_now(sock, data, length) < 0) {
+        clib_warning("Failed to send NOTIFICATION %u/%u to %U", error_code, error_subcode,
+                     format_ip4_address, &sock->peer_addr.sin_addr.s_addr);
+    }
+    clib_mem_free(data);
+}
+
+/* Tear down the transport after a failure and return the neighbor to Idle */
+void bgp_socket_handle_down(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
+    clib_warning("Transport to neighbor %U went down.",
+                 format_ip4_address, &neighbor->neighbor_ip);
+
+    if (neighbor->socket) {
+        bgp_socket_close(neighbor->socket);
+        neighbor->socket = NULL;
+    }
+    neighbor->rx_flags = 0;
+    bgp_transition_state(bmp, neighbor, BGP_STATE_IDLE);
+}
+
+/* Map a poller callback back to its neighbor and socket, or NULL if they have gone away */
+static bgp_neighbor_t *bgp_socket_owner(clib_file_t *uf, bgp_socket_t **sockp) {
+    bgp_main_t *bmp = &bgp_main;
+    bgp_neighbor_t *neighbor;
+    u32 file_index = uf - file_main.file_pool;
+
+    if (pool_is_free_index(bmp->neighbors, uf->private_data)) {
+        return NULL;
+    }
+    neighbor = pool_elt_at_index(bmp->neighbors, uf->private_data);
+    if (neighbor->socket && neighbor->socket->clib_file_index == file_index) {
+        *sockp = neighbor->socket;
+        return neighbor;
+    }
+    if (neighbor->collision_socket && neighbor->collision_socket->clib_file_index == file_index) {
+        *sockp = neighbor->collision_socket;
+        return neighbor;
+    }
+    return NULL;
+}
+
+/* Drop the inbound connection that lost (or never reached) collision resolution */
+void bgp_socket_drop_collision(bgp_neighbor_t *neighbor) {
+    if (neighbor->collision_socket) {
+        bgp_socket_close(neighbor->collision_socket);
+        neighbor->collision_socket = NULL;
+    }
+}
+
+/* Length of the complete message at the head of the buffer, 0 if incomplete, -1 if malformed */
+static int bgp_socket_next_message(bgp_socket_t *sock, u32 offset) {
+    u8 *msg = sock->rx_buffer + offset;
+    u16 length;
+
+    if (vec_len(sock->rx_buffer) - offset < BGP_HEADER_LEN) {
+        return 0;
+    }
+    length = clib_net_to_host_u16(clib_mem_unaligned(msg + 16, u16));
+    if (length < BGP_HEADER_LEN || length > BGP_MAX_MESSAGE_LEN) {
+        return -1;
+    }
+    if (vec_len(sock->rx_buffer) - offset < length) {
+        return 0; // Wait for the rest of the message
+    }
+    return length;
+}
+
+/* Split the receive buffer into complete BGP messages and dispatch them */
+static int bgp_socket_frame_rx(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
+    bgp_socket_t *sock = neighbor->socket;
+    u32 offset = 0;
+    int length;
+
+    while ((length = bgp_socket_next_message(sock, offset)) > 0) {
+        bgp_handle_received_message(bmp, neighbor, sock->rx_buffer + offset, length);
+        offset += length;
+    }
+    if (length < 0) {
+        clib_warning("Bad message length from neighbor %U",
+                     format_ip4_address, &neighbor->neighbor_ip);
+        return -1;
+    }
+
+    if (offset) {
+        vec_delete(sock->rx_buffer, offset, 0);
+    }
+    return 0;
+}
+
+/* Process bytes appended to the receive buffer by either backend */
+void bgp_socket_input(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
+    if (bgp_socket_frame_rx(bmp, neighbor) < 0) {
+        bgp_socket_handle_down(bmp, neighbor);
+        return;
+    }
+
+    // Handshake messages move the FSM; UPDATEs do not
+    if (neighbor->rx_flags) {
+        bgp_fsm_post(bmp, neighbor, BGP_FSM_EVENT_MESSAGE);
+    }
+}
+
+/* The colliding connection only matters until its OPEN names the peer's BGP Identifier */
+static void bgp_socket_collision_input(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
+    bgp_socket_t *sock = neighbor->collision_socket;
+    int length;
+
+    while ((length = bgp_socket_next_message(sock, 0)) > 0) {
+        u8 *msg = sock->rx_buffer;
+
+        if (msg[18] == BGP_MSG_OPEN && length >= sizeof(bgp_open_message_t)) {
+            bgp_open_message_t open = *(bgp_open_message_t *)msg;
+
+            vec_delete(sock->rx_buffer, length, 0);
+            bgp_resolve_collision(bmp, neighbor, &open);
+            return;
+        }
+        // Nothing but OPEN is valid before the handshake
+        vec_delete(sock->rx_buffer, length, 0);
+    }
+
+    if (length < 0) {
+        bgp_socket_drop_collision(neighbor);
+    }
+}
+
+/* Bytes were appended to a receive buffer by a backend that does not go through the poller */
+void bgp_socket_rx_ready(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_socket_t *sock) {
+    if (sock == neighbor->collision_socket) {
+        bgp_socket_collision_input(bmp, neighbor);
+    } else {
+        bgp_socket_input(bmp, neighbor);
+    }
+}
+
+/* Mark a pending connect as complete and let the FSM send OPEN */
+void bgp_socket_connected(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
+    neighbor->socket->is_connecting = 0;
+    neighbor->socket->is_connected = 1;
+    clib_warning("TCP connection to neighbor %U established.",
+                 format_ip4_address, &neighbor->neighbor_ip);
+    bgp_fsm_post(bmp, neighbor, BGP_FSM_EVENT_TCP_CONNECTED);
+}
+
+static clib_error_t *bgp_socket_read_ready(clib_file_t *uf) {
+    bgp_main_t *bmp = &bgp_main;
+    bgp_socket_t *sock;
+    bgp_neighbor_t *neighbor = bgp_socket_owner(uf, &sock);
+    int n;
+
+    if (!neighbor) {
+        return 0;
+    }
+
+    do {
+        u32 len = vec_len(sock->rx_buffer);
+
+        vec_validate(sock->rx_buffer, len + BGP_SOCKET_RX_CHUNK - 1);
+        n = bgp_socket_receive(sock, sock->rx_buffer + len, BGP_SOCKET_RX_CHUNK);
+        vec_set_len(sock->rx_buffer, len + (n > 0 ? n : 0));
+    } while (n == BGP_SOCKET_RX_CHUNK);
+
+    if (sock == neighbor->collision_socket) {
+        if (n < 0) {
+            bgp_socket_drop_collision(neighbor);
+        } else {
+            bgp_socket_collision_input(bmp, neighbor);
+        }
+        return 0;
+    }
+
+    if (n < 0) {
+        bgp_socket_handle_down(bmp, neighbor);
+        return 0;
+    }
+
+    bgp_socket_input(bmp, neighbor);
+    return 0;
+}
+
+static clib_error_t *bgp_socket_write_ready(clib_file_t *uf) {
+    bgp_main_t *bmp = &bgp_main;
+    bgp_socket_t *sock;
+    bgp_neighbor_t *neighbor = bgp_socket_owner(uf, &sock);
+
+    if (!neighbor) {
+        return 0;
+    }
+
+    if (sock == neighbor->collision_socket) {
+        bgp_socket_want_write(sock, 0);
+        return 0;
+    }
+
+    if (sock->is_connecting) {
+        int err = 0;
+        socklen_t err_len = sizeof(err);
+
+        sock->is_connecting = 0;
+        if (getsockopt(sock->socket_fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 || err) {
+            clib_warning("Connect to neighbor %U failed: %s",
+                         format_ip4_address, &neighbor->neighbor_ip, strerror(err ? err : errno));
+            bgp_socket_handle_down(bmp, neighbor);
+            return 0;
+        }
+
+        bgp_socket_want_write(sock, 0);
+        bgp_socket_connected(bmp, neighbor);
+        return 0;
+    }
+
+    bgp_socket_flush(neighbor);
+    return 0;
+}
+
+static clib_error_t *bgp_socket_error(clib_file_t *uf) {
+    bgp_socket_t *sock;
+    bgp_neighbor_t *neighbor = bgp_socket_owner(uf, &sock);
+
+    if (!neighbor) {
+        return 0;
+    }
+    if (sock == neighbor->collision_socket) {
+        bgp_socket_drop_collision(neighbor);
+    } else {
+        bgp_socket_handle_down(&bgp_main, neighbor);
+    }
+    return 0;
+}
+
+/* Hand each accepted connection to the neighbor configured for its source address */
+static clib_error_t *bgp_socket_accept_ready(clib_file_t *uf) {
+    bgp_main_t *bmp = &bgp_main;
+    struct sockaddr_in peer_addr;
+    socklen_t addr_len;
+    int fd;
+
+    while (1) {
+        bgp_neighbor_t *neighbor;
+        bgp_socket_t *sock;
+        ip4_address_t peer_ip;
+
+        addr_len = sizeof(peer_addr);
+        fd = accept4(uf->file_descriptor, (struct sockaddr *)&peer_addr, &addr_len,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                clib_warning("Failed to accept BGP connection: %s", strerror(errno));
+            }
+            break;
+        }
+
+        peer_ip.as_u32 = peer_addr.sin_addr.s_addr;
+        neighbor = bgp_find_neighbor(bmp, peer_ip);
+        if (!neighbor) {
+            clib_warning("Rejected BGP connection from unconfigured peer %U",
+                         format_ip4_address, &peer_ip);
+            close(fd);
+            continue;
+        }
+
+        sock = bgp_socket_from_fd(fd, &peer_addr);
+        if (neighbor->owner_thread == 0) {
+            bgp_handle_incoming_connection(bmp, neighbor, sock);
+        } else if (bgp_handoff_to_worker(bmp, neighbor->owner_thread, BGP_HANDOFF_ACCEPT,
+                                         neighbor - bmp->neighbors, sock) < 0) {
+            // Owner is backed up; the peer will retry
+            bgp_socket_close(sock);
+        }
+    }
+    return 0;
+}
+
+/* Open the passive listener on BGP_PORT */
+int bgp_socket_listen(bgp_main_t *bmp) {
+    clib_file_t template = { 0 };
+    struct sockaddr_in addr = { 0 };
+    int fd, one = 1;
+
+    if (bmp->listen_fd >= 0) {
+        return 0;
+    }
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        clib_warning("Failed to create BGP listener: %s", strerror(errno));
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(BGP_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    // A large backlog absorbs every peer reconnecting at once after a restart
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        clib_warning("Failed to listen on BGP port %u: %s", BGP_PORT, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    template.read_function = bgp_socket_accept_ready;
+    template.file_descriptor = fd;
+    template.description = format(0, "bgp listener");
+
+    bmp->listen_fd = fd;
+    bmp->listen_file_index = clib_file_add(&file_main, &template);
+
+    clib_warning("BGP listening on port %u", BGP_PORT);
+    return 0;
+}
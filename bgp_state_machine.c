@@ -3,79 +3,17 @@
 #include <bgp/bgp.h>
 // #include <bgp/bgp_messages.h>
 
-void bgp_handle_route_update(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
-    u8 *route_update_data_pointer = NULL;
-    u16 route_update_data_length = 0;
-
-    // Construct the route update data
-    if (bgp_construct_route_update(bmp, neighbor, &route_update_data_pointer, &route_update_data_length) == 0) {
-        // Allocate memory for the BGP message
-        bgp_message_t *message = clib_mem_alloc(sizeof(bgp_message_t));
-        if (!message) {
-            clib_warning("Failed to allocate memory for BGP message");
-            clib_mem_free(route_update_data_pointer); // Free route update data if allocation fails
-            return;
-        }
-
-        // Populate the BGP message
-        message->type = BGP_MSG_UPDATE;
-        message->data = route_update_data_pointer;
-        message->length = route_update_data_length;
-
-        // Enqueue the message for transmission
-        if (bgp_enqueue_message(neighbor, message) < 0) {
-            clib_warning("Failed to enqueue route update message for neighbor %U",
-                         format_ip4_address, &neighbor->neighbor_ip);
-            clib_mem_free(route_update_data_pointer); // Free the message data
-            clib_mem_free(message);                   // Free the message structure
-        } else {
-            clib_warning("Route update message enqueued for neighbor %U",
-                         format_ip4_address, &neighbor->neighbor_ip);
-        }
-    } else {
-        clib_warning("Failed to construct route update data");
-    }
-}
-
-
-/**
- * Handles sending and receiving Keepalive messages for a BGP neighbor.
+/*
+ * UPDATEs are diffed and encoded per update group (bgp_update_group.c) and
+ * arrive as batches; the session only has to ask for its initial table.
  */
-void bgp_handle_keepalive(bgp_neighbor_t *neighbor) {
-    bgp_main_t *bmp = &bgp_main;
-
-    // Check if the keepalive timer has expired
-    if (neighbor->keepalive_timer > 0) {
-        neighbor->keepalive_timer--;
-    } else {
-        // Send a Keepalive message
-        bgp_message_t *keepalive_message = clib_mem_alloc(sizeof(bgp_message_t));
-        keepalive_message->type = BGP_MSG_KEEPALIVE;
-        keepalive_message->data = NULL;  // No payload for Keepalive messages
-        keepalive_message->length = sizeof(bgp_message_header_t); // Only the header
-
-        if (bgp_enqueue_message(neighbor, keepalive_message) < 0) {
-            clib_mem_free(keepalive_message); // Free memory if enqueue fails
-            clib_warning("Queue is full for neighbor %U, dropping Keepalive message.",
-                         format_ip4_address, &neighbor->neighbor_ip);
-        } else {
-            clib_warning("Sent Keepalive to neighbor %U.",
-                         format_ip4_address, &neighbor->neighbor_ip);
-        }
-
-        // Reset the keepalive timer
-        neighbor->keepalive_timer = bmp->keepalive_time;
+void bgp_handle_route_update(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
+    if (neighbor->rib_out_version || neighbor->rib_out_requested) {
+        return;
     }
-
-    // Process received Keepalive messages (if any)
-    while (!queue_is_empty(&neighbor->output_queue)) {
-
-        bgp_message_t *received_message = queue_dequeue(&neighbor->output_queue);
-        if (received_message && received_message->type == BGP_MSG_KEEPALIVE) {
-            clib_warning("Received Keepalive from neighbor %U.",
-                         format_ip4_address, &neighbor->neighbor_ip);
-            clib_mem_free(received_message); // Free the processed message
-        }
+    neighbor->rib_out_requested = 1;
+    if (bgp_handoff_to_main(bmp, BGP_HANDOFF_RIB_OUT_REQUEST, neighbor - bmp->neighbors, 0) < 0) {
+        neighbor->rib_out_requested = 0; // Asked again on the next keepalive
     }
 }
 
@@ -85,13 +23,30 @@ void bgp_enter_state(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_state_t new_
     clib_warning("Neighbor %U transitioning to state: %d",
                  format_ip4_address, &neighbor->neighbor_ip, new_state);
 
-    neighbor->state = new_state;
+    bgp_neighbor_set_state(bmp, neighbor, new_state);
 
     switch (new_state) {
         case BGP_STATE_IDLE:
             // Clear resources and prepare for session restart
-            neighbor->hold_timer = 0;
-            neighbor->keepalive_timer = 0;
+            bgp_timer_stop(bmp, neighbor, BGP_TIMER_HOLD);
+            bgp_timer_stop(bmp, neighbor, BGP_TIMER_KEEPALIVE);
+            neighbor->rx_flags = 0;
+            if (neighbor->socket) {
+                bgp_socket_close(neighbor->socket);
+                neighbor->socket = NULL;
+            }
+            if (neighbor->collision_socket) {
+                bgp_socket_close(neighbor->collision_socket);
+                neighbor->collision_socket = NULL;
+            }
+
+            // Pending output belonged to the old byte stream; the next session starts from scratch
+            bgp_discard_output(neighbor);
+            neighbor->rib_out_version = 0;
+            neighbor->rib_out_requested = 0;
+
+            // Back off before reconnecting so a flapping peer is not hammered
+            bgp_timer_start_jittered(bmp, neighbor, BGP_TIMER_CONNECT_RETRY, bmp->connect_retry_time);
             break;
 
         case BGP_STATE_CONNECT:
@@ -100,33 +55,41 @@ void bgp_enter_state(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_state_t new_
             break;
 
         case BGP_STATE_ACTIVE:
-            // Listening for incoming connections
+            // Outbound connect failed: listen for the peer until ConnectRetry expires
+            if (neighbor->socket) {
+                bgp_socket_close(neighbor->socket);
+                neighbor->socket = NULL;
+            }
+            bgp_timer_start_jittered(bmp, neighbor, BGP_TIMER_CONNECT_RETRY, bmp->connect_retry_time);
             break;
 
         case BGP_STATE_OPEN_SENT:
-            // Send an OPEN message
+            // Send an OPEN message and give the peer a few minutes to answer with its own
+            bgp_socket_local_address(neighbor->socket, &neighbor->local_addr);
             bgp_send_open_message(bmp, neighbor);
+            neighbor->hold_time = BGP_OPEN_SENT_HOLD_TIME;
+            neighbor->keepalive_time = 0;
+            bgp_timer_start(bmp, neighbor, BGP_TIMER_HOLD, neighbor->hold_time);
             break;
 
         case BGP_STATE_OPEN_CONFIRM:
-            // Await KEEPALIVE or NOTIFICATION message
+            // Acknowledge the peer's OPEN, then await KEEPALIVE or NOTIFICATION
+            bgp_send_keepalive_message(neighbor);
+            if (neighbor->keepalive_time) {
+                bgp_timer_start_jittered(bmp, neighbor, BGP_TIMER_KEEPALIVE, neighbor->keepalive_time);
+            }
             break;
 
         case BGP_STATE_ESTABLISHED:
             // // Session established; start exchanging routes
             // bgp_start_route_exchange(bmp, neighbor);
-            bgp_handle_keepalive(neighbor);
+            if (neighbor->keepalive_time && !bgp_timer_is_running(neighbor, BGP_TIMER_KEEPALIVE)) {
+                bgp_timer_start_jittered(bmp, neighbor, BGP_TIMER_KEEPALIVE, neighbor->keepalive_time);
+            }
             bgp_handle_route_update(bmp, neighbor);
 
-            // Process messages from the output queue
-            bgp_message_t *message;
-            while ((message = queue_dequeue(&neighbor->output_queue)) != NULL) {
-                if (bgp_socket_send(neighbor->socket, message->data, message->length) < 0) {
-                    clib_warning("Failed to send message to neighbor %U.",
-                                format_ip4_address, &neighbor->neighbor_ip);
-                }
-                clib_mem_free(message); // Free the message after sending
-            }
+            // Hand the output queue to the transmit path
+            bgp_socket_flush(neighbor);
             break;
 
         default:
@@ -165,19 +128,27 @@ void bgp_transition_state(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_state_t
     }
 }
 
-/* Periodic processing of state transitions */
+/* Evaluate a neighbor's state against its socket and received messages */
 void bgp_process_state(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
     switch (neighbor->state) {
         case BGP_STATE_IDLE:
-            bgp_transition_state(bmp, neighbor, BGP_STATE_CONNECT);
+            // Started by BGP_FSM_EVENT_START; after a failure ConnectRetry expiry moves it on
+            if (!bgp_timer_is_running(neighbor, BGP_TIMER_CONNECT_RETRY)) {
+                bgp_transition_state(bmp, neighbor, BGP_STATE_CONNECT);
+            }
             break;
 
         case BGP_STATE_CONNECT:
             if (bgp_tcp_is_connected(neighbor)) {
                 bgp_transition_state(bmp, neighbor, BGP_STATE_OPEN_SENT);
-            } else {
-                bgp_transition_state(bmp, neighbor, BGP_STATE_IDLE);
+            } else if (!neighbor->socket || !neighbor->socket->is_connecting) {
+                bgp_transition_state(bmp, neighbor, BGP_STATE_ACTIVE);
             }
+            // Otherwise the connect-complete callback advances the session
+            break;
+
+        case BGP_STATE_ACTIVE:
+            // Waiting for ConnectRetry to expire or for the peer to connect to us
             break;
 
         case BGP_STATE_OPEN_SENT:
@@ -197,25 +168,11 @@ void bgp_process_state(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
             break;
 
         case BGP_STATE_ESTABLISHED:
-            // Handle keepalive and route updates
-            bgp_handle_keepalive(neighbor);
+            // Keepalives run off the timer wheel; ask for the initial table if needed
             bgp_handle_route_update(bmp, neighbor);
 
-            // Process queued messages for the neighbor
-            while (!queue_is_empty(&neighbor->output_queue)) {
-                bgp_message_t *message = queue_dequeue(&neighbor->output_queue);
-                if (message) {
-                    // Send the message to the neighbor
-                    if (bgp_socket_send(neighbor->socket, message->data, message->length) < 0) {
-                        clib_warning("Failed to send message to neighbor %U.",
-                                    format_ip4_address, &neighbor->neighbor_ip);
-                    }
-
-                    // Free the message after sending
-                    clib_mem_free(message);
-                }
-            }
-
+            // Send what the socket accepts; the rest goes out on write-ready
+            bgp_socket_flush(neighbor);
             break;
 
         default:
@@ -225,21 +182,248 @@ void bgp_process_state(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
     }
 }
 
-/* Timer events for managing neighbor state */
-void bgp_handle_timers(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
-    // Handle hold timer expiration
-    if (neighbor->hold_timer > 0 && --neighbor->hold_timer == 0) {
-        clib_warning("Hold timer expired for neighbor %U. Resetting session.",
+/*
+ * Nothing polls the FSM: socket callbacks, message arrival and
+ * configuration post typed events to the neighbor's owner thread, which
+ * runs only that neighbor's transitions. Idle neighbors cost nothing.
+ * Events are queued rather than run in place so transitions never nest
+ * inside socket callbacks. Posting for a neighbor owned by another thread
+ * requires the worker barrier.
+ */
+void bgp_fsm_post(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_fsm_event_t event) {
+    bgp_shard_t *shard = vec_elt_at_index(bmp->shards, neighbor->owner_thread);
+    bgp_fsm_event_elt_t *elt;
+
+    ASSERT(vlib_get_thread_index() == neighbor->owner_thread || vlib_worker_thread_barrier_held());
+
+    vec_add2(shard->fsm_events, elt, 1);
+    elt->neighbor_index = neighbor - bmp->neighbors;
+    elt->event = event;
+
+    // Workers drain their queue every loop; the main thread's lives in the periodic process
+    if (neighbor->owner_thread == 0 && vec_len(shard->fsm_events) == 1 && bmp->periodic_node_index) {
+        vlib_process_signal_event(bmp->vlib_main, bmp->periodic_node_index, BGP_EVENT_FSM, 0);
+    }
+}
+
+static void bgp_fsm_handle_event(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_fsm_event_t event) {
+    u32 old_state;
+
+    // Only a neighbor at rest in Idle is started; a failed one waits for ConnectRetry
+    if (event == BGP_FSM_EVENT_START && neighbor->state != BGP_STATE_IDLE) {
+        return;
+    }
+    // Operator reset: tell an open peer why, drop the transport and reconnect at once
+    if (event == BGP_FSM_EVENT_RESET) {
+        if (neighbor->state == BGP_STATE_OPEN_CONFIRM || neighbor->state == BGP_STATE_ESTABLISHED) {
+            bgp_send_notification_message(neighbor, BGP_ERR_CEASE, BGP_CEASE_ADMIN_RESET);
+        }
+        bgp_transition_state(bmp, neighbor, BGP_STATE_IDLE);
+        bgp_timer_stop(bmp, neighbor, BGP_TIMER_CONNECT_RETRY);
+    }
+    // Fast external fallover: the peer is unreachable, so do not wait for the hold timer
+    if (event == BGP_FSM_EVENT_LINK_DOWN && neighbor->state != BGP_STATE_IDLE) {
+        clib_warning("Interface to neighbor %U went down, resetting session",
                      format_ip4_address, &neighbor->neighbor_ip);
         bgp_transition_state(bmp, neighbor, BGP_STATE_IDLE);
+        return;
+    }
+    // The last session's paths leave the RIB before a new session can bring any
+    if (neighbor->state == BGP_STATE_IDLE && !bgp_peer_down_flush(bmp, neighbor)) {
+        return; // Its owner starts it once the handoff goes through
+    }
+    if (event == BGP_FSM_EVENT_CONNECT_RETRY &&
+        (neighbor->state == BGP_STATE_IDLE || neighbor->state == BGP_STATE_ACTIVE)) {
+        bgp_transition_state(bmp, neighbor, BGP_STATE_CONNECT);
     }
 
-    // Handle keepalive timer expiration
-    if (neighbor->keepalive_timer > 0 && --neighbor->keepalive_timer == 0) {
-        clib_warning("Keepalive timer expired for neighbor %U. Sending keepalive.",
-                     format_ip4_address, &neighbor->neighbor_ip);
-        bgp_send_keepalive_message(neighbor);
-        neighbor->keepalive_timer = bmp->keepalive_time;
+    // Follow the transitions this event enables, e.g. OPEN and KEEPALIVE in one read
+    do {
+        old_state = neighbor->state;
+        bgp_process_state(bmp, neighbor);
+    } while (neighbor->state != old_state);
+}
+
+u32 bgp_fsm_dispatch(bgp_main_t *bmp, u32 thread_index) {
+    bgp_shard_t *shard = vec_elt_at_index(bmp->shards, thread_index);
+    bgp_fsm_event_elt_t *elt;
+    u32 n_events = 0;
+
+    while (vec_len(shard->fsm_events)) {
+        bgp_fsm_event_elt_t *tmp = shard->fsm_running;
+
+        shard->fsm_running = shard->fsm_events;
+        shard->fsm_events = tmp;
+        vec_foreach (elt, shard->fsm_running) {
+            if (!pool_is_free_index(bmp->neighbors, elt->neighbor_index)) {
+                bgp_fsm_handle_event(bmp, pool_elt_at_index(bmp->neighbors, elt->neighbor_index), elt->event);
+            }
+        }
+        n_events += vec_len(shard->fsm_running);
+        vec_reset_length(shard->fsm_running);
+    }
+    shard->n_fsm_events += n_events;
+    return n_events;
+}
+
+/* A neighbor's session timer fired; the wheel has already forgotten it */
+void bgp_handle_timer_expired(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_timer_type_t timer) {
+    switch (timer) {
+        case BGP_TIMER_HOLD:
+            if (neighbor->state != BGP_STATE_IDLE) {
+                clib_warning("Hold timer expired for neighbor %U. Resetting session.",
+                             format_ip4_address, &neighbor->neighbor_ip);
+                bgp_transition_state(bmp, neighbor, BGP_STATE_IDLE);
+            }
+            break;
+
+        case BGP_TIMER_KEEPALIVE:
+            if (!neighbor->keepalive_time) {
+                // Negotiated away (hold time 0) after the timer was started
+            } else if (neighbor->state == BGP_STATE_ESTABLISHED &&
+                       neighbor->last_update_tx + neighbor->keepalive_time > vlib_time_now(vlib_get_main())) {
+                // An UPDATE restarted the peer's hold timer already; check again when it would lapse
+                f64 lapse = neighbor->last_update_tx + neighbor->keepalive_time - vlib_time_now(vlib_get_main());
+                bgp_timer_start(bmp, neighbor, BGP_TIMER_KEEPALIVE, (u32)(lapse + 0.999));
+                vec_elt_at_index(bmp->shards, neighbor->owner_thread)->keepalives_suppressed++;
+            } else if (neighbor->state == BGP_STATE_OPEN_CONFIRM || neighbor->state == BGP_STATE_ESTABLISHED) {
+                bgp_send_keepalive_message(neighbor);
+                bgp_timer_start_jittered(bmp, neighbor, BGP_TIMER_KEEPALIVE, neighbor->keepalive_time);
+            }
+            if (neighbor->state == BGP_STATE_ESTABLISHED) {
+                bgp_handle_route_update(bmp, neighbor); // Retries a refused table request
+            }
+            break;
+
+        case BGP_TIMER_CONNECT_RETRY:
+            bgp_fsm_post(bmp, neighbor, BGP_FSM_EVENT_CONNECT_RETRY);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* Attach an accepted connection to its neighbor, resolving collisions */
+void bgp_handle_incoming_connection(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_socket_t *sock) {
+    u32 neighbor_index = neighbor - bmp->neighbors;
+    u8 *open_data;
+    int open_length;
+
+    // Still withdrawing the last session's paths: the peer retries later
+    if (neighbor->state == BGP_STATE_IDLE && !bgp_peer_down_flush(bmp, neighbor)) {
+        bgp_socket_close(sock);
+        return;
+    }
+
+    switch (neighbor->state) {
+        case BGP_STATE_IDLE:
+        case BGP_STATE_CONNECT:
+        case BGP_STATE_ACTIVE:
+            // No handshake in progress: the inbound connection becomes the session
+            if (neighbor->socket) {
+                bgp_socket_close(neighbor->socket);
+            }
+            neighbor->socket = sock;
+            bgp_timer_stop(bmp, neighbor, BGP_TIMER_CONNECT_RETRY);
+            bgp_socket_register(sock, neighbor_index);
+            bgp_transition_state(bmp, neighbor, BGP_STATE_OPEN_SENT);
+            clib_warning("Accepted BGP connection from neighbor %U",
+                         format_ip4_address, &neighbor->neighbor_ip);
+            break;
+
+        case BGP_STATE_OPEN_SENT:
+        case BGP_STATE_OPEN_CONFIRM:
+            // Both sides connected at once; keep both until the new OPEN names a winner
+            if (neighbor->collision_socket) {
+                bgp_socket_close(neighbor->collision_socket);
+            }
+            // Short-lived: the poller rather than a ring slot; session layer sockets stay as they are
+            if (sock->backend == BGP_TRANSPORT_IO_URING) {
+                sock->backend = BGP_TRANSPORT_SOCKET;
+            }
+            neighbor->collision_socket = sock;
+            bgp_socket_register(sock, neighbor_index);
+
+            // Nothing else is written on this connection yet, so the OPEN goes out directly
+            open_length = bgp_create_open_message(&open_data, bmp->bgp_as_number,
+                                                  clib_net_to_host_u32(bmp->bgp_router_id),
+                                                  bmp->hold_time);
+            if (open_length > 0 && bgp_socket_write_now(sock, open_data, open_length) == 0) {
+                clib_mem_free(open_data);
+                clib_warning("Connection collision with neighbor %U, awaiting OPEN",
+                             format_ip4_address, &neighbor->neighbor_ip);
+                break;
+            }
+            if (open_length > 0) {
+                clib_mem_free(open_data);
+            }
+            // A missing or truncated OPEN would leave the collision unresolved; keep the existing session
+            clib_warning("Failed to send OPEN on colliding connection from neighbor %U, closing it",
+                         format_ip4_address, &neighbor->neighbor_ip);
+            bgp_socket_close(sock);
+            neighbor->collision_socket = NULL;
+            break;
+
+        default:
+            // An established session always wins over a new connection
+            clib_warning("Rejected BGP connection from established neighbor %U",
+                         format_ip4_address, &neighbor->neighbor_ip);
+            bgp_socket_close(sock);
+            break;
     }
 }
 
+/* Pick the surviving connection once the colliding connection's OPEN arrives */
+void bgp_resolve_collision(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_open_message_t *open) {
+    u32 local_router_id = clib_net_to_host_u32(bmp->bgp_router_id);
+    u32 remote_router_id = clib_net_to_host_u32(open->bgp_identifier.as_u32);
+    bgp_socket_t *incoming = neighbor->collision_socket;
+    bgp_socket_t *existing = neighbor->socket;
+    int keep_incoming;
+
+    neighbor->collision_socket = NULL;
+
+    if (existing->is_inbound) {
+        // Both came from the peer, so there is no collision: it gave up on the first
+        keep_incoming = 1;
+    } else {
+        // RFC 4271 6.8: the connection opened by the higher BGP Identifier survives
+        keep_incoming = remote_router_id > local_router_id;
+    }
+
+    if (!keep_incoming) {
+        clib_warning("Collision with neighbor %U: keeping existing connection",
+                     format_ip4_address, &neighbor->neighbor_ip);
+        bgp_socket_send_notification(0, incoming, BGP_ERR_CEASE, BGP_CEASE_COLLISION);
+        bgp_socket_close(incoming);
+        return;
+    }
+
+    clib_warning("Collision with neighbor %U: switching to the inbound connection",
+                 format_ip4_address, &neighbor->neighbor_ip);
+    bgp_socket_send_notification(neighbor, existing, BGP_ERR_CEASE, BGP_CEASE_COLLISION);
+    bgp_socket_close(existing);
+    neighbor->socket = incoming;
+    neighbor->rx_flags = 0;
+    bgp_socket_local_address(incoming, &neighbor->local_addr);
+    bgp_discard_output(neighbor);
+
+    if (bgp_open_negotiate(bmp, neighbor, open) < 0) {
+        bgp_transition_state(bmp, neighbor, BGP_STATE_IDLE);
+        return;
+    }
+
+    // Our OPEN went out when the connection was accepted and the peer's has now
+    // arrived: whatever the old connection had reached, this one is in OpenConfirm
+    bgp_exit_state(bmp, neighbor, neighbor->state);
+    bgp_enter_state(bmp, neighbor, BGP_STATE_OPEN_CONFIRM);
+    if (neighbor->hold_time) {
+        bgp_timer_start(bmp, neighbor, BGP_TIMER_HOLD, neighbor->hold_time);
+    } else {
+        bgp_timer_stop(bmp, neighbor, BGP_TIMER_HOLD);
+    }
+
+    // Anything the peer sent after its OPEN
+    bgp_socket_input(bmp, neighbor);
+}
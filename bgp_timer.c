@@ -0,0 +1,185 @@
+/*
+ * bgp_timer.c - per-neighbor session timers on VPP timer wheels
+ *
+ * Copyright (c) <current-year> <your-organization>
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vlib/vlib.h>
+#include <bgp/bgp.h>
+
+/*
+ * Hold, keepalive and connect-retry timers live on the timer wheel of the
+ * thread that owns the neighbor (bmp->shards[owner_thread]). Starting,
+ * restarting and stopping a timer is O(1), and a tick with nothing due only
+ * advances the wheel, however many neighbors are configured. The wheel is
+ * driven by the periodic process on the main thread and by bgp-shard-input
+ * on workers.
+ *
+ * Keepalive and connect-retry intervals are jittered to 75-100% of their
+ * base (RFC 4271 section 10). Jitter alone still lets a mass bring-up pile
+ * into a few ticks, so each thread also counts running timers per due slot
+ * and a jittered timer takes the less loaded of two random candidates.
+ */
+
+// Expired handles carry the timer id above the neighbor index (4 timers per object)
+#define BGP_TIMER_HANDLE_TIMER_SHIFT 30
+#define BGP_TIMER_HANDLE_INDEX_MASK  ((1 << BGP_TIMER_HANDLE_TIMER_SHIFT) - 1)
+
+static_always_inline bgp_shard_t *bgp_timer_shard(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
+    return vec_elt_at_index(bmp->shards, neighbor->owner_thread);
+}
+
+static_always_inline u8 bgp_timer_slot(bgp_shard_t *shard, u32 ticks) {
+    return (shard->timer_wheel.current_tick + ticks) % BGP_TIMER_SPREAD_SLOTS;
+}
+
+/* (Re)start a timer; runs on the owner thread or under the worker barrier */
+void bgp_timer_start(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_timer_type_t timer, u32 seconds) {
+    bgp_shard_t *shard = bgp_timer_shard(bmp, neighbor);
+    tw_timer_wheel_4t_3w_256sl_t *tw = &shard->timer_wheel;
+    u32 ticks = clib_max(1, seconds);
+
+    if (bgp_timer_is_running(neighbor, timer)) {
+        tw_timer_update_4t_3w_256sl(tw, neighbor->timers[timer], ticks);
+        shard->timer_load[neighbor->timer_slot[timer]]--;
+    } else {
+        neighbor->timers[timer] = tw_timer_start_4t_3w_256sl(tw, neighbor - bmp->neighbors, timer, ticks);
+    }
+    neighbor->timer_slot[timer] = bgp_timer_slot(shard, ticks);
+    shard->timer_load[neighbor->timer_slot[timer]]++;
+    neighbor->timer_deadline[timer] = vlib_time_now(vlib_get_main()) + ticks * BGP_TIMER_TICK_SECONDS;
+}
+
+/* Start a timer at a jittered interval, preferring the emptier of two due ticks */
+void bgp_timer_start_jittered(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_timer_type_t timer, u32 seconds) {
+    bgp_shard_t *shard = bgp_timer_shard(bmp, neighbor);
+    u32 a = bgp_jittered_interval(&shard->random_seed, seconds);
+    u32 b = bgp_jittered_interval(&shard->random_seed, seconds);
+
+    if (shard->timer_load[bgp_timer_slot(shard, b)] < shard->timer_load[bgp_timer_slot(shard, a)]) {
+        a = b;
+    }
+    bgp_timer_start(bmp, neighbor, timer, a);
+}
+
+void bgp_timer_stop(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_timer_type_t timer) {
+    bgp_shard_t *shard;
+
+    if (bgp_timer_is_running(neighbor, timer)) {
+        shard = bgp_timer_shard(bmp, neighbor);
+        tw_timer_stop_4t_3w_256sl(&shard->timer_wheel, neighbor->timers[timer]);
+        shard->timer_load[neighbor->timer_slot[timer]]--;
+        neighbor->timers[timer] = ~0;
+    }
+}
+
+void bgp_timer_stop_all(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
+    bgp_timer_type_t timer;
+
+    for (timer = 0; timer < BGP_N_TIMERS; timer++) {
+        bgp_timer_stop(bmp, neighbor, timer);
+    }
+}
+
+/* Whole seconds until a timer fires, 0 when it is stopped */
+u32 bgp_timer_remaining(bgp_neighbor_t *neighbor, bgp_timer_type_t timer, f64 now) {
+    if (!bgp_timer_is_running(neighbor, timer) || neighbor->timer_deadline[timer] <= now) {
+        return 0;
+    }
+    return (u32)(neighbor->timer_deadline[timer] - now + 0.5);
+}
+
+static_always_inline u32 bgp_tx_histogram_bucket(u32 n_messages) {
+    return n_messages ? clib_min(BGP_TX_HISTOGRAM_BUCKETS - 1, 1 + min_log2(n_messages)) : 0;
+}
+
+/* Close the transmit count of every tick the wheel moved past */
+static void bgp_tx_histogram_advance(bgp_shard_t *shard) {
+    u64 tick = shard->timer_wheel.current_tick;
+
+    if (tick == shard->tx_tick) {
+        return;
+    }
+    shard->tx_histogram[bgp_tx_histogram_bucket(shard->tx_in_tick)]++;
+    shard->tx_histogram[0] += tick - shard->tx_tick - 1;
+    shard->tx_tick = tick;
+    shard->tx_in_tick = 0;
+}
+
+/* Advance a thread's wheel and run the timers that came due */
+void bgp_timer_expire(bgp_main_t *bmp, u32 thread_index, f64 now) {
+    bgp_shard_t *shard = vec_elt_at_index(bmp->shards, thread_index);
+    u32 *handle;
+
+    shard->expired = tw_timer_expire_timers_vec_4t_3w_256sl(&shard->timer_wheel, now, shard->expired);
+    bgp_tx_histogram_advance(shard);
+    if (vec_len(shard->expired) == 0) {
+        return;
+    }
+
+    // The wheel already freed these; forget them before any handler stops or restarts timers
+    vec_foreach (handle, shard->expired) {
+        u32 neighbor_index = *handle & BGP_TIMER_HANDLE_INDEX_MASK;
+        bgp_timer_type_t timer = *handle >> BGP_TIMER_HANDLE_TIMER_SHIFT;
+        bgp_neighbor_t *neighbor;
+
+        if (!pool_is_free_index(bmp->neighbors, neighbor_index)) {
+            neighbor = pool_elt_at_index(bmp->neighbors, neighbor_index);
+            shard->timer_load[neighbor->timer_slot[timer]]--;
+            neighbor->timers[timer] = ~0;
+        }
+    }
+
+    vec_foreach (handle, shard->expired) {
+        u32 neighbor_index = *handle & BGP_TIMER_HANDLE_INDEX_MASK;
+        if (!pool_is_free_index(bmp->neighbors, neighbor_index)) {
+            bgp_handle_timer_expired(bmp, pool_elt_at_index(bmp->neighbors, neighbor_index),
+                                     *handle >> BGP_TIMER_HANDLE_TIMER_SHIFT);
+        }
+    }
+    vec_reset_length(shard->expired);
+}
+
+static clib_error_t *
+bgp_show_tx_histogram_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    bgp_main_t *bmp = &bgp_main;
+    bgp_shard_t *shard;
+    u32 bucket;
+
+    vec_foreach (shard, bmp->shards) {
+        vlib_cli_output(vm, "thread %u: %llu keepalives suppressed", shard - bmp->shards,
+                        shard->keepalives_suppressed);
+        vlib_cli_output(vm, "  %13s  %s", "msgs/tick", "ticks");
+        for (bucket = 0; bucket < BGP_TX_HISTOGRAM_BUCKETS; bucket++) {
+            if (shard->tx_histogram[bucket] == 0) {
+                continue;
+            }
+            if (bucket == 0) {
+                vlib_cli_output(vm, "  %13u  %llu", 0, shard->tx_histogram[bucket]);
+            } else if (bucket == BGP_TX_HISTOGRAM_BUCKETS - 1) {
+                vlib_cli_output(vm, "  %12u+  %llu", 1 << (bucket - 1), shard->tx_histogram[bucket]);
+            } else {
+                vlib_cli_output(vm, "  %6u-%6u  %llu", 1 << (bucket - 1), (1 << bucket) - 1,
+                                shard->tx_histogram[bucket]);
+            }
+        }
+    }
+    return 0;
+}
+
+VLIB_CLI_COMMAND(bgp_show_tx_histogram_command, static) = {
+    .path = "show bgp tx-histogram",
+    .short_help = "show bgp tx-histogram",
+    .function = bgp_show_tx_histogram_command_fn,
+};
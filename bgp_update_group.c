@@ -0,0 +1,1222 @@
+/*
+ * bgp_update_group.c - outbound update groups and UPDATE encoding
+ *
+ * Copyright (c) <current-year> <your-organization>
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vlib/vlib.h>
+#include <vlib/threads.h>
+#include <vppinfra/xxhash.h>
+#include <bgp/bgp.h>
+
+/*
+ * Neighbors are grouped by outbound policy. After each RIB publish the main
+ * thread hands the groups with work to the main thread and workers; every
+ * group diffs its Adj-RIB-Out against the snapshot and encodes the result
+ * independently, touching nothing but its own fields. The main thread then
+ * gives each member a copy of the encoded UPDATEs, which the member's owner
+ * thread queues for transmission.
+ *
+ * Changes are rate limited per group by the Minimum Route Advertisement
+ * Interval (RFC 4271 9.2.1.1): diffs only add prefixes to a pending set,
+ * which is advertised once the interval since the last flush has passed.
+ * Withdrawals can optionally skip the wait.
+ *
+ * Members are versioned by the group's sequence number: an incremental
+ * batch only applies on top of the sequence it was built from, and a member
+ * at 0 waits for a full-table batch it asked for itself. The whole-table
+ * encoding is kept per snapshot, so members that ask while it is current,
+ * such as new peer group members, get it without anything being encoded.
+ */
+
+static void bgp_update_free_messages(u8 ***updates, bgp_update_info_t **info) {
+    u8 **update;
+
+    vec_foreach (update, *updates) {
+        vec_free(*update);
+    }
+    vec_reset_length(*updates);
+    vec_reset_length(*info);
+}
+
+#define BGP_UPDATE_PREFIX_MAX_LEN 5  // Length byte plus a /32
+
+/* Next group sequence, skipping 0 (full table) and BGP_UPDATE_BATCH_RESTART when it wraps */
+static_always_inline u32 bgp_update_seq_next(u32 seq) {
+    return seq >= BGP_UPDATE_BATCH_RESTART - 1 ? 1 : seq + 1;
+}
+
+// A route as the group advertises it, after outbound policy
+typedef struct {
+    u32 split_source;             // Member the route came from, which must not get it back; ~0 if none
+    u32 next_hop;                 // Network order, 0 = each member's own address (next-hop-self)
+    u32 local_pref;
+    u32 med;
+    u32 origin;
+    u32 attr_set;                 // AS path sent after the prepends
+    u32 communities;              // Attribute set whose communities are sent
+    u32 prepend_as;
+    u32 prepend_count;
+    u32 route_index;              // Index in the snapshot's routes
+} bgp_update_adv_t;
+
+/*
+ * Attributes that would change what a neighbor sees for a prefix. Sets go
+ * in by content: a freed set's ID may be reused while the Adj-RIB-Out
+ * still remembers it.
+ */
+static_always_inline uword bgp_update_adv_fingerprint(bgp_main_t *bmp, bgp_update_adv_t *adv,
+                                                      bgp_route_t *route) {
+    u64 a = ((u64)adv->next_hop << 32) | adv->local_pref;
+    u64 b = ((u64)adv->med << 32) | ((u64)adv->origin << 24) | (route->as_path_length & 0xffffff);
+    u64 c = bgp_attr_set_get(bmp, adv->attr_set)->hash ^
+        clib_xxhash(bgp_attr_set_get(bmp, adv->communities)->hash);
+    u64 d = ((u64)adv->prepend_as << 32) | adv->prepend_count;
+    u64 e = adv->split_source;
+    return clib_xxhash(a ^ clib_xxhash(b ^ clib_xxhash(c ^ clib_xxhash(d ^ clib_xxhash(e)))));
+}
+
+static int bgp_update_adv_cmp_attrs(bgp_update_adv_t *a, bgp_update_adv_t *b) {
+    if (a->split_source != b->split_source) {
+        return a->split_source < b->split_source ? -1 : 1;
+    }
+    if (a->next_hop != b->next_hop) {
+        return a->next_hop < b->next_hop ? -1 : 1;
+    }
+    if (a->local_pref != b->local_pref) {
+        return a->local_pref < b->local_pref ? -1 : 1;
+    }
+    if (a->med != b->med) {
+        return a->med < b->med ? -1 : 1;
+    }
+    if (a->attr_set != b->attr_set) {
+        return a->attr_set < b->attr_set ? -1 : 1;
+    }
+    if (a->communities != b->communities) {
+        return a->communities < b->communities ? -1 : 1;
+    }
+    if (a->prepend_as != b->prepend_as) {
+        return a->prepend_as < b->prepend_as ? -1 : 1;
+    }
+    if (a->prepend_count != b->prepend_count) {
+        return a->prepend_count < b->prepend_count ? -1 : 1;
+    }
+    return a->origin < b->origin ? -1 : a->origin > b->origin;
+}
+
+static int bgp_update_adv_cmp(void *a1, void *a2) {
+    bgp_update_adv_t *a = a1, *b = a2;
+    int cmp = bgp_update_adv_cmp_attrs(a, b);
+
+    if (cmp) {
+        return cmp;
+    }
+    return a->route_index < b->route_index ? -1 : a->route_index > b->route_index;
+}
+
+// Outbound policy of one group, resolved once per build
+typedef struct {
+    bgp_prefix_list_t *filter;
+    bgp_route_map_t *map;
+    uword *members;               // Bitmap of the group's members
+    u8 is_ebgp;
+    u8 is_route_reflector_client;
+} bgp_update_policy_t;
+
+static void bgp_update_policy_init(bgp_main_t *bmp, bgp_update_group_t *group, bgp_update_policy_t *policy) {
+    u32 *index;
+
+    clib_memset(policy, 0, sizeof(*policy));
+    if (group->route_filter != ~0) {
+        policy->filter = pool_elt_at_index(bmp->prefix_lists, group->route_filter);
+    }
+    if (group->route_map_out != ~0) {
+        policy->map = pool_elt_at_index(bmp->route_maps, group->route_map_out);
+    }
+    vec_foreach (index, group->members) {
+        policy->members = clib_bitmap_set(policy->members, *index, 1);
+    }
+    policy->is_ebgp = group->is_ebgp;
+    policy->is_route_reflector_client = group->is_route_reflector_client;
+}
+
+/*
+ * Decide whether the group advertises a route and with what; on permit,
+ * adv holds it. iBGP-learned routes reach iBGP peers only through route
+ * reflection: from a client to everyone, from a non-client to clients
+ * (RFC 4271 9.1.1, RFC 4456 section 6). A member never gets its own
+ * routes back; that is left to delivery through adv->split_source.
+ */
+static_always_inline int bgp_update_group_permits(bgp_main_t *bmp, bgp_update_policy_t *policy,
+                                                  bgp_route_t *route, bgp_update_adv_t *adv) {
+    bgp_route_map_result_t result;
+
+    if (route->source_neighbor != ~0 && !route->source_is_ebgp && !policy->is_ebgp &&
+        !route->source_is_rr_client && !policy->is_route_reflector_client) {
+        return 0;
+    }
+    if (policy->filter && !bgp_prefix_list_permits(policy->filter, route->prefix, route->mask_length)) {
+        return 0;
+    }
+    adv->split_source = route->source_neighbor != ~0 && clib_bitmap_get(policy->members, route->source_neighbor) ?
+        route->source_neighbor : ~0;
+    // eBGP peers get our address (RFC 4271 5.1.3); iBGP peers the route's, if it has one
+    adv->next_hop = policy->is_ebgp ? 0 : route->next_hop.as_u32;
+    adv->local_pref = route->local_pref;
+    adv->med = route->med;
+    adv->origin = route->origin;
+    adv->attr_set = route->attr_set;
+    adv->communities = route->attr_set;
+    adv->prepend_as = 0;
+    adv->prepend_count = 0;
+    if (policy->map) {
+        if (!bgp_route_map_apply(bmp, policy->map, route, &result)) {
+            return 0;
+        }
+        adv->local_pref = result.local_pref;
+        adv->med = result.med;
+        adv->communities = result.communities;
+        adv->prepend_as = result.prepend_as;
+        adv->prepend_count = result.prepend_count;
+    }
+    return 1;
+}
+
+// === UPDATE encoding ===
+
+static u8 *bgp_update_start(void) {
+    u8 *msg = 0;
+
+    vec_validate(msg, BGP_HEADER_LEN + 1);
+    clib_memset(msg, 0xff, 16);
+    msg[18] = BGP_MSG_UPDATE;
+    msg[19] = msg[20] = 0; // Withdrawn routes length
+    return msg;
+}
+
+static void bgp_update_finish(u8 ***out, bgp_update_info_t **info, u8 *msg, bgp_update_info_t *msg_info) {
+    clib_mem_unaligned(msg + 16, u16) = clib_host_to_net_u16(vec_len(msg));
+    vec_add1(*out, msg);
+    vec_add1(*info, *msg_info);
+}
+
+static void bgp_update_put_prefix(u8 **msg, ip4_address_t prefix, u8 mask_length) {
+    u8 *p;
+
+    vec_add2(*msg, p, 1 + (mask_length + 7) / 8);
+    p[0] = mask_length;
+    clib_memcpy(p + 1, &prefix, (mask_length + 7) / 8);
+}
+
+static void bgp_update_close_withdraws(u8 ***out, bgp_update_info_t **info, u8 *msg,
+                                       bgp_update_info_t *msg_info) {
+    u8 *p;
+
+    clib_mem_unaligned(msg + BGP_HEADER_LEN, u16) =
+        clib_host_to_net_u16(vec_len(msg) - BGP_HEADER_LEN - 2);
+    vec_add2(msg, p, 2);
+    p[0] = p[1] = 0; // No path attributes
+    bgp_update_finish(out, info, msg, msg_info);
+}
+
+/*
+ * Withdrawn prefixes (bgp_dest_key() values), packed into as few UPDATEs as
+ * fit; for every member, or with source_only for split_source alone.
+ */
+static void bgp_update_encode_withdraws(u8 ***out, bgp_update_info_t **info, uword *keys, u32 split_source,
+                                        u8 source_only) {
+    bgp_update_info_t msg_info = { .split_source = split_source, .source_only = source_only };
+    u8 *msg = 0;
+    uword *key;
+
+    vec_foreach (key, keys) {
+        ip4_address_t prefix = { .as_u32 = clib_host_to_net_u32(*key >> 8) };
+
+        // Leave room for the empty path attribute length
+        if (msg && vec_len(msg) + BGP_UPDATE_PREFIX_MAX_LEN + 2 > BGP_MAX_MESSAGE_LEN) {
+            bgp_update_close_withdraws(out, info, msg, &msg_info);
+            msg = 0;
+        }
+        if (!msg) {
+            msg = bgp_update_start();
+        }
+        bgp_update_put_prefix(&msg, prefix, *key & 0xff);
+    }
+    if (msg) {
+        bgp_update_close_withdraws(out, info, msg, &msg_info);
+    }
+}
+
+/* Attribute header, with the extended length when the value needs it; returns where the value goes */
+static u8 *bgp_update_put_attr_header(u8 **msg, u8 flags, u8 type, u32 length) {
+    u8 *p;
+
+    if (length > 255) {
+        vec_add2(*msg, p, 4 + length);
+        p[0] = flags | BGP_ATTR_FLAG_EXTENDED;
+        p[1] = type;
+        clib_mem_unaligned(p + 2, u16) = clib_host_to_net_u16(length);
+        return p + 4;
+    }
+    vec_add2(*msg, p, 3 + length);
+    p[0] = flags;
+    p[1] = type;
+    p[2] = length;
+    return p + 3;
+}
+
+/* AS_PATH: our AS towards eBGP peers, policy prepends, then the route's path (one segment, 2-octet ASes) */
+static void bgp_update_put_as_path(u8 **msg, bgp_update_group_t *group, bgp_update_adv_t *adv,
+                                   bgp_attr_set_t *set, u16 local_as) {
+    u32 n_as = (group->is_ebgp != 0) + adv->prepend_count + vec_len(set->as_path), i;
+    u8 *p;
+
+    n_as = clib_min(n_as, 255); // One segment
+    p = bgp_update_put_attr_header(msg, BGP_ATTR_FLAG_TRANSITIVE, BGP_ATTR_AS_PATH, n_as ? 2 + 2 * n_as : 0);
+    if (!n_as) {
+        return;
+    }
+    p[0] = BGP_AS_SEQUENCE;
+    p[1] = n_as;
+    p += 2;
+    for (i = 0; i < n_as; i++, p += 2) {
+        u32 as;
+        if (group->is_ebgp && i == 0) {
+            as = local_as;
+        } else if (i - (group->is_ebgp != 0) < adv->prepend_count) {
+            as = adv->prepend_as;
+        } else {
+            as = set->as_path[i - (group->is_ebgp != 0) - adv->prepend_count];
+        }
+        clib_mem_unaligned(p, u16) = clib_host_to_net_u16(as);
+    }
+}
+
+/* Path attributes; returns the offset of the NEXT_HOP value in the message */
+static u16 bgp_update_put_attrs(u8 **msg, bgp_main_t *bmp, bgp_update_group_t *group, bgp_update_adv_t *adv,
+                                u16 local_as) {
+    u32 *communities = bgp_attr_set_get(bmp, adv->communities)->communities;
+    u32 start = vec_len(*msg), i;
+    u16 next_hop_offset;
+    u8 *p;
+
+    vec_add2(*msg, p, 2); // Total path attribute length, filled in below
+
+    vec_add2(*msg, p, 4);
+    p[0] = BGP_ATTR_FLAG_TRANSITIVE;
+    p[1] = BGP_ATTR_ORIGIN;
+    p[2] = 1;
+    p[3] = adv->origin;
+
+    bgp_update_put_as_path(msg, group, adv, bgp_attr_set_get(bmp, adv->attr_set), local_as);
+
+    vec_add2(*msg, p, 7);
+    p[0] = BGP_ATTR_FLAG_TRANSITIVE;
+    p[1] = BGP_ATTR_NEXT_HOP;
+    p[2] = 4;
+    clib_memcpy(p + 3, &adv->next_hop, 4);
+    next_hop_offset = p + 3 - *msg;
+
+    if (adv->med) {
+        vec_add2(*msg, p, 7);
+        p[0] = BGP_ATTR_FLAG_OPTIONAL;
+        p[1] = BGP_ATTR_MED;
+        p[2] = 4;
+        clib_mem_unaligned(p + 3, u32) = clib_host_to_net_u32(adv->med);
+    }
+
+    if (!group->is_ebgp) {
+        vec_add2(*msg, p, 7);
+        p[0] = BGP_ATTR_FLAG_TRANSITIVE;
+        p[1] = BGP_ATTR_LOCAL_PREF;
+        p[2] = 4;
+        clib_mem_unaligned(p + 3, u32) = clib_host_to_net_u32(adv->local_pref ? adv->local_pref : 100);
+    }
+
+    if (vec_len(communities)) {
+        p = bgp_update_put_attr_header(msg, BGP_ATTR_FLAG_OPTIONAL | BGP_ATTR_FLAG_TRANSITIVE,
+                                       BGP_ATTR_COMMUNITIES, 4 * vec_len(communities));
+        for (i = 0; i < vec_len(communities); i++) {
+            clib_mem_unaligned(p + 4 * i, u32) = clib_host_to_net_u32(communities[i]);
+        }
+    }
+
+    clib_mem_unaligned(*msg + start, u16) = clib_host_to_net_u16(vec_len(*msg) - start - 2);
+    return next_hop_offset;
+}
+
+/*
+ * Reachable prefixes, one UPDATE per attribute set (more when the NLRI
+ * overflows). Routes learned from a member go in UPDATEs of their own,
+ * which that member is not given.
+ */
+static void bgp_update_encode_routes(u8 ***out, bgp_update_info_t **info, bgp_main_t *bmp,
+                                     bgp_update_group_t *group, bgp_route_t *routes, bgp_update_adv_t *advs,
+                                     u16 local_as) {
+    bgp_update_info_t msg_info = { 0 };
+    bgp_update_adv_t *adv, *prev = 0;
+    u8 *msg = 0;
+
+    vec_sort_with_function(advs, bgp_update_adv_cmp);
+    vec_foreach (adv, advs) {
+        bgp_route_t *route = &routes[adv->route_index];
+
+        if (msg && (bgp_update_adv_cmp_attrs(prev, adv) ||
+                    vec_len(msg) + BGP_UPDATE_PREFIX_MAX_LEN > BGP_MAX_MESSAGE_LEN)) {
+            bgp_update_finish(out, info, msg, &msg_info);
+            msg = 0;
+        }
+        if (!msg) {
+            u16 next_hop_offset;
+
+            msg = bgp_update_start();
+            next_hop_offset = bgp_update_put_attrs(&msg, bmp, group, adv, local_as);
+            msg_info.split_source = adv->split_source;
+            msg_info.next_hop_offset = adv->next_hop ? 0 : next_hop_offset;
+        }
+        bgp_update_put_prefix(&msg, route->prefix, route->mask_length);
+        prev = adv;
+    }
+    if (msg) {
+        bgp_update_finish(out, info, msg, &msg_info);
+    }
+}
+
+/*
+ * A member whose route became the best path must forget what it was sent
+ * for the prefix before: it gets a withdrawal in place of the UPDATE it is
+ * skipped for. advs is sorted by split_source.
+ */
+static void bgp_update_encode_split_withdraws(u8 ***out, bgp_update_info_t **info, bgp_route_t *routes,
+                                              bgp_update_adv_t *advs) {
+    uword *keys = 0;
+    u32 i, j;
+
+    for (i = 0; i < vec_len(advs); i = j) {
+        for (j = i; j < vec_len(advs) && advs[j].split_source == advs[i].split_source; j++) {
+            bgp_route_t *route = &routes[advs[j].route_index];
+            vec_add1(keys, bgp_dest_key(route->prefix, route->mask_length));
+        }
+        if (advs[i].split_source != ~0) {
+            bgp_update_encode_withdraws(out, info, keys, advs[i].split_source, 1 /* source_only */);
+        }
+        vec_reset_length(keys);
+    }
+    vec_free(keys);
+}
+
+// === Per-group work, run on any thread ===
+
+static_always_inline void bgp_update_group_mark_pending(bgp_update_group_t *group, uword key) {
+    if (!group->pending) {
+        group->pending = hash_create(0, sizeof(uword));
+    }
+    hash_set(group->pending, key, 0);
+}
+
+static_always_inline u32 bgp_update_group_mrai(bgp_main_t *bmp, bgp_update_group_t *group) {
+    return group->is_ebgp ? bmp->mrai_ebgp : bmp->mrai_ibgp;
+}
+
+/*
+ * Collect the prefixes whose advertisement differs from the snapshot into
+ * the pending set. Repeated flaps of one prefix stay a single entry, and a
+ * prefix that flaps back to what was advertised costs nothing at flush.
+ */
+static void bgp_update_group_diff(bgp_main_t *bmp, bgp_update_group_t *group, bgp_rib_snapshot_t *rib,
+                                  bgp_update_policy_t *policy, uword **withdraws) {
+    bgp_update_adv_t adv;
+    uword key, value, *p, *w;
+    u32 i;
+
+    for (i = 0; i < vec_len(rib->routes); i++) {
+        bgp_route_t *route = &rib->routes[i];
+
+        if (!bgp_update_group_permits(bmp, policy, route, &adv)) {
+            continue;
+        }
+        key = bgp_dest_key(route->prefix, route->mask_length);
+        p = hash_get(group->adj_rib_out, key);
+        if (!p || p[0] != bgp_update_adv_fingerprint(bmp, &adv, route)) {
+            bgp_update_group_mark_pending(group, key);
+        }
+    }
+
+    // Advertised earlier but gone from the RIB or filtered now
+    hash_foreach (key, value, group->adj_rib_out, ({
+        p = hash_get(rib->route_by_key, key);
+        if (!p || !bgp_update_group_permits(bmp, policy, &rib->routes[p[0]], &adv)) {
+            if (bmp->withdraw_immediate) {
+                vec_add1(*withdraws, key);
+            } else {
+                bgp_update_group_mark_pending(group, key);
+            }
+        }
+    }));
+
+    // Immediate withdrawals bypass MRAI and leave the pending set
+    vec_foreach (w, *withdraws) {
+        hash_unset(group->adj_rib_out, *w);
+        if (group->pending) {
+            hash_unset(group->pending, *w);
+        }
+    }
+}
+
+/* MRAI expired: advertise the pending set against the current snapshot */
+static void bgp_update_group_flush_pending(bgp_main_t *bmp, bgp_update_group_t *group, bgp_rib_snapshot_t *rib,
+                                           bgp_update_policy_t *policy, bgp_update_adv_t **advs,
+                                           uword **withdraws) {
+    bgp_update_adv_t adv;
+    uword key, value, *p, *q, *w;
+    u32 n_withdraws = vec_len(*withdraws);
+
+    hash_foreach (key, value, group->pending, ({
+        p = hash_get(rib->route_by_key, key);
+        q = hash_get(group->adj_rib_out, key);
+        if (p && bgp_update_group_permits(bmp, policy, &rib->routes[p[0]], &adv)) {
+            uword fingerprint = bgp_update_adv_fingerprint(bmp, &adv, &rib->routes[p[0]]);
+
+            if (!q || q[0] != fingerprint) {
+                hash_set(group->adj_rib_out, key, fingerprint);
+                adv.route_index = p[0];
+                vec_add1(*advs, adv);
+            }
+        } else if (q) {
+            vec_add1(*withdraws, key);
+        }
+    }));
+    for (w = *withdraws + n_withdraws; w < vec_end(*withdraws); w++) {
+        hash_unset(group->adj_rib_out, *w);
+    }
+    hash_free(group->pending);
+}
+
+/* Bring the group's Adj-RIB-Out up to the snapshot, at most once per MRAI, and encode what changed */
+static void bgp_update_group_build(bgp_main_t *bmp, bgp_update_group_t *group, bgp_update_task_t *task) {
+    bgp_rib_snapshot_t *rib = task->rib;
+    bgp_update_policy_t policy;
+    u16 local_as = bmp->bgp_as_number;
+    bgp_update_adv_t *advs = 0, adv;
+    uword *withdraws = 0;
+    u32 i;
+
+    bgp_update_policy_init(bmp, group, &policy);
+
+    if (group->rib_version != rib->version) {
+        bgp_update_group_diff(bmp, group, rib, &policy, &withdraws);
+        group->rib_version = rib->version;
+    }
+    if (hash_elts(group->pending) && task->now >= group->mrai_deadline) {
+        bgp_update_group_flush_pending(bmp, group, rib, &policy, &advs, &withdraws);
+        group->mrai_deadline = task->now + bgp_update_group_mrai(bmp, group);
+    }
+
+    group->base_seq = group->seq;
+    if (vec_len(advs) || vec_len(withdraws)) {
+        bgp_update_encode_withdraws(&group->updates, &group->update_info, withdraws, ~0, 0);
+        bgp_update_encode_routes(&group->updates, &group->update_info, bmp, group, rib->routes, advs, local_as);
+        bgp_update_encode_split_withdraws(&group->updates, &group->update_info, rib->routes, advs);
+        group->seq = bgp_update_seq_next(group->seq);
+    }
+    vec_reset_length(advs);
+
+    group->n_encoded += vec_len(group->updates);
+    if (vec_len(group->full_waiters) && group->full_rib_version != rib->version) {
+        bgp_update_free_messages(&group->full_updates, &group->full_update_info);
+        for (i = 0; i < vec_len(rib->routes); i++) {
+            if (bgp_update_group_permits(bmp, &policy, &rib->routes[i], &adv)) {
+                adv.route_index = i;
+                vec_add1(advs, adv);
+            }
+        }
+        bgp_update_encode_routes(&group->full_updates, &group->full_update_info, bmp, group, rib->routes, advs,
+                                 local_as);
+        group->full_rib_version = rib->version;
+        group->n_encoded += vec_len(group->full_updates);
+    } else if (vec_len(group->full_waiters)) {
+        group->n_table_reused += vec_len(group->full_waiters);
+    }
+    vec_free(advs);
+    vec_free(withdraws);
+    clib_bitmap_free(policy.members);
+}
+
+/* Encode every group of a task; the caller guarantees no one else touches them */
+void bgp_update_group_encode(bgp_update_task_t *task) {
+    bgp_main_t *bmp = &bgp_main;
+    u32 *index;
+
+    vec_foreach (index, task->groups) {
+        bgp_update_group_build(bmp, pool_elt_at_index(bmp->update_groups, *index), task);
+    }
+}
+
+// === Delivery ===
+
+/* One member's copy of encoded UPDATEs, minus its own routes and with its own address as next hop */
+static bgp_update_batch_t *bgp_update_batch_create(bgp_main_t *bmp, u32 neighbor_index, u32 base_seq, u32 seq,
+                                                   u8 **updates, bgp_update_info_t *info) {
+    bgp_neighbor_t *neighbor = pool_elt_at_index(bmp->neighbors, neighbor_index);
+    bgp_update_batch_t *batch = clib_mem_alloc(sizeof(*batch));
+    ip4_address_t self = neighbor->local_addr;
+    u32 i;
+
+    // Not known before the connection is up; the router ID is the best guess
+    if (!self.as_u32) {
+        self.as_u32 = bmp->bgp_router_id;
+    }
+
+    batch->base_seq = base_seq;
+    batch->seq = seq;
+    batch->messages = 0;
+    for (i = 0; i < vec_len(updates); i++) {
+        bgp_message_t *message;
+
+        if (info[i].split_source != ~0 && (info[i].split_source == neighbor_index) != info[i].source_only) {
+            continue;
+        }
+        message = clib_mem_alloc(sizeof(*message));
+        clib_memset(message, 0, sizeof(*message));
+        message->type = BGP_MSG_UPDATE;
+        message->length = vec_len(updates[i]);
+        message->data = clib_mem_alloc(message->length);
+        clib_memcpy(message->data, updates[i], message->length);
+        if (info[i].next_hop_offset) {
+            clib_memcpy(message->data + info[i].next_hop_offset, &self, sizeof(self));
+        }
+        vec_add1(batch->messages, message);
+    }
+    return batch;
+}
+
+void bgp_update_batch_free(bgp_update_batch_t *batch) {
+    bgp_message_t **message;
+
+    vec_foreach (message, batch->messages) {
+        bgp_message_free(*message);
+    }
+    vec_free(batch->messages);
+    clib_mem_free(batch);
+}
+
+/* A batch applies on top of the sequence the member holds, a full table only once it was asked for */
+static bool bgp_update_batch_in_sync(bgp_neighbor_t *neighbor, bgp_update_batch_t *batch) {
+    if (batch->base_seq == BGP_UPDATE_BATCH_RESTART) {
+        return true; // Follows whatever the old group sent
+    }
+    if (batch->base_seq) {
+        return neighbor->rib_out_version == batch->base_seq;
+    }
+    return neighbor->rib_out_version == 0 && neighbor->rib_out_requested;
+}
+
+/* The member's sequence once a batch is queued; after a restart it needs a new table */
+static void bgp_update_batch_advance(bgp_neighbor_t *neighbor, bgp_update_batch_t *batch) {
+    if (batch->base_seq == BGP_UPDATE_BATCH_RESTART) {
+        neighbor->rib_out_version = 0;
+    } else {
+        neighbor->rib_out_version = batch->seq;
+    }
+    neighbor->rib_out_requested = 0;
+}
+
+/* Queue a batch on the neighbor's owner thread if it still fits the session */
+void bgp_update_batch_apply(bgp_main_t *bmp, bgp_neighbor_t *neighbor, bgp_update_batch_t *batch) {
+    u32 i;
+
+    if (neighbor->state != BGP_STATE_ESTABLISHED || !bgp_update_batch_in_sync(neighbor, batch)) {
+        bgp_update_batch_free(batch); // Built for an earlier session
+        return;
+    }
+
+    for (i = 0; i < vec_len(batch->messages); i++) {
+        if (bgp_enqueue_message(neighbor, batch->messages[i]) < 0) {
+            /*
+             * The peer missed part of the stream, withdrawals included, and
+             * a full table would not carry those: reset the session so it
+             * drops everything learned from us (RFC 4486 Cease, out of resources)
+             */
+            clib_warning("Output queue to neighbor %U overflowed, resetting session",
+                         format_ip4_address, &neighbor->neighbor_ip);
+            vec_delete(batch->messages, i, 0);
+            bgp_update_batch_free(batch);
+            bgp_send_notification_message(neighbor, BGP_ERR_CEASE, BGP_CEASE_OUT_OF_RESOURCES);
+            bgp_transition_state(bmp, neighbor, BGP_STATE_IDLE);
+            return;
+        }
+    }
+    vec_reset_length(batch->messages);
+    bgp_update_batch_advance(neighbor, batch);
+    if (batch->base_seq == BGP_UPDATE_BATCH_RESTART) {
+        bgp_handle_route_update(bmp, neighbor); // Now ask the new group for its table
+    }
+    bgp_update_batch_free(batch);
+
+    bgp_socket_flush(neighbor);
+}
+
+/* Hand a batch to the member's owner; 0 on success, the caller keeps it otherwise */
+static int bgp_update_group_send(bgp_main_t *bmp, u32 neighbor_index, bgp_update_batch_t *batch) {
+    bgp_neighbor_t *neighbor;
+
+    if (pool_is_free_index(bmp->neighbors, neighbor_index)) {
+        bgp_update_batch_free(batch);
+        return 0;
+    }
+    neighbor = pool_elt_at_index(bmp->neighbors, neighbor_index);
+    if (neighbor->owner_thread == 0) {
+        bgp_update_batch_apply(bmp, neighbor, batch);
+        return 0;
+    }
+    return bgp_handoff_to_worker(bmp, neighbor->owner_thread, BGP_HANDOFF_UPDATE_BATCH,
+                                 neighbor_index, batch);
+}
+
+static void bgp_update_group_send_or_defer(bgp_main_t *bmp, bgp_update_group_t *group,
+                                           u32 neighbor_index, bgp_update_batch_t *batch) {
+    bgp_update_deferred_t *deferred;
+
+    if (bgp_update_group_send(bmp, neighbor_index, batch) < 0) {
+        vec_add2(group->deferred, deferred, 1);
+        deferred->neighbor_index = neighbor_index;
+        deferred->batch = batch;
+    }
+}
+
+/* Retry batches a full ring refused; returns 1 while some are still held back */
+static int bgp_update_group_flush_deferred(bgp_main_t *bmp, bgp_update_group_t *group) {
+    u32 i;
+
+    for (i = 0; i < vec_len(group->deferred); i++) {
+        if (bgp_update_group_send(bmp, group->deferred[i].neighbor_index, group->deferred[i].batch) < 0) {
+            break;
+        }
+    }
+    vec_delete(group->deferred, i, 0);
+    return vec_len(group->deferred) != 0;
+}
+
+/* Give every member its copy of the last build */
+static void bgp_update_group_deliver(bgp_main_t *bmp, bgp_update_group_t *group) {
+    u32 *index;
+
+    // Incremental updates only go to members that already hold the table
+    if (vec_len(group->updates)) {
+        vec_foreach (index, group->members) {
+            if (clib_bitmap_get(group->synced, *index)) {
+                bgp_update_group_send_or_defer(bmp, group, *index,
+                                               bgp_update_batch_create(bmp, *index, group->base_seq, group->seq,
+                                                                       group->updates, group->update_info));
+            }
+        }
+    }
+
+    vec_foreach (index, group->full_waiters) {
+        bgp_update_group_send_or_defer(bmp, group, *index,
+                                       bgp_update_batch_create(bmp, *index, 0, group->seq, group->full_updates,
+                                                               group->full_update_info));
+        group->synced = clib_bitmap_set(group->synced, *index, 1);
+    }
+    vec_reset_length(group->full_waiters);
+
+    // full_updates stays for whoever asks next against this snapshot
+    bgp_update_free_messages(&group->updates, &group->update_info);
+}
+
+/*
+ * A member far behind on transmit holds its group back, as it would with a
+ * per-neighbor Adj-RIB-Out. rib_out_paused of a worker-owned neighbor is
+ * read without synchronization; a stale value only shifts the group by one
+ * pass.
+ */
+static int bgp_update_group_blocked(bgp_main_t *bmp, bgp_update_group_t *group) {
+    u32 *index;
+
+    vec_foreach (index, group->members) {
+        bgp_neighbor_t *neighbor = pool_elt_at_index(bmp->neighbors, *index);
+        if (neighbor->rib_out_paused) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Encode all groups with work, in parallel across update_threads, then deliver */
+void bgp_update_groups_run(bgp_main_t *bmp) {
+    bgp_rib_snapshot_t *rib = bmp->rib_snapshot;
+    bgp_update_task_t *tasks = 0, *task;
+    bgp_update_group_t *group;
+    u32 *work = 0, *index, n_threads, i;
+    volatile u32 pending = 0;
+    f64 start, now = vlib_time_now(bmp->vlib_main);
+
+    if (!rib) {
+        return;
+    }
+
+    pool_foreach (group, bmp->update_groups) {
+        if (bgp_update_group_flush_deferred(bmp, group) || vec_len(group->members) == 0) {
+            continue;
+        }
+        // New snapshot to diff, MRAI expired with changes pending, or a member waiting
+        if (group->rib_version == rib->version && vec_len(group->full_waiters) == 0 &&
+            !(hash_elts(group->pending) && now >= group->mrai_deadline)) {
+            continue;
+        }
+        if (!bgp_update_group_blocked(bmp, group)) {
+            vec_add1(work, group - bmp->update_groups);
+        }
+    }
+    if (vec_len(work) == 0) {
+        return;
+    }
+    start = now;
+
+    // Round-robin the groups over main + workers; each task touches only its own groups
+    n_threads = clib_min(clib_min(bmp->update_threads, vlib_num_workers() + 1), vec_len(work));
+    vec_validate(tasks, n_threads - 1);
+    for (i = 0; i < vec_len(work); i++) {
+        vec_add1(tasks[i % n_threads].groups, work[i]);
+    }
+
+    vec_foreach (task, tasks) {
+        u32 thread_index = task - tasks;
+
+        task->rib = rib;
+        task->now = now;
+        task->pending = &pending;
+        if (thread_index == 0) {
+            continue;
+        }
+        clib_atomic_fetch_add(&pending, 1);
+        if (bgp_handoff_to_worker(bmp, thread_index, BGP_HANDOFF_ENCODE, ~0, task) < 0) {
+            clib_atomic_fetch_sub(&pending, 1);
+            bgp_update_group_encode(task);
+        }
+    }
+    bgp_update_group_encode(&tasks[0]);
+    while (clib_atomic_load_acq_n(&pending)) {
+        CLIB_PAUSE();
+    }
+
+    vec_foreach (index, work) {
+        bgp_update_group_deliver(bmp, pool_elt_at_index(bmp->update_groups, *index));
+    }
+
+    bmp->update_last_groups = vec_len(work);
+    bmp->update_last_seconds = vlib_time_now(bmp->vlib_main) - start;
+    vec_foreach (task, tasks) {
+        vec_free(task->groups);
+    }
+    vec_free(tasks);
+    vec_free(work);
+}
+
+// === Membership, main thread ===
+
+/* Place a new neighbor in the group matching its outbound policy; caller holds the barrier */
+void bgp_update_group_join(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
+    u8 is_ebgp = neighbor->remote_as != bmp->bgp_as_number;
+    bgp_update_group_t *group, *match = 0;
+
+    pool_foreach (group, bmp->update_groups) {
+        if (group->is_ebgp == is_ebgp &&
+            group->is_route_reflector_client == neighbor->is_route_reflector_client &&
+            !strcmp(group->route_filter_name, neighbor->route_filter_name) &&
+            group->route_map_out == neighbor->route_map_out) {
+            match = group;
+            break;
+        }
+    }
+
+    if (!match) {
+        pool_get_zero(bmp->update_groups, match);
+        match->is_ebgp = is_ebgp;
+        match->is_route_reflector_client = neighbor->is_route_reflector_client;
+        strncpy(match->route_filter_name, neighbor->route_filter_name,
+                sizeof(match->route_filter_name) - 1);
+        match->route_filter =
+            match->route_filter_name[0] ? bgp_prefix_list_intern(bmp, match->route_filter_name) : ~0;
+        match->route_map_out = neighbor->route_map_out;
+        match->adj_rib_out = hash_create(0, sizeof(uword));
+        match->seq = 1; // Members at 0 are waiting for a full table
+    }
+
+    vec_add1(match->members, neighbor - bmp->neighbors);
+    neighbor->update_group = match - bmp->update_groups;
+}
+
+static void bgp_update_group_free(bgp_update_group_t *group) {
+    bgp_update_deferred_t *deferred;
+
+    vec_foreach (deferred, group->deferred) {
+        bgp_update_batch_free(deferred->batch);
+    }
+    vec_free(group->deferred);
+    vec_free(group->members);
+    vec_free(group->full_waiters);
+    bgp_update_free_messages(&group->updates, &group->update_info);
+    vec_free(group->updates);
+    vec_free(group->update_info);
+    bgp_update_free_messages(&group->full_updates, &group->full_update_info);
+    vec_free(group->full_updates);
+    vec_free(group->full_update_info);
+    clib_bitmap_free(group->synced);
+    hash_free(group->adj_rib_out);
+    hash_free(group->pending);
+}
+
+void bgp_update_groups_free(bgp_main_t *bmp) {
+    bgp_update_group_t *group;
+
+    pool_foreach (group, bmp->update_groups) {
+        bgp_update_group_free(group);
+    }
+    pool_free(bmp->update_groups);
+}
+
+/* Remove a neighbor from its group, freeing the group when it empties; caller holds the barrier */
+void bgp_update_group_leave(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
+    u32 neighbor_index = neighbor - bmp->neighbors;
+    bgp_update_group_t *group;
+    u32 i;
+
+    if (neighbor->update_group == ~0) {
+        return;
+    }
+    group = pool_elt_at_index(bmp->update_groups, neighbor->update_group);
+    bgp_update_group_resync(bmp, neighbor_index);
+    neighbor->update_group = ~0;
+
+    if ((i = vec_search(group->members, neighbor_index)) != ~0) {
+        vec_del1(group->members, i);
+    }
+    if (vec_len(group->members) == 0) {
+        bgp_update_group_free(group);
+        pool_put(bmp->update_groups, group);
+    }
+}
+
+/*
+ * Move a neighbor whose outbound policy changed to the group matching it;
+ * caller holds the barrier. The new group's full table replaces what the
+ * peer holds, except for prefixes the new policy no longer advertises:
+ * those are withdrawn first, in a batch queued behind whatever the old
+ * group still has in flight for the neighbor.
+ */
+void bgp_update_group_rejoin(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
+    u32 neighbor_index = neighbor - bmp->neighbors;
+    bgp_rib_snapshot_t *rib = bmp->rib_snapshot;
+    bgp_update_deferred_t *moved = 0, *deferred;
+    bgp_update_group_t *group;
+    bgp_update_policy_t policy;
+    bgp_update_info_t *info = 0;
+    bgp_update_adv_t adv;
+    uword *keys = 0, *withdraws = 0, *key, dest_key, fingerprint, *p;
+    u8 **updates = 0;
+    bgp_update_batch_t *batch;
+
+    if (neighbor->update_group != ~0) {
+        group = pool_elt_at_index(bmp->update_groups, neighbor->update_group);
+        hash_foreach (dest_key, fingerprint, group->adj_rib_out, ({
+            vec_add1(keys, dest_key);
+        }));
+        // Batches a full ring refused stay ahead of the withdrawals
+        for (deferred = group->deferred; deferred < vec_end(group->deferred);) {
+            if (deferred->neighbor_index == neighbor_index) {
+                vec_add1(moved, *deferred);
+                vec_delete(group->deferred, 1, deferred - group->deferred);
+            } else {
+                deferred++;
+            }
+        }
+    }
+    bgp_update_group_leave(bmp, neighbor);
+    bgp_update_group_join(bmp, neighbor);
+    group = pool_elt_at_index(bmp->update_groups, neighbor->update_group);
+    vec_append(group->deferred, moved);
+    vec_free(moved);
+
+    if (neighbor->state != BGP_STATE_ESTABLISHED) {
+        // No session holds anything; the next one asks for the table
+        neighbor->rib_out_version = 0;
+        neighbor->rib_out_requested = 0;
+        vec_free(keys);
+        return;
+    }
+
+    bgp_update_policy_init(bmp, group, &policy);
+    vec_foreach (key, keys) {
+        p = rib ? hash_get(rib->route_by_key, *key) : 0;
+        if (!p || !bgp_update_group_permits(bmp, &policy, &rib->routes[p[0]], &adv) ||
+            adv.split_source == neighbor_index) {
+            vec_add1(withdraws, *key);
+        }
+    }
+    clib_bitmap_free(policy.members);
+
+    bgp_update_encode_withdraws(&updates, &info, withdraws, ~0, 0);
+    batch = bgp_update_batch_create(bmp, neighbor_index, BGP_UPDATE_BATCH_RESTART, 0, updates, info);
+    if (vec_len(group->deferred)) {
+        vec_add2(group->deferred, deferred, 1);
+        deferred->neighbor_index = neighbor_index;
+        deferred->batch = batch;
+    } else {
+        bgp_update_group_send_or_defer(bmp, group, neighbor_index, batch);
+    }
+
+    bgp_update_free_messages(&updates, &info);
+    vec_free(updates);
+    vec_free(info);
+    vec_free(withdraws);
+    vec_free(keys);
+}
+
+/* A member asked for its initial table */
+void bgp_update_group_request_full(bgp_main_t *bmp, u32 neighbor_index) {
+    bgp_neighbor_t *neighbor;
+    bgp_update_group_t *group;
+
+    if (pool_is_free_index(bmp->neighbors, neighbor_index)) {
+        return;
+    }
+    neighbor = pool_elt_at_index(bmp->neighbors, neighbor_index);
+    if (neighbor->update_group == ~0) {
+        return;
+    }
+    group = pool_elt_at_index(bmp->update_groups, neighbor->update_group);
+
+    // The table encoded for the current snapshot is still good; batches held back keep their order
+    if (group->full_rib_version && bmp->rib_snapshot && group->full_rib_version == bmp->rib_snapshot->version &&
+        vec_len(group->deferred) == 0) {
+        bgp_update_group_send_or_defer(bmp, group, neighbor_index,
+                                       bgp_update_batch_create(bmp, neighbor_index, 0, group->seq,
+                                                               group->full_updates, group->full_update_info));
+        group->synced = clib_bitmap_set(group->synced, neighbor_index, 1);
+        group->n_table_reused++;
+        return;
+    }
+
+    group->synced = clib_bitmap_set(group->synced, neighbor_index, 0);
+    if (vec_search(group->full_waiters, neighbor_index) == ~0) {
+        vec_add1(group->full_waiters, neighbor_index);
+    }
+}
+
+/* The member's session lost its table; stop sending it incremental updates */
+void bgp_update_group_resync(bgp_main_t *bmp, u32 neighbor_index) {
+    bgp_neighbor_t *neighbor;
+    bgp_update_group_t *group;
+    u32 i;
+
+    if (pool_is_free_index(bmp->neighbors, neighbor_index)) {
+        return;
+    }
+    neighbor = pool_elt_at_index(bmp->neighbors, neighbor_index);
+    if (neighbor->update_group == ~0) {
+        return;
+    }
+    group = pool_elt_at_index(bmp->update_groups, neighbor->update_group);
+    group->synced = clib_bitmap_set(group->synced, neighbor_index, 0);
+    if ((i = vec_search(group->full_waiters, neighbor_index)) != ~0) {
+        vec_del1(group->full_waiters, i);
+    }
+}
+
+/*
+ * Outbound policy changed for these prefixes (bgp_dest_key() values); the
+ * next flush re-checks just them against the snapshot. The cached whole
+ * table was filtered with the old policy.
+ */
+void bgp_update_group_reevaluate(bgp_main_t *bmp, bgp_update_group_t *group, uword *keys) {
+    uword *key;
+
+    vec_foreach (key, keys) {
+        bgp_update_group_mark_pending(group, *key);
+    }
+    group->full_rib_version = 0;
+}
+
+/* Re-check everything, for changes that cannot be bounded to a prefix range */
+void bgp_update_group_reevaluate_all(bgp_update_group_t *group) {
+    group->rib_version = 0;
+    group->full_rib_version = 0;
+}
+
+static clib_error_t *bgp_update_group_init(vlib_main_t *vm) {
+    bgp_main_t *bmp = &bgp_main;
+
+    bmp->update_threads = 1;
+    bmp->mrai_ibgp = 5;  // RFC 4271 section 10 suggested values
+    bmp->mrai_ebgp = 30;
+    return 0;
+}
+
+VLIB_INIT_FUNCTION(bgp_update_group_init) = {
+    .runs_after = VLIB_INITS("bgp_init"),
+};
+
+// === CLI ===
+
+static clib_error_t *
+bgp_set_update_threads_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    bgp_main_t *bmp = &bgp_main;
+    u32 n_threads;
+
+    if (!unformat(input, "%u", &n_threads) || n_threads == 0) {
+        return clib_error_return(0, "Usage: set bgp update-threads <n>");
+    }
+    if (n_threads > vlib_num_workers() + 1) {
+        return clib_error_return(0, "Only %u threads (main + workers) available", vlib_num_workers() + 1);
+    }
+    bmp->update_threads = n_threads;
+    bgp_shard_update_node_state(bmp);
+    return 0;
+}
+
+VLIB_CLI_COMMAND(bgp_set_update_threads_command, static) = {
+    .path = "set bgp update-threads",
+    .short_help = "set bgp update-threads <n>",
+    .function = bgp_set_update_threads_command_fn,
+};
+
+static clib_error_t *
+bgp_set_advertisement_interval_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    bgp_main_t *bmp = &bgp_main;
+    u32 seconds;
+
+    if (unformat(input, "ibgp %u", &seconds)) {
+        bmp->mrai_ibgp = seconds;
+    } else if (unformat(input, "ebgp %u", &seconds)) {
+        bmp->mrai_ebgp = seconds;
+    } else {
+        return clib_error_return(0, "Usage: set bgp advertisement-interval <ibgp|ebgp> <seconds>");
+    }
+    return 0;
+}
+
+VLIB_CLI_COMMAND(bgp_set_advertisement_interval_command, static) = {
+    .path = "set bgp advertisement-interval",
+    .short_help = "set bgp advertisement-interval <ibgp|ebgp> <seconds>",
+    .function = bgp_set_advertisement_interval_command_fn,
+};
+
+static clib_error_t *
+bgp_set_withdraw_immediate_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    if (unformat(input, "enable")) {
+        bgp_main.withdraw_immediate = 1;
+    } else if (unformat(input, "disable")) {
+        bgp_main.withdraw_immediate = 0;
+    } else {
+        return clib_error_return(0, "Usage: set bgp withdraw-immediate <enable|disable>");
+    }
+    return 0;
+}
+
+VLIB_CLI_COMMAND(bgp_set_withdraw_immediate_command, static) = {
+    .path = "set bgp withdraw-immediate",
+    .short_help = "set bgp withdraw-immediate <enable|disable>",
+    .function = bgp_set_withdraw_immediate_command_fn,
+};
+
+static clib_error_t *
+bgp_show_update_groups_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    bgp_main_t *bmp = &bgp_main;
+    bgp_update_group_t *group;
+
+    vlib_cli_output(vm, "Update threads: %u, last run: %u groups in %.3f ms",
+                    bmp->update_threads, bmp->update_last_groups, bmp->update_last_seconds * 1e3);
+    vlib_cli_output(vm, "Advertisement interval: iBGP %us, eBGP %us, withdrawals %s",
+                    bmp->mrai_ibgp, bmp->mrai_ebgp, bmp->withdraw_immediate ? "immediate" : "batched");
+    pool_foreach (group, bmp->update_groups) {
+        char *map_name = group->route_map_out != ~0 ?
+            pool_elt_at_index(bmp->route_maps, group->route_map_out)->name : "";
+
+        vlib_cli_output(vm, "  group %u: %s%s%s%s%s%s, %u members (%u synced, %u waiting), "
+                        "%u prefixes advertised, %u pending, seq %u, %llu UPDATEs encoded, "
+                        "%llu tables reused, %u deferred",
+                        group - bmp->update_groups, group->is_ebgp ? "eBGP" : "iBGP",
+                        group->is_route_reflector_client ? " rr-client" : "",
+                        group->route_filter_name[0] ? " filter " : "", group->route_filter_name,
+                        map_name[0] ? " route-map " : "", map_name,
+                        vec_len(group->members), clib_bitmap_count_set_bits(group->synced),
+                        vec_len(group->full_waiters), hash_elts(group->adj_rib_out),
+                        hash_elts(group->pending), group->seq,
+                        group->n_encoded, group->n_table_reused, vec_len(group->deferred));
+    }
+    return 0;
+}
+
+VLIB_CLI_COMMAND(bgp_show_update_groups_command, static) = {
+    .path = "show bgp update-groups",
+    .short_help = "show bgp update-groups",
+    .function = bgp_show_update_groups_command_fn,
+};
+
+// === Self-test ===
+
+/*
+ * One member through the batches it can be handed: a full table only when
+ * it asked, increments only on top of the sequence it holds, and a restart
+ * from a former group whatever it held.
+ */
+void bgp_update_group_self_test(bgp_check_t *check) {
+    static const struct {
+        const char *what;
+        u8 request;                   // Member asks for the table first
+        u32 base_seq, seq;
+        bool in_sync;
+        u32 version;                  // Afterwards
+    } steps[] = {
+        { "increment before any table", 0, 5, 6, false, 0 },
+        { "table nobody asked for", 0, 0, 5, false, 0 },
+        { "requested table", 1, 0, 5, true, 5 },
+        { "increment on top", 0, 5, 6, true, 6 },
+        { "replayed increment", 0, 5, 6, false, 6 },
+        { "increment past a gap", 0, 7, 8, false, 6 },
+        { "table while holding one", 1, 0, 9, false, 6 },
+        { "restart", 0, BGP_UPDATE_BATCH_RESTART, 0, true, 0 },
+        { "old group's increment", 0, 6, 7, false, 0 },
+        { "new group's table unasked", 0, 0, 3, false, 0 },
+        { "new group's requested table", 1, 0, 3, true, 3 },
+    };
+    bgp_neighbor_t neighbor = { 0 };
+    bgp_update_batch_t batch = { 0 };
+    u32 seq, i;
+    bool in_sync;
+
+    for (i = 0; i < ARRAY_LEN(steps); i++) {
+        if (steps[i].request) {
+            neighbor.rib_out_requested = 1;
+        }
+        batch.base_seq = steps[i].base_seq;
+        batch.seq = steps[i].seq;
+        if ((in_sync = bgp_update_batch_in_sync(&neighbor, &batch))) {
+            bgp_update_batch_advance(&neighbor, &batch);
+        }
+        bgp_check(check, in_sync == steps[i].in_sync && neighbor.rib_out_version == steps[i].version,
+                  "%s: %s, member at %u, expected %s and %u", steps[i].what, in_sync ? "applied" : "refused",
+                  neighbor.rib_out_version, steps[i].in_sync ? "applied" : "refused", steps[i].version);
+        bgp_check(check, !in_sync || !neighbor.rib_out_requested, "%s: request still pending", steps[i].what);
+    }
+
+    // Sequences never land on the values that mean full table or restart
+    bgp_check(check, bgp_update_seq_next(1) == 2, "seq after 1 is %u", bgp_update_seq_next(1));
+    for (seq = BGP_UPDATE_BATCH_RESTART - 4, i = 0; i < 8; i++) {
+        seq = bgp_update_seq_next(seq);
+        bgp_check(check, seq != 0 && seq != BGP_UPDATE_BATCH_RESTART, "seq wrapped to %u", seq);
+    }
+    bgp_check(check, seq == 5, "seq is %u after wrapping, expected 5", seq);
+}
@@ -0,0 +1,673 @@
+/*
+ * bgp_uring.c - io_uring transport backend for BGP sessions
+ *
+ * Copyright (c) <current-year> <your-organization>
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vnet/vnet.h>
+#include <vlib/unix/unix.h>
+#include <vppinfra/file.h>
+#include <bgp/bgp.h>
+
+#ifdef BGP_HAVE_IO_URING
+
+#include <liburing.h>
+#include <sys/eventfd.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+
+#define BGP_URING_QUEUE_DEPTH    4096
+#define BGP_URING_RX_BGID        1
+#define BGP_URING_RX_BUFFERS     1024          // Must be a power of two
+#define BGP_URING_RX_BUFFER_SIZE 4096
+#define BGP_URING_TX_SLOTS       1024          // Sessions that can use the ring at once
+#define BGP_URING_TX_SLOT_SIZE   (16 << 10)
+
+typedef enum {
+    BGP_URING_OP_CONNECT = 1,
+    BGP_URING_OP_RECV,
+    BGP_URING_OP_SEND,
+    BGP_URING_OP_CANCEL,
+} bgp_uring_op_t;
+
+typedef struct {
+    u32 neighbor_index;   // Owner of the slot
+    u32 generation;       // Owner socket instance
+    u8 orphaned;          // Owner closed while a write was outstanding
+} bgp_uring_tx_slot_t;
+
+typedef struct {
+    struct io_uring ring;
+    int event_fd;                        // Signalled by the kernel on completions
+    u32 event_file_index;                // Poller registration for event_fd
+    struct io_uring_buf_ring *rx_ring;   // Provided buffers for multishot receive
+    u8 *rx_memory;
+    u8 *tx_memory;                       // Registered (fixed) transmit buffers
+    bgp_uring_tx_slot_t *tx_slots;
+    u32 *free_tx_slots;
+    u32 next_generation;
+    u8 enabled;
+} bgp_uring_main_t;
+
+static bgp_uring_main_t bgp_uring_main;
+
+/* user_data layout: index (32) | generation (24) | op (8) */
+static inline u64 bgp_uring_user_data(u32 index, u32 generation, bgp_uring_op_t op) {
+    return ((u64)index << 32) | ((u64)(generation & 0xffffff) << 8) | op;
+}
+
+static struct io_uring_sqe *bgp_uring_get_sqe(void) {
+    bgp_uring_main_t *um = &bgp_uring_main;
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&um->ring);
+
+    if (!sqe) {
+        // Submission queue is full; push the batch out early
+        io_uring_submit(&um->ring);
+        sqe = io_uring_get_sqe(&um->ring);
+    }
+    return sqe;
+}
+
+/* Find the neighbor whose current socket issued a completion */
+static bgp_neighbor_t *bgp_uring_owner(u32 neighbor_index, u32 generation) {
+    bgp_main_t *bmp = &bgp_main;
+    bgp_neighbor_t *neighbor;
+
+    if (pool_is_free_index(bmp->neighbors, neighbor_index)) {
+        return NULL;
+    }
+    neighbor = pool_elt_at_index(bmp->neighbors, neighbor_index);
+    if (!neighbor->socket || neighbor->socket->backend != BGP_TRANSPORT_IO_URING ||
+        neighbor->socket->generation != generation) {
+        return NULL;
+    }
+    return neighbor;
+}
+
+static void bgp_uring_recycle_rx_buffer(u16 bid) {
+    bgp_uring_main_t *um = &bgp_uring_main;
+
+    io_uring_buf_ring_add(um->rx_ring, um->rx_memory + (uword)bid * BGP_URING_RX_BUFFER_SIZE,
+                          BGP_URING_RX_BUFFER_SIZE, bid,
+                          io_uring_buf_ring_mask(BGP_URING_RX_BUFFERS), 0);
+    io_uring_buf_ring_advance(um->rx_ring, 1);
+}
+
+static void bgp_uring_arm_recv(bgp_socket_t *sock) {
+    struct io_uring_sqe *sqe = bgp_uring_get_sqe();
+
+    if (!sqe) {
+        clib_warning("io_uring submission queue exhausted, receive not armed");
+        return;
+    }
+    io_uring_prep_recv_multishot(sqe, sock->socket_fd, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BGP_URING_RX_BGID;
+    io_uring_sqe_set_data64(sqe, bgp_uring_user_data(sock->neighbor_index, sock->generation,
+                                                     BGP_URING_OP_RECV));
+}
+
+static void bgp_uring_release_tx_slot(bgp_socket_t *sock) {
+    bgp_uring_main_t *um = &bgp_uring_main;
+
+    if (sock->tx_slot == ~0) {
+        return;
+    }
+    if (sock->tx_in_flight) {
+        // The kernel still reads from the slot; free it on completion
+        um->tx_slots[sock->tx_slot].orphaned = 1;
+    } else {
+        vec_add1(um->free_tx_slots, sock->tx_slot);
+    }
+    sock->tx_slot = ~0;
+}
+
+/* Attach a socket to the ring; -1 means the caller must use the sockets path */
+int bgp_uring_register(bgp_socket_t *sock) {
+    bgp_uring_main_t *um = &bgp_uring_main;
+    bgp_uring_tx_slot_t *slot;
+
+    if (!um->enabled || vec_len(um->free_tx_slots) == 0) {
+        sock->backend = BGP_TRANSPORT_SOCKET;
+        return -1;
+    }
+
+    sock->tx_slot = vec_pop(um->free_tx_slots);
+    sock->generation = ++um->next_generation & 0xffffff;
+
+    slot = &um->tx_slots[sock->tx_slot];
+    slot->neighbor_index = sock->neighbor_index;
+    slot->generation = sock->generation;
+    slot->orphaned = 0;
+
+    if (sock->is_connected) {
+        bgp_uring_arm_recv(sock);
+    }
+    return 0;
+}
+
+int bgp_uring_connect(bgp_socket_t *sock) {
+    struct io_uring_sqe *sqe = bgp_uring_get_sqe();
+
+    if (!sqe) {
+        clib_warning("io_uring submission queue exhausted, cannot connect");
+        return -1;
+    }
+    io_uring_prep_connect(sqe, sock->socket_fd, (struct sockaddr *)&sock->peer_addr,
+                          sizeof(sock->peer_addr));
+    io_uring_sqe_set_data64(sqe, bgp_uring_user_data(sock->neighbor_index, sock->generation,
+                                                     BGP_URING_OP_CONNECT));
+    sock->is_connecting = 1;
+    return 0;
+}
+
+/* Copy queued messages into the registered slot and post one write */
+void bgp_uring_flush(bgp_neighbor_t *neighbor) {
+    bgp_uring_main_t *um = &bgp_uring_main;
+    bgp_socket_t *sock = neighbor->socket;
+    struct io_uring_sqe *sqe;
+    bgp_message_t *message;
+    u8 *slot;
+    u32 length = 0;
+    int i = 0;
+
+    if (sock->tx_in_flight) {
+        return; // The completion handler continues the flush
+    }
+
+    slot = um->tx_memory + (uword)sock->tx_slot * BGP_URING_TX_SLOT_SIZE;
+    while ((message = queue_peek_nth(&neighbor->output_queue, i)) != NULL) {
+        u32 skip = i == 0 ? sock->tx_offset : 0;
+        u32 n = message->length - skip;
+
+        if (length + n > BGP_URING_TX_SLOT_SIZE) {
+            break;
+        }
+        clib_memcpy_fast(slot + length, message->data + skip, n);
+        length += n;
+        i++;
+    }
+
+    if (!length) {
+        return;
+    }
+
+    sqe = bgp_uring_get_sqe();
+    if (!sqe) {
+        clib_warning("io_uring submission queue exhausted, transmit deferred");
+        return;
+    }
+    io_uring_prep_write_fixed(sqe, sock->socket_fd, slot, length, 0, 0);
+    io_uring_sqe_set_data64(sqe, bgp_uring_user_data(sock->tx_slot, sock->generation,
+                                                     BGP_URING_OP_SEND));
+    sock->tx_in_flight = 1;
+}
+
+void bgp_uring_close(bgp_socket_t *sock) {
+    bgp_uring_main_t *um = &bgp_uring_main;
+    struct io_uring_sqe *sqe;
+
+    bgp_uring_release_tx_slot(sock);
+
+    if (sock->socket_fd < 0) {
+        return;
+    }
+
+    // Cancel the multishot receive and any pending connect before the fd goes away
+    sqe = bgp_uring_get_sqe();
+    if (sqe) {
+        io_uring_prep_cancel_fd(sqe, sock->socket_fd, IORING_ASYNC_CANCEL_ALL);
+        io_uring_sqe_set_data64(sqe, bgp_uring_user_data(0, 0, BGP_URING_OP_CANCEL));
+        io_uring_submit(&um->ring);
+    }
+    close(sock->socket_fd);
+    sock->socket_fd = -1;
+}
+
+static void bgp_uring_complete_recv(bgp_main_t *bmp, struct io_uring_cqe *cqe,
+                                    u32 neighbor_index, u32 generation) {
+    bgp_uring_main_t *um = &bgp_uring_main;
+    bgp_neighbor_t *neighbor = bgp_uring_owner(neighbor_index, generation);
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        u16 bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (neighbor && cqe->res > 0) {
+            vec_add(neighbor->socket->rx_buffer,
+                    um->rx_memory + (uword)bid * BGP_URING_RX_BUFFER_SIZE, cqe->res);
+        }
+        bgp_uring_recycle_rx_buffer(bid);
+    }
+
+    if (!neighbor) {
+        return;
+    }
+
+    if (cqe->res == -ENOBUFS) {
+        // Provided buffers ran dry; the multishot terminated, so re-arm it
+        bgp_uring_arm_recv(neighbor->socket);
+        return;
+    }
+    if (cqe->res <= 0) {
+        bgp_socket_handle_down(bmp, neighbor);
+        return;
+    }
+
+    bgp_socket_input(bmp, neighbor);
+
+    neighbor = bgp_uring_owner(neighbor_index, generation);
+    if (neighbor && !(cqe->flags & IORING_CQE_F_MORE)) {
+        bgp_uring_arm_recv(neighbor->socket);
+    }
+}
+
+static void bgp_uring_complete_send(bgp_main_t *bmp, struct io_uring_cqe *cqe, u32 slot_index) {
+    bgp_uring_main_t *um = &bgp_uring_main;
+    bgp_uring_tx_slot_t *slot = &um->tx_slots[slot_index];
+    bgp_neighbor_t *neighbor;
+
+    if (slot->orphaned) {
+        slot->orphaned = 0;
+        vec_add1(um->free_tx_slots, slot_index);
+        return;
+    }
+
+    neighbor = bgp_uring_owner(slot->neighbor_index, slot->generation);
+    if (!neighbor) {
+        return;
+    }
+
+    neighbor->socket->tx_in_flight = 0;
+    if (cqe->res < 0) {
+        clib_warning("Failed to send messages to neighbor %U: %s",
+                     format_ip4_address, &neighbor->neighbor_ip, strerror(-cqe->res));
+        bgp_socket_handle_down(bmp, neighbor);
+        return;
+    }
+
+    bgp_socket_tx_advance(neighbor, cqe->res);
+    if (!queue_is_empty(&neighbor->output_queue)) {
+        bgp_uring_flush(neighbor);
+    }
+}
+
+static void bgp_uring_complete(bgp_main_t *bmp, struct io_uring_cqe *cqe) {
+    u64 user_data = io_uring_cqe_get_data64(cqe);
+    u32 index = user_data >> 32;
+    u32 generation = (user_data >> 8) & 0xffffff;
+    bgp_neighbor_t *neighbor;
+
+    switch (user_data & 0xff) {
+        case BGP_URING_OP_CONNECT:
+            neighbor = bgp_uring_owner(index, generation);
+            if (!neighbor) {
+                break;
+            }
+            if (cqe->res < 0) {
+                clib_warning("Connect to neighbor %U failed: %s",
+                             format_ip4_address, &neighbor->neighbor_ip, strerror(-cqe->res));
+                bgp_socket_handle_down(bmp, neighbor);
+                break;
+            }
+            bgp_uring_arm_recv(neighbor->socket);
+            bgp_socket_connected(bmp, neighbor);
+            break;
+
+        case BGP_URING_OP_RECV:
+            bgp_uring_complete_recv(bmp, cqe, index, generation);
+            break;
+
+        case BGP_URING_OP_SEND:
+            bgp_uring_complete_send(bmp, cqe, index);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* Submit everything queued since the last wakeup in one syscall */
+void bgp_uring_submit(bgp_main_t *bmp) {
+    bgp_uring_main_t *um = &bgp_uring_main;
+
+    if (um->enabled && io_uring_sq_ready(&um->ring)) {
+        io_uring_submit(&um->ring);
+    }
+}
+
+static clib_error_t *bgp_uring_event_ready(clib_file_t *uf) {
+    bgp_uring_main_t *um = &bgp_uring_main;
+    bgp_main_t *bmp = &bgp_main;
+    struct io_uring_cqe *cqe;
+    unsigned head, count = 0;
+    u64 events;
+
+    if (read(um->event_fd, &events, sizeof(events)) < 0 && errno != EAGAIN) {
+        return clib_error_return_unix(0, "read eventfd");
+    }
+
+    // Reap the whole completion batch, then submit whatever the handlers queued
+    io_uring_for_each_cqe(&um->ring, head, cqe) {
+        bgp_uring_complete(bmp, cqe);
+        count++;
+    }
+    io_uring_cq_advance(&um->ring, count);
+
+    bgp_uring_submit(bmp);
+    return 0;
+}
+
+clib_error_t *bgp_uring_init(bgp_main_t *bmp) {
+    bgp_uring_main_t *um = &bgp_uring_main;
+    clib_file_t template = { 0 };
+    struct iovec tx_iov;
+    int rv, i;
+
+    if (um->enabled) {
+        return 0;
+    }
+
+    rv = io_uring_queue_init(BGP_URING_QUEUE_DEPTH, &um->ring, 0);
+    if (rv < 0) {
+        return clib_error_return(0, "io_uring_queue_init failed: %s", strerror(-rv));
+    }
+
+    um->rx_ring = io_uring_setup_buf_ring(&um->ring, BGP_URING_RX_BUFFERS, BGP_URING_RX_BGID, 0, &rv);
+    if (!um->rx_ring) {
+        io_uring_queue_exit(&um->ring);
+        return clib_error_return(0, "io_uring buffer ring setup failed: %s", strerror(-rv));
+    }
+    um->rx_memory = clib_mem_alloc_aligned((uword)BGP_URING_RX_BUFFERS * BGP_URING_RX_BUFFER_SIZE,
+                                           CLIB_CACHE_LINE_BYTES);
+    for (i = 0; i < BGP_URING_RX_BUFFERS; i++) {
+        io_uring_buf_ring_add(um->rx_ring, um->rx_memory + (uword)i * BGP_URING_RX_BUFFER_SIZE,
+                              BGP_URING_RX_BUFFER_SIZE, i,
+                              io_uring_buf_ring_mask(BGP_URING_RX_BUFFERS), i);
+    }
+    io_uring_buf_ring_advance(um->rx_ring, BGP_URING_RX_BUFFERS);
+
+    um->tx_memory = clib_mem_alloc_aligned((uword)BGP_URING_TX_SLOTS * BGP_URING_TX_SLOT_SIZE,
+                                           CLIB_CACHE_LINE_BYTES);
+    tx_iov.iov_base = um->tx_memory;
+    tx_iov.iov_len = (uword)BGP_URING_TX_SLOTS * BGP_URING_TX_SLOT_SIZE;
+    rv = io_uring_register_buffers(&um->ring, &tx_iov, 1);
+    if (rv < 0) {
+        io_uring_free_buf_ring(&um->ring, um->rx_ring, BGP_URING_RX_BUFFERS, BGP_URING_RX_BGID);
+        io_uring_queue_exit(&um->ring);
+        clib_mem_free(um->rx_memory);
+        clib_mem_free(um->tx_memory);
+        return clib_error_return(0, "io_uring_register_buffers failed: %s", strerror(-rv));
+    }
+
+    vec_validate(um->tx_slots, BGP_URING_TX_SLOTS - 1);
+    for (i = BGP_URING_TX_SLOTS - 1; i >= 0; i--) {
+        vec_add1(um->free_tx_slots, i);
+    }
+
+    // Completions wake the main loop through the file poller
+    um->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    io_uring_register_eventfd(&um->ring, um->event_fd);
+
+    template.read_function = bgp_uring_event_ready;
+    template.file_descriptor = um->event_fd;
+    template.description = format(0, "bgp io_uring completions");
+    um->event_file_index = clib_file_add(&file_main, &template);
+
+    um->enabled = 1;
+    clib_warning("BGP io_uring transport initialized (depth %u)", BGP_URING_QUEUE_DEPTH);
+    return 0;
+}
+
+/*
+ * Loopback benchmark: push the same byte stream over a 127.0.0.1 TCP pair
+ * with one send() per message, with gathered sendmsg() batches (the sockets
+ * backend), and with batched io_uring submissions.
+ */
+typedef enum {
+    BGP_BENCH_SEND_PER_MESSAGE,
+    BGP_BENCH_SENDMSG_BATCH,
+    BGP_BENCH_IO_URING,
+} bgp_bench_mode_t;
+
+static int bgp_uring_bench_pair(int *client_fd, int *server_fd) {
+    struct sockaddr_in addr = { 0 };
+    socklen_t addr_len = sizeof(addr);
+    int listen_fd, one = 1;
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listen_fd, 1) < 0 || getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len) < 0) {
+        return -1;
+    }
+
+    *client_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (*client_fd < 0 || connect(*client_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(listen_fd);
+        return -1;
+    }
+    *server_fd = accept(listen_fd, NULL, NULL);
+    close(listen_fd);
+    if (*server_fd < 0) {
+        close(*client_fd);
+        return -1;
+    }
+
+    setsockopt(*client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(*client_fd, F_SETFL, fcntl(*client_fd, F_GETFL, 0) | O_NONBLOCK);
+    fcntl(*server_fd, F_SETFL, fcntl(*server_fd, F_GETFL, 0) | O_NONBLOCK);
+    return 0;
+}
+
+static u64 bgp_uring_bench_drain(int fd, u8 *buffer, u32 size, u64 *syscalls) {
+    u64 total = 0;
+    ssize_t n;
+
+    do {
+        n = recv(fd, buffer, size, MSG_DONTWAIT);
+        (*syscalls)++;
+        if (n > 0) {
+            total += n;
+        }
+    } while (n > 0);
+    return total;
+}
+
+static clib_error_t *bgp_uring_bench_run(bgp_bench_t *bench, bgp_bench_mode_t mode, u32 n_messages,
+                                         u32 message_size, u32 batch, f64 *seconds, u64 *syscalls) {
+    u64 target = (u64)n_messages * message_size, sent = 0, received = 0;
+    struct iovec *iov = 0;
+    struct io_uring ring;
+    u8 *payload, *rx_buffer;
+    int cfd, sfd, i;
+
+    if (bgp_uring_bench_pair(&cfd, &sfd) < 0) {
+        return clib_error_return_unix(0, "loopback socket pair");
+    }
+
+    payload = clib_mem_alloc((uword)batch * message_size);
+    rx_buffer = clib_mem_alloc(64 << 10);
+    memset(payload, 0xFF, (uword)batch * message_size);
+
+    if (mode == BGP_BENCH_IO_URING) {
+        struct iovec reg = { .iov_base = payload, .iov_len = (uword)batch * message_size };
+        if (io_uring_queue_init(clib_max(batch, 8), &ring, 0) < 0 ||
+            io_uring_register_buffers(&ring, &reg, 1) < 0) {
+            close(cfd);
+            close(sfd);
+            clib_mem_free(payload);
+            clib_mem_free(rx_buffer);
+            return clib_error_return(0, "io_uring setup failed");
+        }
+    }
+    vec_validate(iov, batch - 1);
+
+    *syscalls = 0;
+    bgp_bench_start(bench);
+
+    while (received < target) {
+        u64 remaining = target - sent;
+        u32 n_batch = clib_min(batch, (remaining + message_size - 1) / message_size);
+        ssize_t rv;
+
+        switch (mode) {
+            case BGP_BENCH_SEND_PER_MESSAGE:
+                for (i = 0; i < n_batch; i++) {
+                    rv = send(cfd, payload, clib_min(message_size, target - sent), MSG_DONTWAIT);
+                    (*syscalls)++;
+                    if (rv <= 0) {
+                        break;
+                    }
+                    sent += rv;
+                }
+                break;
+
+            case BGP_BENCH_SENDMSG_BATCH:
+                if (n_batch) {
+                    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = n_batch };
+                    for (i = 0; i < n_batch; i++) {
+                        iov[i].iov_base = payload + i * message_size;
+                        iov[i].iov_len = message_size;
+                    }
+                    iov[n_batch - 1].iov_len = remaining - (u64)(n_batch - 1) * message_size;
+                    if (iov[n_batch - 1].iov_len > message_size) {
+                        iov[n_batch - 1].iov_len = message_size;
+                    }
+                    rv = sendmsg(cfd, &msg, MSG_DONTWAIT);
+                    (*syscalls)++;
+                    if (rv > 0) {
+                        sent += rv;
+                    }
+                }
+                break;
+
+            case BGP_BENCH_IO_URING:
+                if (n_batch) {
+                    struct io_uring_sqe *sqe = 0;
+                    u32 n_done = 0;
+                    for (i = 0; i < n_batch; i++) {
+                        u32 len = clib_min(message_size, remaining - (u64)i * message_size);
+                        if (sqe) {
+                            sqe->flags |= IOSQE_IO_LINK; // Keep the stream in order
+                        }
+                        sqe = io_uring_get_sqe(&ring);
+                        io_uring_prep_write_fixed(sqe, cfd, payload + i * message_size, len, 0, 0);
+                    }
+                    io_uring_submit(&ring);
+                    (*syscalls)++;
+
+                    // Drain the receiver while the kernel works through the batch
+                    while (n_done < n_batch) {
+                        struct io_uring_cqe *cqe;
+                        received += bgp_uring_bench_drain(sfd, rx_buffer, 64 << 10, syscalls);
+                        while (io_uring_peek_cqe(&ring, &cqe) == 0) {
+                            if (cqe->res > 0) {
+                                sent += cqe->res;
+                            }
+                            io_uring_cqe_seen(&ring, cqe);
+                            n_done++;
+                        }
+                    }
+                }
+                break;
+        }
+
+        received += bgp_uring_bench_drain(sfd, rx_buffer, 64 << 10, syscalls);
+    }
+
+    *seconds = bgp_bench_stop(bench);
+
+    if (mode == BGP_BENCH_IO_URING) {
+        io_uring_queue_exit(&ring);
+    }
+    vec_free(iov);
+    clib_mem_free(payload);
+    clib_mem_free(rx_buffer);
+    close(cfd);
+    close(sfd);
+    return 0;
+}
+
+static clib_error_t *
+bgp_transport_benchmark_command_fn(vlib_main_t *vm, unformat_input_t *input, vlib_cli_command_t *cmd) {
+    static const char *mode_names[] = { "send per message", "sendmsg batch", "io_uring batch" };
+    u32 n_messages = 1000000, message_size = BGP_HEADER_LEN, batch = 64;
+    clib_error_t *error = 0;
+    bgp_bench_t bench;
+    int mode;
+
+    while (unformat_check_input(input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat(input, "messages %u", &n_messages))
+            ;
+        else if (unformat(input, "size %u", &message_size))
+            ;
+        else if (unformat(input, "batch %u", &batch))
+            ;
+        else
+            return clib_error_return(0, "unknown input `%U'", format_unformat_error, input);
+    }
+
+    if (message_size < BGP_HEADER_LEN || message_size > BGP_MAX_MESSAGE_LEN || batch == 0) {
+        return clib_error_return(0, "size must be %u-%u bytes and batch non-zero",
+                                 BGP_HEADER_LEN, BGP_MAX_MESSAGE_LEN);
+    }
+
+    bgp_bench_init(&bench, vm);
+    vlib_cli_output(vm, "%u messages of %u bytes, batch %u", n_messages, message_size, batch);
+    for (mode = BGP_BENCH_SEND_PER_MESSAGE; mode <= BGP_BENCH_IO_URING; mode++) {
+        f64 seconds;
+        u64 syscalls;
+
+        error = bgp_uring_bench_run(&bench, mode, n_messages, message_size, batch, &seconds, &syscalls);
+        if (error) {
+            break;
+        }
+        bgp_bench_report(&bench, mode_names[mode], n_messages, "messages", seconds, "%lu syscalls", syscalls);
+    }
+    bgp_bench_free(&bench);
+    return error;
+}
+
+VLIB_CLI_COMMAND(bgp_transport_benchmark_command, static) = {
+    .path = "test bgp transport-benchmark",
+    .short_help = "test bgp transport-benchmark [messages <n>] [size <bytes>] [batch <n>]",
+    .function = bgp_transport_benchmark_command_fn,
+};
+
+#else /* BGP_HAVE_IO_URING */
+
+clib_error_t *bgp_uring_init(bgp_main_t *bmp) {
+    return clib_error_return(0, "BGP plugin was built without io_uring support");
+}
+
+int bgp_uring_register(bgp_socket_t *sock) {
+    sock->backend = BGP_TRANSPORT_SOCKET;
+    return -1;
+}
+
+int bgp_uring_connect(bgp_socket_t *sock) {
+    return -1;
+}
+
+void bgp_uring_flush(bgp_neighbor_t *neighbor) {
+}
+
+void bgp_uring_close(bgp_socket_t *sock) {
+}
+
+void bgp_uring_submit(bgp_main_t *bmp) {
+}
+
+#endif /* BGP_HAVE_IO_URING */
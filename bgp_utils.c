@@ -56,15 +56,82 @@ const char *bgp_state_to_string(bgp_state_t state) {
     }
 }
 
+static_always_inline bgp_output_class_t bgp_message_class(bgp_message_t *message) {
+    return message->type == BGP_MSG_UPDATE ? BGP_OUTPUT_BULK : BGP_OUTPUT_CONTROL;
+}
+
+// Queue a message for transmission; never drops, the byte budget only throttles UPDATE generation
 int bgp_enqueue_message(bgp_neighbor_t *neighbor, bgp_message_t *message) {
-    if (queue_is_full(&neighbor->output_queue)) {
-        clib_warning("Output queue is full for neighbor %U", format_ip4_address, &neighbor->neighbor_ip);
-        return -1; // Queue is full
+    bgp_output_class_t class = bgp_message_class(message);
+    custom_queue_t *queue = class == BGP_OUTPUT_BULK ? &neighbor->bulk_queue : &neighbor->control_queue;
+    bgp_output_stats_t *stats = &neighbor->output_stats[class];
+
+    message->enqueue_time = clib_cpu_time_now();
+    if (queue_enqueue(queue, message) < 0) {
+        return -1;
+    }
+    stats->max_depth = clib_max(stats->max_depth, queue->count);
+
+    if (class == BGP_OUTPUT_BULK && !neighbor->rib_out_paused && queue_over_budget(queue)) {
+        neighbor->rib_out_paused = 1;
+        clib_warning("Output queue for neighbor %U over budget (%u bytes), pausing updates",
+                     format_ip4_address, &neighbor->neighbor_ip, queue->bytes);
     }
-    queue_enqueue(&neighbor->output_queue, message);
     return 0; // Success
 }
 
+// True while the neighbor's output queue is too far behind to accept more UPDATEs
+bool bgp_rib_out_blocked(bgp_neighbor_t *neighbor) {
+    return neighbor->rib_out_paused;
+}
+
+/*
+ * Move pending messages onto the wire queue: every control message first,
+ * then UPDATEs only up to BGP_OUTPUT_WIRE_WINDOW. Keeping the committed bulk
+ * small bounds how long a KEEPALIVE queued mid table-dump waits.
+ */
+void bgp_output_schedule(bgp_neighbor_t *neighbor) {
+    bgp_message_t *message;
+
+    // A wire queue that cannot grow leaves the message where it was, for the next flush
+    while ((message = queue_dequeue(&neighbor->control_queue)) != NULL) {
+        if (queue_enqueue(&neighbor->output_queue, message) < 0) {
+            queue_requeue_head(&neighbor->control_queue, message);
+            return;
+        }
+    }
+    while (neighbor->output_queue.bytes < BGP_OUTPUT_WIRE_WINDOW &&
+           (message = queue_dequeue(&neighbor->bulk_queue)) != NULL) {
+        if (queue_enqueue(&neighbor->output_queue, message) < 0) {
+            queue_requeue_head(&neighbor->bulk_queue, message);
+            return;
+        }
+    }
+}
+
+// Drop the head of the wire queue once the transport has written all of it
+void bgp_output_retire(bgp_neighbor_t *neighbor) {
+    bgp_message_t *message = queue_dequeue(&neighbor->output_queue);
+    bgp_output_stats_t *stats;
+    u64 latency;
+
+    if (!message) {
+        return;
+    }
+    stats = &neighbor->output_stats[bgp_message_class(message)];
+    latency = clib_cpu_time_now() - message->enqueue_time;
+    stats->messages++;
+    stats->latency_clocks += latency;
+    stats->latency_max = clib_max(stats->latency_max, latency);
+
+    // Retire runs on the owner thread; charge its transmit histogram
+    vec_elt_at_index(bgp_main.shards, vlib_get_thread_index())->tx_in_tick++;
+    if (message->type == BGP_MSG_UPDATE) {
+        neighbor->last_update_tx = vlib_time_now(vlib_get_main());
+    }
+    bgp_message_free(message);
+}
+
 bgp_message_t *bgp_dequeue_message(bgp_neighbor_t *neighbor) {
     if (queue_is_empty(&neighbor->output_queue)) {
         clib_warning("Queue is empty for neighbor %U.", format_ip4_address, &neighbor->neighbor_ip);
@@ -81,16 +148,40 @@ void queue_init(custom_queue_t *queue, int capacity) {
     queue->head = 0;
     queue->tail = 0;
     queue->count = 0;
+    queue->bytes = 0;
 }
 
+// Double the ring, unwrapping it so the oldest message lands at index 0
+static int queue_grow(custom_queue_t *queue) {
+    int new_capacity = queue->capacity ? queue->capacity * 2 : 16;
+    bgp_message_t **buffer = clib_mem_alloc(new_capacity * sizeof(bgp_message_t *));
+    int i;
+
+    if (!buffer) {
+        return -1;
+    }
+    for (i = 0; i < queue->count; i++) {
+        buffer[i] = queue->buffer[(queue->head + i) % queue->capacity];
+    }
+    if (queue->buffer) {
+        clib_mem_free(queue->buffer);
+    }
+
+    queue->buffer = buffer;
+    queue->capacity = new_capacity;
+    queue->head = 0;
+    queue->tail = queue->count;
+    return 0;
+}
 
 int queue_enqueue(custom_queue_t *queue, bgp_message_t *message) {
-    if (queue_is_full(queue)) {
-        return -1; // Queue is full
+    if (queue_is_full(queue) && queue_grow(queue) < 0) {
+        return -1; // Out of memory
     }
     queue->buffer[queue->tail] = message;
     queue->tail = (queue->tail + 1) % queue->capacity;
     queue->count++;
+    queue->bytes += message->length;
     return 0; // Success
 }
 
@@ -101,16 +192,43 @@ bgp_message_t *queue_dequeue(custom_queue_t *queue) {
     bgp_message_t *message = queue->buffer[queue->head];
     queue->head = (queue->head + 1) % queue->capacity;
     queue->count--;
+    queue->bytes -= message->length;
     return message;
 }
 
+// Put back the message queue_dequeue() just returned; the slot it left is still free
+void queue_requeue_head(custom_queue_t *queue, bgp_message_t *message) {
+    ASSERT(!queue_is_full(queue));
+    queue->head = (queue->head + queue->capacity - 1) % queue->capacity;
+    queue->buffer[queue->head] = message;
+    queue->count++;
+    queue->bytes += message->length;
+}
+
+bgp_message_t *queue_peek(custom_queue_t *queue) {
+    if (queue->count == 0) {
+        return NULL; // Queue is empty
+    }
+    return queue->buffer[queue->head];
+}
+
+bgp_message_t *queue_peek_nth(custom_queue_t *queue, int n) {
+    if (n >= queue->count) {
+        return NULL;
+    }
+    return queue->buffer[(queue->head + n) % queue->capacity];
+}
+
 void queue_free(custom_queue_t *queue) {
-    clib_mem_free(queue->buffer);
+    if (queue->buffer) {
+        clib_mem_free(queue->buffer);
+    }
     queue->buffer = NULL;
     queue->capacity = 0;
     queue->count = 0;
     queue->head = 0;
     queue->tail = 0;
+    queue->bytes = 0;
 }
 
 bool queue_is_empty(custom_queue_t *queue) {
@@ -121,7 +239,12 @@ bool queue_is_full(custom_queue_t *queue) {
     return queue->count == queue->capacity;
 }
 
-int bgp_create_open_message(u8 **message, u16 as_number, u32 bgp_identifier) {
+// Queued bytes reached the budget; unlike a full ring this never refuses an enqueue
+bool queue_over_budget(custom_queue_t *queue) {
+    return queue->bytes >= queue->byte_limit;
+}
+
+int bgp_create_open_message(u8 **message, u16 as_number, u32 bgp_identifier, u16 hold_time) {
     // Allocate memory for the OPEN message
     size_t message_size = sizeof(bgp_open_message_t);
     bgp_open_message_t *open_msg = clib_mem_alloc(message_size);
@@ -137,7 +260,7 @@ int bgp_create_open_message(u8 **message, u16 as_number, u32 bgp_identifier) {
     open_msg->header.length = clib_host_to_net_u16(message_size); // Total length in network byte order
     open_msg->version = 4;                     // BGP version
     open_msg->my_as = clib_host_to_net_u16(as_number); // AS number in network byte order
-    open_msg->hold_time = clib_host_to_net_u16(180);   // Default hold time: 180 seconds
+    open_msg->hold_time = clib_host_to_net_u16(hold_time); // Proposed; each side uses the lower
     open_msg->bgp_identifier.as_u32 = clib_host_to_net_u32(bgp_identifier); // BGP Identifier in network byte order
     open_msg->opt_param_length = 0;            // No optional parameters
 
@@ -148,30 +271,35 @@ int bgp_create_open_message(u8 **message, u16 as_number, u32 bgp_identifier) {
 }
 
 
-/**
- * Constructs a BGP route update message.
- */
-int bgp_construct_route_update(bgp_main_t *bmp, bgp_neighbor_t *neighbor, u8 **data, u16 *length) {
-    // Example implementation: This should encode withdrawn routes, path attributes, and NLRI.
-    // For now, we'll mock a simple route update message.
-    
-    const char *mock_data = "Mock Route Update Data"; // Replace with actual data encoding
-    size_t mock_length = strlen(mock_data) + 1;
-
-    *data = clib_mem_alloc(mock_length);
-    if (!*data) {
-        clib_warning("Failed to allocate memory for route update data");
-        return -1;
+// Free a queued message and its encoded payload
+void bgp_message_free(bgp_message_t *message) {
+    if (message->data) {
+        clib_mem_free(message->data);
     }
-
-    memcpy(*data, mock_data, mock_length);
-    *length = (u16)mock_length;
-
-    return 0; // Success
+    clib_mem_free(message);
 }
 
+// Drop everything queued for the neighbor (the byte stream it was meant for is gone)
+void bgp_discard_output(bgp_neighbor_t *neighbor) {
+    bgp_message_t *message;
 
+    while ((message = queue_dequeue(&neighbor->output_queue)) != NULL) {
+        bgp_message_free(message);
+    }
+    while ((message = queue_dequeue(&neighbor->control_queue)) != NULL) {
+        bgp_message_free(message);
+    }
+    while ((message = queue_dequeue(&neighbor->bulk_queue)) != NULL) {
+        bgp_message_free(message);
+    }
+    neighbor->rib_out_paused = 0;
+}
 
+// RFC 4271 section 10: jitter timers by a random factor between 0.75 and 1.0
+u32 bgp_jittered_interval(u32 *seed, u32 interval) {
+    u32 factor = 75 + random_u32(seed) % 26;
+    return clib_max(1, (u64)interval * factor / 100);
+}
 
 // Request a full RIB update for the neighbor
 void bgp_request_full_update(bgp_neighbor_t *neighbor, bool rib_in) {
@@ -196,35 +324,98 @@ void bgp_recompute_rib_out(bgp_neighbor_t *neighbor) {
 
 void bgp_send_open_message(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
     clib_warning("Sending OPEN message to neighbor %U", format_ip4_address, &neighbor->neighbor_ip);
-    // TODO: Add logic to construct and send an OPEN message
+
+    u8 *open_data;
+    int open_length = bgp_create_open_message(&open_data, bmp->bgp_as_number,
+                                              clib_net_to_host_u32(bmp->bgp_router_id), bmp->hold_time);
+    if (open_length < 0) {
+        return;
+    }
+
+    bgp_message_t *message = clib_mem_alloc(sizeof(bgp_message_t));
+    message->type = BGP_MSG_OPEN;
+    message->data = open_data;
+    message->length = open_length;
+
+    if (bgp_enqueue_message(neighbor, message) < 0) {
+        bgp_message_free(message);
+        return;
+    }
+    bgp_socket_flush(neighbor);
+}
+
+/* Hand a pending PEER_DOWN to the RIB owner; false while the ring still refuses it */
+bool bgp_peer_down_flush(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
+    if (!neighbor->peer_down_pending) {
+        return true;
+    }
+    if (bgp_handoff_to_main(bmp, BGP_HANDOFF_PEER_DOWN, neighbor - bmp->neighbors, 0) < 0) {
+        return false;
+    }
+    neighbor->peer_down_pending = 0;
+    vec_elt_at_index(bmp->shards, neighbor->owner_thread)->n_peer_down_pending--;
+    return true;
 }
 
 void bgp_stop_route_exchange(bgp_main_t *bmp, bgp_neighbor_t *neighbor) {
     clib_warning("Stopping route exchange with neighbor %U", format_ip4_address, &neighbor->neighbor_ip);
-    // TODO: Add logic to stop exchanging routes
+
+    /*
+     * The peer's paths leave the Adj-RIB-In; the RIB owner re-runs selection.
+     * A full ring leaves the handoff pending: the owner retries it every
+     * loop and keeps the neighbor in Idle, so no path from a new session
+     * can overtake it.
+     */
+    if (!neighbor->peer_down_pending) {
+        neighbor->peer_down_pending = 1;
+        vec_elt_at_index(bmp->shards, neighbor->owner_thread)->n_peer_down_pending++;
+    }
+    if (!bgp_peer_down_flush(bmp, neighbor)) {
+        clib_warning("RIB handoff ring full, withdrawing paths from %U once it drains",
+                     format_ip4_address, &neighbor->neighbor_ip);
+    }
 }
 
 bool bgp_tcp_is_connected(bgp_neighbor_t *neighbor) {
-    clib_warning("Checking TCP connection for neighbor %U", format_ip4_address, &neighbor->neighbor_ip);
-    return true; // Replace with actual connection check logic
+    return neighbor->socket && neighbor->socket->is_connected;
 }
 
 bool bgp_received_open(bgp_neighbor_t *neighbor) {
-    clib_warning("Checking if OPEN message received from neighbor %U", format_ip4_address, &neighbor->neighbor_ip);
-    return false; // Replace with actual logic
+    bool received = (neighbor->rx_flags & BGP_RX_OPEN) != 0;
+    neighbor->rx_flags &= ~BGP_RX_OPEN;
+    return received;
 }
 
 bool bgp_received_notification(bgp_neighbor_t *neighbor) {
-    clib_warning("Checking if NOTIFICATION message received from neighbor %U", format_ip4_address, &neighbor->neighbor_ip);
-    return false; // Replace with actual logic
+    bool received = (neighbor->rx_flags & BGP_RX_NOTIFICATION) != 0;
+    neighbor->rx_flags &= ~BGP_RX_NOTIFICATION;
+    return received;
 }
 
 bool bgp_received_keepalive(bgp_neighbor_t *neighbor) {
-    clib_warning("Checking if KEEPALIVE message received from neighbor %U", format_ip4_address, &neighbor->neighbor_ip);
-    return false; // Replace with actual logic
+    bool received = (neighbor->rx_flags & BGP_RX_KEEPALIVE) != 0;
+    neighbor->rx_flags &= ~BGP_RX_KEEPALIVE;
+    return received;
 }
 
 void bgp_send_keepalive_message(bgp_neighbor_t *neighbor) {
-    clib_warning("Sending KEEPALIVE message to neighbor %U", format_ip4_address, &neighbor->neighbor_ip);
-    // TODO: Add logic to construct and send a KEEPALIVE message
-}
\ No newline at end of file
+    size_t keepalive_length;
+
+    bgp_message_t *message = clib_mem_alloc(sizeof(bgp_message_t));
+    message->type = BGP_MSG_KEEPALIVE;
+    message->data = bgp_create_keepalive_message(&keepalive_length);
+    message->length = keepalive_length;
+
+    if (bgp_enqueue_message(neighbor, message) < 0) {
+        bgp_message_free(message);
+        clib_warning("Failed to queue Keepalive message for neighbor %U.",
+                     format_ip4_address, &neighbor->neighbor_ip);
+        return;
+    }
+    bgp_socket_flush(neighbor);
+}
+
+/* Write a NOTIFICATION ahead of the output queue, which the caller's close discards */
+void bgp_send_notification_message(bgp_neighbor_t *neighbor, u8 error_code, u8 error_subcode) {
+    bgp_socket_send_notification(neighbor, neighbor->socket, error_code, error_subcode);
+}